@@ -1,41 +1,136 @@
 #include <stdio.h>
 #include <SDL2/SDL.h>
 #include <stdbool.h>
+#include <string.h>
 #include <time.h>
 #include "src/config.h"
 #include "src/colorp.h"
 
-// User-defined types
-#define instructionPerCycle 8;
-#define cycleDuration 16;
-
 // Function prototypes
 int initSDL2();
-void initChip8();
-int loadRom(const char *rom);
+int initScreen(SDL_Renderer *renderer);
 void drawGfx(SDL_Renderer *renderer);
+int setFilter(SDL_Renderer *renderer, enum ScaleFilter filter);
+int emulationThread(void *data);
+void publishFrame(void);
+void streamFrame(void);
+void themePalette(uint32_t palette[2]);
+void takeInput(void);
+void addLatencySample(struct LatencyStats *stats, uint64_t ticks);
+void printLatency(const char *name, const struct LatencyStats *stats);
 void inputCycle(SDL_Event event);
-void updateInput();
-void handleInterrupts(int *SPEED, int *interruptType);
-void updateTimers();
-void emulateCycle(int *SPEED, int *interruptType);
-void initAudio();
-void soundBeep();
+void processEvent(SDL_Event event);
 
 // Global variables
-bool running = true;
+atomic_bool running = true; // Cleared by either thread to stop both
 SDL_Renderer *renderer = NULL;
 int currentTheme = 0; // Default theme
 
 // Main function
 int main(int argc, char *argv[]) {
+    const char *positional[3] = { NULL, NULL, NULL }; // ROM, theme, window size
+    int positionalCount = 0;
+    int instructionsPerFrame = instructionPerCycle;
+    int multiplier = 1;
+    bool uncapped = false;
+    uint32_t seed = RANDOM_DEFAULT_SEED;
+    const char *moviePath = NULL;
+    const char *profilePath = NULL;
+    bool analyze = false;
+    bool legacy = false;
+    const char *packPath = NULL;
+    bool latency = false;
+    enum ScaleFilter filter = FILTER_NONE;
+    const char *netplayOption = NULL;
+    struct NetplayConditions conditions = { 0, 0, 0 };
+    const char *streamAddress = NULL;
+    const char *capturePath = NULL;
+    bool debug = false;
+    const char *debugSocket = NULL;
+
+    // Options can go anywhere, everything else is positional
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--ipf") == 0 && i + 1 < argc) {
+            instructionsPerFrame = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            multiplier = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--uncapped") == 0) {
+            uncapped = true;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            moviePath = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profilePath = argv[++i];
+        } else if (strcmp(argv[i], "--analyze") == 0) {
+            analyze = true;
+        } else if (strcmp(argv[i], "--legacy") == 0) {
+            legacy = true;
+        } else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc) {
+            packPath = argv[++i];
+        } else if (strcmp(argv[i], "--latency") == 0) {
+            latency = true;
+        } else if (strcmp(argv[i], "--netplay") == 0 && i + 1 < argc) {
+            netplayOption = argv[++i];
+        } else if (strcmp(argv[i], "--netsim") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d:%d:%d", &conditions.latencyMs, &conditions.jitterMs, &conditions.lossPercent) != 3) {
+                printf("Invalid network conditions. Using none.\n");
+                memset(&conditions, 0, sizeof(conditions));
+            }
+        } else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc) {
+            streamAddress = argv[++i];
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            capturePath = argv[++i];
+        } else if (strcmp(argv[i], "--debug") == 0) {
+            debug = true;
+        } else if (strcmp(argv[i], "--debug-socket") == 0 && i + 1 < argc) {
+            debug = true;
+            debugSocket = argv[++i];
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            const int parsed = parseFilter(argv[++i]);
+            if (parsed < 0) printf("Unknown filter %s. Using none.\n", argv[i]);
+            else filter = (enum ScaleFilter)parsed;
+        } else if (positionalCount < 3) {
+            positional[positionalCount++] = argv[i];
+        }
+    }
+    if (instructionsPerFrame < 1 || multiplier < 1) {
+        printf("Instructions per frame and speed must be at least 1.\n");
+        return EXIT_FAILURE;
+    }
+
+    // Both cabinets have to run the same frames at the same rate, and a movie cannot follow rollbacks
+    int netplayPlayer = 0, netplayPort = 0, peerPort = 0;
+    char peerHost[256];
+    if (netplayOption) {
+        if (sscanf(netplayOption, "%d:%d:%255[^:]:%d", &netplayPlayer, &netplayPort, peerHost, &peerPort) != 4 ||
+            netplayPlayer < 1 || netplayPlayer > 2) {
+            printf("Invalid netplay option, expected player:port:host:port with player 1 or 2.\n");
+            return EXIT_FAILURE;
+        }
+        if (multiplier != 1 || uncapped) printf("Netplay runs at 1x speed.\n");
+        if (moviePath) printf("Recording is not available during netplay.\n");
+        multiplier = 1;
+        uncapped = false;
+        moviePath = NULL;
+    }
 
-    int SPEED = 8; // Number of instructions per frame
-    int interruptType = -1; // -1 means no interrupt
+    // Check if window size was provided
+    frontend.windowWidth = DEFAULT_WINDOW_WIDTH;
+    frontend.windowHeight = DEFAULT_WINDOW_HEIGHT;
+    if (positionalCount >= 3) {
+        if (sscanf(positional[2], "%dx%d", &frontend.windowWidth, &frontend.windowHeight) != 2 ||
+            frontend.windowWidth <= 0 || frontend.windowHeight <= 0) {
+            printf("Invalid window size. Using %dx%d.\n", DEFAULT_WINDOW_WIDTH, DEFAULT_WINDOW_HEIGHT);
+            frontend.windowWidth = DEFAULT_WINDOW_WIDTH;
+            frontend.windowHeight = DEFAULT_WINDOW_HEIGHT;
+        }
+    }
 
     // Check if SDL2 was initialized
-    if(!initSDL2()) EXIT_FAILURE;
-    SDL_Window *window = SDL_CreateWindow("CHIP-8 Emulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 640, 320, SDL_WINDOW_SHOWN);
+    if(!initSDL2()) return EXIT_FAILURE;
+    SDL_Window *window = SDL_CreateWindow("CHIP-8 Emulator", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                                          frontend.windowWidth, frontend.windowHeight, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
     // Check if window was created
     if(!window) {
         printf("Window could not be created. %s\n", SDL_GetError());
@@ -43,7 +138,7 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    initAudio();
+    initAudio(&frontend.audio);
 
     // Create renderer
     renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
@@ -55,15 +150,24 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
+    // Create the screen texture
+    initUpscaler(&frontend.upscaler, filter);
+    if(!initScreen(renderer)) {
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return EXIT_FAILURE;
+    }
+
     // Check if ROM was provided
-    if (argc < 2) {
-        printf("Usage: %s <ROM>\n", argv[0]);
+    if (positionalCount < 1) {
+        printf("Usage: %s [--ipf N] [--speed N] [--uncapped] [--seed N] [--record movie] [--profile prefix] [--analyze] [--legacy] [--pack file] [--filter name] [--latency] [--netplay player:port:host:port] [--netsim latency:jitter:loss] [--stream address] [--capture file.gif|file.y4m] [--debug] [--debug-socket path] <ROM> [theme] [WIDTHxHEIGHT]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
     // Check if theme was provided
-    if (argc >= 3) {
-        currentTheme = atoi(argv[2]);
+    if (positionalCount >= 2) {
+        currentTheme = atoi(positional[1]);
         if (currentTheme < 0 || currentTheme >= (int)(sizeof(themes) / sizeof(struct Theme))) {
             printf("Invalid theme. Using default theme.\n");
             currentTheme = 0;
@@ -71,49 +175,160 @@ int main(int argc, char *argv[]) {
     }
 
     // Initialize Chip8
-    initChip8();
+    initChip8(&chip8);
+    setInstructionsPerFrame(&chip8, instructionsPerFrame);
+    seedRandom(&chip8, seed);
+    if (profilePath && enableProfiler(&chip8) != 0) profilePath = NULL;
+    frontend.theme = themes[currentTheme];
+
+    // Load ROM, from a pack the ROM is given by name or index
+    int loaded = -1;
+    if (packPath) {
+        struct RomPack pack;
+        if (openRomPack(&pack, packPath) == 0) {
+            char *end;
+            const long index = strtol(positional[0], &end, 0);
+            const int found = *end == '\0' ? (int)index : findPackRomName(&pack, positional[0]);
+            if (found < 0) printf("ROM %s is not in the pack.\n", positional[0]);
+            else loaded = loadPackRom(&chip8, &pack, (uint32_t)found);
+            closeRomPack(&pack);
+        }
+    } else {
+        loaded = loadRom(&chip8, positional[0]);
+    }
+    if (loaded != 0) {
+        closeAudio(&frontend.audio);
+        SDL_DestroyTexture(frontend.screen);
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return EXIT_FAILURE;
+    }
 
-    // Load ROM
-    if(loadRom(argv[1]) == -1) EXIT_FAILURE;
+    // Static analysis, cached per ROM, picks the quirks before the first instruction runs
+    if (analyze) {
+        static struct RomAnalysis analysis;
+        const int source = loadAnalysis(ANALYSIS_CACHE_DIR, chip8.memory + ROM_START, chip8.romSize, &analysis);
+        if (source >= 0) {
+            applyAnalysis(&chip8, &analysis);
+            printf("Analysis (%s): %u blocks, profile %s\n", source == 1 ? "cached" : "fresh", analysis.blockCount,
+                   quirkProfileName(analysisProfile(&analysis)));
+        }
+    }
+    // SCHIP 1.1 games can not be told from later SCHIP games by looking at them, so that profile is asked for
+    if (legacy) applyQuirkProfile(&chip8, PROFILE_SCHIP_LEGACY);
+
+    // The session starts from the state every option above produced, the other side has to use the same ones
+    if (netplayOption) {
+        if (openNetplay(&frontend.netplay, &chip8, netplayPlayer - 1, netplayPort, peerHost, peerPort) != 0) {
+            closeAudio(&frontend.audio);
+            SDL_DestroyTexture(frontend.screen);
+            SDL_DestroyRenderer(renderer);
+            SDL_DestroyWindow(window);
+            SDL_Quit();
+            return EXIT_FAILURE;
+        }
+        setNetplayConditions(&frontend.netplay, &conditions);
+        frontend.netplaying = true;
+        printf("Netplay as player %d on port %d with %s:%d\n", netplayPlayer, netplayPort, peerHost, peerPort);
+    }
 
-    SDL_Event event;
+    // Subscribers connect with chip8_viewer, a failed listener leaves the emulator running without it
+    if (streamAddress) {
+        initStreamEncoder(&frontend.streamEncoder);
+        frontend.streaming = openStreamServer(&frontend.stream, streamAddress) == 0;
+        if (frontend.streaming) printf("Streaming the display on %s\n", streamAddress);
+    }
 
-    // Main loop
-    while (running) {
-        uint32_t frameStart = SDL_GetTicks();
+    // Frames are encoded on a thread of their own, a failed capture leaves the emulator running without it
+    if (capturePath) {
+        frontend.capturing = startCapture(&frontend.capture, capturePath) == 0;
+        if (frontend.capturing) printf("Capturing to %s\n", capturePath);
+    }
 
-        // Decrement timers
-        updateTimers();
+    SDL_Event event;
 
-        // Check for events
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) running = false;
-            inputCycle(event);
+    // Record the key mask of every frame so the run can be replayed with chip8_replay
+    if (moviePath) startMovie(&frontend.movie, &chip8, MOVIE_HASH_INTERVAL);
+    frontend.recording = moviePath != NULL;
+
+    // The machine runs on its own thread so a slow present or vsync never delays instructions or timers
+    spscInit(&frontend.input, frontend.inputStorage, sizeof(struct KeyInput), INPUT_QUEUE_SIZE);
+    frontend.measureLatency = latency;
+    tripleInit(&frontend.frames, &frontend.frameSlots[0], &frontend.frameSlots[1], &frontend.frameSlots[2]);
+    frontend.frameEvent = SDL_RegisterEvents(1);
+    frontend.wake = SDL_CreateSemaphore(0);
+    initScheduler(&frontend.scheduler, multiplier, uncapped);
+    // The debugger starts paused, so breakpoints can go in before the first instruction runs
+    if (debug && frontend.wake && enableDebugger(&chip8) == 0) {
+        if (startDebugConsole(&frontend.debugConsole, debugSocket, frontend.wake) == 0) {
+            chip8.debugger->paused = true;
+            chip8.debugger->stop = DEBUG_STOP_PAUSE;
+            frontend.debugging = true;
+        } else {
+            disableDebugger(&chip8);
         }
+    }
+    frontend.realTime = multiplier == 1 && !uncapped;
+    SDL_Thread *emulation = frontend.wake && frontend.frameEvent != (Uint32)-1 ?
+                            SDL_CreateThread(emulationThread, "emulation", NULL) : NULL;
+    if (!emulation) {
+        printf("Emulation thread could not be started. %s\n", SDL_GetError());
+        running = false;
+    }
 
-        // Emulate instructions
-        for (int i = 0; i < abs(SPEED); ++i) {
-            if (SPEED <= 0) break; // Quit early if SPEED is negative
-            emulateCycle(&SPEED, &interruptType);
+    // Main loop: events go to the emulation thread, the latest published frame is presented
+    while (running) {
+        if (SDL_WaitEventTimeout(&event, RENDER_WAIT_MS)) {
+            processEvent(event);
+            while (SDL_PollEvent(&event)) processEvent(event);
         }
 
-        // Update input values
-        updateInput();
-
-        // Handle interrupts
-        handleInterrupts(&SPEED, &interruptType);
-
-        // Draw graphics
-        if (chip8.drawFlag) drawGfx(renderer);
+        // Draw graphics, frames that leave the display unchanged are never published
+        if (tripleAcquire(&frontend.frames) || frontend.redraw) drawGfx(renderer);
+    }
+    if (emulation) {
+        SDL_SemPost(frontend.wake);
+        SDL_WaitThread(emulation, NULL);
+    }
+    if (frontend.wake) SDL_DestroySemaphore(frontend.wake);
+    if (!frontend.recording) moviePath = NULL;
 
-        // Frame rate control
-        uint32_t frameTime = SDL_GetTicks() - frameStart;
-        if (frameTime < chip8.cD) {
-            SDL_Delay(chip8.cD - frameTime);
-        }
+    printSchedulerStats(&frontend.scheduler);
+    if (moviePath && writeMovie(&frontend.movie, moviePath) == 0) {
+        printf("Recorded %d frames to %s\n", frontend.movie.frameCount, moviePath);
+    }
+    freeMovie(&frontend.movie);
+    if (profilePath) {
+        writeProfile(chip8.profiler, profilePath);
+        disableProfiler(&chip8);
+    }
+    printf("Frames: %llu, changed: %llu, changed rows: %llu\n", (unsigned long long)chip8.frameStats.frames,
+           (unsigned long long)chip8.frameStats.changedFrames, (unsigned long long)chip8.frameStats.changedRows);
+    printf("Frames published: %llu, presented: %llu, replaced before presenting: %llu\n",
+           (unsigned long long)atomic_load(&frontend.frames.published), (unsigned long long)frontend.presentedFrames,
+           (unsigned long long)atomic_load(&frontend.frames.dropped));
+    if (latency) {
+        printLatency("Key press to display change", &frontend.changeLatency);
+        printLatency("Key press to present", &frontend.presentLatency);
+    }
+    if (frontend.netplaying) {
+        printNetplayStats(&frontend.netplay);
+        closeNetplay(&frontend.netplay);
+    }
+    if (frontend.capturing) stopCapture(&frontend.capture);
+    if (frontend.debugging) {
+        stopDebugConsole(&frontend.debugConsole);
+        disableDebugger(&chip8);
+    }
+    if (frontend.streaming) {
+        printStreamStats(&frontend.stream, &frontend.streamEncoder);
+        closeStreamServer(&frontend.stream);
     }
 
     // Close SDL2
+    closeAudio(&frontend.audio);
+    SDL_DestroyTexture(frontend.screen);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -122,702 +337,297 @@ int main(int argc, char *argv[]) {
 
 
 
-// Initialize SDL2
-int initSDL2(){
-    if(SDL_Init(SDL_INIT_VIDEO)==-1) {
-        printf("SDL2 could not be initialized. %s\n", SDL_GetError());
-        return 0;
-    }
-    return 1;
-}
-
-// Initialize Chip8
-void initChip8() {
-    chip8.pc = 0x200;
-    chip8.opcode = 0;
-    chip8.I = 0;
-    chip8.sp = 0;
-    chip8.delay_timer = 0;
-    chip8.sound_timer = 0;
-    memset(chip8.memory, 0, 4096);
-    memset(chip8.V, 0, 16);
-    memset(chip8.gfx, 0, HIGH_RES_WIDTH * HIGH_RES_HEIGHT);
-    memset(chip8.stack, 0, 16 * sizeof(uint16_t)); // Assuming stack is of type uint16_t
-    chip8.waitingForKey = false;
-    chip8.compatMode = false;
-    chip8.highRes = false;
-    chip8.legacyMode = false;
-    chip8.IPC = instructionPerCycle;
-    chip8.cD = cycleDuration;
-    chip8.plane = 1;
-    chip8.theme = themes[currentTheme];
-
-
-    unsigned char fontSet[80] = {
-        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-        0x20, 0x60, 0x20, 0x20, 0x70, // 1
-        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-    };
-
-    for (int i = 0; i < 80; ++i) {
-        chip8.memory[i] = fontSet[i];
-    }
-}
-
-// Load ROM
-int loadRom(const char *rom){
-    FILE *file = fopen(rom, "rb");
-    if(!file) {
-        printf("File could not be opened.\n");
-        return 0;
-    };
-
-    // Get file size
-    fseek(file, 0, SEEK_END);
-    long size = ftell(file);
-    rewind(file);
+// Emulation thread: run the frames due, publish the display when it changed, then wait for the next batch
+int emulationThread(void *data) {
+    (void)data;
 
-    // Allocate memory to store the file
-    char *buffer = (char*)malloc(sizeof(char)*size);
-    if(!buffer) {
-        printf("Memory could not be allocated.\n");
-        return -1;
-    };
+    // The first frame is published even if blank, so the render thread has the theme to clear with
+    frontend.pendingRows = ~0ULL;
+    while (running) {
+        // Debugger commands run between batches. While paused no frames run, the timers included, and every
+        // command posts the wake semaphore
+        if (frontend.debugging) {
+            serviceDebugConsole(&frontend.debugConsole, &chip8);
+            if (chip8.debugger->paused) {
+                // Show what stepping drew. A step is not a frame, the frame counters stay as they are
+                if (chip8.dirtyRows || chip8.highRes != chip8.shownHighRes) {
+                    updateShownRows(&chip8);
+                    frontend.pendingRows |= chip8.changedRows;
+                    if (frontend.pendingRows) publishFrame();
+                }
+                SDL_SemWaitTimeout(frontend.wake, IDLE_WAIT_MS);
+                schedulerResync(&frontend.scheduler);
+                continue;
+            }
+        }
 
-    // Copy the file into the buffer
-    const size_t result = fread(buffer, 1, size, file);
-    if ((size_t)result != (size_t)size) {
-        printf("Reading error.\n");
-        return -1;
-    };
+        // Run the frames due since the last batch: take the input that arrived as late as possible, tick timers,
+        // emulate the frame's instructions with the input applied inside it, latch input and handle interrupts
+        while (running && schedulerFrameDue(&frontend.scheduler)) {
+            takeInput();
+            if (frontend.netplaying) {
+                netplayAdvance(&frontend.netplay, &chip8, frontend.netplayKeys,
+                               (double)SDL_GetPerformanceCounter() / (double)SDL_GetPerformanceFrequency());
+            } else {
+                runFrame(&chip8);
+            }
+            if (!chip8.running) running = false;
+            if (frontend.recording && recordFrame(&frontend.movie, &chip8) != 0) frontend.recording = false;
+            if (frontend.capturing) {
+                uint32_t palette[2];
+                themePalette(palette);
+                captureFrame(&frontend.capture, &chip8, palette);
+            }
+            frontend.pendingRows |= chip8.changedRows;
+            if (frontend.latencyStart && chip8.changedRows) {
+                addLatencySample(&frontend.changeLatency, SDL_GetPerformanceCounter() - frontend.latencyStart);
+                frontend.changeInputTime = frontend.latencyStart;
+                frontend.latencyStart = 0;
+            }
 
-    // Check if ROM fits in memory
-    if((4096 - 512) > size) {
-        for(int i = 0; i < size; ++i) {
-            chip8.memory[i + 512] = buffer[i];
+            // Hand the sound state for this tick to the audio callback, once per batch when running fast
+            if (frontend.realTime) updateAudio(&frontend.audio, &chip8, frontend.tick++);
+            if (frontend.debugging && chip8.debugger->paused) break;
+        }
+        if (!frontend.realTime) updateAudio(&frontend.audio, &chip8, frontend.tick++);
+        if (frontend.pendingRows) publishFrame();
+        if (frontend.streaming) streamFrame();
+
+        // Frame rate control. While the guest idles the thread sleeps on the wake semaphore, so a key press still
+        // wakes it at once
+        if (!running) break;
+        if (isQuiescent(&chip8) && !frontend.netplaying) {
+            // Nothing can change until a key is pressed, frames are not run at all until then. Every key event posts
+            // the semaphore, so one that is already queued returns at once
+            SDL_SemWaitTimeout(frontend.wake, IDLE_WAIT_MS);
+            const uint64_t skipped = schedulerResync(&frontend.scheduler);
+            if (frontend.capturing) captureIdleFrames(&frontend.capture, skipped);
+        } else if (chip8.idleState != IDLE_NONE && frontend.realTime) {
+            SDL_SemWaitTimeout(frontend.wake, schedulerMsUntilDue(&frontend.scheduler));
+        } else {
+            schedulerWait(&frontend.scheduler);
         }
-    } else {
-        printf("ROM too big for memory.\n");
-        return -1;
     }
 
-    // Close file and free buffer
-    fclose(file);
-    free(buffer);
+    // Wake the render thread so it sees running cleared
+    SDL_Event quit = { .type = SDL_QUIT };
+    SDL_PushEvent(&quit);
     return 0;
 }
 
-// Input cycle
-void inputCycle(const SDL_Event event) {
-    switch (event.type){
-        // Check if a key was pressed
-        case SDL_KEYDOWN:
-            if (!chip8.waitingForKey) {
-                // Check which key was pressed
-                switch (event.key.keysym.sym){
-                    case SDLK_1: chip8.key[0x1] = 1; break;
-                    case SDLK_2: chip8.key[0x2] = 1; break;
-                    case SDLK_3: chip8.key[0x3] = 1; break;
-                    case SDLK_4: chip8.key[0xC] = 1; break;
-                    case SDLK_q: chip8.key[0x4] = 1; break;
-                    case SDLK_w: chip8.key[0x5] = 1; break;
-                    case SDLK_e: chip8.key[0x6] = 1; break;
-                    case SDLK_r: chip8.key[0xD] = 1; break;
-                    case SDLK_a: chip8.key[0x7] = 1; break;
-                    case SDLK_s: chip8.key[0x8] = 1; break;
-                    case SDLK_d: chip8.key[0x9] = 1; break;
-                    case SDLK_f: chip8.key[0xE] = 1; break;
-                    case SDLK_z: chip8.key[0xA] = 1; break;
-                    case SDLK_x: chip8.key[0x0] = 1; break;
-                    case SDLK_c: chip8.key[0xB] = 1; break;
-                    case SDLK_v: chip8.key[0xF] = 1; break;
-                    default: break;
-                }
-                chip8.waitingForKey = true;
-            }
-        break;
-        // Check if a key was released
-        case SDL_KEYUP:
-            // Check which key was released
-                switch (event.key.keysym.sym){
-                    case SDLK_1: chip8.key[0x1] = 0; break;
-                    case SDLK_2: chip8.key[0x2] = 0; break;
-                    case SDLK_3: chip8.key[0x3] = 0; break;
-                    case SDLK_4: chip8.key[0xC] = 0; break;
-                    case SDLK_q: chip8.key[0x4] = 0; break;
-                    case SDLK_w: chip8.key[0x5] = 0; break;
-                    case SDLK_e: chip8.key[0x6] = 0; break;
-                    case SDLK_r: chip8.key[0xD] = 0; break;
-                    case SDLK_a: chip8.key[0x7] = 0; break;
-                    case SDLK_s: chip8.key[0x8] = 0; break;
-                    case SDLK_d: chip8.key[0x9] = 0; break;
-                    case SDLK_f: chip8.key[0xE] = 0; break;
-                    case SDLK_z: chip8.key[0xA] = 0; break;
-                    case SDLK_x: chip8.key[0x0] = 0; break;
-                    case SDLK_c: chip8.key[0xB] = 0; break;
-                    case SDLK_v: chip8.key[0xF] = 0; break;
-                    default: break;
-                }
-        chip8.waitingForKey = false;
-        break;
-        default: break;
+// Copy the display into the triple buffer's free slot and hand it to the render thread
+void publishFrame(void) {
+    struct FrameSlot *slot = tripleWriteSlot(&frontend.frames);
+
+    slot->sequence = ++frontend.sequence;
+    slot->changedRows = frontend.pendingRows;
+    themePalette(slot->palette);
+    slot->inputTime = frontend.changeInputTime;
+    frontend.changeInputTime = 0;
+    copyDisplay(&slot->display, &chip8);
+    triplePublish(&frontend.frames);
+    frontend.pendingRows = 0;
+
+    // One wake-up event at a time, the render thread always takes the latest frame anyway
+    if (!atomic_exchange(&frontend.framePosted, true)) {
+        SDL_Event published = { .type = frontend.frameEvent };
+        SDL_PushEvent(&published);
     }
 }
 
-// Emulate one cycle
-void emulateCycle(int *SPEED, int *interruptType) {
-    // Fetch opcode
-        chip8.opcode = chip8.memory[chip8.pc] << 8 | chip8.memory[chip8.pc + 1];
-        chip8.pc += 2;
-        // Decode opcode
-    // Decode opcode
-    switch (chip8.opcode & 0xF000) {
-        case 0x0000:
-            switch (chip8.opcode & 0x00FF) {
-                case 0x00E0: // Clear the screen
-                    memset(chip8.gfx, 0, 64 * 32);
-                    chip8.drawFlag = true;
-                    break;
-                case 0x00EE: // Return from subroutine
-                    chip8.sp--;
-                    chip8.pc = chip8.stack[chip8.sp];
-                    break;
-                case 0x00C0: // 00CN: Scroll display N lines down
-                {
-                    uint8_t n = chip8.opcode & 0x000F;
-                    int width = chip8.highRes ? HIGH_RES_WIDTH : LOW_RES_WIDTH;
-                    int height = chip8.highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
-
-                    if (n > 0) {
-                        for (int plane = 0; plane < 2; ++plane) {
-                            if (chip8.plane & (1 << plane)) {
-                                for (int y = height - 1; y >= n; --y) {
-                                    for (int x = 0; x < width; ++x) {
-                                        chip8.gfx[(y * width + x) + (plane * width * height)] = chip8.gfx[((y - n) * width + x) + (plane * width * height)];
-                                    }
-                                }
-                                for (int y = 0; y < n; ++y) {
-                                    for (int x = 0; x < width; ++x) {
-                                        chip8.gfx[(y * width + x) + (plane * width * height)] = 0;
-                                    }
-                                }
-                            }
-                        }
-                        chip8.drawFlag = true;
-                    }
-                }
-                break;
-                case 0x00D0: // 00DN: Scroll display N lines up
-                {
-                    uint8_t n = chip8.opcode & 0x000F;
-                    int width = chip8.highRes ? HIGH_RES_WIDTH : LOW_RES_WIDTH;
-                    int height = chip8.highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
-
-                    if (n > 0) {
-                        for (int plane = 0; plane < 2; ++plane) {
-                            if (chip8.plane & (1 << plane)) {
-                                for (int y = 0; y < height - n; ++y) {
-                                    for (int x = 0; x < width; ++x) {
-                                        chip8.gfx[(y * width + x) + (plane * width * height)] = chip8.gfx[((y + n) * width + x) + (plane * width * height)];
-                                    }
-                                }
-                                for (int y = height - n; y < height; ++y) {
-                                    for (int x = 0; x < width; ++x) {
-                                        chip8.gfx[(y * width + x) + (plane * width * height)] = 0;
-                                    }
-                                }
-                            }
-                        }
-                        chip8.drawFlag = true;
-                    }
-                }
-                break;
-                case 0x00FB: // 00FB: Scroll display 4 pixels right
-                {
-                    int width = chip8.highRes ? HIGH_RES_WIDTH : LOW_RES_WIDTH;
-                    int height = chip8.highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
-                    int scrollAmount = chip8.legacyMode && !chip8.highRes ? 2 : 4;
-
-                    for (int plane = 0; plane < 2; ++plane) {
-                        if (chip8.plane & (1 << plane)) {
-                            for (int y = 0; y < height; ++y) {
-                                for (int x = width - 1; x >= scrollAmount; --x) {
-                                    chip8.gfx[y * width + x] = chip8.gfx[y * width + (x - scrollAmount)];
-                                }
-                                for (int x = 0; x < scrollAmount; ++x) {
-                                    chip8.gfx[y * width + x] = 0;
-                                }
-                            }
-                        }
-                    }
-                    chip8.drawFlag = true;
-                }
-                break;
-                case 0x00FC: // 00FC: Scroll display 4 pixels left
-                {
-                    int width = chip8.highRes ? HIGH_RES_WIDTH : LOW_RES_WIDTH;
-                    int height = chip8.highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
-                    int scrollAmount = chip8.legacyMode && !chip8.highRes ? 2 : 4;
-
-                    for (int plane = 0; plane < 2; ++plane) {
-                        if (chip8.plane & (1 << plane)) {
-                            for (int y = 0; y < height; ++y) {
-                                for (int x = 0; x < width - scrollAmount; ++x) {
-                                    chip8.gfx[y * width + x] = chip8.gfx[y * width + (x + scrollAmount)];
-                                }
-                                for (int x = width - scrollAmount; x < width; ++x) {
-                                    chip8.gfx[y * width + x] = 0;
-                                }
-                            }
-                        }
-                    }
-                    chip8.drawFlag = true;
-                }
-                break;
-                case 0x00C6: // 00C6: Scroll display 6 lines down
-                {
-                    uint8_t n = 6;
-                    int width = chip8.highRes ? HIGH_RES_WIDTH : LOW_RES_WIDTH;
-                    int height = chip8.highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
-
-                    if (n > 0) {
-                        for (int y = height - 1; y >= n; --y) {
-                            for (int x = 0; x < width; ++x) {
-                                chip8.gfx[y * width + x] = chip8.gfx[(y - n) * width + x];
-                            }
-                        }
-                        for (int y = 0; y < n; ++y) {
-                            for (int x = 0; x < width; ++x) {
-                                chip8.gfx[y * width + x] = 0;
-                            }
-                        }
-                        chip8.drawFlag = true;
-                    }
-                }
-                break;
-                case 0x00DC: // 00DC: Scroll display 12 lines down
-                {
-                    uint8_t n = 12;
-                    int width = chip8.highRes ? HIGH_RES_WIDTH : LOW_RES_WIDTH;
-                    int height = chip8.highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
-
-                    if (n > 0) {
-                        for (int y = height - 1; y >= n; --y) {
-                            for (int x = 0; x < width; ++x) {
-                                chip8.gfx[y * width + x] = chip8.gfx[(y - n) * width + x];
-                            }
-                        }
-                        for (int y = 0; y < n; ++y) {
-                            for (int x = 0; x < width; ++x) {
-                                chip8.gfx[y * width + x] = 0;
-                            }
-                        }
-                        chip8.drawFlag = true;
-                    }
-                }
-                break;
-                case 0x00CC: // 00CC: Scroll display 12 lines down
-                {
-                    uint8_t n = 12;
-                    int width = chip8.highRes ? HIGH_RES_WIDTH : LOW_RES_WIDTH;
-                    int height = chip8.highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
-
-                    if (n > 0) {
-                        for (int y = height - 1; y >= n; --y) {
-                            for (int x = 0; x < width; ++x) {
-                                chip8.gfx[y * width + x] = chip8.gfx[(y - n) * width + x];
-                            }
-                        }
-                        for (int y = 0; y < n; ++y) {
-                            for (int x = 0; x < width; ++x) {
-                                chip8.gfx[y * width + x] = 0;
-                            }
-                        }
-                        chip8.drawFlag = true;
-                    }
-                }
-                break;
-                case 0x00FA: // 00FA: Compatible mode
-                    chip8.compatMode = !chip8.compatMode;
-                    break;
-                case 0x00FE: // 00FE: LOW RES mode
-                    chip8.highRes = false;
-                    memset(chip8.gfx, 0, HIGH_RES_WIDTH * HIGH_RES_HEIGHT);
-                    chip8.drawFlag = true;
-                break;
-                case 0x00FF: // 00FF: HIGH RES mode
-                    chip8.highRes = true;
-                    memset(chip8.gfx, 0, HIGH_RES_WIDTH * HIGH_RES_HEIGHT);
-                    chip8.drawFlag = true;
-                break;
-                case 0x00FD: // 00FD: Exit the interpreter
-                    running = false;
-                    break;
-                default:
-                    printf("Unknown opcode: 0x%X\n", chip8.opcode);
-                    break;
-            }
-            break;
-        case 0x1000: // 1NNN: Jump to address NNN
-            chip8.pc = chip8.opcode & 0x0FFF;
-            break;
-        case 0x2000: // 2NNN: Call subroutine at NNN
-            chip8.stack[chip8.sp] = chip8.pc;
-            chip8.sp++;
-            chip8.pc = chip8.opcode & 0x0FFF;
-            break;
-        case 0x3000: // 3XNN: Skip next instruction if VX equals NN
-            if (chip8.V[(chip8.opcode & 0x0F00) >> 8] == (chip8.opcode & 0x00FF)) {
-                chip8.pc += 2;
-            }
-            break;
-        case 0x4000: // 4XNN: Skip next instruction if VX does not equal NN
-            if (chip8.V[(chip8.opcode & 0x0F00) >> 8] != (chip8.opcode & 0x00FF)) {
-                chip8.pc += 2;
-            }
-            break;
-        case 0x5000: // 5XY0: Skip next instruction if VX equals VY
-            if (chip8.V[(chip8.opcode & 0x0F00) >> 8] == chip8.V[(chip8.opcode & 0x00F0) >> 4]) {
-                chip8.pc += 2;
-            }
-            break;
-        case 0x6000: // 6XNN: Set VX to NN
-            chip8.V[(chip8.opcode & 0x0F00) >> 8] = chip8.opcode & 0x00FF;
-            break;
-        case 0x7000: // 7XNN: Add NN to VX
-            chip8.V[(chip8.opcode & 0x0F00) >> 8] += chip8.opcode & 0x00FF;
-            break;
-        case 0x8000: // 8XYN: Perform operation based on N
-            switch (chip8.opcode & 0x000F) {
-                case 0x0000: // 8XY0: Set VX equal to VY
-                    chip8.V[(chip8.opcode & 0x0F00) >> 8] = chip8.V[(chip8.opcode & 0x00F0) >> 4];
-                    break;
-                case 0x0001: // 8XY1: Set VX equal to VX OR VY
-                    chip8.V[(chip8.opcode & 0x0F00) >> 8] |= chip8.V[(chip8.opcode & 0x00F0) >> 4];
-                    if (!chip8.highRes) chip8.V[0xF] = 0;
-                    break;
-                case 0x0002: // 8XY2: Set VX equal to VX AND VY
-                    chip8.V[(chip8.opcode & 0x0F00) >> 8] &= chip8.V[(chip8.opcode & 0x00F0) >> 4];
-                    if (!chip8.highRes) chip8.V[0xF] = 0;
-                    break;
-                case 0x0003: // 8XY3: Set VX equal to VX XOR VY
-                    chip8.V[(chip8.opcode & 0x0F00) >> 8] ^= chip8.V[(chip8.opcode & 0x00F0) >> 4];
-                    if (!chip8.highRes) chip8.V[0xF] = 0;
-                    break;
-                case 0x0004: // 8XY4: Set VX equal to VX plus VY. In the case of an overflow VF is set to 1.
-                    {
-                        uint16_t sum = chip8.V[(chip8.opcode & 0x0F00) >> 8] + chip8.V[(chip8.opcode & 0x00F0) >> 4];
-                        chip8.V[0xF] = sum > 0xFF;
-                        chip8.V[(chip8.opcode & 0x0F00) >> 8] = sum & 0xFF;
-                        //Overflow check
-                        if (sum > 0xFF) {
-                            chip8.V[0xF] = 1;
-                        } else {
-                            chip8.V[0xF] = 0;
-                        }
-                    }
-                    break;
-                case 0x0005: // 8XY5: Set VX equal to VX minus VY. VF is set to 0 when there's a borrow, and 1 when there isn't.
-                    {
-                        uint8_t vx = chip8.V[(chip8.opcode & 0x0F00) >> 8];
-                        uint8_t vy = chip8.V[(chip8.opcode & 0x00F0) >> 4];
-                        chip8.V[(chip8.opcode & 0x0F00) >> 8] = vx - vy;
-                        // Check for borrow
-                        chip8.V[0xF] = (vx >= vy) ? 0x01 : 0x00;
-                    }
-                break;
-                case 0x0006: // 8XY6: Shift VX right by one. VF is set to the value of the least significant bit of VX before the shift.
-                    if (chip8.compatMode) {
-                        chip8.carry = (chip8.V[0xF] = chip8.V[(chip8.opcode & 0x0F00) >> 8] & 0x1);
-                        chip8.V[(chip8.opcode & 0x0F00) >> 8] >>= 1;
-
-                        chip8.V[0xF] = chip8.carry;
-                    } else {
-                        chip8.carry = (chip8.V[(chip8.opcode & 0x00F0) >> 4] & 0x1);
-                        chip8.V[(chip8.opcode & 0x0F00) >> 8] = chip8.V[(chip8.opcode & 0x00F0) >> 4] >> 1;
-
-                        chip8.V[0xF] = chip8.carry;
-                    }
-                break;
-                case 0x0007: // 8XY7: Set VX equal to VY minus VX. VF is set to 1 if VY > VX. Otherwise 0
-                    {
-                        uint8_t vx = chip8.V[(chip8.opcode & 0x0F00) >> 8];
-                        uint8_t vy = chip8.V[(chip8.opcode & 0x00F0) >> 4];
-                        chip8.V[(chip8.opcode & 0x0F00) >> 8] = vy - vx;
-
-                        // Check for borrow
-                        chip8.V[0xF] = (vy >= vx) ? 0x01 : 0x00;
-                    }
-                break;
-                case 0x000E: // 8XYE: Shift VX left by one. VF is set to the value of the most significant bit of VX before the shift.
-                    if (chip8.compatMode) {
-                        chip8.carry = ((chip8.V[(chip8.opcode & 0x0F00) >> 8] & 0x80) >> 7);
-                        chip8.V[(chip8.opcode & 0x0F00) >> 8] <<= 1;
-
-                        chip8.V[0xF] = chip8.carry;
-                    } else {
-                        chip8.carry = ((chip8.V[(chip8.opcode & 0x00F0) >> 4] & 0x80) >> 7);
-                        chip8.V[(chip8.opcode & 0x0F00) >> 8] = chip8.V[(chip8.opcode & 0x00F0) >> 4] << 1;
-
-                        chip8.V[0xF] = chip8.carry;
-                    }
-                break;
-                default:
-                    printf("Unknown opcode: 0x%X\n", chip8.opcode);
-                    break;
-            }
-            break;
-        case 0x9000: // 9XY0: Skip next instruction if VX does not equal VY
-            if (chip8.V[(chip8.opcode & 0x0F00) >> 8] != chip8.V[(chip8.opcode & 0x00F0) >> 4]) {
-                chip8.pc += 2;
-            }
-            break;
-        case 0xA000: // ANNN: Set I to the address NNN
-            chip8.I = chip8.opcode & 0x0FFF;
-            break;
-        case 0xB000: // BNNN: Jump to the address NNN plus V0
-            {
-                uint16_t address = chip8.opcode & 0x0FFF;
-                chip8.pc = address + chip8.V[0];
-            }
-        break;
-        case 0xC000: // CXNN: Set VX to a random number and NN
-            chip8.V[(chip8.opcode & 0x0F00) >> 8] = (rand() % 0xFF) & (chip8.opcode & 0x00FF);
-            break;
-        case 0xD000: // DXYN: Draw a sprite at position VX, VY with N bytes of sprite data starting at the address stored in I
-        {
-            const uint8_t x = chip8.V[(chip8.opcode & 0x0F00) >> 8];
-            const uint8_t y = chip8.V[(chip8.opcode & 0x00F0) >> 4];
-            const uint8_t height = chip8.opcode & 0x000F;
-            const int width = chip8.highRes ? HIGH_RES_WIDTH : LOW_RES_WIDTH;
-            const int displayHeight = chip8.highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
-
-            chip8.V[0xF] = 0; // Reset VF
-
-            for (int yline = 0; yline < height; yline++) {
-                uint8_t pixel = chip8.memory[chip8.I + yline];
-
-                for (int xline = 0; xline < 8; xline++) {
-                    if ((pixel & (0x80 >> xline)) != 0) {
-                        int xPos = (x + xline) % width;
-                        int yPos = (y + yline) % displayHeight;
-
-                        // Check for collision
-                        if (chip8.gfx[yPos * width + xPos] == 1) {
-                            chip8.V[0xF] = 1;
-                        }
-                        chip8.gfx[yPos * width + xPos] ^= 1;
-                    }
-                }
-            }
+// Background and foreground of the current theme, as the frame consumers take them
+void themePalette(uint32_t palette[2]) {
+    const SDL_Color bg = frontend.theme.bgColor;
+    const SDL_Color fg = frontend.theme.fgColor;
 
-            chip8.drawFlag = true; // Set flag to update the screen
-        }
-        break;
-
-        case 0xE000:
-            switch (chip8.opcode & 0x00FF) {
-                case 0x009E: // EX9E: Skip next instruction if key with the value of VX is pressed
-                    if (chip8.KC & ~(chip8.IK) & (1 << chip8.V[(chip8.opcode & 0x0F00) >> 8])) {
-                        chip8.pc += 2;
-                    }
-                break;
-                case 0x00A1: // EXA1: Skip next instruction if key with the value of VX is not pressed
-                    if (!(chip8.KC & ~(chip8.IK) & (1 << chip8.V[(chip8.opcode & 0x0F00) >> 8]))) {
-                        chip8.pc += 2;
-                    }
-                break;
-                default:
-                    printf("Unknown opcode: 0x%X\n", chip8.opcode);
-                    break;
-            }
-            break;
-        case 0xF000:
-            switch (chip8.opcode & 0x00FF) {
-                case 0x0007: // FX07: Set VX to the value of the delay timer
-                    chip8.V[(chip8.opcode & 0x0F00) >> 8] = chip8.delay_timer;
-                    break;
-                case 0x000A: // FX0A: Wait for a key press, store the value of the key in Vx
-                    chip8.waitingForKey = true;
-                chip8.keyReg = (chip8.opcode & 0x0F00) >> 8;
-                *interruptType = 2; // Set interrupt type for FX0A
-                *SPEED = -(*SPEED); // Invert SPEED to quit early
-                break;
-
-                case 0x0015: // FX15: Set the delay timer to VX
-                    chip8.delay_timer = chip8.V[(chip8.opcode & 0x0F00) >> 8];
-                    break;
-                case 0x0018: // FX18: Set the sound timer to VX
-                    chip8.sound_timer = chip8.V[(chip8.opcode & 0x0F00) >> 8];
-                    break;
-                case 0x001E: // FX1E: Add VX to I
-                    chip8.I += chip8.V[(chip8.opcode & 0x0F00) >> 8];
-                    break;
-                case 0x0029: // FX29: Set I to the location of the sprite for the character in VX
-                    chip8.I = chip8.V[(chip8.opcode & 0x0F00) >> 8] * 0x5;
-                    break;
-                case 0x0033: // FX33: Store the binary-coded decimal representation of VX at the addresses I, I+1, and I+2
-                    chip8.memory[chip8.I] = chip8.V[(chip8.opcode & 0x0F00) >> 8] / 100;
-                    chip8.memory[chip8.I + 1] = (chip8.V[(chip8.opcode & 0x0F00) >> 8] / 10) % 10;
-                    chip8.memory[chip8.I + 2] = (chip8.V[(chip8.opcode & 0x0F00) >> 8] % 10);
-                    break;
-                case 0x0055: // FX55: Store V0 to VX in memory starting at address I
-                    for (int i = 0; i <= ((chip8.opcode & 0x0F00) >> 8); ++i) {
-                        chip8.memory[chip8.I + i] = chip8.V[i];
-                    }
-                    if (!chip8.compatMode) {
-                        chip8.I += ((chip8.opcode & 0x0F00) >> 8) + 1;
-                    }
-                    break;
-                case 0x0065: // FX65: Fill V0 to VX with values from memory starting at address I
-                    for (int i = 0; i <= ((chip8.opcode & 0x0F00) >> 8); ++i) {
-                        chip8.V[i] = chip8.memory[chip8.I + i];
-                    }
-                    // If not in compat mode, increase I
-                    if (!chip8.compatMode) {
-                        chip8.I += ((chip8.opcode & 0x0F00) >> 8) + 1;
-                    }
-                    break;
-                default:
-                    printf("Unknown opcode: 0x%X\n", chip8.opcode);
-                    break;
-            }
-            break;
-        // Unknown opcode
-        default:
-            printf("Unknown opcode: 0x%X\n", chip8.opcode);
-            break;
-    }
+    palette[0] = packArgb(bg.r, bg.g, bg.b, bg.a);
+    palette[1] = packArgb(fg.r, fg.g, fg.b, fg.a);
 }
 
-// Update input values
-void updateInput() {
-    chip8.KP = chip8.KC;
-    chip8.KC = 0;
+// Send what changed on the display since the last batch to the stream subscribers. Runs after every batch, also
+// when nothing changed, so new subscribers are taken in while the guest idles
+void streamFrame(void) {
+    static uint8_t message[STREAM_MAX_MESSAGE];
+    uint32_t palette[2];
 
-    // Update KC based on current key states
-    for (int i = 0; i < 16; ++i) {
-        if (chip8.key[i]) {
-            chip8.KC |= (1 << i);
+    themePalette(palette);
+    const int size = encodeFrame(&frontend.streamEncoder, &chip8, palette, message);
+    publishStream(&frontend.stream, &frontend.streamEncoder, message, size);
+}
+
+// Queue the key changes that arrived over the last frame period for the next frame, each at the instruction
+// matching its arrival time. Called right before runFrame, so input is sampled as late as it can be
+void takeInput(void) {
+    const uint64_t now = SDL_GetPerformanceCounter();
+    const uint64_t period = frontend.scheduler.frequency / ((uint64_t)SCHEDULER_FRAME_RATE * frontend.scheduler.multiplier);
+    const uint64_t budget = (uint64_t)abs(chip8.speed);
+    struct KeyInput input;
+
+    while (spscPop(&frontend.input, &input)) {
+        if (frontend.netplaying) {
+            // Netplay exchanges one key mask per frame, so the change lands at the start of the next frame
+            if (input.pressed) frontend.netplayKeys |= (uint16_t)(1 << input.key);
+            else frontend.netplayKeys &= (uint16_t)~(1 << input.key);
+        } else {
+            // Position in the frame period that just ended, anything older goes before the first instruction
+            const uint64_t position = now - input.time < period ? period - (now - input.time) : 0;
+            queueKeyEvent(&chip8, input.key, input.pressed, (int)(position * budget / period));
         }
+        if (frontend.measureLatency && input.pressed && !frontend.latencyStart) frontend.latencyStart = input.time;
     }
+}
 
-    // Update IK to detect key releases
-    chip8.IK = chip8.KP & ~chip8.KC;
+void addLatencySample(struct LatencyStats *stats, uint64_t ticks) {
+    if (stats->samples == 0 || ticks < stats->min) stats->min = ticks;
+    if (ticks > stats->max) stats->max = ticks;
+    stats->total += ticks;
+    ++stats->samples;
 }
 
-// Handle interrupts
-void handleInterrupts(int *SPEED, int *interruptType) {
-    if (*interruptType == 2) { // FX0A interrupt
-        uint16_t keyPresses = chip8.KC & ~chip8.IK;
-        if (keyPresses) {
-            chip8.V[chip8.keyReg] = log2(keyPresses & -keyPresses);
-            chip8.IK |= keyPresses;
-            *interruptType = -1; // Clear interrupt
-            *SPEED = abs(*SPEED); // Restore SPEED
-        }
+void printLatency(const char *name, const struct LatencyStats *stats) {
+    const double ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    if (stats->samples == 0) {
+        printf("%s: no samples\n", name);
+        return;
     }
+    printf("%s: %llu samples, mean %.2f ms, min %.2f ms, max %.2f ms\n", name, (unsigned long long)stats->samples,
+           (double)stats->total / stats->samples * ms, stats->min * ms, stats->max * ms);
 }
 
-// Update timers
-void updateTimers() {
-    if (chip8.delay_timer > 0) {
-        --chip8.delay_timer;
-    }
-    if (chip8.sound_timer > 0) {
-        // Play the beep sound
-        soundBeep();
-        --chip8.sound_timer;
-    } else {
-        // Stop the beep sound
-        SDL_ClearQueuedAudio(chip8.beepDevice);
-        SDL_PauseAudioDevice(chip8.beepDevice, 1);
+// Initialize SDL2
+int initSDL2(){
+    if(SDL_Init(SDL_INIT_VIDEO)==-1) {
+        printf("SDL2 could not be initialized. %s\n", SDL_GetError());
+        return 0;
     }
+    return 1;
 }
 
-void drawGfx(SDL_Renderer *renderer) {
-    // Set background color and clear screen
-    SDL_SetRenderDrawColor(renderer, chip8.theme.bgColor.r, chip8.theme.bgColor.g, chip8.theme.bgColor.b, chip8.theme.bgColor.a);
-    SDL_RenderClear(renderer);
-
-    // Set foreground color
-    SDL_SetRenderDrawColor(renderer, chip8.theme.fgColor.r, chip8.theme.fgColor.g, chip8.theme.fgColor.b, chip8.theme.fgColor.a);
-
-    int width = chip8.highRes ? HIGH_RES_WIDTH : LOW_RES_WIDTH;
-    int height = chip8.highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
-    int pixelSize = chip8.highRes ? 5 : 10; // Adjust pixel size for high-res
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            if (chip8.gfx[y * width + x] == 1) {
-                int drawX = (x * pixelSize) % (width * pixelSize);
-                int drawY = (y * pixelSize) % (height * pixelSize);
-
-                // Draw pixel
-                SDL_Rect pixelRect = { drawX, drawY, pixelSize, pixelSize };
-                SDL_RenderFillRect(renderer, &pixelRect);
-            }
-        }
+// Handle one SDL event on the render thread. Key events are queued for the emulation thread
+void processEvent(const SDL_Event event) {
+    if (event.type == SDL_QUIT) running = false;
+    if (event.type == frontend.frameEvent) atomic_store(&frontend.framePosted, false);
+    if (event.type == SDL_WINDOWEVENT) frontend.redraw = true;
+    // F2 cycles through the scaling filters
+    if (event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_F2 && !event.key.repeat) {
+        setFilter(renderer, (enum ScaleFilter)((frontend.upscaler.filter + 1) % FILTER_COUNT));
+        printf("Filter: %s\n", filterName(frontend.upscaler.filter));
     }
-    SDL_RenderPresent(renderer);
+    inputCycle(event);
 }
 
-// Initialize audio
-void initAudio() {
-    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
-        printf("SDL2 audio could not be initialized. %s\n", SDL_GetError());
+// Input cycle: map a key event to its CHIP-8 key and hand it to the emulation thread, stamped with its arrival time.
+// Every key is tracked on its own, so a key pressed while another is held still registers. Auto-repeats are ignored
+void inputCycle(const SDL_Event event) {
+    struct KeyInput input;
+
+    if ((event.type != SDL_KEYDOWN && event.type != SDL_KEYUP) || event.key.repeat) return;
+    // Check which key was pressed or released
+    switch (event.key.keysym.sym){
+        case SDLK_1: input.key = 0x1; break;
+        case SDLK_2: input.key = 0x2; break;
+        case SDLK_3: input.key = 0x3; break;
+        case SDLK_4: input.key = 0xC; break;
+        case SDLK_q: input.key = 0x4; break;
+        case SDLK_w: input.key = 0x5; break;
+        case SDLK_e: input.key = 0x6; break;
+        case SDLK_r: input.key = 0xD; break;
+        case SDLK_a: input.key = 0x7; break;
+        case SDLK_s: input.key = 0x8; break;
+        case SDLK_d: input.key = 0x9; break;
+        case SDLK_f: input.key = 0xE; break;
+        case SDLK_z: input.key = 0xA; break;
+        case SDLK_x: input.key = 0x0; break;
+        case SDLK_c: input.key = 0xB; break;
+        case SDLK_v: input.key = 0xF; break;
+        default: return;
+    }
+    input.time = SDL_GetPerformanceCounter();
+    input.pressed = event.type == SDL_KEYDOWN;
+    if (!spscPush(&frontend.input, &input)) {
+        printf("Input queue full, key event dropped.\n");
         return;
     }
+    SDL_SemPost(frontend.wake);
+}
 
-    // Set audio specifications
-    chip8.beepSpec.freq = 44100;
-    chip8.beepSpec.format = AUDIO_F32SYS;
-    chip8.beepSpec.channels = 1;
-    chip8.beepSpec.samples = 2048;
-    chip8.beepSpec.callback = NULL;
-
-    // Open audio device
-    chip8.beepDevice = SDL_OpenAudioDevice(NULL, 0, &chip8.beepSpec, NULL, 0);
-    if (chip8.beepDevice == 0) {
-        printf("SDL2 audio device could not be opened for playback. %s\n", SDL_GetError());
+// Create the streaming texture, sized for high res at the filter's scale. Low res frames only use its top-left corner
+int initScreen(SDL_Renderer *renderer) {
+    const int scale = filterScale(frontend.upscaler.filter);
+    frontend.screen = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                        HIGH_RES_WIDTH * scale, HIGH_RES_HEIGHT * scale);
+    if(!frontend.screen) {
+        printf("Texture could not be created. %s\n", SDL_GetError());
+        return 0;
     }
+    // Keep the 2:1 aspect ratio when the window is resized, letterboxing the rest
+    SDL_RenderSetLogicalSize(renderer, HIGH_RES_WIDTH, HIGH_RES_HEIGHT);
+    frontend.redraw = true;
+    return 1;
 }
 
-// Play beep sound
-void soundBeep() {
-    if (chip8.beepDevice == 0) {
-        return; // Audio device not initialized
-    }
+// Switch the scaling filter at run time. The texture is recreated at the new size, keeping the old one if that fails
+int setFilter(SDL_Renderer *renderer, enum ScaleFilter filter) {
+    SDL_Texture *previous = frontend.screen;
+    const enum ScaleFilter previousFilter = frontend.upscaler.filter;
 
-    // Play beep sound
-    if (chip8.sound_timer > 0) {
-        int sampleCount = chip8.beepSpec.freq;
-        float* buffer = (float*)malloc(sizeof(float) * sampleCount);
+    initUpscaler(&frontend.upscaler, filter);
+    if (!initScreen(renderer)) {
+        frontend.screen = previous;
+        initUpscaler(&frontend.upscaler, previousFilter);
+        return -1;
+    }
+    SDL_DestroyTexture(previous);
+    return 0;
+}
 
-        for (int i = 0; i < sampleCount; ++i) {
-            buffer[i] = sin(2 * M_PI * 440 * i / chip8.beepSpec.freq);
+// Convert the rows that changed since the last present to ARGB in the texture and scale it to the window with a single copy
+void drawGfx(SDL_Renderer *renderer) {
+    const struct FrameSlot *frame = tripleReadSlot(&frontend.frames);
+    const uint32_t *palette = frame->palette;
+    const int scale = filterScale(frontend.upscaler.filter);
+    const int width = displayWidth(&frame->display), height = displayHeight(&frame->display);
+    const bool newFrame = frame->sequence != frontend.shownSequence;
+    const SDL_Rect source = { 0, 0, width * scale, height * scale };
+    int firstRow = 0;
+    int lastRow = height - 1;
+    void *pixels;
+    int pitch;
+
+    // Nothing published yet, keep the redraw for the first frame
+    if (frame->sequence == 0) return;
+
+    // Locked texture memory is write-only, so the band between the first and last changed row is rewritten in full.
+    // The frame's changed rows are relative to the frame before it, so after a skipped frame everything is redrawn
+    if (frame->sequence != frontend.shownSequence + 1 || palette[0] != frontend.shownPalette[0] ||
+        palette[1] != frontend.shownPalette[1]) {
+        frontend.redraw = true;
+    }
+    if (!frontend.redraw) {
+        while (firstRow < lastRow && !(frame->changedRows >> firstRow & 1)) ++firstRow;
+        while (lastRow > firstRow && !(frame->changedRows >> lastRow & 1)) --lastRow;
+        // Edge smoothing looks at the rows above and below, so their output changes too
+        if (frontend.upscaler.filter == FILTER_SCALE2X || frontend.upscaler.filter == FILTER_SCALE3X) {
+            if (firstRow > 0) --firstRow;
+            if (lastRow < height - 1) ++lastRow;
         }
+    }
+    const SDL_Rect band = { 0, firstRow * scale, source.w, (lastRow - firstRow + 1) * scale };
 
-        SDL_QueueAudio(chip8.beepDevice, buffer, sampleCount * sizeof(float));
-        SDL_PauseAudioDevice(chip8.beepDevice, 0);
-
-        free(buffer);
-    } else {
-        // Stop the beep sound
-        SDL_ClearQueuedAudio(chip8.beepDevice);
-        SDL_PauseAudioDevice(chip8.beepDevice, 1);
+    if (SDL_LockTexture(frontend.screen, &band, &pixels, &pitch) != 0) {
+        printf("Texture could not be locked. %s\n", SDL_GetError());
+        return;
     }
-}
\ No newline at end of file
+    upscaleRows(&frontend.upscaler, &frame->display, pixels, pitch, palette, firstRow, lastRow - firstRow + 1);
+    SDL_UnlockTexture(frontend.screen);
+    frontend.redraw = false;
+    frontend.shownSequence = frame->sequence;
+    frontend.shownPalette[0] = palette[0];
+    frontend.shownPalette[1] = palette[1];
+    ++frontend.presentedFrames;
+
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, frontend.screen, &source, NULL);
+    SDL_RenderPresent(renderer);
+    if (newFrame && frame->inputTime) addLatencySample(&frontend.presentLatency, SDL_GetPerformanceCounter() - frame->inputTime);
+}
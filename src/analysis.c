@@ -0,0 +1,368 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "analysis.h"
+#include "blockcache.h"
+#include "ops.h"
+
+#if defined(_WIN32)
+#include <direct.h>
+#define makeDirectory(path) _mkdir(path)
+#else
+#include <sys/stat.h>
+#define makeDirectory(path) mkdir(path, 0755)
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define CHIP8_HAVE_READV 1
+#endif
+
+_Static_assert(sizeof(struct BasicBlock) == 12, "BasicBlock must stay 12 bytes");
+_Static_assert(sizeof(struct RomAnalysis) % 8 == 0, "RomAnalysis must not end in padding");
+_Static_assert(sizeof(struct AnalysisFileHeader) == 16, "AnalysisFileHeader must stay 16 bytes");
+
+// Write an opcode as assembly, in the mnemonics of Cowgod's reference plus the SCHIP/XO-CHIP extensions
+void disassembleOpcode(uint16_t opcode, char *text, size_t size) {
+    const int x = (opcode & 0x0F00) >> 8, y = (opcode & 0x00F0) >> 4, n = opcode & 0x000F;
+    const int nn = opcode & 0x00FF, nnn = opcode & 0x0FFF;
+
+    switch (classifyOpcode(opcode)) {
+        case OP_CLS: snprintf(text, size, "CLS"); break;
+        case OP_RET: snprintf(text, size, "RET"); break;
+        case OP_SCROLL_DOWN: case OP_SCROLL_DOWN_6: case OP_SCROLL_DOWN_12:
+            snprintf(text, size, "SCD %d", n); break;
+        case OP_SCROLL_UP: snprintf(text, size, "SCU %d", n); break;
+        case OP_SCROLL_RIGHT: snprintf(text, size, "SCR"); break;
+        case OP_SCROLL_LEFT: snprintf(text, size, "SCL"); break;
+        case OP_COMPAT: snprintf(text, size, "COMPAT"); break;
+        case OP_LOW_RES: snprintf(text, size, "LOW"); break;
+        case OP_HIGH_RES: snprintf(text, size, "HIGH"); break;
+        case OP_EXIT: snprintf(text, size, "EXIT"); break;
+        case OP_JP: snprintf(text, size, "JP 0x%03X", nnn); break;
+        case OP_CALL: snprintf(text, size, "CALL 0x%03X", nnn); break;
+        case OP_SE_IMM: snprintf(text, size, "SE V%X, 0x%02X", x, nn); break;
+        case OP_SNE_IMM: snprintf(text, size, "SNE V%X, 0x%02X", x, nn); break;
+        case OP_SE_REG: snprintf(text, size, "SE V%X, V%X", x, y); break;
+        case OP_LD_IMM: snprintf(text, size, "LD V%X, 0x%02X", x, nn); break;
+        case OP_ADD_IMM: snprintf(text, size, "ADD V%X, 0x%02X", x, nn); break;
+        case OP_LD_REG: snprintf(text, size, "LD V%X, V%X", x, y); break;
+        case OP_OR: snprintf(text, size, "OR V%X, V%X", x, y); break;
+        case OP_AND: snprintf(text, size, "AND V%X, V%X", x, y); break;
+        case OP_XOR: snprintf(text, size, "XOR V%X, V%X", x, y); break;
+        case OP_ADD_REG: snprintf(text, size, "ADD V%X, V%X", x, y); break;
+        case OP_SUB: snprintf(text, size, "SUB V%X, V%X", x, y); break;
+        case OP_SHR: snprintf(text, size, "SHR V%X, V%X", x, y); break;
+        case OP_SUBN: snprintf(text, size, "SUBN V%X, V%X", x, y); break;
+        case OP_SHL: snprintf(text, size, "SHL V%X, V%X", x, y); break;
+        case OP_SNE_REG: snprintf(text, size, "SNE V%X, V%X", x, y); break;
+        case OP_LD_I: snprintf(text, size, "LD I, 0x%03X", nnn); break;
+        case OP_JP_V0: snprintf(text, size, "JP V0, 0x%03X", nnn); break;
+        case OP_RND: snprintf(text, size, "RND V%X, 0x%02X", x, nn); break;
+        case OP_DRW: snprintf(text, size, "DRW V%X, V%X, %d", x, y, n); break;
+        case OP_SKP: snprintf(text, size, "SKP V%X", x); break;
+        case OP_SKNP: snprintf(text, size, "SKNP V%X", x); break;
+        case OP_LD_VX_DT: snprintf(text, size, "LD V%X, DT", x); break;
+        case OP_LD_KEY: snprintf(text, size, "LD V%X, K", x); break;
+        case OP_LD_DT: snprintf(text, size, "LD DT, V%X", x); break;
+        case OP_LD_ST: snprintf(text, size, "LD ST, V%X", x); break;
+        case OP_ADD_I: snprintf(text, size, "ADD I, V%X", x); break;
+        case OP_LD_F: snprintf(text, size, "LD F, V%X", x); break;
+        case OP_BCD: snprintf(text, size, "LD B, V%X", x); break;
+        case OP_STORE: snprintf(text, size, "LD [I], V%X", x); break;
+        case OP_LOAD: snprintf(text, size, "LD V%X, [I]", x); break;
+        case OP_AUDIO: snprintf(text, size, "AUDIO"); break;
+        case OP_PITCH: snprintf(text, size, "PITCH V%X", x); break;
+        default: snprintf(text, size, "DW 0x%04X", opcode); break;
+    }
+}
+
+// Hash of the ROM image, the key analysis results are cached under
+uint64_t romHash(const uint8_t *rom, size_t size) {
+    return hashBytes(HASH_SEED, rom, size);
+}
+
+static inline bool isSkip(enum OpClass cls) {
+    return cls == OP_SE_IMM || cls == OP_SNE_IMM || cls == OP_SE_REG || cls == OP_SNE_REG || cls == OP_SKP ||
+           cls == OP_SKNP;
+}
+
+// Instructions after which execution never continues at the next address
+static inline bool endsTrace(enum OpClass cls) {
+    return cls == OP_JP || cls == OP_RET || cls == OP_JP_V0 || cls == OP_EXIT;
+}
+
+static uint32_t featureOf(uint16_t opcode, enum OpClass cls) {
+    switch (cls) {
+        case OP_LOW_RES: case OP_HIGH_RES: return ROM_HIGH_RES;
+        case OP_SCROLL_DOWN: case OP_SCROLL_UP: case OP_SCROLL_RIGHT: case OP_SCROLL_LEFT:
+        case OP_SCROLL_DOWN_6: case OP_SCROLL_DOWN_12:
+            return ROM_SCROLL;
+        case OP_DRW: return (opcode & 0x000F) == 0 ? ROM_LARGE_SPRITES : 0;
+        case OP_EXIT: return ROM_EXIT;
+        case OP_COMPAT: return ROM_SETS_COMPAT;
+        case OP_SHR: case OP_SHL: return ROM_SHIFTS;
+        case OP_STORE: case OP_LOAD: return ROM_LOAD_STORE;
+        case OP_JP_V0: return ROM_INDIRECT_JUMP;
+        case OP_AUDIO: case OP_PITCH: return ROM_XO_CHIP;
+        case OP_UNKNOWN: return ROM_UNKNOWN_OPCODES;
+        default: return 0;
+    }
+}
+
+// Recursive descent from the entry point: follow every static edge, mark instructions and block leaders
+static void traceCode(const uint8_t *memory, struct RomAnalysis *analysis) {
+    uint16_t worklist[2 * MEMORY_SIZE]; // Each instruction adds at most two entries
+    int pending = 0;
+    uint8_t *flags = analysis->addressFlags;
+
+    worklist[pending++] = ROM_START;
+    flags[ROM_START] |= ADDR_LEADER;
+    while (pending > 0) {
+        int address = worklist[--pending];
+        while (address <= MEMORY_SIZE - 2 && !(flags[address] & ADDR_INSTRUCTION)) {
+            const uint16_t opcode = memory[address] << 8 | memory[address + 1];
+            const enum OpClass cls = classifyOpcode(opcode);
+            const int target = opcode & 0x0FFF;
+
+            flags[address] |= ADDR_CODE | ADDR_INSTRUCTION;
+            flags[address + 1] |= ADDR_CODE;
+            analysis->instructionCount++;
+            analysis->features |= featureOf(opcode, cls);
+            if (cls == OP_JP_V0) analysis->indirectJumps++;
+
+            // Every static target starts a block, and so does whatever follows a block-ending instruction
+            if (cls == OP_JP || cls == OP_CALL) {
+                flags[target] |= ADDR_LEADER | (cls == OP_JP ? ADDR_JUMP_TARGET : ADDR_CALL_TARGET);
+                worklist[pending++] = target;
+            }
+            if (isSkip(cls) && address + 4 < MEMORY_SIZE) {
+                flags[address + 4] |= ADDR_LEADER;
+                worklist[pending++] = address + 4;
+            }
+            if (cls == OP_CALL || isSkip(cls)) {
+                if (address + 2 < MEMORY_SIZE) flags[address + 2] |= ADDR_LEADER;
+            }
+            if (endsTrace(cls)) break;
+            address += 2;
+        }
+    }
+}
+
+// Record a write of length bytes at I. Writes with an unknown I are only counted
+static void recordWrite(struct RomAnalysis *analysis, int address, int length) {
+    if (address < 0) {
+        analysis->unknownWrites++;
+        return;
+    }
+    bool hitsCode = false;
+    for (int i = address; i < address + length && i < MEMORY_SIZE; ++i) {
+        analysis->addressFlags[i] |= ADDR_WRITTEN;
+        if (analysis->addressFlags[i] & ADDR_CODE) {
+            analysis->addressFlags[i] |= ADDR_SELF_MODIFIED;
+            hitsCode = true;
+        }
+    }
+    if (hitsCode) {
+        analysis->codeWrites++;
+        analysis->features |= ROM_SELF_MODIFYING;
+    }
+}
+
+// Split the traced code into basic blocks at the leaders, and follow I through each block to find writes
+static void buildBlocks(const uint8_t *memory, struct RomAnalysis *analysis) {
+    const uint8_t *flags = analysis->addressFlags;
+
+    // Jumps may land on odd addresses or below the ROM, so every address is a candidate
+    for (int start = 0; start <= MEMORY_SIZE - 2; ++start) {
+        if (!(flags[start] & ADDR_LEADER) || !(flags[start] & ADDR_INSTRUCTION)) continue;
+        if (analysis->blockCount == ANALYSIS_MAX_BLOCKS) break;
+
+        struct BasicBlock *block = &analysis->blocks[analysis->blockCount++];
+        int address = start;
+        int i = -1; // Value of I, -1 while it is unknown
+        memset(block, 0, sizeof(*block));
+        block->start = (uint16_t)start;
+        block->exit = BLOCK_END_OF_MEMORY;
+
+        while (address <= MEMORY_SIZE - 2) {
+            const uint16_t opcode = memory[address] << 8 | memory[address + 1];
+            const enum OpClass cls = classifyOpcode(opcode);
+            const int x = (opcode & 0x0F00) >> 8;
+            address += 2;
+
+            if (cls == OP_LD_I) i = opcode & 0x0FFF;
+            else if (cls == OP_ADD_I || cls == OP_LD_F || cls == OP_LOAD) i = -1;
+            else if (cls == OP_BCD) recordWrite(analysis, i, 3);
+            else if (cls == OP_STORE) {
+                recordWrite(analysis, i, x + 1);
+                i = -1; // Whether I moves depends on compatMode
+            }
+
+            if (cls == OP_JP) {
+                block->exit = BLOCK_JUMP;
+                block->successors[block->successorCount++] = opcode & 0x0FFF;
+            } else if (cls == OP_CALL) {
+                block->exit = BLOCK_CALL;
+                block->successors[block->successorCount++] = (uint16_t)address;
+                block->successors[block->successorCount++] = opcode & 0x0FFF;
+            } else if (isSkip(cls)) {
+                block->exit = BLOCK_SKIP;
+                block->successors[block->successorCount++] = (uint16_t)address;
+                block->successors[block->successorCount++] = (uint16_t)(address + 2);
+            } else if (cls == OP_RET) {
+                block->exit = BLOCK_RETURN;
+            } else if (cls == OP_JP_V0) {
+                block->exit = BLOCK_INDIRECT;
+            } else if (cls == OP_EXIT) {
+                block->exit = BLOCK_HALT;
+            } else if (address <= MEMORY_SIZE - 2 && (flags[address] & ADDR_LEADER)) {
+                block->exit = BLOCK_FALLTHROUGH;
+                block->successors[block->successorCount++] = (uint16_t)address;
+            } else {
+                continue;
+            }
+            break;
+        }
+        block->end = (uint16_t)address;
+    }
+}
+
+// Analyse a ROM image without running it. Returns -1 if it does not fit in memory
+int analyzeRom(const uint8_t *rom, size_t size, struct RomAnalysis *analysis) {
+    uint8_t memory[MEMORY_SIZE] = { 0 };
+
+    if (size >= MEMORY_SIZE - ROM_START) {
+        printf("ROM too big for memory.\n");
+        return -1;
+    }
+    memcpy(memory + ROM_START, rom, size);
+    memset(analysis, 0, sizeof(*analysis));
+    analysis->romHash = romHash(rom, size);
+    analysis->romSize = (uint32_t)size;
+
+    traceCode(memory, analysis);
+    buildBlocks(memory, analysis);
+
+    // SCHIP ROMs expect shifts on VX and an I left in place by FX55/FX65. Without 00FA they have no way
+    // of asking for that, so the analysis does it for them
+    const uint32_t features = analysis->features;
+    analysis->suggestedCompatMode = (features & ROM_SCHIP) && (features & (ROM_SHIFTS | ROM_LOAD_STORE)) &&
+                                    !(features & ROM_SETS_COMPAT);
+    return 0;
+}
+
+static void cachePath(char *path, size_t size, const char *cacheDir, uint64_t hash) {
+    snprintf(path, size, "%s/%016llx.c8a", cacheDir, (unsigned long long)hash);
+}
+
+// Bytes of an analysis that go to the cache: the fixed part and only the blocks in use
+static size_t storedSize(uint32_t blockCount) {
+    return offsetof(struct RomAnalysis, blocks) + blockCount * sizeof(struct BasicBlock);
+}
+
+// Look the ROM up in the cache. Returns 0 on a hit, -1 when there is no usable entry
+int readCachedAnalysis(const char *cacheDir, const uint8_t *rom, size_t size, struct RomAnalysis *analysis) {
+    struct AnalysisFileHeader header;
+    char path[1024];
+    const uint64_t hash = romHash(rom, size);
+
+    cachePath(path, sizeof(path), cacheDir, hash);
+    // A hit has to beat analysing the ROM again, so the entry is read straight into place with as few system
+    // calls as possible: one read for header and analysis together where there is readv
+#ifdef CHIP8_HAVE_READV
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct iovec parts[2] = { { &header, sizeof(header) }, { analysis, sizeof(*analysis) } };
+    const ssize_t got = readv(fd, parts, 2);
+    close(fd);
+    const bool complete = got >= (ssize_t)sizeof(header);
+    const size_t stored = complete ? (size_t)got - sizeof(header) : 0;
+#else
+    FILE *in = fopen(path, "rb");
+    if (!in) return -1;
+    const bool complete = fread(&header, sizeof(header), 1, in) == 1;
+    const size_t stored = complete ? fread(analysis, 1, sizeof(*analysis), in) : 0;
+    fclose(in);
+#endif
+
+    // Entries from another version or byte order are simply redone, they are only a cache
+    if (!complete || memcmp(header.magic, ANALYSIS_MAGIC, 4) != 0 || header.version != ANALYSIS_VERSION ||
+        header.byteOrder != ANALYSIS_BYTE_ORDER || stored < storedSize(0) || analysis->blockCount > ANALYSIS_MAX_BLOCKS ||
+        header.analysisSize != storedSize(analysis->blockCount) || stored != header.analysisSize ||
+        analysis->romHash != hash || analysis->romSize != size) {
+        return -1;
+    }
+    memset(analysis->blocks + analysis->blockCount, 0,
+           (ANALYSIS_MAX_BLOCKS - analysis->blockCount) * sizeof(struct BasicBlock));
+    return 0;
+}
+
+// Store an analysis in the cache directory, creating it if needed. Written to a temporary file and renamed,
+// so concurrent runs never read a half written entry
+int writeCachedAnalysis(const char *cacheDir, const struct RomAnalysis *analysis) {
+    struct AnalysisFileHeader header;
+    char path[1024], tempPath[1040];
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ANALYSIS_MAGIC, 4);
+    header.version = ANALYSIS_VERSION;
+    header.byteOrder = ANALYSIS_BYTE_ORDER;
+    header.analysisSize = (uint32_t)storedSize(analysis->blockCount);
+
+    makeDirectory(cacheDir);
+    cachePath(path, sizeof(path), cacheDir, analysis->romHash);
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    FILE *out = fopen(tempPath, "wb");
+    if (!out) {
+        printf("File could not be opened: %s\n", tempPath);
+        return -1;
+    }
+    const bool written = fwrite(&header, sizeof(header), 1, out) == 1 && fwrite(analysis, header.analysisSize, 1, out) == 1;
+    if (fclose(out) != 0 || !written) {
+        printf("Writing error.\n");
+        remove(tempPath);
+        return -1;
+    }
+    if (rename(tempPath, path) != 0) {
+        printf("File could not be replaced: %s\n", path);
+        remove(tempPath);
+        return -1;
+    }
+    return 0;
+}
+
+// Cached analysis of a ROM, analysing and caching it on a miss. cacheDir may be NULL to skip the cache.
+// Returns 1 when served from the cache, 0 when freshly analysed and -1 on failure
+int loadAnalysis(const char *cacheDir, const uint8_t *rom, size_t size, struct RomAnalysis *analysis) {
+    if (cacheDir && readCachedAnalysis(cacheDir, rom, size, analysis) == 0) return 1;
+    if (analyzeRom(rom, size, analysis) != 0) return -1;
+    // A cache that can not be written only costs the next start its shortcut
+    if (cacheDir) writeCachedAnalysis(cacheDir, analysis);
+    return 0;
+}
+
+// The profile a ROM should start in: XO-CHIP if it uses XO-CHIP opcodes, SCHIP modern if it needs compatMode.
+// Nothing in a ROM tells SCHIP 1.1 games from later ones, schip-legacy is only ever asked for
+enum QuirkProfile analysisProfile(const struct RomAnalysis *analysis) {
+    if (analysis->features & ROM_XO_CHIP) return PROFILE_XO_CHIP;
+    if (analysis->suggestedCompatMode) return PROFILE_SCHIP_MODERN;
+    return PROFILE_CHIP8;
+}
+
+// Set a loaded machine up from the analysis of its ROM: start it in the profile it needs and translate
+// every known block up front if the block cache is attached. A plain CHIP-8 result leaves the quirks alone
+void applyAnalysis(struct Chip8 *chip8, const struct RomAnalysis *analysis) {
+    const enum QuirkProfile profile = analysisProfile(analysis);
+    if (profile != PROFILE_CHIP8) applyQuirkProfile(chip8, profile);
+    if (chip8->blockCache) {
+        // Cache blocks also end at DXYN and FX0A, so one analysed block can take several of them
+        for (uint32_t i = 0; i < analysis->blockCount; ++i) {
+            const struct BasicBlock *block = &analysis->blocks[i];
+            for (int pc = block->start; pc >= 0 && pc < block->end; pc = prewarmBlock(chip8, (uint16_t)pc)) {}
+        }
+    }
+}
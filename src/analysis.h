@@ -0,0 +1,96 @@
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "core.h"
+#include "dispatch.h"
+
+#define ANALYSIS_MAGIC "C8AN"
+#define ANALYSIS_VERSION 2 // Bump whenever the analysis or struct RomAnalysis changes, old cache files are redone
+#define ANALYSIS_BYTE_ORDER 0x0102
+#define ANALYSIS_MAX_BLOCKS (MEMORY_SIZE / 2)
+#define ANALYSIS_CACHE_DIR ".chip8cache"
+
+// Bits of RomAnalysis.addressFlags, one byte per memory address
+#define ADDR_CODE 0x01 // Part of a reachable instruction
+#define ADDR_INSTRUCTION 0x02 // First byte of a reachable instruction
+#define ADDR_LEADER 0x04 // First instruction of a basic block
+#define ADDR_JUMP_TARGET 0x08 // 1NNN lands here
+#define ADDR_CALL_TARGET 0x10 // 2NNN lands here
+#define ADDR_WRITTEN 0x20 // FX33/FX55 with a known I writes here
+#define ADDR_SELF_MODIFIED 0x40 // Written and part of a reachable instruction
+
+// Bits of RomAnalysis.features, what the reachable code uses
+#define ROM_HIGH_RES (1 << 0) // 00FE/00FF
+#define ROM_SCROLL (1 << 1) // 00CN, 00DN, 00FB, 00FC
+#define ROM_LARGE_SPRITES (1 << 2) // DXY0
+#define ROM_EXIT (1 << 3) // 00FD
+#define ROM_SETS_COMPAT (1 << 4) // 00FA switches the quirks itself
+#define ROM_SHIFTS (1 << 5) // 8XY6/8XYE, shift VX or VY depending on compatMode
+#define ROM_LOAD_STORE (1 << 6) // FX55/FX65, I is incremented unless compatMode
+#define ROM_INDIRECT_JUMP (1 << 7) // BNNN, targets unknown until run time
+#define ROM_SELF_MODIFYING (1 << 8) // A write with known I lands on reachable code
+#define ROM_XO_CHIP (1 << 9) // F002/FX3A
+#define ROM_UNKNOWN_OPCODES (1 << 10) // Reachable opcodes the core does not decode
+#define ROM_SCHIP (ROM_HIGH_RES | ROM_SCROLL | ROM_LARGE_SPRITES | ROM_EXIT)
+
+// How a basic block hands over control
+enum BlockExit {
+    BLOCK_FALLTHROUGH, // Runs into the next block
+    BLOCK_JUMP,
+    BLOCK_CALL, // Successors are the return address and the subroutine
+    BLOCK_RETURN,
+    BLOCK_SKIP, // Successors are the next instruction and the one after
+    BLOCK_INDIRECT, // BNNN
+    BLOCK_HALT, // 00FD
+    BLOCK_END_OF_MEMORY
+};
+
+struct BasicBlock {
+    uint16_t start;
+    uint16_t end; // First byte past the last instruction
+    uint16_t successors[2]; // Fall-through or return address first
+    uint8_t successorCount;
+    uint8_t exit; // enum BlockExit
+    uint16_t reserved;
+};
+
+// Everything found about a ROM without running it. Fixed layout with no pointers, cached on disk as is
+struct RomAnalysis {
+    uint64_t romHash; // hashBytes over the ROM image, the cache key
+    uint32_t romSize;
+    uint32_t features; // ROM_* bits
+    uint32_t instructionCount; // Reachable instructions
+    uint32_t blockCount;
+    uint32_t indirectJumps;
+    uint32_t codeWrites; // FX33/FX55 that write over reachable code
+    uint32_t unknownWrites; // FX33/FX55 whose I could not be worked out statically
+    uint8_t suggestedCompatMode; // SCHIP ROM that shifts or uses FX55/FX65 but never sets 00FA itself
+    uint8_t reserved[3];
+    uint8_t addressFlags[MEMORY_SIZE]; // ADDR_* bits
+    struct BasicBlock blocks[ANALYSIS_MAX_BLOCKS]; // Sorted by start address
+};
+
+// Cache file: this header followed by struct RomAnalysis cut off after the last block in use. There is no
+// checksum, the file is named after the ROM hash, checked against romHash on load, and written by rename
+struct AnalysisFileHeader {
+    char magic[4]; // ANALYSIS_MAGIC
+    uint16_t version;
+    uint16_t byteOrder; // ANALYSIS_BYTE_ORDER
+    uint32_t analysisSize; // Bytes of RomAnalysis stored
+    uint32_t reserved;
+};
+
+// Function prototypes
+void disassembleOpcode(uint16_t opcode, char *text, size_t size);
+uint64_t romHash(const uint8_t *rom, size_t size);
+int analyzeRom(const uint8_t *rom, size_t size, struct RomAnalysis *analysis);
+int readCachedAnalysis(const char *cacheDir, const uint8_t *rom, size_t size, struct RomAnalysis *analysis);
+int writeCachedAnalysis(const char *cacheDir, const struct RomAnalysis *analysis);
+int loadAnalysis(const char *cacheDir, const uint8_t *rom, size_t size, struct RomAnalysis *analysis);
+enum QuirkProfile analysisProfile(const struct RomAnalysis *analysis);
+void applyAnalysis(struct Chip8 *chip8, const struct RomAnalysis *analysis);
+
+#endif // ANALYSIS_H
@@ -0,0 +1,144 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "audio.h"
+
+#define TWO_PI 6.28318530717958647692
+
+// Step through the 128 pattern samples at 4000 * 2^((pitch - 64) / 48) samples per second
+static uint32_t patternStep(uint8_t pitch, int sampleRate) {
+    const double rate = 4000.0 * pow(2.0, (pitch - 64) / 48.0);
+    return (uint32_t)(rate / (AUDIO_PATTERN_SIZE * 8) / sampleRate * 4294967296.0);
+}
+
+// Apply every queued command whose tick has started. Runs on the audio thread
+static void applyDueCommands(struct AudioEngine *audio, uint64_t samplesPerTick) {
+    const int64_t now = (int64_t)(audio->sample / samplesPerTick);
+    struct AudioCommand command;
+
+    while (spscPeek(&audio->commands, &command)) {
+        int64_t due = (int64_t)command.tick + audio->tickOffset;
+
+        // First command, or the emulator drifted away from the audio clock (stall, pacing error): start over
+        if (!audio->synced || due > now + AUDIO_MAX_DRIFT_TICKS || due < now - AUDIO_MAX_DRIFT_TICKS) {
+            audio->tickOffset = now - (int64_t)command.tick + AUDIO_LATENCY_TICKS;
+            audio->synced = true;
+            due = now + AUDIO_LATENCY_TICKS;
+        }
+        if (due > now) break;
+        if (due < now || audio->sample % samplesPerTick != 0) audio->lateCommands++;
+
+        if (command.usePattern && (!audio->playing.usePattern || command.pitch != audio->playing.pitch)) {
+            audio->patternStep = patternStep(command.pitch, audio->spec.freq);
+        }
+        if (command.on && !audio->playing.on) {
+            // Every beep starts at the top of its waveform
+            audio->beepPhase = 0;
+            audio->patternPhase = 0;
+        }
+        audio->playing = command;
+        spscDrop(&audio->commands);
+    }
+}
+
+static void renderSamples(struct AudioEngine *audio, float *out, int count) {
+    const struct AudioCommand *playing = &audio->playing;
+
+    if (!playing->on) {
+        memset(out, 0, count * sizeof(float));
+    } else if (playing->usePattern) {
+        for (int i = 0; i < count; ++i) {
+            const uint32_t bit = audio->patternPhase >> 25;
+            out[i] = (playing->pattern[bit >> 3] >> (7 - (bit & 7))) & 1 ? AUDIO_VOLUME : -AUDIO_VOLUME;
+            audio->patternPhase += audio->patternStep;
+        }
+    } else {
+        for (int i = 0; i < count; ++i) {
+            out[i] = audio->wavetable[audio->beepPhase >> 24];
+            audio->beepPhase += audio->beepStep;
+        }
+    }
+}
+
+// SDL audio callback, renders the stream tick by tick so commands land on exact sample boundaries
+static void audioCallback(void *userdata, Uint8 *stream, int len) {
+    struct AudioEngine *audio = userdata;
+    const uint64_t samplesPerTick = audio->spec.freq / AUDIO_TICK_RATE;
+    float *out = (float *)stream;
+    const int count = len / (int)sizeof(float);
+
+    for (int i = 0; i < count;) {
+        applyDueCommands(audio, samplesPerTick);
+
+        int run = (int)(samplesPerTick - audio->sample % samplesPerTick);
+        if (run > count - i) run = count - i;
+        renderSamples(audio, out + i, run);
+        audio->sample += run;
+        i += run;
+    }
+}
+
+// Open the audio device and start the callback. Returns -1 if there is no audio, the emulator runs silent
+int initAudio(struct AudioEngine *audio) {
+    SDL_AudioSpec wanted;
+
+    memset(audio, 0, sizeof(*audio));
+    spscInit(&audio->commands, audio->commandStorage, sizeof(struct AudioCommand), AUDIO_QUEUE_SIZE);
+    for (int i = 0; i < AUDIO_WAVETABLE_SIZE; ++i) {
+        audio->wavetable[i] = (float)(sin(TWO_PI * i / AUDIO_WAVETABLE_SIZE) * AUDIO_VOLUME);
+    }
+
+    if (SDL_Init(SDL_INIT_AUDIO) < 0) {
+        printf("SDL2 audio could not be initialized. %s\n", SDL_GetError());
+        return -1;
+    }
+
+    // Set audio specifications
+    memset(&wanted, 0, sizeof(wanted));
+    wanted.freq = AUDIO_SAMPLE_RATE;
+    wanted.format = AUDIO_F32SYS;
+    wanted.channels = 1;
+    wanted.samples = AUDIO_BUFFER_SAMPLES;
+    wanted.callback = audioCallback;
+    wanted.userdata = audio;
+
+    // Open audio device, SDL converts if the hardware wants another format
+    audio->device = SDL_OpenAudioDevice(NULL, 0, &wanted, &audio->spec, 0);
+    if (audio->device == 0) {
+        printf("SDL2 audio device could not be opened for playback. %s\n", SDL_GetError());
+        return -1;
+    }
+    audio->beepStep = (uint32_t)(AUDIO_BEEP_FREQUENCY / audio->spec.freq * 4294967296.0);
+    audio->sent.pitch = AUDIO_DEFAULT_PITCH;
+    SDL_PauseAudioDevice(audio->device, 0);
+    return 0;
+}
+
+void closeAudio(struct AudioEngine *audio) {
+    if (audio->device == 0) return;
+    SDL_CloseAudioDevice(audio->device);
+    audio->device = 0;
+}
+
+// Send the sound state after a timer tick to the audio thread, only when it changed
+void updateAudio(struct AudioEngine *audio, const struct Chip8 *chip8, uint64_t tick) {
+    struct AudioCommand command;
+
+    if (audio->device == 0) return;
+
+    command.tick = tick;
+    command.on = chip8->sound_timer > 0;
+    command.usePattern = chip8->audioPatternLoaded;
+    command.pitch = chip8->pitch;
+    memcpy(command.pattern, chip8->audioPattern, sizeof(command.pattern));
+
+    if (command.on == audio->sent.on && command.usePattern == audio->sent.usePattern &&
+        command.pitch == audio->sent.pitch && memcmp(command.pattern, audio->sent.pattern, sizeof(command.pattern)) == 0) {
+        return;
+    }
+    if (!spscPush(&audio->commands, &command)) {
+        audio->dropped++;
+        return;
+    }
+    audio->sent = command;
+}
@@ -0,0 +1,57 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <SDL2/SDL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "core.h"
+#include "spsc.h"
+
+#define AUDIO_SAMPLE_RATE 44100
+#define AUDIO_BUFFER_SAMPLES 512
+#define AUDIO_TICK_RATE 60 // Timer ticks per second, commands start and stop on these boundaries
+#define AUDIO_LATENCY_TICKS 2 // Commands play this many ticks after they were sent, absorbs frame jitter
+#define AUDIO_MAX_DRIFT_TICKS 8 // Resync the tick clocks once a command is this far off
+#define AUDIO_QUEUE_SIZE 64 // Power of two
+#define AUDIO_WAVETABLE_SIZE 256
+#define AUDIO_BEEP_FREQUENCY 440.0
+#define AUDIO_VOLUME 0.25f
+
+// Sound state from the emulation thread, taking effect at the start of a timer tick
+struct AudioCommand {
+    uint64_t tick;
+    bool on; // sound_timer > 0
+    bool usePattern; // XO-CHIP pattern instead of the beep
+    uint8_t pitch;
+    uint8_t pattern[AUDIO_PATTERN_SIZE];
+};
+
+struct AudioEngine {
+    SDL_AudioDeviceID device;
+    SDL_AudioSpec spec;
+    struct SpscQueue commands;
+    struct AudioCommand commandStorage[AUDIO_QUEUE_SIZE];
+    float wavetable[AUDIO_WAVETABLE_SIZE]; // One cycle of the beep, scaled to AUDIO_VOLUME
+
+    // Emulation thread only
+    struct AudioCommand sent; // Last state pushed
+    uint64_t dropped; // Commands that found the queue full, retried next tick
+
+    // Audio callback only
+    struct AudioCommand playing;
+    uint64_t sample; // Samples rendered since the device started
+    int64_t tickOffset; // Maps a command tick onto the audio tick clock
+    bool synced;
+    uint32_t beepPhase; // Wavetable position, full cycle is 2^32
+    uint32_t beepStep;
+    uint32_t patternPhase; // Pattern position, full 128 samples is 2^32
+    uint32_t patternStep;
+    uint64_t lateCommands; // Commands that arrived after their tick had started
+};
+
+// Function prototypes
+int initAudio(struct AudioEngine *audio);
+void closeAudio(struct AudioEngine *audio);
+void updateAudio(struct AudioEngine *audio, const struct Chip8 *chip8, uint64_t tick);
+
+#endif // AUDIO_H
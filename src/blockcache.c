@@ -0,0 +1,394 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blockcache.h"
+#include "dispatch.h"
+#include "ops.h"
+
+// Attach an empty block cache, runFrame uses it from then on
+int enableBlockCache(struct Chip8 *chip8) {
+    if (chip8->blockCache) return 0;
+    chip8->blockCache = calloc(1, sizeof(struct BlockCache));
+    if (!chip8->blockCache) {
+        printf("Block cache could not be allocated.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Detach and free the block cache, the core goes back to plain dispatch
+void disableBlockCache(struct Chip8 *chip8) {
+    struct BlockCache *cache = chip8->blockCache;
+    if (!cache) return;
+    for (int i = 0; i < MEMORY_SIZE; ++i) {
+        free(cache->blocks[i]);
+    }
+    free(cache);
+    chip8->blockCache = NULL;
+}
+
+// Drop every block, keeping the allocations for reuse
+void flushBlockCache(struct BlockCache *cache) {
+    for (int i = 0; i < MEMORY_SIZE; ++i) {
+        if (cache->blocks[i]) cache->blocks[i]->valid = false;
+    }
+    memset(cache->covered, 0, sizeof(cache->covered));
+    cache->stats.flushes++;
+}
+
+static inline bool isCovered(const struct BlockCache *cache, uint16_t address) {
+    return (cache->covered[address >> 6] >> (address & 63)) & 1;
+}
+
+// Drop the blocks overlapping [address, address + length), which must not wrap
+static void invalidateRange(struct BlockCache *cache, int address, int length) {
+    bool hit = false;
+    for (int i = 0; i < length && !hit; ++i) {
+        hit = isCovered(cache, address + i);
+    }
+    if (!hit) return;
+
+    // Only blocks starting at most one block length before the write can reach it
+    int first = address - MAX_BLOCK_OPS * 2 + 1;
+    if (first < 0) first = 0;
+    for (int start = first; start < address + length; ++start) {
+        struct Block *block = cache->blocks[start];
+        if (block && block->valid && block->end > address) {
+            block->valid = false;
+            cache->stats.invalidations++;
+        }
+    }
+    // Covered bits are left set, at worst a later write scans a few empty slots
+}
+
+// Called for every guest write to memory
+void invalidateBlocks(struct BlockCache *cache, uint16_t address, int length) {
+    if (address + length > MEMORY_SIZE) {
+        invalidateRange(cache, address, MEMORY_SIZE - address);
+        invalidateRange(cache, 0, address + length - MEMORY_SIZE);
+    } else {
+        invalidateRange(cache, address, length);
+    }
+}
+
+double blockCacheHitRate(const struct BlockCache *cache) {
+    const uint64_t entries = cache->stats.hits + cache->stats.misses;
+    return entries ? (double)cache->stats.hits / entries : 0.0;
+}
+
+// Instructions that leave pc somewhere other than the next instruction, or that must be seen at a block boundary
+static inline bool endsBlock(enum OpClass cls) {
+    switch (cls) {
+        case OP_RET: case OP_EXIT: case OP_JP: case OP_CALL: case OP_SE_IMM: case OP_SNE_IMM:
+        case OP_SE_REG: case OP_SNE_REG: case OP_JP_V0: case OP_DRW: case OP_SKP: case OP_SKNP:
+        case OP_LD_KEY:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Decode the straight-line run starting at pc into the block slot for pc
+static struct Block *translateBlock(struct BlockCache *cache, const struct Chip8 *chip8, uint16_t pc) {
+    struct Block *block = cache->blocks[pc];
+    if (!block) {
+        block = malloc(sizeof(struct Block));
+        if (!block) return NULL;
+        cache->blocks[pc] = block;
+    }
+
+    block->start = pc;
+    block->count = 0;
+    uint16_t address = pc;
+    while (block->count < MAX_BLOCK_OPS && address <= MEMORY_SIZE - 2) {
+        const uint16_t opcode = chip8->memory[address] << 8 | chip8->memory[address + 1];
+        struct MicroOp *op = &block->ops[block->count++];
+        op->opcode = opcode;
+        op->cls = (uint8_t)classifyOpcode(opcode);
+        op->x = (opcode & 0x0F00) >> 8;
+        op->y = (opcode & 0x00F0) >> 4;
+        op->nn = opcode & 0x00FF;
+        op->nnn = opcode & 0x0FFF;
+        address += 2;
+        if (endsBlock(op->cls)) break;
+    }
+    block->end = address;
+    block->valid = true;
+
+    for (int i = pc; i < address; ++i) {
+        cache->covered[i >> 6] |= 1ULL << (i & 63);
+    }
+    return block;
+}
+
+// Translate the block at pc ahead of time, for block starts known from static analysis.
+// Returns the address the block ends at, or -1 on failure
+int prewarmBlock(struct Chip8 *chip8, uint16_t pc) {
+    struct BlockCache *cache = chip8->blockCache;
+    if (!cache || pc > MEMORY_SIZE - 2) return -1;
+    const struct Block *block = cache->blocks[pc];
+    if (!block || !block->valid) block = translateBlock(cache, chip8, pc);
+    return block ? block->end : -1;
+}
+
+#ifndef CHIP8_HAVE_COMPUTED_GOTO
+// Block terminators see pc past themselves, exactly like the interpreter, and always end the block
+#define TERMINATE(statement) \
+    chip8->pc = block->start + 2 * (i + 1); \
+    chip8->opcode = op->opcode; \
+    statement; \
+    return i + 1
+
+// Execute up to limit ops of a block. Returns the number executed and leaves pc/opcode as the interpreter would
+static inline int runBlock(struct Chip8 *chip8, const struct Block *block, int limit) {
+    int i;
+    for (i = 0; i < limit; ++i) {
+        const struct MicroOp *op = &block->ops[i];
+
+        switch (op->cls) {
+            // Straight-line ops never look at pc
+            case OP_LD_IMM: loadImm(chip8, op->x, op->nn); break;
+            case OP_ADD_IMM: addImm(chip8, op->x, op->nn); break;
+            case OP_LD_REG: loadReg(chip8, op->x, op->y); break;
+            case OP_OR: orReg(chip8, op->x, op->y); break;
+            case OP_AND: andReg(chip8, op->x, op->y); break;
+            case OP_XOR: xorReg(chip8, op->x, op->y); break;
+            case OP_ADD_REG: addReg(chip8, op->x, op->y); break;
+            case OP_SUB: subReg(chip8, op->x, op->y); break;
+            case OP_SHR: shiftRight(chip8, op->x, op->y); break;
+            case OP_SUBN: subNReg(chip8, op->x, op->y); break;
+            case OP_SHL: shiftLeft(chip8, op->x, op->y); break;
+            case OP_LD_I: chip8->I = op->nnn; break;
+            case OP_ADD_I: addI(chip8, op->x); break;
+            case OP_LD_F: loadFont(chip8, op->x); break;
+            case OP_LD_VX_DT: loadDelay(chip8, op->x); break;
+            case OP_LD_DT: setDelay(chip8, op->x); break;
+            case OP_LD_ST: setSound(chip8, op->x); break;
+            case OP_LOAD: opLoad(chip8, op->opcode); break;
+            case OP_AUDIO: opAudio(chip8, op->opcode); break;
+            case OP_PITCH: opPitch(chip8, op->opcode); break;
+            case OP_RND: opRandom(chip8, op->opcode); break;
+            case OP_CLS: opClearScreen(chip8, op->opcode); break;
+            case OP_SCROLL_DOWN: opScrollDown(chip8, op->opcode); break;
+            case OP_SCROLL_UP: opScrollUp(chip8, op->opcode); break;
+            case OP_SCROLL_RIGHT: opScrollRight(chip8, op->opcode); break;
+            case OP_SCROLL_LEFT: opScrollLeft(chip8, op->opcode); break;
+            case OP_SCROLL_DOWN_6: opScrollDown6(chip8, op->opcode); break;
+            case OP_SCROLL_DOWN_12: opScrollDown12(chip8, op->opcode); break;
+            case OP_COMPAT: opCompat(chip8, op->opcode); break;
+            case OP_LOW_RES: opLowRes(chip8, op->opcode); break;
+            case OP_HIGH_RES: opHighRes(chip8, op->opcode); break;
+            case OP_UNKNOWN: opUnknown(chip8, op->opcode); break;
+
+            // Writes may land inside this very block, stop as soon as it is invalidated
+            case OP_BCD:
+                opBcd(chip8, op->opcode);
+                if (!block->valid) { TERMINATE((void)0); }
+                break;
+            case OP_STORE:
+                opStore(chip8, op->opcode);
+                if (!block->valid) { TERMINATE((void)0); }
+                break;
+
+            case OP_JP: TERMINATE(chip8->pc = op->nnn);
+            case OP_SE_IMM: TERMINATE(skipEqualImm(chip8, op->x, op->nn));
+            case OP_SNE_IMM: TERMINATE(skipNotEqualImm(chip8, op->x, op->nn));
+            case OP_SE_REG: TERMINATE(skipEqualReg(chip8, op->x, op->y));
+            case OP_SNE_REG: TERMINATE(skipNotEqualReg(chip8, op->x, op->y));
+            case OP_CALL: TERMINATE(opCall(chip8, op->opcode));
+            case OP_RET: TERMINATE(opReturn(chip8, op->opcode));
+            case OP_JP_V0: TERMINATE(opJumpV0(chip8, op->opcode));
+            case OP_DRW: TERMINATE(opDraw(chip8, op->opcode));
+            case OP_SKP: TERMINATE(opSkipKey(chip8, op->opcode));
+            case OP_SKNP: TERMINATE(opSkipNotKey(chip8, op->opcode));
+            case OP_LD_KEY: TERMINATE(opWaitKey(chip8, op->opcode));
+            case OP_EXIT: TERMINATE(opExit(chip8, op->opcode));
+            default: break;
+        }
+    }
+
+    chip8->pc = block->start + 2 * i;
+    chip8->opcode = block->ops[i - 1].opcode;
+    return i;
+}
+
+#undef TERMINATE
+#endif
+
+// Look up or translate the block at pc. Returns NULL when pc has to go through the interpreter
+static inline struct Block *enterBlock(struct BlockCache *cache, const struct Chip8 *chip8, uint16_t pc) {
+    // Fetches that wrap around the end of memory take the interpreter path
+    if (pc > MEMORY_SIZE - 2) return NULL;
+
+    struct Block *block = cache->blocks[pc];
+    if (block && block->valid) {
+        cache->stats.hits++;
+        return block;
+    }
+    cache->stats.misses++;
+    return translateBlock(cache, chip8, pc);
+}
+
+#ifdef CHIP8_HAVE_COMPUTED_GOTO
+// Threaded block runner: each micro-op jumps straight to the next one, and terminators straight to the next block
+uint64_t executeBlocks(struct Chip8 *chip8, int count) {
+    static void *const labels[OP_COUNT] = {
+        [OP_CLS] = &&op_CLS, [OP_RET] = &&op_RET, [OP_SCROLL_DOWN] = &&op_SCROLL_DOWN,
+        [OP_SCROLL_UP] = &&op_SCROLL_UP, [OP_SCROLL_RIGHT] = &&op_SCROLL_RIGHT, [OP_SCROLL_LEFT] = &&op_SCROLL_LEFT,
+        [OP_SCROLL_DOWN_6] = &&op_SCROLL_DOWN_6, [OP_SCROLL_DOWN_12] = &&op_SCROLL_DOWN_12, [OP_COMPAT] = &&op_COMPAT,
+        [OP_LOW_RES] = &&op_LOW_RES, [OP_HIGH_RES] = &&op_HIGH_RES, [OP_EXIT] = &&op_EXIT, [OP_JP] = &&op_JP,
+        [OP_CALL] = &&op_CALL, [OP_SE_IMM] = &&op_SE_IMM, [OP_SNE_IMM] = &&op_SNE_IMM, [OP_SE_REG] = &&op_SE_REG,
+        [OP_LD_IMM] = &&op_LD_IMM, [OP_ADD_IMM] = &&op_ADD_IMM, [OP_LD_REG] = &&op_LD_REG, [OP_OR] = &&op_OR,
+        [OP_AND] = &&op_AND, [OP_XOR] = &&op_XOR, [OP_ADD_REG] = &&op_ADD_REG, [OP_SUB] = &&op_SUB,
+        [OP_SHR] = &&op_SHR, [OP_SUBN] = &&op_SUBN, [OP_SHL] = &&op_SHL, [OP_SNE_REG] = &&op_SNE_REG,
+        [OP_LD_I] = &&op_LD_I, [OP_JP_V0] = &&op_JP_V0, [OP_RND] = &&op_RND, [OP_DRW] = &&op_DRW,
+        [OP_SKP] = &&op_SKP, [OP_SKNP] = &&op_SKNP, [OP_LD_VX_DT] = &&op_LD_VX_DT, [OP_LD_KEY] = &&op_LD_KEY,
+        [OP_LD_DT] = &&op_LD_DT, [OP_LD_ST] = &&op_LD_ST, [OP_ADD_I] = &&op_ADD_I, [OP_LD_F] = &&op_LD_F,
+        [OP_BCD] = &&op_BCD, [OP_STORE] = &&op_STORE, [OP_LOAD] = &&op_LOAD, [OP_AUDIO] = &&op_AUDIO,
+        [OP_PITCH] = &&op_PITCH, [OP_UNKNOWN] = &&op_UNKNOWN,
+    };
+    struct BlockCache *cache = chip8->blockCache;
+    const struct Block *block;
+    const struct MicroOp *op;
+    uint64_t executed = 0;
+    int i, limit;
+
+    if (chip8->speed <= 0 || !chip8->running) return 0;
+
+// Continue with the next op, or leave the block once the budget for it is used up
+#define NEXT() \
+    do { \
+        if (++i >= limit) goto blockDone; \
+        op = &block->ops[i]; \
+        goto *labels[op->cls]; \
+    } while (0)
+// Terminators see pc past themselves, exactly like the interpreter
+#define TERMINATE(statement) \
+    do { \
+        chip8->pc = block->start + 2 * (i + 1); \
+        chip8->opcode = op->opcode; \
+        statement; \
+        executed += i + 1; \
+        cache->stats.instructions += i + 1; \
+        goto nextBlock; \
+    } while (0)
+
+nextBlock:
+    while ((int)executed < count) {
+        block = enterBlock(cache, chip8, chip8->pc);
+        if (block) {
+            limit = block->count;
+            if (limit > count - (int)executed) limit = count - (int)executed;
+            i = 0;
+            op = block->ops;
+            goto *labels[op->cls];
+        }
+        emulateCycle(chip8);
+        ++executed;
+        if (chip8->speed <= 0 || !chip8->running) break;
+    }
+    return executed;
+
+op_LD_IMM: loadImm(chip8, op->x, op->nn); NEXT();
+op_ADD_IMM: addImm(chip8, op->x, op->nn); NEXT();
+op_LD_REG: loadReg(chip8, op->x, op->y); NEXT();
+op_OR: orReg(chip8, op->x, op->y); NEXT();
+op_AND: andReg(chip8, op->x, op->y); NEXT();
+op_XOR: xorReg(chip8, op->x, op->y); NEXT();
+op_ADD_REG: addReg(chip8, op->x, op->y); NEXT();
+op_SUB: subReg(chip8, op->x, op->y); NEXT();
+op_SHR: shiftRight(chip8, op->x, op->y); NEXT();
+op_SUBN: subNReg(chip8, op->x, op->y); NEXT();
+op_SHL: shiftLeft(chip8, op->x, op->y); NEXT();
+op_LD_I: chip8->I = op->nnn; NEXT();
+op_ADD_I: addI(chip8, op->x); NEXT();
+op_LD_F: loadFont(chip8, op->x); NEXT();
+op_LD_VX_DT: loadDelay(chip8, op->x); NEXT();
+op_LD_DT: setDelay(chip8, op->x); NEXT();
+op_LD_ST: setSound(chip8, op->x); NEXT();
+op_LOAD: opLoad(chip8, op->opcode); NEXT();
+op_AUDIO: opAudio(chip8, op->opcode); NEXT();
+op_PITCH: opPitch(chip8, op->opcode); NEXT();
+op_RND: opRandom(chip8, op->opcode); NEXT();
+op_CLS: opClearScreen(chip8, op->opcode); NEXT();
+op_SCROLL_DOWN: opScrollDown(chip8, op->opcode); NEXT();
+op_SCROLL_UP: opScrollUp(chip8, op->opcode); NEXT();
+op_SCROLL_RIGHT: opScrollRight(chip8, op->opcode); NEXT();
+op_SCROLL_LEFT: opScrollLeft(chip8, op->opcode); NEXT();
+op_SCROLL_DOWN_6: opScrollDown6(chip8, op->opcode); NEXT();
+op_SCROLL_DOWN_12: opScrollDown12(chip8, op->opcode); NEXT();
+op_COMPAT: opCompat(chip8, op->opcode); NEXT();
+op_LOW_RES: opLowRes(chip8, op->opcode); NEXT();
+op_HIGH_RES: opHighRes(chip8, op->opcode); NEXT();
+op_UNKNOWN: opUnknown(chip8, op->opcode); NEXT();
+
+// Writes may land inside this very block, stop as soon as it is invalidated
+op_BCD:
+    opBcd(chip8, op->opcode);
+    if (!block->valid) TERMINATE((void)0);
+    NEXT();
+op_STORE:
+    opStore(chip8, op->opcode);
+    if (!block->valid) TERMINATE((void)0);
+    NEXT();
+
+op_JP: TERMINATE(chip8->pc = op->nnn);
+op_SE_IMM: TERMINATE(skipEqualImm(chip8, op->x, op->nn));
+op_SNE_IMM: TERMINATE(skipNotEqualImm(chip8, op->x, op->nn));
+op_SE_REG: TERMINATE(skipEqualReg(chip8, op->x, op->y));
+op_SNE_REG: TERMINATE(skipNotEqualReg(chip8, op->x, op->y));
+op_CALL: TERMINATE(opCall(chip8, op->opcode));
+op_RET: TERMINATE(opReturn(chip8, op->opcode));
+op_JP_V0: TERMINATE(opJumpV0(chip8, op->opcode));
+op_DRW: TERMINATE(opDraw(chip8, op->opcode));
+op_SKP: TERMINATE(opSkipKey(chip8, op->opcode));
+op_SKNP: TERMINATE(opSkipNotKey(chip8, op->opcode));
+
+// FX0A and 00FD end the run as well as the block
+op_LD_KEY:
+    chip8->pc = block->start + 2 * (i + 1);
+    chip8->opcode = op->opcode;
+    opWaitKey(chip8, op->opcode);
+    executed += i + 1;
+    cache->stats.instructions += i + 1;
+    return executed;
+op_EXIT:
+    chip8->pc = block->start + 2 * (i + 1);
+    chip8->opcode = op->opcode;
+    opExit(chip8, op->opcode);
+    executed += i + 1;
+    cache->stats.instructions += i + 1;
+    return executed;
+
+blockDone:
+    chip8->pc = block->start + 2 * i;
+    chip8->opcode = block->ops[i - 1].opcode;
+    executed += i;
+    cache->stats.instructions += i;
+    goto nextBlock;
+#undef NEXT
+#undef TERMINATE
+}
+#else
+// Run up to count instructions from cached blocks, stopping early on FX0A or 00FD
+uint64_t executeBlocks(struct Chip8 *chip8, int count) {
+    struct BlockCache *cache = chip8->blockCache;
+    uint64_t executed = 0;
+
+    while ((int)executed < count && chip8->speed > 0 && chip8->running) {
+        struct Block *block = enterBlock(cache, chip8, chip8->pc);
+        if (!block) {
+            emulateCycle(chip8);
+            ++executed;
+            continue;
+        }
+
+        int limit = block->count;
+        if (limit > count - (int)executed) limit = count - (int)executed;
+        const int ran = runBlock(chip8, block, limit);
+        executed += ran;
+        cache->stats.instructions += ran;
+    }
+    return executed;
+}
+#endif
@@ -0,0 +1,54 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "core.h"
+
+// Longest straight-line run translated into one block
+#define MAX_BLOCK_OPS 64
+
+// Instruction with its operands already extracted
+struct MicroOp {
+    uint16_t opcode;
+    uint16_t nnn;
+    uint8_t cls; // enum OpClass
+    uint8_t x;
+    uint8_t y;
+    uint8_t nn;
+};
+
+// Straight-line run of instructions starting at one pc. Blocks end after a jump, skip, call, return,
+// DXYN, FX0A or 00FD, whichever comes first
+struct Block {
+    uint16_t start;
+    uint16_t end; // First byte past the block
+    uint16_t count;
+    bool valid;
+    struct MicroOp ops[MAX_BLOCK_OPS];
+};
+
+struct BlockCacheStats {
+    uint64_t hits; // Block entries served from the cache
+    uint64_t misses; // Block entries that had to be translated
+    uint64_t invalidations; // Blocks dropped because memory under them was written
+    uint64_t flushes; // Whole-cache flushes (reset, ROM load)
+    uint64_t instructions; // Instructions executed from blocks
+};
+
+struct BlockCache {
+    struct Block *blocks[MEMORY_SIZE]; // Indexed by start address, allocated on first use
+    uint64_t covered[MEMORY_SIZE / 64]; // Bytes that lie inside at least one translated block
+    struct BlockCacheStats stats;
+};
+
+// Function prototypes
+int enableBlockCache(struct Chip8 *chip8);
+void disableBlockCache(struct Chip8 *chip8);
+void flushBlockCache(struct BlockCache *cache);
+void invalidateBlocks(struct BlockCache *cache, uint16_t address, int length);
+uint64_t executeBlocks(struct Chip8 *chip8, int count);
+int prewarmBlock(struct Chip8 *chip8, uint16_t pc);
+double blockCacheHitRate(const struct BlockCache *cache);
+
+#endif // BLOCKCACHE_H
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <string.h>
+#include "capture.h"
+
+// Encoder thread: write every frame in the ring, sleep a while, and drain the ring once more on stop
+static int encoderThread(void *data) {
+    struct Capture *capture = data;
+    struct VideoFrame frame;
+
+    for (;;) {
+        // Read before draining, so frames pushed before the stop request are still written
+        const bool stopping = atomic_load(&capture->stopping);
+        while (spscPop(&capture->ring, &frame)) {
+            if (capture->failed) continue;
+            const uint64_t start = SDL_GetPerformanceCounter();
+            if (writeVideoFrame(&capture->writer, &frame) != 0) {
+                printf("Writing error.\n");
+                capture->failed = true;
+            }
+            capture->encodeSeconds += (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+        }
+        if (stopping) break;
+        SDL_Delay(CAPTURE_POLL_MS);
+    }
+    return 0;
+}
+
+// Open the file, GIF or Y4M by its extension, and start the encoder thread
+int startCapture(struct Capture *capture, const char *path) {
+    const int format = parseVideoFormat(path);
+
+    memset(capture, 0, sizeof(*capture));
+    if (format < 0) {
+        printf("Unknown capture format: %s, use .gif or .y4m\n", path);
+        return -1;
+    }
+    if (openVideo(&capture->writer, path, (enum VideoFormat)format) != 0) return -1;
+    spscInit(&capture->ring, capture->ringStorage, sizeof(struct VideoFrame), CAPTURE_RING_SIZE);
+    atomic_init(&capture->stopping, false);
+    capture->thread = SDL_CreateThread(encoderThread, "capture", capture);
+    if (!capture->thread) {
+        printf("Capture thread could not be started. %s\n", SDL_GetError());
+        closeVideo(&capture->writer, 0);
+        return -1;
+    }
+    return 0;
+}
+
+// Called by the emulation thread after every frame. Only frames that changed the display are copied, the encoder
+// works out how long each one stayed up from the frame numbers
+void captureFrame(struct Capture *capture, const struct Chip8 *chip8, const uint32_t palette[2]) {
+    const uint64_t number = capture->frame++;
+
+    if (number == 0 || chip8->changedRows || palette[0] != capture->palette[0] || palette[1] != capture->palette[1]) {
+        capture->dirty = true;
+    }
+    if (!capture->dirty) return;
+
+    // Copied straight into the ring slot. A frame that finds the ring full is dropped, and the next frame is tried
+    // even if unchanged so the display still gets written once the encoder catches up
+    struct VideoFrame *slot = spscReserve(&capture->ring);
+    if (!slot) {
+        ++capture->dropped;
+        return;
+    }
+    slot->number = number;
+    slot->palette[0] = palette[0];
+    slot->palette[1] = palette[1];
+    slot->highRes = chip8->highRes;
+    memcpy(slot->gfx, chip8->gfx[0], sizeof(slot->gfx));
+    spscCommit(&capture->ring);
+    capture->palette[0] = palette[0];
+    capture->palette[1] = palette[1];
+    capture->dirty = false;
+    ++capture->captured;
+}
+
+// Called by the emulation thread for frames skipped while the guest was quiescent. They would not have changed
+// the display, so the frame shown stays up for them too and the capture keeps real time
+void captureIdleFrames(struct Capture *capture, uint64_t frames) {
+    capture->frame += frames;
+}
+
+// Let the encoder write what is left in the ring, then finish the file. Call once the emulation thread has stopped
+void stopCapture(struct Capture *capture) {
+    atomic_store(&capture->stopping, true);
+    SDL_WaitThread(capture->thread, NULL);
+    if (closeVideo(&capture->writer, capture->frame) != 0) capture->failed = true;
+    printf("Capture: %llu frames, %llu changed the display, %llu dropped with the encoder behind, %llu written, "
+           "%.1f us per frame encoding%s\n",
+           (unsigned long long)capture->frame, (unsigned long long)capture->captured,
+           (unsigned long long)capture->dropped, (unsigned long long)capture->writer.framesWritten,
+           capture->captured ? capture->encodeSeconds * 1e6 / capture->captured : 0.0,
+           capture->failed ? ", incomplete" : "");
+}
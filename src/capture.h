@@ -0,0 +1,43 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <SDL2/SDL.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "core.h"
+#include "spsc.h"
+#include "video.h"
+
+#define CAPTURE_RING_SIZE 64 // Frames waiting for the encoder thread, a power of two (about a second of changes)
+#define CAPTURE_POLL_MS 10 // The encoder thread checks the ring this often, well before CAPTURE_RING_SIZE frames pile up
+
+// Session capture for --capture. The emulation thread copies each frame that changed the display into a
+// preallocated ring and the encoder thread writes them out. When the ring is full the frame is dropped and counted.
+// The encoder polls the ring, so pushing a frame is a copy and an atomic store, never a wait or a system call
+struct Capture {
+    struct SpscQueue ring;
+    struct VideoFrame ringStorage[CAPTURE_RING_SIZE];
+    SDL_Thread *thread;
+    atomic_bool stopping;
+
+    // Emulation thread
+    uint64_t frame; // Emulated frames seen so far
+    bool dirty; // The display changed since the last frame that made it into the ring
+    uint32_t palette[2];
+    uint64_t captured; // Frames pushed into the ring
+    uint64_t dropped; // Frames that found the ring full
+
+    // Encoder thread
+    struct VideoWriter writer;
+    bool failed; // A write failed, the rest of the ring is drained without writing
+    double encodeSeconds;
+};
+
+// Function prototypes
+int startCapture(struct Capture *capture, const char *path);
+void captureFrame(struct Capture *capture, const struct Chip8 *chip8, const uint32_t palette[2]);
+void captureIdleFrames(struct Capture *capture, uint64_t frames);
+void stopCapture(struct Capture *capture);
+
+#endif // CAPTURE_H
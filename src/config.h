@@ -2,45 +2,104 @@
 #define CONFIG_H
 
 #include <SDL2/SDL.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include "core.h"
+#include "analysis.h"
+#include "audio.h"
+#include "capture.h"
 #include "colorp.h"
+#include "debugconsole.h"
+#include "movie.h"
+#include "netplay.h"
+#include "profiler.h"
+#include "render.h"
+#include "rompack.h"
+#include "scheduler.h"
+#include "spsc.h"
+#include "stream.h"
+#include "triplebuffer.h"
+#include "upscale.h"
 
-#define LOW_RES_WIDTH 64
-#define LOW_RES_HEIGHT 32
-#define HIGH_RES_WIDTH 128
-#define HIGH_RES_HEIGHT 64
-
-struct Chip8 {
-    unsigned short opcode;
-    unsigned char memory[4096];
-    unsigned char V[16];
-    unsigned short I;
-    unsigned short pc;
-    unsigned char gfx[HIGH_RES_WIDTH * HIGH_RES_HEIGHT];
-    unsigned char delay_timer;
-    unsigned char sound_timer;
-    unsigned short stack[16];
-    unsigned short sp;
-    unsigned char key[16];
-    uint16_t KP; // Previous key states
-    uint16_t KC; // Current key states
-    uint16_t IK; // Input keys
-    uint8_t keyReg; // Register index for FX0A instruction
-    uint8_t carry;
-    bool drawFlag;
-    bool compatMode;
-    bool highRes;
-    bool legacyMode;
-    bool xoChipMode;
-    bool waitingForKey;
-    bool keyReleased;
-    double IPC;
-    double cD;
-    uint8_t plane;
-
-    SDL_AudioSpec beepSpec;
-    SDL_AudioDeviceID beepDevice;
+#define DEFAULT_WINDOW_WIDTH 640
+#define DEFAULT_WINDOW_HEIGHT 320
+#define IDLE_WAIT_MS 500 // Longest block in the event queue while the guest waits on a key
+#define RENDER_WAIT_MS 100 // Longest block in the event queue on the render thread
+#define INPUT_QUEUE_SIZE 256 // Key events on their way to the emulation thread, a power of two
+
+// A completed frame as the emulation thread publishes it
+struct FrameSlot {
+    uint64_t sequence; // 1 for the first frame published, consecutive after that
+    uint64_t changedRows; // Rows changed since the previous published frame
+    uint32_t palette[2]; // Theme colours the frame is drawn in
+    uint64_t inputTime; // With --latency: arrival of the key press this frame is the first display change after
+    struct Display display; // Plane 0 and the resolution, all renderRows and upscaleRows read
+};
+
+// A key change on its way from the render thread to the emulation thread
+struct KeyInput {
+    uint64_t time; // Performance counter when the event arrived
+    uint8_t key;
+    bool pressed;
+};
+
+// Delays from a key press to its effect, in performance counter ticks
+struct LatencyStats {
+    uint64_t samples;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+};
+
+// SDL side of the emulator, kept out of the core so it can run headless. The emulation thread runs the machine and
+// publishes frames, the main thread handles events and presents, and the two only meet in frames, input and wake
+struct Frontend {
+    // Render thread
+    SDL_Texture *screen; // Streaming texture the display is uploaded to once per frame
+    int windowWidth;
+    int windowHeight;
+    bool redraw; // Upload and present the whole display on the next frame (start, window exposed or resized)
+    struct Upscaler upscaler; // Scaling filter applied to the display before upload, set with --filter or F2
+    uint64_t shownSequence; // Sequence of the frame in the texture
+    uint32_t shownPalette[2];
+    uint64_t presentedFrames;
+    struct LatencyStats presentLatency; // Key press to the present showing its first display change
+
+    // Emulation thread
+    struct AudioEngine audio;
+    uint64_t tick; // Audio ticks sent so far, stamps the audio commands
+    struct Scheduler scheduler;
+    bool realTime; // 1x speed, audio is updated every frame
+    uint64_t pendingRows; // Rows changed by the frames run since the last publish
+    uint64_t sequence; // Frames published so far
+    struct Movie movie; // Input recording, used with --record
+    bool recording;
     struct Theme theme; // Use Theme struct for colors
-} chip8;
+    bool measureLatency; // --latency
+    uint64_t latencyStart; // Arrival of a key press no display change has followed yet
+    uint64_t changeInputTime; // Arrival of the key press the next published frame answers
+    struct LatencyStats changeLatency; // Key press to the end of the frame that changed the display
+    struct Netplay netplay; // Rollback session with the other cabinet, used with --netplay
+    bool netplaying;
+    uint16_t netplayKeys; // Keys held on this side, netplay keeps the local player's half
+    struct StreamEncoder streamEncoder; // Display deltas for the subscribers of --stream
+    struct StreamServer stream;
+    bool streaming;
+    struct Capture capture; // Frames for the encoder thread of --capture
+    bool capturing;
+    struct DebugConsole debugConsole; // REPL of --debug, commands run here between frames
+    bool debugging;
+
+    // Shared
+    struct TripleBuffer frames; // Completed frames, emulation thread to render thread
+    struct FrameSlot frameSlots[3];
+    struct SpscQueue input; // Key changes, render thread to emulation thread
+    struct KeyInput inputStorage[INPUT_QUEUE_SIZE];
+    SDL_sem *wake; // Posted with every key event, the emulation thread sleeps on it while the guest idles
+    Uint32 frameEvent; // SDL user event pushed when a frame is published
+    atomic_bool framePosted; // A frame event is in the queue and not handled yet
+} frontend;
+
+struct Chip8 chip8;
 
-#endif // CONFIG_H
\ No newline at end of file
+#endif // CONFIG_H
@@ -0,0 +1,383 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blockcache.h"
+#include "core.h"
+#include "debugger.h"
+#include "jit.h"
+#include "profiler.h"
+
+// Initialize Chip8
+void initChip8(struct Chip8 *chip8) {
+    chip8->pc = 0x200;
+    chip8->opcode = 0;
+    chip8->I = 0;
+    chip8->sp = 0;
+    chip8->delay_timer = 0;
+    chip8->sound_timer = 0;
+    memset(chip8->memory, 0, 4096);
+    memset(chip8->V, 0, 16);
+    memset(chip8->gfx, 0, sizeof(chip8->gfx));
+    memset(chip8->stack, 0, 16 * sizeof(uint16_t)); // Assuming stack is of type uint16_t
+    chip8->waitingForKey = false;
+    chip8->compatMode = false;
+    chip8->highRes = false;
+    chip8->legacyMode = false;
+    chip8->xoChipMode = false;
+    chip8->IPC = instructionPerCycle;
+    chip8->cD = cycleDuration;
+    chip8->plane = 1;
+    memset(chip8->audioPattern, 0, sizeof(chip8->audioPattern));
+    chip8->pitch = AUDIO_DEFAULT_PITCH;
+    chip8->audioPatternLoaded = false;
+    chip8->drawFlag = false;
+    chip8->dirtyRows = 0;
+    chip8->changedRows = 0;
+    memset(chip8->shownRows, 0, sizeof(chip8->shownRows));
+    chip8->shownHighRes = false;
+    memset(&chip8->frameStats, 0, sizeof(chip8->frameStats));
+    chip8->running = true;
+    chip8->speed = (int)chip8->IPC;
+    chip8->interruptType = INTERRUPT_NONE;
+    chip8->idleState = IDLE_NONE;
+    seedRandom(chip8, RANDOM_DEFAULT_SEED);
+    memset(chip8->key, 0, 16);
+    chip8->KP = 0;
+    chip8->KC = 0;
+    chip8->IK = 0;
+    chip8->inputEventCount = 0;
+    chip8->appliedEventCount = 0;
+    initDispatch();
+    if (chip8->blockCache) flushBlockCache(chip8->blockCache);
+    if (chip8->jit) flushJit(chip8->jit);
+
+    unsigned char fontSet[80] = {
+        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+        0x20, 0x60, 0x20, 0x20, 0x70, // 1
+        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+        0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+    };
+
+    for (int i = 0; i < 80; ++i) {
+        chip8->memory[i] = fontSet[i];
+    }
+}
+
+// Seed the CXNN generator. xorshift has no zero state, so 0 maps to the default seed
+void seedRandom(struct Chip8 *chip8, uint32_t seed) {
+    chip8->randomState = seed ? seed : RANDOM_DEFAULT_SEED;
+}
+
+// 64-bit FNV-1a, start from HASH_SEED
+uint64_t hashBytes(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// Hash of what is on screen: both planes and the resolution
+uint64_t framebufferHash(const struct Chip8 *chip8) {
+    const uint8_t highRes = chip8->highRes;
+    uint64_t hash = hashBytes(HASH_SEED, &highRes, 1);
+    return hashBytes(hash, chip8->gfx, sizeof(chip8->gfx));
+}
+
+// Hash of the whole machine state a ROM can observe, for comparing runs
+uint64_t stateDigest(const struct Chip8 *chip8) {
+    const uint8_t flags[] = { chip8->delay_timer, chip8->sound_timer, chip8->compatMode, chip8->highRes, chip8->plane, chip8->running };
+    uint64_t hash = framebufferHash(chip8);
+    hash = hashBytes(hash, chip8->memory, sizeof(chip8->memory));
+    hash = hashBytes(hash, chip8->V, sizeof(chip8->V));
+    hash = hashBytes(hash, &chip8->I, sizeof(chip8->I));
+    hash = hashBytes(hash, &chip8->pc, sizeof(chip8->pc));
+    hash = hashBytes(hash, chip8->stack, sizeof(chip8->stack));
+    hash = hashBytes(hash, &chip8->sp, sizeof(chip8->sp));
+    hash = hashBytes(hash, flags, sizeof(flags));
+    return hashBytes(hash, &chip8->randomState, sizeof(chip8->randomState));
+}
+
+// Load ROM. The file is read in one go into a buffer the size of ROM space, one byte more means it does not fit
+int loadRom(struct Chip8 *chip8, const char *rom){
+    uint8_t buffer[MEMORY_SIZE - ROM_START];
+    FILE *file = fopen(rom, "rb");
+    if(!file) {
+        printf("File could not be opened: %s\n", rom);
+        return -1;
+    }
+
+    const size_t size = fread(buffer, 1, sizeof(buffer), file);
+    const bool failed = ferror(file) != 0;
+    const bool tooBig = !failed && fgetc(file) != EOF;
+    fclose(file);
+    if (failed) {
+        printf("Reading error.\n");
+        return -1;
+    }
+    if (tooBig) {
+        printf("ROM too big for memory.\n");
+        return -1;
+    }
+    return loadRomData(chip8, buffer, size);
+}
+
+// Copy a ROM image that is already in memory to 0x200
+int loadRomData(struct Chip8 *chip8, const uint8_t *data, size_t size) {
+    if(size >= MEMORY_SIZE - ROM_START) {
+        printf("ROM too big for memory.\n");
+        return -1;
+    }
+    memcpy(chip8->memory + ROM_START, data, size);
+    chip8->romSize = (uint16_t)size;
+    if (chip8->blockCache) invalidateBlocks(chip8->blockCache, ROM_START, (int)size);
+    if (chip8->jit) invalidateJit(chip8->jit, ROM_START, (int)size);
+    return 0;
+}
+
+// Update input values
+void updateInput(struct Chip8 *chip8) {
+    chip8->KP = chip8->KC;
+    chip8->KC = 0;
+
+    // Update KC based on current key states
+    for (int i = 0; i < 16; ++i) {
+        if (chip8->key[i]) {
+            chip8->KC |= (1 << i);
+        }
+    }
+
+    // Update IK to detect key releases
+    chip8->IK = chip8->KP & ~chip8->KC;
+}
+
+// Queue a key change for the next runFrame, applied just before the instruction at offset into the frame. Events
+// have to be queued in the order they happened. When the queue is full the change goes straight into key[], to be
+// latched at the end of the frame, and -1 is returned
+int queueKeyEvent(struct Chip8 *chip8, int key, bool pressed, int offset) {
+    if (chip8->appliedEventCount) chip8->appliedEventCount = 0;
+    if (chip8->inputEventCount == INPUT_MAX_EVENTS) {
+        chip8->key[key & 0xF] = pressed;
+        return -1;
+    }
+    // Never earlier than the event before it
+    if (offset < 0) offset = 0;
+    if (offset > UINT16_MAX) offset = UINT16_MAX;
+    if (chip8->inputEventCount > 0 && offset < chip8->inputEvents[chip8->inputEventCount - 1].offset) {
+        offset = chip8->inputEvents[chip8->inputEventCount - 1].offset;
+    }
+    struct InputEvent *event = &chip8->inputEvents[chip8->inputEventCount++];
+    event->offset = (uint16_t)offset;
+    event->key = (uint8_t)(key & 0xF);
+    event->pressed = pressed;
+    return 0;
+}
+
+// Apply a queued key change at once, so EX9E/EXA1 see it from the next instruction on
+static void applyKeyEvent(struct Chip8 *chip8, const struct InputEvent *event) {
+    const uint16_t bit = (uint16_t)(1 << event->key);
+    chip8->key[event->key] = event->pressed;
+    if (event->pressed) {
+        chip8->KC |= bit;
+        chip8->IK &= ~bit; // A fresh press, not the release seen at the end of the last frame
+    } else {
+        chip8->KC &= ~bit;
+    }
+}
+
+// Handle interrupts
+void handleInterrupts(struct Chip8 *chip8) {
+    if (chip8->interruptType == INTERRUPT_KEY) { // FX0A interrupt
+        uint16_t keyPresses = chip8->KC & ~chip8->IK;
+        if (keyPresses) {
+            chip8->V[chip8->keyReg] = log2(keyPresses & -keyPresses);
+            chip8->IK |= keyPresses;
+            chip8->interruptType = INTERRUPT_NONE; // Clear interrupt
+            chip8->speed = abs(chip8->speed); // Restore speed
+        }
+    }
+}
+
+// Set how many instructions run per 60 Hz frame. A pending FX0A keeps the core paused
+void setInstructionsPerFrame(struct Chip8 *chip8, int count) {
+    if (count < 1) count = 1;
+    chip8->IPC = count;
+    chip8->speed = chip8->speed < 0 || chip8->interruptType != INTERRUPT_NONE ? -count : count;
+}
+
+// Update timers
+void updateTimers(struct Chip8 *chip8) {
+    if (chip8->delay_timer > 0) {
+        --chip8->delay_timer;
+    }
+    // The frontend starts and stops the beep from sound_timer
+    if (chip8->sound_timer > 0) {
+        --chip8->sound_timer;
+    }
+}
+
+// Compare the rows written since the last call against the display as last shown, so a sprite that was drawn and
+// erased again does not count as a change. Sets changedRows and drawFlag and returns the number of rows changed.
+// Leaves frameStats alone, for display updates that are not frames, like a debugger step
+int updateShownRows(struct Chip8 *chip8) {
+    const int height = chip8->highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
+    const uint64_t allRows = height == 64 ? ~0ULL : (1ULL << height) - 1;
+    uint64_t changed = 0;
+    int changedCount = 0;
+
+    if (chip8->highRes != chip8->shownHighRes) {
+        // Resolution switch, every row has a new size
+        changed = allRows;
+        changedCount = height;
+        chip8->shownHighRes = chip8->highRes;
+        memcpy(chip8->shownRows, chip8->gfx[0], sizeof(chip8->shownRows));
+    } else {
+        const uint64_t dirty = chip8->dirtyRows & allRows;
+        for (int y = 0; y < height && dirty >> y; ++y) {
+            if ((dirty >> y & 1) && memcmp(chip8->shownRows[y], chip8->gfx[0][y], sizeof(chip8->shownRows[y])) != 0) {
+                memcpy(chip8->shownRows[y], chip8->gfx[0][y], sizeof(chip8->shownRows[y]));
+                changed |= 1ULL << y;
+                ++changedCount;
+            }
+        }
+    }
+
+    chip8->dirtyRows = 0;
+    chip8->changedRows = changed;
+    chip8->drawFlag = changed != 0;
+    return changedCount;
+}
+
+// updateShownRows at the end of a frame, counted in frameStats
+void trackFrameChanges(struct Chip8 *chip8) {
+    const int changedCount = updateShownRows(chip8);
+    chip8->frameStats.frames++;
+    if (chip8->changedRows) {
+        chip8->frameStats.changedFrames++;
+        chip8->frameStats.changedRows += changedCount;
+    }
+}
+
+static uint16_t readWord(const struct Chip8 *chip8, int address) {
+    return chip8->memory[address & 0xFFF] << 8 | chip8->memory[(address + 1) & 0xFFF];
+}
+
+// Start of a delay timer busy wait (FX07, 3X00, 1NNN back to the FX07) that pc is inside of, or -1
+static int delayLoopStart(const struct Chip8 *chip8) {
+    for (int phase = 0; phase < 3 && chip8->pc >= 2 * phase; ++phase) {
+        const int start = chip8->pc - 2 * phase;
+        const uint16_t load = readWord(chip8, start);
+        const uint16_t skip = readWord(chip8, start + 2);
+        if ((load & 0xF0FF) == 0xF007 && (skip & 0xF0FF) == 0x3000 && (load & 0x0F00) == (skip & 0x0F00) &&
+            readWord(chip8, start + 4) == (0x1000 | start)) {
+            return start;
+        }
+    }
+    return -1;
+}
+
+// When the guest is idling, play the frame's whole instruction budget out arithmetically. The delay timer only
+// changes between frames, so a busy wait that is still running at the start of a frame runs for all of it.
+// The machine ends exactly where the interpreter would have left it. Returns the instructions accounted for
+static uint64_t skipIdleLoop(struct Chip8 *chip8, int budget) {
+    if (budget <= 0 || !chip8->running || chip8->pc >= MEMORY_SIZE) return 0;
+
+    const uint16_t opcode = readWord(chip8, chip8->pc);
+    if (opcode == (0x1000 | chip8->pc)) {
+        chip8->opcode = opcode;
+        chip8->idleState = IDLE_HALTED;
+        return budget;
+    }
+    if (chip8->delay_timer == 0) return 0;
+
+    const int start = delayLoopStart(chip8);
+    if (start < 0) return 0;
+    const int phase = (chip8->pc - start) / 2;
+    const int x = (readWord(chip8, start) & 0x0F00) >> 8;
+    if (phase == 1 && chip8->V[x] == 0) return 0; // About to leave the loop
+
+    // FX07 runs at least once unless the whole budget ends before getting back to it
+    if (phase == 0 || budget > 3 - phase) chip8->V[x] = chip8->delay_timer;
+    chip8->opcode = readWord(chip8, start + 2 * ((phase + budget - 1) % 3));
+    chip8->pc = start + 2 * ((phase + budget) % 3);
+    chip8->idleState = IDLE_DELAY_LOOP;
+    return budget;
+}
+
+// True when running more frames cannot change anything until a key is pressed: the guest is halted or waiting
+// in FX0A and both timers have run out. Frontends can block on input instead of running frames
+bool isQuiescent(const struct Chip8 *chip8) {
+    return (chip8->idleState == IDLE_HALTED || chip8->idleState == IDLE_KEY_WAIT) && chip8->delay_timer == 0 &&
+           chip8->sound_timer == 0 && chip8->running;
+}
+
+// Emulate up to count instructions. Idle loops are skipped, except under the profiler, which wants to see every
+// instruction, and under an active debugger, which has to see every breakpoint
+static uint64_t executeInstructions(struct Chip8 *chip8, int count) {
+    uint64_t executed;
+    if (chip8->profiler) return executeProfiled(chip8, count);
+#ifdef CHIP8_DEBUGGER
+    if (chip8->debugger && debuggerActive(chip8->debugger)) return executeDebugged(chip8, count);
+#endif
+    if ((executed = skipIdleLoop(chip8, count)) != 0) return executed;
+    if (chip8->jit) return executeJit(chip8, count);
+    if (chip8->blockCache) return executeBlocks(chip8, count);
+    return executeCycles(chip8, count);
+}
+
+// Run one 60 Hz frame: tick timers, execute the frame's instructions with queued key events applied at their
+// offsets, then latch input and service interrupts. Returns the number of instructions executed.
+uint64_t runFrame(struct Chip8 *chip8) {
+    uint64_t executed = 0;
+
+    // Decrement timers
+    updateTimers(chip8);
+
+    // Emulate instructions, a negative speed means the core is waiting on an interrupt. The frame is split at each
+    // queued key event
+    chip8->idleState = IDLE_NONE;
+    const int budget = chip8->speed;
+    for (int i = 0; i < chip8->inputEventCount; ++i) {
+        const int until = chip8->inputEvents[i].offset < budget ? chip8->inputEvents[i].offset : budget;
+        if (chip8->speed > 0 && until > (int)executed) executed += executeInstructions(chip8, until - (int)executed);
+        applyKeyEvent(chip8, &chip8->inputEvents[i]);
+    }
+    if (chip8->speed > 0 && budget > (int)executed) executed += executeInstructions(chip8, budget - (int)executed);
+    chip8->appliedEventCount = chip8->inputEventCount;
+    chip8->inputEventCount = 0;
+
+    // Update input values
+    updateInput(chip8);
+
+    // Handle interrupts
+    handleInterrupts(chip8);
+    if (chip8->interruptType == INTERRUPT_KEY) chip8->idleState = IDLE_KEY_WAIT;
+
+    // Work out what the frontend has to redraw
+    trackFrameChanges(chip8);
+    return executed;
+}
+
+// Run up to N frames back to back with no frame pacing, stopping early if the ROM exits.
+// Returns the number of instructions executed.
+uint64_t runFrames(struct Chip8 *chip8, int frames) {
+    uint64_t executed = 0;
+    for (int frame = 0; frame < frames && chip8->running; ++frame) {
+        executed += runFrame(chip8);
+    }
+    return executed;
+}
@@ -0,0 +1,150 @@
+#ifndef CORE_H
+#define CORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOW_RES_WIDTH 64
+#define LOW_RES_HEIGHT 32
+#define HIGH_RES_WIDTH 128
+#define HIGH_RES_HEIGHT 64
+
+#define MEMORY_SIZE 4096
+#define ROM_START 0x200
+
+// User-defined types
+#define instructionPerCycle 8
+#define cycleDuration 16
+
+// Interrupt types raised by the core
+#define INTERRUPT_NONE -1
+#define INTERRUPT_KEY 2 // FX0A is waiting for a key press
+
+#define HASH_SEED 0xCBF29CE484222325ULL // FNV-1a offset basis, the starting value for hashBytes
+// Why the last frame did no useful work, set by runFrame
+#define IDLE_NONE 0
+#define IDLE_DELAY_LOOP 1 // Spinning on the delay timer (FX07, 3X00, 1NNN back), skipped to the next tick
+#define IDLE_HALTED 2 // Jump to self, only the timers still change
+#define IDLE_KEY_WAIT 3 // FX0A is waiting for a key
+
+#define INPUT_MAX_EVENTS 32 // Key events queued for one frame
+
+#define RANDOM_DEFAULT_SEED 0x2545F491u // Used by initChip8, so runs are reproducible unless the seed is changed
+
+// XO-CHIP audio
+#define AUDIO_PATTERN_SIZE 16 // Bytes in the pattern buffer, one bit per sample
+#define AUDIO_DEFAULT_PITCH 64 // Plays the pattern at 4000 samples per second
+
+struct BlockCache;
+struct Debugger;
+struct Jit;
+struct Profiler;
+
+// A key change applied partway through a frame, just before the instruction at offset. Lets a frontend apply input at
+// the point in the frame it arrived instead of latching it at the end
+struct InputEvent {
+    uint16_t offset; // Instructions into the frame
+    uint8_t key;
+    uint8_t pressed;
+};
+
+// Display change counters, updated once per runFrame
+struct FrameStats {
+    uint64_t frames;
+    uint64_t changedFrames; // Frames where at least one row differs from the frame before
+    uint64_t changedRows; // Sum of changed rows over all frames
+};
+
+// Emulator core state. Nothing in here depends on SDL, so any number of
+// instances can run side by side in the same process. A struct Chip8 must
+// start zeroed (static, calloc or = {0}) before the first initChip8.
+struct Chip8 {
+    unsigned short opcode;
+    unsigned char memory[MEMORY_SIZE];
+    unsigned char V[16];
+    unsigned short I;
+    unsigned short pc;
+    uint16_t romSize; // Bytes placed at ROM_START by the last loadRom/loadRomData
+    uint64_t gfx[2][HIGH_RES_HEIGHT][HIGH_RES_WIDTH / 64]; // Packed rows per plane, leftmost pixel in the top bit
+    unsigned char delay_timer;
+    unsigned char sound_timer;
+    unsigned short stack[16];
+    unsigned short sp;
+    unsigned char key[16];
+    uint16_t KP; // Previous key states
+    uint16_t KC; // Current key states
+    uint16_t IK; // Input keys
+    struct InputEvent inputEvents[INPUT_MAX_EVENTS]; // Queued for the next runFrame, afterwards the ones it applied
+    int inputEventCount; // Events queued for the next runFrame
+    int appliedEventCount; // Events the last runFrame applied, valid until the next queueKeyEvent
+    uint8_t keyReg; // Register index for FX0A instruction
+    uint8_t carry;
+    bool drawFlag; // The last runFrame changed the display
+    bool compatMode;
+    bool highRes;
+    bool legacyMode;
+    bool xoChipMode;
+    bool waitingForKey;
+    bool keyReleased;
+    bool running; // Cleared by 00FD
+    double IPC; // Instructions per frame, see setInstructionsPerFrame
+    double cD;
+    uint8_t plane;
+    uint8_t audioPattern[AUDIO_PATTERN_SIZE]; // Set by F002
+    uint8_t pitch; // Set by FX3A
+    bool audioPatternLoaded; // F002 ran, play the pattern instead of the plain beep
+    int speed; // Instructions per frame, negative while an interrupt is pending
+    int interruptType; // INTERRUPT_NONE when no interrupt is pending
+    int idleState; // IDLE_* for the last frame
+    uint32_t randomState; // CXNN generator, per instance so machines on different threads stay independent
+    uint64_t dirtyRows; // Rows of plane 0 written since the last frame, bit N is row N
+    uint64_t changedRows; // Rows that differ from the previous frame, set by runFrame
+    uint64_t shownRows[HIGH_RES_HEIGHT][HIGH_RES_WIDTH / 64]; // Plane 0 as of the previous frame
+    bool shownHighRes;
+    struct FrameStats frameStats;
+
+    struct BlockCache *blockCache; // Optional, see blockcache.h
+    struct Jit *jit; // Optional, see jit.h
+    struct Profiler *profiler; // Optional, see profiler.h
+    struct Debugger *debugger; // Optional, see debugger.h, only attached in builds with CHIP8_DEBUGGER
+};
+
+// Read one pixel from the packed display
+static inline bool getPixel(const struct Chip8 *chip8, int plane, int x, int y) {
+    return (chip8->gfx[plane][y][x >> 6] >> (63 - (x & 63))) & 1;
+}
+
+// xorshift32 step for CXNN
+static inline uint32_t nextRandom(struct Chip8 *chip8) {
+    uint32_t x = chip8->randomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    chip8->randomState = x;
+    return x;
+}
+
+// Function prototypes
+void initChip8(struct Chip8 *chip8);
+void seedRandom(struct Chip8 *chip8, uint32_t seed);
+uint64_t hashBytes(uint64_t hash, const void *data, size_t size);
+uint64_t framebufferHash(const struct Chip8 *chip8);
+uint64_t stateDigest(const struct Chip8 *chip8);
+int loadRom(struct Chip8 *chip8, const char *rom);
+int loadRomData(struct Chip8 *chip8, const uint8_t *data, size_t size);
+void initDispatch(void);
+void emulateCycle(struct Chip8 *chip8);
+uint64_t executeCycles(struct Chip8 *chip8, int count);
+void updateInput(struct Chip8 *chip8);
+int queueKeyEvent(struct Chip8 *chip8, int key, bool pressed, int offset);
+void handleInterrupts(struct Chip8 *chip8);
+void setInstructionsPerFrame(struct Chip8 *chip8, int count);
+void updateTimers(struct Chip8 *chip8);
+int updateShownRows(struct Chip8 *chip8);
+void trackFrameChanges(struct Chip8 *chip8);
+uint64_t runFrame(struct Chip8 *chip8);
+bool isQuiescent(const struct Chip8 *chip8);
+uint64_t runFrames(struct Chip8 *chip8, int frames);
+
+#endif // CORE_H
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <string.h>
+#include "debugconsole.h"
+
+#if defined(CHIP8_DEBUGGER) && (defined(__unix__) || defined(__APPLE__))
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define DEBUG_PROMPT "(chip8) "
+
+static void sendText(int fd, const char *text) {
+    size_t left = strlen(text);
+    while (left > 0) {
+        const ssize_t sent = write(fd, text, left);
+        if (sent <= 0) return;
+        text += sent;
+        left -= (size_t)sent;
+    }
+}
+
+static void closeClient(struct DebugConsole *console, int index) {
+    close(console->clients[index].fd);
+    console->clients[index] = console->clients[--console->clientCount];
+}
+
+// Hand one command line to the emulation thread
+static void queueCommand(struct DebugConsole *console, int source, const char *line) {
+    struct DebugLine *command = spscReserve(&console->commands);
+    if (!command) {
+        sendText(source == DEBUG_CONSOLE ? STDOUT_FILENO : source, "Busy, try again\n");
+        return;
+    }
+    command->source = source;
+    snprintf(command->text, sizeof(command->text), "%s", line);
+    spscCommit(&console->commands);
+    SDL_SemPost(console->wake);
+}
+
+// Read what is waiting on an input and queue every complete line. Returns -1 at end of file
+static int readInput(struct DebugConsole *console, struct DebugInput *input, int source) {
+    const ssize_t got = read(input->fd, input->line + input->length, sizeof(input->line) - 1 - (size_t)input->length);
+    if (got <= 0) return -1;
+    input->length += (int)got;
+    input->line[input->length] = '\0';
+
+    char *start = input->line, *end;
+    while ((end = strchr(start, '\n')) != NULL) {
+        *end = '\0';
+        if (end > start && end[-1] == '\r') end[-1] = '\0';
+        queueCommand(console, source, start);
+        start = end + 1;
+    }
+    input->length -= (int)(start - input->line);
+    memmove(input->line, start, (size_t)input->length);
+    // A line too long for the buffer is dropped
+    if (input->length == (int)sizeof(input->line) - 1) input->length = 0;
+    return 0;
+}
+
+// Deliver the emulation thread's replies. A client that has gone away loses its replies
+static void deliverReplies(struct DebugConsole *console) {
+    struct DebugLine reply;
+
+    while (spscPop(&console->replies, &reply)) {
+        if (reply.source == DEBUG_CONSOLE || reply.source == DEBUG_BROADCAST) {
+            if (reply.source == DEBUG_BROADCAST) fputs("\n", stdout);
+            fputs(reply.text, stdout);
+            if (console->consoleOpen) fputs(DEBUG_PROMPT, stdout);
+            fflush(stdout);
+        }
+        for (int i = 0; i < console->clientCount; ++i) {
+            if (reply.source == DEBUG_BROADCAST || reply.source == console->clients[i].fd) {
+                sendText(console->clients[i].fd, reply.text);
+            }
+        }
+    }
+}
+
+// Console thread: wait on stdin, the listener and the clients, queue commands, deliver replies
+static int consoleThread(void *data) {
+    struct DebugConsole *console = data;
+    struct pollfd fds[2 + DEBUG_MAX_CLIENTS];
+
+    if (console->consoleOpen) {
+        fputs("Debugger ready, type help for the commands\n" DEBUG_PROMPT, stdout);
+        fflush(stdout);
+    }
+    while (!atomic_load(&console->stopping)) {
+        int count = 0;
+        fds[count++] = (struct pollfd){ .fd = console->consoleOpen ? STDIN_FILENO : -1, .events = POLLIN };
+        fds[count++] = (struct pollfd){ .fd = console->listener, .events = POLLIN };
+        for (int i = 0; i < console->clientCount; ++i) {
+            fds[count++] = (struct pollfd){ .fd = console->clients[i].fd, .events = POLLIN };
+        }
+        const int ready = poll(fds, (nfds_t)count, DEBUG_POLL_MS);
+
+        if (ready > 0) {
+            if (fds[0].revents && readInput(console, &console->console, DEBUG_CONSOLE) != 0) console->consoleOpen = false;
+            // Clients are checked from the back, so closing one does not move any not checked yet
+            for (int i = console->clientCount - 1; i >= 0; --i) {
+                if (fds[2 + i].revents && readInput(console, &console->clients[i], console->clients[i].fd) != 0) {
+                    closeClient(console, i);
+                }
+            }
+            if (fds[1].revents) {
+                const int fd = accept(console->listener, NULL, NULL);
+                if (fd >= 0 && console->clientCount == DEBUG_MAX_CLIENTS) {
+                    sendText(fd, "Too many debugger clients\n");
+                    close(fd);
+                } else if (fd >= 0) {
+                    console->clients[console->clientCount++] = (struct DebugInput){ .fd = fd };
+                    sendText(fd, "Debugger ready, type help for the commands\n");
+                }
+            }
+        }
+        deliverReplies(console);
+    }
+    return 0;
+}
+
+int startDebugConsole(struct DebugConsole *console, const char *socketPath, SDL_sem *wake) {
+    memset(console, 0, sizeof(*console));
+    console->wake = wake;
+    console->listener = -1;
+    console->console.fd = STDIN_FILENO;
+    console->consoleOpen = true;
+    atomic_init(&console->stopping, false);
+    spscInit(&console->commands, console->commandStorage, sizeof(struct DebugLine), DEBUG_QUEUE_SIZE);
+    spscInit(&console->replies, console->replyStorage, sizeof(struct DebugLine), DEBUG_QUEUE_SIZE);
+
+    if (socketPath) {
+        struct sockaddr_un local = { 0 };
+        local.sun_family = AF_UNIX;
+        if (strlen(socketPath) >= sizeof(local.sun_path)) {
+            printf("Socket path is too long: %s\n", socketPath);
+            return -1;
+        }
+        strcpy(local.sun_path, socketPath);
+        signal(SIGPIPE, SIG_IGN); // A client hanging up must not end the emulator
+        unlink(socketPath); // A socket file left by a previous run
+        console->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (console->listener < 0 || bind(console->listener, (struct sockaddr *)&local, sizeof(local)) != 0 ||
+            listen(console->listener, DEBUG_MAX_CLIENTS) != 0) {
+            printf("Debugger socket could not be opened: %s\n", socketPath);
+            if (console->listener >= 0) close(console->listener);
+            return -1;
+        }
+        snprintf(console->path, sizeof(console->path), "%s", socketPath);
+    }
+
+    console->thread = SDL_CreateThread(consoleThread, "debugger", console);
+    if (!console->thread) {
+        printf("Debugger thread could not be started. %s\n", SDL_GetError());
+        if (console->listener >= 0) close(console->listener);
+        if (console->path[0]) unlink(console->path);
+        return -1;
+    }
+    return 0;
+}
+
+// Called by the emulation thread between frames: run the queued commands and report a stop that happened while
+// running. The replies go back to wherever each command came from
+void serviceDebugConsole(struct DebugConsole *console, struct Chip8 *chip8) {
+    struct DebugLine command;
+
+    while (spscPeek(&console->commands, &command)) {
+        struct DebugLine *reply = spscReserve(&console->replies);
+        if (!reply) break; // Run it once the console thread has taken the replies waiting
+        spscDrop(&console->commands);
+        reply->source = command.source;
+        debugCommand(chip8, command.text, reply->text, sizeof(reply->text));
+        spscCommit(&console->replies);
+    }
+    if (chip8->debugger->stopEvent) {
+        struct DebugLine *reply = spscReserve(&console->replies);
+        if (!reply) return;
+        reply->source = DEBUG_BROADCAST;
+        formatStop(chip8, reply->text, sizeof(reply->text));
+        spscCommit(&console->replies);
+        chip8->debugger->stopEvent = false;
+    }
+}
+
+void stopDebugConsole(struct DebugConsole *console) {
+    atomic_store(&console->stopping, true);
+    SDL_WaitThread(console->thread, NULL);
+    for (int i = console->clientCount - 1; i >= 0; --i) closeClient(console, i);
+    if (console->listener >= 0) close(console->listener);
+    if (console->path[0]) unlink(console->path);
+}
+#else
+int startDebugConsole(struct DebugConsole *console, const char *socketPath, SDL_sem *wake) {
+    (void)console;
+    (void)socketPath;
+    (void)wake;
+    printf("The debugger console is not available on this platform.\n");
+    return -1;
+}
+
+void serviceDebugConsole(struct DebugConsole *console, struct Chip8 *chip8) {
+    (void)console;
+    (void)chip8;
+}
+
+void stopDebugConsole(struct DebugConsole *console) {
+    (void)console;
+}
+#endif
@@ -0,0 +1,56 @@
+#ifndef DEBUGCONSOLE_H
+#define DEBUGCONSOLE_H
+
+#include <SDL2/SDL.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "core.h"
+#include "debugger.h"
+#include "spsc.h"
+
+#define DEBUG_QUEUE_SIZE 16 // Lines in flight each way, a power of two
+#define DEBUG_MAX_CLIENTS 4
+#define DEBUG_LINE_SIZE 256 // Longest command line
+#define DEBUG_POLL_MS 50 // Longest the console thread waits before checking for replies and stop
+#define DEBUG_CONSOLE (-1) // Source of lines typed on stdin
+#define DEBUG_BROADCAST (-2) // Destination of stop reports, every console and client gets them
+
+// A command on its way to the emulation thread, or a reply on its way back
+struct DebugLine {
+    int source; // DEBUG_CONSOLE, a client socket, or DEBUG_BROADCAST for replies
+    char text[DEBUG_REPLY_SIZE];
+};
+
+// Line buffer of one input, commands end with a newline
+struct DebugInput {
+    int fd;
+    char line[DEBUG_LINE_SIZE];
+    int length;
+};
+
+// REPL for --debug on stdin and, with --debug-socket, on a Unix socket (nc -U PATH). A thread of its own reads
+// the commands and hands them to the emulation thread, which owns the machine and runs them between frames
+struct DebugConsole {
+    SDL_Thread *thread;
+    atomic_bool stopping;
+    SDL_sem *wake; // The emulation thread's, posted with every command so a paused or idle machine answers at once
+    struct SpscQueue commands; // Console thread to emulation thread
+    struct DebugLine commandStorage[DEBUG_QUEUE_SIZE];
+    struct SpscQueue replies; // Emulation thread to console thread
+    struct DebugLine replyStorage[DEBUG_QUEUE_SIZE];
+
+    // Console thread
+    struct DebugInput console;
+    bool consoleOpen; // stdin has not reached end of file
+    int listener;
+    char path[108];
+    struct DebugInput clients[DEBUG_MAX_CLIENTS];
+    int clientCount;
+};
+
+// Function prototypes
+int startDebugConsole(struct DebugConsole *console, const char *socketPath, SDL_sem *wake);
+void serviceDebugConsole(struct DebugConsole *console, struct Chip8 *chip8);
+void stopDebugConsole(struct DebugConsole *console);
+
+#endif // DEBUGCONSOLE_H
@@ -0,0 +1,228 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "debugger.h"
+#include "dispatch.h"
+
+#ifdef CHIP8_DEBUGGER
+static const char *const stopNames[] = { "running", "paused", "breakpoint", "step", "returned" };
+
+int enableDebugger(struct Chip8 *chip8) {
+    if (chip8->debugger) return 0;
+    chip8->debugger = calloc(1, sizeof(struct Debugger));
+    if (!chip8->debugger) {
+        printf("Memory could not be allocated.\n");
+        return -1;
+    }
+    return 0;
+}
+
+void disableDebugger(struct Chip8 *chip8) {
+    free(chip8->debugger);
+    chip8->debugger = NULL;
+}
+
+// Set or clear the breakpoint on an address. Returns -1 for an address outside memory
+int setBreakpoint(struct Debugger *debugger, unsigned address, bool enabled) {
+    if (address >= MEMORY_SIZE) return -1;
+    const uint64_t bit = 1ULL << (address & 63);
+    const bool set = debugger->breakpoints[address >> 6] & bit;
+    if (enabled && !set) {
+        debugger->breakpoints[address >> 6] |= bit;
+        debugger->breakpointCount++;
+    } else if (!enabled && set) {
+        debugger->breakpoints[address >> 6] &= ~bit;
+        debugger->breakpointCount--;
+    }
+    return 0;
+}
+
+static void stopDebugger(struct Debugger *debugger, enum DebugStop reason) {
+    debugger->paused = true;
+    debugger->mode = DEBUG_RUN;
+    debugger->stop = reason;
+    debugger->stopEvent = true;
+}
+
+static void resumeDebugger(struct Debugger *debugger, enum DebugMode mode) {
+    debugger->paused = false;
+    debugger->mode = mode;
+    debugger->stop = DEBUG_STOP_NONE;
+    debugger->resuming = true;
+}
+
+// Run up to count instructions under the debugger, called by runFrame in place of the usual dispatch while the
+// debugger is active. Stops early on a breakpoint or when a step over or run to return is done
+uint64_t executeDebugged(struct Chip8 *chip8, int count) {
+    struct Debugger *debugger = chip8->debugger;
+    uint64_t executed = 0;
+
+    while (!debugger->paused && (int)executed < count && chip8->speed > 0 && chip8->running) {
+        if (breakpointAt(debugger->breakpoints, chip8->pc) && !debugger->resuming) {
+            debugger->hits++;
+            stopDebugger(debugger, DEBUG_STOP_BREAKPOINT);
+            break;
+        }
+        // Running to a breakpoint goes through the interpreter with the bitmap test, stepping one at a time
+        if (debugger->mode == DEBUG_RUN && !debugger->resuming) {
+            executed += executeCyclesBreak(chip8, count - (int)executed, debugger->breakpoints);
+            continue;
+        }
+        debugger->resuming = false;
+        emulateCycle(chip8);
+        ++executed;
+        if (debugger->mode != DEBUG_RUN && chip8->pc == debugger->targetPc && chip8->sp == debugger->targetSp) {
+            stopDebugger(debugger, DEBUG_STOP_RETURN);
+        }
+    }
+    return executed;
+}
+
+static int append(char *out, size_t size, int used, const char *format, ...) {
+    va_list args;
+
+    if (used < 0 || (size_t)used >= size) return used;
+    va_start(args, format);
+    const int written = vsnprintf(out + used, size - (size_t)used, format, args);
+    va_end(args);
+    if (written < 0) return used;
+    return (size_t)(used + written) < size ? used + written : (int)size - 1;
+}
+
+static uint16_t opcodeAt(const struct Chip8 *chip8, unsigned address) {
+    return (uint16_t)(chip8->memory[address & 0xFFF] << 8 | chip8->memory[(address + 1) & 0xFFF]);
+}
+
+// pc with the instruction there, I, sp, timers, V0-VF and the stack, one line each
+int formatRegisters(const struct Chip8 *chip8, char *out, size_t size) {
+    int used = append(out, size, 0, "pc %03X (%04X)  I %03X  sp %d  delay %d  sound %d\n", chip8->pc,
+                      opcodeAt(chip8, chip8->pc), chip8->I, chip8->sp, chip8->delay_timer, chip8->sound_timer);
+    for (int row = 0; row < 2; ++row) {
+        for (int i = row * 8; i < row * 8 + 8; ++i) used = append(out, size, used, "V%X %02X%s", i, chip8->V[i], i % 8 == 7 ? "\n" : "  ");
+    }
+    used = append(out, size, used, "stack");
+    if (chip8->sp == 0) used = append(out, size, used, " empty");
+    for (int i = 0; i < chip8->sp && i < 16; ++i) used = append(out, size, used, " %03X", chip8->stack[i]);
+    return append(out, size, used, "\n");
+}
+
+// Where and why the machine stopped, then its registers
+int formatStop(const struct Chip8 *chip8, char *out, size_t size) {
+    const struct Debugger *debugger = chip8->debugger;
+    const int used = append(out, size, 0, "Stopped at %03X (%s)\n", chip8->pc, stopNames[debugger->stop]);
+    return used + formatRegisters(chip8, out + used, size - (size_t)used);
+}
+
+static bool parseAddress(const char *text, unsigned *address) {
+    char *end;
+    if (!text || !*text) return false;
+    const unsigned long value = strtoul(text, &end, 16);
+    if (*end != '\0' || value >= MEMORY_SIZE) return false;
+    *address = (unsigned)value;
+    return true;
+}
+
+// Run one command line from the console or the debug socket and write the reply. Returns 0, or -1 for a command
+// that was not understood. Commands that resume return at once, the stop is reported through stopEvent
+int debugCommand(struct Chip8 *chip8, const char *line, char *reply, size_t size) {
+    struct Debugger *debugger = chip8->debugger;
+    char command[16] = "", argument[32] = "";
+    unsigned address;
+
+    reply[0] = '\0';
+    if (sscanf(line, "%15s %31s", command, argument) < 1) return 0;
+    const char *arg = argument[0] ? argument : NULL;
+
+    if (strcmp(command, "b") == 0 || strcmp(command, "break") == 0) {
+        if (!parseAddress(arg, &address)) {
+            snprintf(reply, size, "Usage: break ADDRESS, in hex below %X\n", MEMORY_SIZE);
+            return -1;
+        }
+        setBreakpoint(debugger, address, true);
+        snprintf(reply, size, "Breakpoint at %03X\n", address);
+    } else if (strcmp(command, "d") == 0 || strcmp(command, "delete") == 0) {
+        if (!arg) {
+            memset(debugger->breakpoints, 0, sizeof(debugger->breakpoints));
+            debugger->breakpointCount = 0;
+            snprintf(reply, size, "All breakpoints deleted\n");
+        } else if (parseAddress(arg, &address)) {
+            setBreakpoint(debugger, address, false);
+            snprintf(reply, size, "Breakpoint at %03X deleted\n", address);
+        } else {
+            snprintf(reply, size, "Usage: delete [ADDRESS]\n");
+            return -1;
+        }
+    } else if (strcmp(command, "l") == 0 || strcmp(command, "list") == 0) {
+        int used = append(reply, size, 0, "%d breakpoints", debugger->breakpointCount);
+        for (unsigned a = 0; a < MEMORY_SIZE; ++a) {
+            if (breakpointAt(debugger->breakpoints, a)) used = append(reply, size, used, " %03X", a);
+        }
+        append(reply, size, used, "\n");
+    } else if (strcmp(command, "s") == 0 || strcmp(command, "step") == 0) {
+        // Stepping pauses first. Later instructions of a multi-step stop on breakpoints, the first never does
+        const int steps = arg ? atoi(arg) : 1;
+        debugger->paused = true;
+        for (int i = 0; i < steps && i < DEBUG_MAX_STEPS && chip8->speed > 0 && chip8->running; ++i) {
+            if (i > 0 && breakpointAt(debugger->breakpoints, chip8->pc)) break;
+            emulateCycle(chip8);
+        }
+        debugger->mode = DEBUG_RUN;
+        debugger->stop = DEBUG_STOP_STEP;
+        if (chip8->speed <= 0) snprintf(reply, size, "Waiting for a key (FX0A)\n");
+        formatStop(chip8, reply + strlen(reply), size - strlen(reply));
+    } else if (strcmp(command, "n") == 0 || strcmp(command, "next") == 0) {
+        // Over a 2NNN, run until it returns to the next instruction with the same stack depth. Anything else steps
+        if ((opcodeAt(chip8, chip8->pc) & 0xF000) != 0x2000) return debugCommand(chip8, "step", reply, size);
+        debugger->targetPc = (chip8->pc + 2) & 0xFFF;
+        debugger->targetSp = chip8->sp;
+        resumeDebugger(debugger, DEBUG_STEP_OVER);
+        snprintf(reply, size, "Running to %03X\n", debugger->targetPc);
+    } else if (strcmp(command, "f") == 0 || strcmp(command, "finish") == 0) {
+        if (chip8->sp == 0) {
+            snprintf(reply, size, "Not in a subroutine\n");
+            return -1;
+        }
+        debugger->targetSp = (chip8->sp - 1) & 0xF;
+        debugger->targetPc = chip8->stack[debugger->targetSp];
+        resumeDebugger(debugger, DEBUG_RUN_TO_RETURN);
+        snprintf(reply, size, "Running to the return to %03X\n", debugger->targetPc);
+    } else if (strcmp(command, "c") == 0 || strcmp(command, "continue") == 0) {
+        resumeDebugger(debugger, DEBUG_RUN);
+        snprintf(reply, size, "Continuing\n");
+    } else if (strcmp(command, "p") == 0 || strcmp(command, "pause") == 0) {
+        debugger->paused = true;
+        debugger->mode = DEBUG_RUN;
+        debugger->stop = DEBUG_STOP_PAUSE;
+        formatStop(chip8, reply, size);
+    } else if (strcmp(command, "r") == 0 || strcmp(command, "regs") == 0) {
+        formatRegisters(chip8, reply, size);
+    } else if (strcmp(command, "h") == 0 || strcmp(command, "help") == 0) {
+        snprintf(reply, size,
+                 "break ADDR (b)     stop before the instruction at ADDR, in hex\n"
+                 "delete [ADDR] (d)  delete one breakpoint or all of them\n"
+                 "list (l)           list breakpoints\n"
+                 "step [N] (s)       pause and run N instructions, 1 by default\n"
+                 "next (n)           step, running a 2NNN call until it returns\n"
+                 "finish (f)         run until the current subroutine returns with 00EE\n"
+                 "continue (c)       run until a breakpoint\n"
+                 "pause (p)          stop at the end of the current frame\n"
+                 "regs (r)           show pc, I, sp, timers, V0-VF and the stack\n");
+    } else {
+        snprintf(reply, size, "Unknown command: %s. Try help\n", command);
+        return -1;
+    }
+    return 0;
+}
+#else
+// Release builds: the interpreter has no breakpoint test and there is nothing to attach
+int enableDebugger(struct Chip8 *chip8) {
+    (void)chip8;
+    printf("This build has no debugger, configure with -DCHIP8_DEBUGGER=ON or make DEBUGGER=1.\n");
+    return -1;
+}
+
+void disableDebugger(struct Chip8 *chip8) {
+    (void)chip8;
+}
+#endif
@@ -0,0 +1,57 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "core.h"
+
+#define DEBUG_REPLY_SIZE 2048 // Longest reply to one command
+#define DEBUG_MAX_STEPS 4096 // Most instructions one step command runs
+
+// How the machine runs while the debugger is not paused
+enum DebugMode {
+    DEBUG_RUN, // Until a breakpoint
+    DEBUG_STEP_OVER, // Until the 2NNN it was started on returns
+    DEBUG_RUN_TO_RETURN, // Until the current subroutine returns through 00EE
+};
+
+// Why the machine last stopped
+enum DebugStop {
+    DEBUG_STOP_NONE,
+    DEBUG_STOP_PAUSE,
+    DEBUG_STOP_BREAKPOINT,
+    DEBUG_STOP_STEP,
+    DEBUG_STOP_RETURN, // A step over or run to return reached its return address
+};
+
+// Attached with enableDebugger, only with CHIP8_DEBUGGER defined. While it has no breakpoints and is neither paused
+// nor stepping, runFrame takes its usual path, block cache, JIT and idle skipping included. With breakpoints set
+// the interpreter tests one bit of the bitmap per instruction. Release builds leave it out entirely
+struct Debugger {
+    uint64_t breakpoints[MEMORY_SIZE / 64]; // See breakpointAt
+    int breakpointCount;
+    bool paused; // runFrame runs no instructions until a command resumes
+    enum DebugMode mode;
+    uint16_t targetPc; // Step over and run to return stop once pc and sp are back at these
+    uint16_t targetSp;
+    bool resuming; // Run the instruction at pc even if it has a breakpoint, it is where the machine stopped
+    enum DebugStop stop;
+    bool stopEvent; // Stopped while running, for the frontend to report
+    uint64_t hits; // Breakpoints hit
+};
+
+static inline bool debuggerActive(const struct Debugger *debugger) {
+    return debugger->paused || debugger->mode != DEBUG_RUN || debugger->breakpointCount > 0;
+}
+
+// Function prototypes
+int enableDebugger(struct Chip8 *chip8);
+void disableDebugger(struct Chip8 *chip8);
+int setBreakpoint(struct Debugger *debugger, unsigned address, bool enabled);
+uint64_t executeDebugged(struct Chip8 *chip8, int count);
+int formatRegisters(const struct Chip8 *chip8, char *out, size_t size);
+int formatStop(const struct Chip8 *chip8, char *out, size_t size);
+int debugCommand(struct Chip8 *chip8, const char *line, char *reply, size_t size);
+
+#endif // DEBUGGER_H
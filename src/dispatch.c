@@ -0,0 +1,357 @@
+#include <stdatomic.h>
+#include "dispatch.h"
+#include "ops.h"
+
+// Handlers that never stop the run early. FX0A and 00FD are handled separately since they end the frame
+#define OP_HANDLERS(X) \
+    X(OP_CLS, opClearScreen) \
+    X(OP_RET, opReturn) \
+    X(OP_SCROLL_DOWN, opScrollDown) \
+    X(OP_SCROLL_UP, opScrollUp) \
+    X(OP_SCROLL_RIGHT, opScrollRight) \
+    X(OP_SCROLL_LEFT, opScrollLeft) \
+    X(OP_SCROLL_DOWN_6, opScrollDown6) \
+    X(OP_SCROLL_DOWN_12, opScrollDown12) \
+    X(OP_COMPAT, opCompat) \
+    X(OP_LOW_RES, opLowRes) \
+    X(OP_HIGH_RES, opHighRes) \
+    X(OP_JP, opJump) \
+    X(OP_CALL, opCall) \
+    X(OP_SE_IMM, opSkipEqualImm) \
+    X(OP_SNE_IMM, opSkipNotEqualImm) \
+    X(OP_SE_REG, opSkipEqualReg) \
+    X(OP_LD_IMM, opLoadImm) \
+    X(OP_ADD_IMM, opAddImm) \
+    X(OP_LD_REG, opLoadReg) \
+    X(OP_OR, opOr) \
+    X(OP_AND, opAnd) \
+    X(OP_XOR, opXor) \
+    X(OP_ADD_REG, opAddReg) \
+    X(OP_SUB, opSub) \
+    X(OP_SHR, opShiftRight) \
+    X(OP_SUBN, opSubN) \
+    X(OP_SHL, opShiftLeft) \
+    X(OP_SNE_REG, opSkipNotEqualReg) \
+    X(OP_LD_I, opLoadI) \
+    X(OP_JP_V0, opJumpV0) \
+    X(OP_RND, opRandom) \
+    X(OP_DRW, opDraw) \
+    X(OP_SKP, opSkipKey) \
+    X(OP_SKNP, opSkipNotKey) \
+    X(OP_LD_VX_DT, opLoadDelay) \
+    X(OP_LD_DT, opSetDelay) \
+    X(OP_LD_ST, opSetSound) \
+    X(OP_ADD_I, opAddI) \
+    X(OP_LD_F, opLoadFont) \
+    X(OP_BCD, opBcd) \
+    X(OP_STORE, opStore) \
+    X(OP_LOAD, opLoad) \
+    X(OP_AUDIO, opAudio) \
+    X(OP_PITCH, opPitch) \
+    X(OP_UNKNOWN, opUnknown)
+
+typedef void (*OpHandler)(struct Chip8 *chip8, uint16_t opcode);
+
+#define HANDLER_ENTRY(cls, fn) [cls] = fn,
+static const OpHandler opHandlers[OP_COUNT] = {
+    OP_HANDLERS(HANDLER_ENTRY)
+    [OP_LD_KEY] = opWaitKey,
+    [OP_EXIT] = opExit,
+};
+
+// Pre-decoded tables, shared by every instance and read-only once built
+static OpHandler dispatchTable[0x10000];
+static uint8_t opClassTable[0x10000];
+static atomic_int dispatchState; // 0 = empty, 1 = building, 2 = ready
+
+// Build the decode tables once per process. Safe to call from several threads
+void initDispatch(void) {
+    int expected = 0;
+    if (atomic_load_explicit(&dispatchState, memory_order_acquire) == 2) return;
+    if (atomic_compare_exchange_strong(&dispatchState, &expected, 1)) {
+        for (uint32_t opcode = 0; opcode < 0x10000; ++opcode) {
+            const enum OpClass cls = classifyOpcode((uint16_t)opcode);
+            opClassTable[opcode] = (uint8_t)cls;
+            dispatchTable[opcode] = opHandlers[cls];
+        }
+        atomic_store_explicit(&dispatchState, 2, memory_order_release);
+    } else {
+        while (atomic_load_explicit(&dispatchState, memory_order_acquire) != 2) {
+            // Another thread is filling the tables
+        }
+    }
+}
+
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+// Decode with nested switches on the opcode nibbles. With a constant quirks argument every quirk check folds away,
+// QUIRKS_DYNAMIC reads them from the machine. Returns true after an opcode that may have changed the quirk profile
+static ALWAYS_INLINE bool stepSwitch(struct Chip8 *chip8, const int quirks) {
+    const uint16_t opcode = fetchOpcode(chip8);
+
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            switch (opcode & 0x00FF) {
+                case 0x00E0: opClearScreen(chip8, opcode); break;
+                case 0x00EE: opReturn(chip8, opcode); break;
+                case 0x00C0: scrollDownQuirks(chip8, opcode & 0x000F, quirks); break;
+                case 0x00D0: scrollUpQuirks(chip8, opcode & 0x000F, quirks); break;
+                case 0x00FB: scrollHorizontalQuirks(chip8, 1, quirks); break;
+                case 0x00FC: scrollHorizontalQuirks(chip8, 0, quirks); break;
+                case 0x00C6: scrollDownQuirks(chip8, 6, quirks); break;
+                case 0x00DC: scrollDownQuirks(chip8, 12, quirks); break;
+                case 0x00CC: scrollDownQuirks(chip8, 12, quirks); break;
+                case 0x00FA: opCompat(chip8, opcode); return true;
+                case 0x00FE: opLowRes(chip8, opcode); return true;
+                case 0x00FF: opHighRes(chip8, opcode); return true;
+                case 0x00FD: opExit(chip8, opcode); break;
+                default: opUnknown(chip8, opcode); break;
+            }
+            break;
+        case 0x1000: opJump(chip8, opcode); break;
+        case 0x2000: opCall(chip8, opcode); break;
+        case 0x3000: opSkipEqualImm(chip8, opcode); break;
+        case 0x4000: opSkipNotEqualImm(chip8, opcode); break;
+        case 0x5000: opSkipEqualReg(chip8, opcode); break;
+        case 0x6000: opLoadImm(chip8, opcode); break;
+        case 0x7000: opAddImm(chip8, opcode); break;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0000: opLoadReg(chip8, opcode); break;
+                case 0x0001: orRegQuirks(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4, quirks); break;
+                case 0x0002: andRegQuirks(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4, quirks); break;
+                case 0x0003: xorRegQuirks(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4, quirks); break;
+                case 0x0004: opAddReg(chip8, opcode); break;
+                case 0x0005: opSub(chip8, opcode); break;
+                case 0x0006: shiftRightQuirks(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4, quirks); break;
+                case 0x0007: opSubN(chip8, opcode); break;
+                case 0x000E: shiftLeftQuirks(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4, quirks); break;
+                default: opUnknown(chip8, opcode); break;
+            }
+            break;
+        case 0x9000: opSkipNotEqualReg(chip8, opcode); break;
+        case 0xA000: opLoadI(chip8, opcode); break;
+        case 0xB000: opJumpV0(chip8, opcode); break;
+        case 0xC000: opRandom(chip8, opcode); break;
+        case 0xD000: opDrawQuirks(chip8, opcode, quirks); break;
+        case 0xE000:
+            switch (opcode & 0x00FF) {
+                case 0x009E: opSkipKey(chip8, opcode); break;
+                case 0x00A1: opSkipNotKey(chip8, opcode); break;
+                default: opUnknown(chip8, opcode); break;
+            }
+            break;
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x0002: opAudio(chip8, opcode); break;
+                case 0x0007: opLoadDelay(chip8, opcode); break;
+                case 0x000A: opWaitKey(chip8, opcode); break;
+                case 0x0015: opSetDelay(chip8, opcode); break;
+                case 0x0018: opSetSound(chip8, opcode); break;
+                case 0x001E: opAddI(chip8, opcode); break;
+                case 0x0029: opLoadFont(chip8, opcode); break;
+                case 0x0033: opBcd(chip8, opcode); break;
+                case 0x0055: opStoreQuirks(chip8, opcode, quirks); break;
+                case 0x0065: opLoadQuirks(chip8, opcode, quirks); break;
+                case 0x003A: opPitch(chip8, opcode); break;
+                default: opUnknown(chip8, opcode); break;
+            }
+            break;
+        // Unknown opcode
+        default:
+            opUnknown(chip8, opcode);
+            break;
+    }
+    return false;
+}
+
+static inline void emulateCycleSwitch(struct Chip8 *chip8) {
+    stepSwitch(chip8, QUIRKS_DYNAMIC);
+}
+
+// Decode with one indirect call through the pre-decoded handler table
+static inline void emulateCycleTable(struct Chip8 *chip8) {
+    const uint16_t opcode = fetchOpcode(chip8);
+    dispatchTable[opcode](chip8, opcode);
+}
+
+// Run up to count instructions, stopping early on FX0A or 00FD
+uint64_t executeCyclesSwitch(struct Chip8 *chip8, int count) {
+    uint64_t executed = 0;
+    while ((int)executed < count && chip8->speed > 0 && chip8->running) {
+        emulateCycleSwitch(chip8);
+        ++executed;
+    }
+    return executed;
+}
+
+// One switch interpreter per quirk profile. Each runs until the count is used up, the frame stops early, or an
+// opcode may have changed the profile, and then hands back to executeCyclesQuirks to pick the next one
+#define QUIRK_VARIANT(quirks) \
+    static uint64_t executeQuirks##quirks(struct Chip8 *chip8, int count) { \
+        uint64_t executed = 0; \
+        while ((int)executed < count && chip8->speed > 0 && chip8->running) { \
+            ++executed; \
+            if (stepSwitch(chip8, quirks)) break; \
+        } \
+        return executed; \
+    }
+QUIRK_VARIANT(0)
+QUIRK_VARIANT(1)
+QUIRK_VARIANT(2)
+QUIRK_VARIANT(3)
+QUIRK_VARIANT(4)
+QUIRK_VARIANT(5)
+QUIRK_VARIANT(6)
+QUIRK_VARIANT(7)
+#undef QUIRK_VARIANT
+
+static uint64_t (*const quirkVariants[QUIRK_VARIANTS])(struct Chip8 *, int) = {
+    executeQuirks0, executeQuirks1, executeQuirks2, executeQuirks3,
+    executeQuirks4, executeQuirks5, executeQuirks6, executeQuirks7,
+};
+
+const char *quirkProfileName(enum QuirkProfile profile) {
+    static const char *const names[PROFILE_COUNT] = { "chip8", "schip-legacy", "schip-modern", "xo-chip" };
+    return (unsigned)profile < PROFILE_COUNT ? names[profile] : "unknown";
+}
+
+// The profile is picked from the machine flags on entry, so a freshly loaded ROM starts in its own variant, and
+// picked again whenever 00FA/00FE/00FF ends a run
+uint64_t executeCyclesQuirks(struct Chip8 *chip8, int count) {
+    uint64_t executed = 0;
+    while ((int)executed < count && chip8->speed > 0 && chip8->running) {
+        executed += quirkVariants[machineQuirks(chip8)](chip8, count - (int)executed);
+    }
+    return executed;
+}
+
+#ifdef CHIP8_DEBUGGER
+// The same variants with one breakpoint bitmap test per instruction, for the debugger. Builds without the debugger
+// leave them out, so the interpreters above never pay for the test
+#define BREAK_VARIANT(quirks) \
+    static uint64_t executeBreakQuirks##quirks(struct Chip8 *chip8, int count, const uint64_t *breakpoints) { \
+        uint64_t executed = 0; \
+        while ((int)executed < count && chip8->speed > 0 && chip8->running) { \
+            if (breakpointAt(breakpoints, chip8->pc)) break; \
+            ++executed; \
+            if (stepSwitch(chip8, quirks)) break; \
+        } \
+        return executed; \
+    }
+BREAK_VARIANT(0)
+BREAK_VARIANT(1)
+BREAK_VARIANT(2)
+BREAK_VARIANT(3)
+BREAK_VARIANT(4)
+BREAK_VARIANT(5)
+BREAK_VARIANT(6)
+BREAK_VARIANT(7)
+#undef BREAK_VARIANT
+
+static uint64_t (*const breakVariants[QUIRK_VARIANTS])(struct Chip8 *, int, const uint64_t *) = {
+    executeBreakQuirks0, executeBreakQuirks1, executeBreakQuirks2, executeBreakQuirks3,
+    executeBreakQuirks4, executeBreakQuirks5, executeBreakQuirks6, executeBreakQuirks7,
+};
+
+// executeCyclesQuirks that stops before the first instruction whose address has its bit set, so the count comes
+// back short
+uint64_t executeCyclesBreak(struct Chip8 *chip8, int count, const uint64_t *breakpoints) {
+    uint64_t executed = 0;
+    while ((int)executed < count && chip8->speed > 0 && chip8->running && !breakpointAt(breakpoints, chip8->pc)) {
+        executed += breakVariants[machineQuirks(chip8)](chip8, count - (int)executed, breakpoints);
+    }
+    return executed;
+}
+#endif
+
+uint64_t executeCyclesTable(struct Chip8 *chip8, int count) {
+    uint64_t executed = 0;
+    while ((int)executed < count && chip8->speed > 0 && chip8->running) {
+        emulateCycleTable(chip8);
+        ++executed;
+    }
+    return executed;
+}
+
+#ifdef CHIP8_HAVE_COMPUTED_GOTO
+// Threaded interpreter: every handler jumps straight to the next one, so only FX0A and 00FD need to check for an early stop
+uint64_t executeCyclesGoto(struct Chip8 *chip8, int count) {
+#define LABEL_ENTRY(cls, fn) [cls] = &&label_##cls,
+    static void *const labels[OP_COUNT] = {
+        OP_HANDLERS(LABEL_ENTRY)
+        [OP_LD_KEY] = &&label_OP_LD_KEY,
+        [OP_EXIT] = &&label_OP_EXIT,
+    };
+#undef LABEL_ENTRY
+    uint64_t executed = 0;
+    uint16_t opcode;
+
+    if (count <= 0 || chip8->speed <= 0 || !chip8->running) return 0;
+
+#define DISPATCH() \
+    do { \
+        if ((int)executed >= count) goto done; \
+        opcode = fetchOpcode(chip8); \
+        ++executed; \
+        goto *labels[opClassTable[opcode]]; \
+    } while (0)
+
+    DISPATCH();
+
+#define LABEL_BODY(cls, fn) label_##cls: fn(chip8, opcode); DISPATCH();
+    OP_HANDLERS(LABEL_BODY)
+#undef LABEL_BODY
+
+label_OP_LD_KEY:
+    opWaitKey(chip8, opcode);
+    goto done;
+label_OP_EXIT:
+    opExit(chip8, opcode);
+    goto done;
+#undef DISPATCH
+
+done:
+    return executed;
+}
+#endif
+
+// Build-time selected dispatch
+#if defined(CHIP8_DISPATCH_GOTO) && defined(CHIP8_HAVE_COMPUTED_GOTO)
+uint64_t executeCycles(struct Chip8 *chip8, int count) {
+    return executeCyclesGoto(chip8, count);
+}
+
+// A single step gains nothing from threading
+void emulateCycle(struct Chip8 *chip8) {
+    emulateCycleTable(chip8);
+}
+#elif defined(CHIP8_DISPATCH_QUIRKS)
+uint64_t executeCycles(struct Chip8 *chip8, int count) {
+    return executeCyclesQuirks(chip8, count);
+}
+
+void emulateCycle(struct Chip8 *chip8) {
+    emulateCycleSwitch(chip8);
+}
+#elif defined(CHIP8_DISPATCH_TABLE) || defined(CHIP8_DISPATCH_GOTO)
+uint64_t executeCycles(struct Chip8 *chip8, int count) {
+    return executeCyclesTable(chip8, count);
+}
+
+void emulateCycle(struct Chip8 *chip8) {
+    emulateCycleTable(chip8);
+}
+#else
+uint64_t executeCycles(struct Chip8 *chip8, int count) {
+    return executeCyclesSwitch(chip8, count);
+}
+
+void emulateCycle(struct Chip8 *chip8) {
+    emulateCycleSwitch(chip8);
+}
+#endif
@@ -0,0 +1,70 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include "core.h"
+
+// Every dispatch mode is always compiled so they can be benchmarked against each other.
+// emulateCycle/executeCycles use the one picked at build time:
+//   CHIP8_DISPATCH_SWITCH  nested switch on the opcode nibbles
+//   CHIP8_DISPATCH_TABLE   64K-entry table of handler pointers indexed by opcode
+//   CHIP8_DISPATCH_GOTO    threaded code with computed goto, falls back to the table without GCC/Clang
+//   CHIP8_DISPATCH_QUIRKS  nested switch specialised per quirk profile, see executeCyclesQuirks (default)
+#if defined(__GNUC__)
+#define CHIP8_HAVE_COMPUTED_GOTO 1
+#endif
+
+// Machine flags that change what an opcode does. Each combination gets its own copy of the switch interpreter
+#define QUIRK_COMPAT (1 << 0) // compatMode: 8XY6/8XYE shift VX, FX55/FX65 leave I alone
+#define QUIRK_HIGH_RES (1 << 1) // highRes: 128x64 display, 8XY1/8XY2/8XY3 keep VF
+#define QUIRK_LEGACY (1 << 2) // legacyMode: 00FB/00FC scroll 2 pixels in low res
+#define QUIRK_VARIANTS 8
+
+static inline int machineQuirks(const struct Chip8 *chip8) {
+    return (chip8->compatMode ? QUIRK_COMPAT : 0) | (chip8->highRes ? QUIRK_HIGH_RES : 0) |
+           (chip8->legacyMode ? QUIRK_LEGACY : 0);
+}
+
+// The platform a ROM is run as. Each maps onto the quirk variants above, the resolution picks between a profile's
+// low and high res copies and is not part of the profile
+enum QuirkProfile {
+    PROFILE_CHIP8,
+    PROFILE_SCHIP_LEGACY, // SCHIP 1.1: compatMode, low res scrolls move 2 pixels
+    PROFILE_SCHIP_MODERN, // compatMode without the legacy scroll
+    PROFILE_XO_CHIP, // Runs in the CHIP-8 variants, none of its opcodes depend on a quirk here
+    PROFILE_COUNT
+};
+
+static inline enum QuirkProfile machineProfile(const struct Chip8 *chip8) {
+    if (chip8->xoChipMode) return PROFILE_XO_CHIP;
+    if (chip8->legacyMode) return PROFILE_SCHIP_LEGACY;
+    if (chip8->compatMode) return PROFILE_SCHIP_MODERN;
+    return PROFILE_CHIP8;
+}
+
+// Start a machine in a profile, the inverse of machineProfile. Analysis, packs, the frontend and the bench all
+// set the quirks through here
+static inline void applyQuirkProfile(struct Chip8 *chip8, enum QuirkProfile profile) {
+    chip8->compatMode = profile == PROFILE_SCHIP_LEGACY || profile == PROFILE_SCHIP_MODERN;
+    chip8->legacyMode = profile == PROFILE_SCHIP_LEGACY;
+    chip8->xoChipMode = profile == PROFILE_XO_CHIP;
+}
+
+// Bit pc of a 4096-bit breakpoint bitmap, MEMORY_SIZE / 64 words with address N in bit N % 64 of word N / 64
+static inline bool breakpointAt(const uint64_t *breakpoints, unsigned pc) {
+    pc &= MEMORY_SIZE - 1;
+    return breakpoints[pc >> 6] >> (pc & 63) & 1;
+}
+
+// Function prototypes
+const char *quirkProfileName(enum QuirkProfile profile);
+uint64_t executeCyclesSwitch(struct Chip8 *chip8, int count);
+uint64_t executeCyclesQuirks(struct Chip8 *chip8, int count);
+#ifdef CHIP8_DEBUGGER
+uint64_t executeCyclesBreak(struct Chip8 *chip8, int count, const uint64_t *breakpoints);
+#endif
+uint64_t executeCyclesTable(struct Chip8 *chip8, int count);
+#ifdef CHIP8_HAVE_COMPUTED_GOTO
+uint64_t executeCyclesGoto(struct Chip8 *chip8, int count);
+#endif
+
+#endif // DISPATCH_H
@@ -0,0 +1,728 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dispatch.h"
+#include "jit.h"
+#include "ops.h"
+
+#ifdef CHIP8_HAVE_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+
+// x86-64 recompiler. Hot pcs are translated into native regions: straight runs of instructions where jumps and skips
+// that land inside the region become native branches, so tight guest loops run without leaving native code.
+// V registers live in host registers for the whole region, the remaining state is accessed through rdi.
+//
+// Region calling convention (System V): int region(struct Chip8 *chip8, int budget) returns the unused budget.
+//   rdi   chip8
+//   r12d  instructions left in the budget, checked before every instruction
+//   rax, rcx, rdx scratch
+//   rbx, rbp, rsi, r8-r11, r13-r15 hold V registers
+//
+// Anything that writes memory, draws, reads input, needs rand() or can stop the frame (DXYN, FX33, FX55, CXNN,
+// EX9E/EXA1, FX0A, 00FD, screen and mode ops) ends the region and runs through emulateCycle. compatMode and highRes
+// are baked into each region and checked on entry, they can only change between regions since 00FA/00FE/00FF are
+// never compiled.
+//
+// The code buffer is never writable and executable at once: it is mapped read/execute, and only the pages a region is
+// about to be written into are switched to read/write while it is compiled.
+
+typedef int (*RegionFn)(struct Chip8 *chip8, int budget);
+
+enum {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15
+};
+
+static const int vRegisterPool[] = { RBX, RBP, RSI, R8, R9, R10, R11, R13, R14, R15 };
+#define V_POOL_SIZE ((int)(sizeof(vRegisterPool) / sizeof(vRegisterPool[0])))
+
+// Worst case native size of one instruction (FX65 with X = F) plus its budget stub, with room to spare
+#define MAX_OP_CODE 512
+#define MAX_REGION_CODE (JIT_MAX_REGION_OPS * MAX_OP_CODE)
+#define MAX_FIXUPS (JIT_MAX_REGION_OPS * 2)
+
+#define OFF_OPCODE ((uint32_t)offsetof(struct Chip8, opcode))
+#define OFF_MEMORY ((uint32_t)offsetof(struct Chip8, memory))
+#define OFF_V ((uint32_t)offsetof(struct Chip8, V))
+#define OFF_I ((uint32_t)offsetof(struct Chip8, I))
+#define OFF_PC ((uint32_t)offsetof(struct Chip8, pc))
+#define OFF_DELAY ((uint32_t)offsetof(struct Chip8, delay_timer))
+#define OFF_SOUND ((uint32_t)offsetof(struct Chip8, sound_timer))
+#define OFF_STACK ((uint32_t)offsetof(struct Chip8, stack))
+#define OFF_SP ((uint32_t)offsetof(struct Chip8, sp))
+#define OFF_CARRY ((uint32_t)offsetof(struct Chip8, carry))
+
+enum FixupKind {
+    FIXUP_TARGET, // Branch to a guest address, native label if it is inside the region, exit stub otherwise
+    FIXUP_BUDGET, // Budget ran out before instruction index
+    FIXUP_EPILOGUE
+};
+
+struct Fixup {
+    uint32_t at; // Offset of the rel32 to patch
+    uint16_t value; // Guest address or instruction index
+    uint8_t kind;
+};
+
+struct Emitter {
+    uint8_t *code;
+    size_t size;
+    int8_t vHost[16]; // Host register holding each V register, -1 if it stays in memory
+    uint16_t start;
+    uint16_t end;
+    int count;
+    uint32_t labels[JIT_MAX_REGION_OPS]; // Native offset of each instruction
+    struct Fixup fixups[MAX_FIXUPS];
+    int fixupCount;
+};
+
+static inline uint8_t modeKey(const struct Chip8 *chip8) {
+    return (uint8_t)(chip8->compatMode | chip8->highRes << 1);
+}
+
+static void emit8(struct Emitter *e, uint8_t byte) {
+    e->code[e->size++] = byte;
+}
+
+static void emit16(struct Emitter *e, uint16_t value) {
+    emit8(e, value & 0xFF);
+    emit8(e, value >> 8);
+}
+
+static void emit32(struct Emitter *e, uint32_t value) {
+    emit16(e, value & 0xFFFF);
+    emit16(e, value >> 16);
+}
+
+// Emit op with V[x] as the r/m operand and reg (al, cl or dl, or a /digit) in the reg field
+static void emitV(struct Emitter *e, const uint8_t *op, int opLength, int reg, int x) {
+    const int host = e->vHost[x];
+
+    // Always emit a REX prefix so host registers 4-7 mean spl/bpl/sil/dil instead of ah/ch/dh/bh
+    emit8(e, 0x40 | (host >= 8 ? 0x01 : 0x00));
+    for (int i = 0; i < opLength; ++i) emit8(e, op[i]);
+    if (host >= 0) {
+        emit8(e, 0xC0 | (reg & 7) << 3 | (host & 7));
+    } else {
+        emit8(e, 0x80 | (reg & 7) << 3 | RDI);
+        emit32(e, OFF_V + x);
+    }
+}
+
+#define EMIT_V(e, reg, x, ...) \
+    do { \
+        static const uint8_t op_[] = { __VA_ARGS__ }; \
+        emitV(e, op_, (int)sizeof(op_), reg, x); \
+    } while (0)
+
+// Emit op with [rdi + offset] as the r/m operand
+static void emitField(struct Emitter *e, const uint8_t *op, int opLength, int reg, uint32_t offset) {
+    for (int i = 0; i < opLength; ++i) emit8(e, op[i]);
+    emit8(e, 0x80 | (reg & 7) << 3 | RDI);
+    emit32(e, offset);
+}
+
+#define EMIT_FIELD(e, reg, offset, ...) \
+    do { \
+        static const uint8_t op_[] = { __VA_ARGS__ }; \
+        emitField(e, op_, (int)sizeof(op_), reg, offset); \
+    } while (0)
+
+static void emitFixup(struct Emitter *e, enum FixupKind kind, uint16_t value) {
+    struct Fixup *fixup = &e->fixups[e->fixupCount++];
+    fixup->at = (uint32_t)e->size;
+    fixup->value = value;
+    fixup->kind = (uint8_t)kind;
+    emit32(e, 0);
+}
+
+// jmp rel32
+static void emitJump(struct Emitter *e, enum FixupKind kind, uint16_t value) {
+    emit8(e, 0xE9);
+    emitFixup(e, kind, value);
+}
+
+// jcc rel32
+static void emitJumpIf(struct Emitter *e, uint8_t condition, enum FixupKind kind, uint16_t value) {
+    emit8(e, 0x0F);
+    emit8(e, 0x80 | condition);
+    emitFixup(e, kind, value);
+}
+
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_L 0xC
+
+// mov word [rdi + pc], address
+static void emitStorePc(struct Emitter *e, uint16_t address) {
+    EMIT_FIELD(e, 0, OFF_PC, 0x66, 0xC7);
+    emit16(e, address);
+}
+
+// Flag result in al (setc/setnc already done) goes to VF
+static void emitStoreFlag(struct Emitter *e, int reg) {
+    EMIT_V(e, reg, 0xF, 0x88);
+}
+
+// Instructions with a native translation
+static bool isCompilable(enum OpClass cls) {
+    switch (cls) {
+        case OP_RET: case OP_JP: case OP_CALL: case OP_SE_IMM: case OP_SNE_IMM: case OP_SE_REG: case OP_LD_IMM:
+        case OP_ADD_IMM: case OP_LD_REG: case OP_OR: case OP_AND: case OP_XOR: case OP_ADD_REG: case OP_SUB:
+        case OP_SHR: case OP_SUBN: case OP_SHL: case OP_SNE_REG: case OP_LD_I: case OP_JP_V0: case OP_LD_VX_DT:
+        case OP_LD_DT: case OP_LD_ST: case OP_ADD_I: case OP_LD_F: case OP_LOAD:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Instructions after which the next address is not reached by falling through
+static bool endsRegion(enum OpClass cls) {
+    return cls == OP_RET || cls == OP_JP || cls == OP_CALL || cls == OP_JP_V0;
+}
+
+// Count how often each V register is touched so the busiest ones get host registers
+static void countRegisterUse(uint16_t opcode, enum OpClass cls, int *uses) {
+    const int x = (opcode & 0x0F00) >> 8;
+    const int y = (opcode & 0x00F0) >> 4;
+
+    switch (cls) {
+        case OP_SE_REG: case OP_SNE_REG: case OP_LD_REG:
+            uses[x]++;
+            uses[y]++;
+            break;
+        case OP_OR: case OP_AND: case OP_XOR: case OP_ADD_REG: case OP_SUB: case OP_SHR: case OP_SUBN: case OP_SHL:
+            uses[x]++;
+            uses[y]++;
+            uses[0xF]++;
+            break;
+        case OP_SE_IMM: case OP_SNE_IMM: case OP_LD_IMM: case OP_ADD_IMM: case OP_LD_VX_DT: case OP_LD_DT:
+        case OP_LD_ST: case OP_ADD_I: case OP_LD_F:
+            uses[x]++;
+            break;
+        case OP_JP_V0:
+            uses[0]++;
+            break;
+        case OP_LOAD:
+            for (int i = 0; i <= x; ++i) uses[i]++;
+            break;
+        default:
+            break;
+    }
+}
+
+static void allocateRegisters(struct Emitter *e, const int *uses) {
+    bool taken[16] = { false };
+    memset(e->vHost, -1, sizeof(e->vHost));
+    for (int slot = 0; slot < V_POOL_SIZE; ++slot) {
+        int best = -1;
+        for (int v = 0; v < 16; ++v) {
+            if (!taken[v] && uses[v] > 0 && (best < 0 || uses[v] > uses[best])) best = v;
+        }
+        if (best < 0) break;
+        taken[best] = true;
+        e->vHost[best] = (int8_t)vRegisterPool[slot];
+    }
+}
+
+static void emitPrologue(struct Emitter *e) {
+    emit8(e, 0x53); // push rbx
+    emit8(e, 0x55); // push rbp
+    emit8(e, 0x41); emit8(e, 0x54); // push r12
+    emit8(e, 0x41); emit8(e, 0x55); // push r13
+    emit8(e, 0x41); emit8(e, 0x56); // push r14
+    emit8(e, 0x41); emit8(e, 0x57); // push r15
+    emit8(e, 0x41); emit8(e, 0x89); emit8(e, 0xF4); // mov r12d, esi
+
+    // movzx host, byte [rdi + V + x]
+    for (int x = 0; x < 16; ++x) {
+        const int host = e->vHost[x];
+        if (host < 0) continue;
+        if (host >= 8) emit8(e, 0x44);
+        EMIT_FIELD(e, host, OFF_V + x, 0x0F, 0xB6);
+    }
+}
+
+static void emitEpilogue(struct Emitter *e) {
+    // mov byte [rdi + V + x], host
+    for (int x = 0; x < 16; ++x) {
+        const int host = e->vHost[x];
+        if (host < 0) continue;
+        emit8(e, 0x40 | (host >= 8 ? 0x04 : 0x00));
+        EMIT_FIELD(e, host, OFF_V + x, 0x88);
+    }
+    emit8(e, 0x44); emit8(e, 0x89); emit8(e, 0xE0); // mov eax, r12d
+    emit8(e, 0x41); emit8(e, 0x5F); // pop r15
+    emit8(e, 0x41); emit8(e, 0x5E); // pop r14
+    emit8(e, 0x41); emit8(e, 0x5D); // pop r13
+    emit8(e, 0x41); emit8(e, 0x5C); // pop r12
+    emit8(e, 0x5D); // pop rbp
+    emit8(e, 0x5B); // pop rbx
+    emit8(e, 0xC3); // ret
+}
+
+// Translate one instruction. address is where it lives, pc already points past it when it runs
+static void emitOp(struct Emitter *e, uint16_t address, uint16_t opcode, enum OpClass cls, uint8_t mode) {
+    const int x = (opcode & 0x0F00) >> 8;
+    const int y = (opcode & 0x00F0) >> 4;
+    const uint8_t nn = opcode & 0x00FF;
+    const uint16_t nnn = opcode & 0x0FFF;
+    const bool compatMode = mode & 1;
+    const bool highRes = mode & 2;
+    const uint16_t next = address + 2;
+
+    switch (cls) {
+        case OP_RET:
+            EMIT_FIELD(e, RAX, OFF_SP, 0x0F, 0xB7); // movzx eax, word [sp]
+            emit8(e, 0x83); emit8(e, 0xE8); emit8(e, 0x01); // sub eax, 1
+            emit8(e, 0x83); emit8(e, 0xE0); emit8(e, 0x0F); // and eax, 0xF
+            EMIT_FIELD(e, RAX, OFF_SP, 0x66, 0x89); // mov word [sp], ax
+            emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0x84); emit8(e, 0x47); // movzx eax, word [rdi + rax*2 + stack]
+            emit32(e, OFF_STACK);
+            EMIT_FIELD(e, RAX, OFF_PC, 0x66, 0x89); // mov word [pc], ax
+            emitJump(e, FIXUP_EPILOGUE, 0);
+            break;
+        case OP_JP:
+            emitJump(e, FIXUP_TARGET, nnn);
+            break;
+        case OP_CALL:
+            EMIT_FIELD(e, RAX, OFF_SP, 0x0F, 0xB7); // movzx eax, word [sp]
+            emit8(e, 0x66); emit8(e, 0xC7); emit8(e, 0x84); emit8(e, 0x47); // mov word [rdi + rax*2 + stack], next
+            emit32(e, OFF_STACK);
+            emit16(e, next);
+            emit8(e, 0x83); emit8(e, 0xC0); emit8(e, 0x01); // add eax, 1
+            emit8(e, 0x83); emit8(e, 0xE0); emit8(e, 0x0F); // and eax, 0xF
+            EMIT_FIELD(e, RAX, OFF_SP, 0x66, 0x89); // mov word [sp], ax
+            emitJump(e, FIXUP_TARGET, nnn);
+            break;
+        case OP_SE_IMM:
+        case OP_SNE_IMM:
+            EMIT_V(e, 7, x, 0x80); // cmp Vx, nn
+            emit8(e, nn);
+            emitJumpIf(e, cls == OP_SE_IMM ? CC_E : CC_NE, FIXUP_TARGET, next + 2);
+            break;
+        case OP_SE_REG:
+        case OP_SNE_REG:
+            EMIT_V(e, RAX, y, 0x8A); // mov al, Vy
+            EMIT_V(e, RAX, x, 0x38); // cmp Vx, al
+            emitJumpIf(e, cls == OP_SE_REG ? CC_E : CC_NE, FIXUP_TARGET, next + 2);
+            break;
+        case OP_LD_IMM:
+            EMIT_V(e, 0, x, 0xC6); // mov Vx, nn
+            emit8(e, nn);
+            break;
+        case OP_ADD_IMM:
+            EMIT_V(e, 0, x, 0x80); // add Vx, nn
+            emit8(e, nn);
+            break;
+        case OP_LD_REG:
+            EMIT_V(e, RAX, y, 0x8A); // mov al, Vy
+            EMIT_V(e, RAX, x, 0x88); // mov Vx, al
+            break;
+        case OP_OR:
+        case OP_AND:
+        case OP_XOR:
+            EMIT_V(e, RAX, y, 0x8A); // mov al, Vy
+            if (cls == OP_OR) EMIT_V(e, RAX, x, 0x08); // or Vx, al
+            else if (cls == OP_AND) EMIT_V(e, RAX, x, 0x20); // and Vx, al
+            else EMIT_V(e, RAX, x, 0x30); // xor Vx, al
+            if (!highRes) {
+                EMIT_V(e, 0, 0xF, 0xC6); // mov VF, 0
+                emit8(e, 0);
+            }
+            break;
+        case OP_ADD_REG:
+            EMIT_V(e, RAX, y, 0x8A); // mov al, Vy
+            EMIT_V(e, RAX, x, 0x00); // add Vx, al
+            emit8(e, 0x0F); emit8(e, 0x92); emit8(e, 0xC0); // setc al
+            emitStoreFlag(e, RAX);
+            break;
+        case OP_SUB:
+            EMIT_V(e, RAX, y, 0x8A); // mov al, Vy
+            EMIT_V(e, RAX, x, 0x28); // sub Vx, al
+            emit8(e, 0x0F); emit8(e, 0x93); emit8(e, 0xC0); // setnc al
+            emitStoreFlag(e, RAX);
+            break;
+        case OP_SUBN:
+            EMIT_V(e, RAX, y, 0x8A); // mov al, Vy
+            EMIT_V(e, RAX, x, 0x2A); // sub al, Vx
+            emit8(e, 0x0F); emit8(e, 0x93); emit8(e, 0xC2); // setnc dl
+            EMIT_V(e, RAX, x, 0x88); // mov Vx, al
+            emitStoreFlag(e, RDX);
+            break;
+        case OP_SHR:
+        case OP_SHL:
+            EMIT_V(e, RAX, compatMode ? x : y, 0x8A); // mov al, src
+            emit8(e, 0x88); emit8(e, 0xC2); // mov dl, al
+            if (cls == OP_SHR) {
+                emit8(e, 0x80); emit8(e, 0xE2); emit8(e, 0x01); // and dl, 1
+                emit8(e, 0xD0); emit8(e, 0xE8); // shr al, 1
+            } else {
+                emit8(e, 0xC0); emit8(e, 0xEA); emit8(e, 0x07); // shr dl, 7
+                emit8(e, 0xD0); emit8(e, 0xE0); // shl al, 1
+            }
+            EMIT_V(e, RAX, x, 0x88); // mov Vx, al
+            emitStoreFlag(e, RDX);
+            EMIT_FIELD(e, RDX, OFF_CARRY, 0x88); // mov [carry], dl
+            break;
+        case OP_LD_I:
+            EMIT_FIELD(e, 0, OFF_I, 0x66, 0xC7); // mov word [I], nnn
+            emit16(e, nnn);
+            break;
+        case OP_JP_V0:
+            EMIT_V(e, RAX, 0, 0x0F, 0xB6); // movzx eax, V0
+            emit8(e, 0x05); // add eax, nnn
+            emit32(e, nnn);
+            EMIT_FIELD(e, RAX, OFF_PC, 0x66, 0x89); // mov word [pc], ax
+            emitJump(e, FIXUP_EPILOGUE, 0);
+            break;
+        case OP_LD_VX_DT:
+            EMIT_FIELD(e, RAX, OFF_DELAY, 0x8A); // mov al, [delay_timer]
+            EMIT_V(e, RAX, x, 0x88); // mov Vx, al
+            break;
+        case OP_LD_DT:
+        case OP_LD_ST:
+            EMIT_V(e, RAX, x, 0x8A); // mov al, Vx
+            EMIT_FIELD(e, RAX, cls == OP_LD_DT ? OFF_DELAY : OFF_SOUND, 0x88); // mov [timer], al
+            break;
+        case OP_ADD_I:
+            EMIT_V(e, RAX, x, 0x0F, 0xB6); // movzx eax, Vx
+            EMIT_FIELD(e, RAX, OFF_I, 0x66, 0x01); // add word [I], ax
+            break;
+        case OP_LD_F:
+            EMIT_V(e, RAX, x, 0x0F, 0xB6); // movzx eax, Vx
+            emit8(e, 0x8D); emit8(e, 0x04); emit8(e, 0x80); // lea eax, [rax + rax*4]
+            EMIT_FIELD(e, RAX, OFF_I, 0x66, 0x89); // mov word [I], ax
+            break;
+        case OP_LOAD:
+            EMIT_FIELD(e, RAX, OFF_I, 0x0F, 0xB7); // movzx eax, word [I]
+            for (int i = 0; i <= x; ++i) {
+                emit8(e, 0x8D); emit8(e, 0x48); emit8(e, (uint8_t)i); // lea ecx, [rax + i]
+                emit8(e, 0x81); emit8(e, 0xE1); emit32(e, 0xFFF); // and ecx, 0xFFF
+                emit8(e, 0x8A); emit8(e, 0x94); emit8(e, 0x0F); emit32(e, OFF_MEMORY); // mov dl, [rdi + rcx + memory]
+                EMIT_V(e, RDX, i, 0x88); // mov Vi, dl
+            }
+            if (!compatMode) {
+                EMIT_FIELD(e, 0, OFF_I, 0x66, 0x83); // add word [I], x + 1
+                emit8(e, (uint8_t)(x + 1));
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static void patch32(struct Emitter *e, uint32_t at, uint32_t target) {
+    const int32_t rel = (int32_t)target - (int32_t)(at + 4);
+    memcpy(e->code + at, &rel, sizeof(rel));
+}
+
+// Scan forward from pc and translate the region into e->code. Returns the number of instructions compiled
+static int compileRegion(struct Emitter *e, const struct Chip8 *chip8, uint16_t pc) {
+    uint16_t opcodes[JIT_MAX_REGION_OPS];
+    uint8_t classes[JIT_MAX_REGION_OPS];
+    int uses[16] = { 0 };
+    uint16_t address = pc;
+    const uint8_t mode = modeKey(chip8);
+
+    e->count = 0;
+    e->size = 0;
+    e->fixupCount = 0;
+    e->start = pc;
+    while (e->count < JIT_MAX_REGION_OPS && address <= MEMORY_SIZE - 2) {
+        const uint16_t opcode = chip8->memory[address] << 8 | chip8->memory[address + 1];
+        const enum OpClass cls = classifyOpcode(opcode);
+        if (!isCompilable(cls)) break;
+        opcodes[e->count] = opcode;
+        classes[e->count] = (uint8_t)cls;
+        countRegisterUse(opcode, cls, uses);
+        e->count++;
+        address += 2;
+        if (endsRegion(cls)) break;
+    }
+    e->end = address;
+    if (e->count == 0) return 0;
+
+    allocateRegisters(e, uses);
+    emitPrologue(e);
+    for (int i = 0; i < e->count; ++i) {
+        e->labels[i] = (uint32_t)e->size;
+        emit8(e, 0x41); emit8(e, 0x83); emit8(e, 0xEC); emit8(e, 0x01); // sub r12d, 1
+        emitJumpIf(e, CC_L, FIXUP_BUDGET, (uint16_t)i);
+        EMIT_FIELD(e, 0, OFF_OPCODE, 0x66, 0xC7); // mov word [opcode], opcode
+        emit16(e, opcodes[i]);
+        // The guest pc is only written on the way out, so every exit path stores it
+        emitOp(e, pc + 2 * i, opcodes[i], (enum OpClass)classes[i], mode);
+    }
+
+    // Falling off the end, pc continues after the region
+    emitStorePc(e, e->end);
+    const uint32_t epilogue = (uint32_t)e->size;
+    emitEpilogue(e);
+
+    // Budget stubs give the instruction back and leave with pc pointing at it
+    uint32_t budgetStubs[JIT_MAX_REGION_OPS];
+    for (int i = 0; i < e->count; ++i) {
+        budgetStubs[i] = (uint32_t)e->size;
+        emit8(e, 0x41); emit8(e, 0x83); emit8(e, 0xC4); emit8(e, 0x01); // add r12d, 1
+        emitStorePc(e, pc + 2 * i);
+        emit8(e, 0xE9);
+        emit32(e, 0);
+        patch32(e, (uint32_t)e->size - 4, epilogue);
+    }
+
+    for (int i = 0; i < e->fixupCount; ++i) {
+        const struct Fixup *fixup = &e->fixups[i];
+        if (fixup->kind == FIXUP_BUDGET) {
+            patch32(e, fixup->at, budgetStubs[fixup->value]);
+        } else if (fixup->kind == FIXUP_EPILOGUE) {
+            patch32(e, fixup->at, epilogue);
+        } else if (fixup->value >= e->start && fixup->value < e->end && !((fixup->value - e->start) & 1)) {
+            patch32(e, fixup->at, e->labels[(fixup->value - e->start) / 2]);
+        } else {
+            // Leaves the region, one exit stub per branch
+            patch32(e, fixup->at, (uint32_t)e->size);
+            emitStorePc(e, fixup->value);
+            emit8(e, 0xE9);
+            emit32(e, 0);
+            patch32(e, (uint32_t)e->size - 4, epilogue);
+        }
+    }
+    return e->count;
+}
+
+static void markCovered(struct Jit *jit, uint16_t start, uint16_t end) {
+    for (int address = start; address < end; ++address) {
+        jit->covered[address >> 6] |= 1ULL << (address & 63);
+    }
+}
+
+// Switch the pages holding [offset, offset + length) of the code buffer between read/write and read/execute
+static int protectCode(struct Jit *jit, size_t offset, size_t length, bool writable) {
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t start = offset & ~(page - 1);
+    const size_t end = (offset + length + page - 1) & ~(page - 1);
+    return mprotect(jit->code + start, (end < JIT_CODE_SIZE ? end : JIT_CODE_SIZE) - start,
+                    writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC);
+}
+
+// Compile the region at pc into the code buffer, flushing everything first if the buffer is full. A region whose
+// pages cannot be switched is left to the interpreter
+static void compileAt(struct Jit *jit, const struct Chip8 *chip8, uint16_t pc) {
+    struct Emitter emitter;
+    struct JitRegion *region;
+    int count;
+
+    if (jit->codeUsed + MAX_REGION_CODE > JIT_CODE_SIZE) flushJit(jit);
+    region = &jit->regions[pc];
+
+    emitter.code = jit->code + jit->codeUsed;
+    region->modeKey = modeKey(chip8);
+    if (protectCode(jit, jit->codeUsed, MAX_REGION_CODE, true) != 0) {
+        count = 0;
+    } else {
+        count = compileRegion(&emitter, chip8, pc);
+        if (protectCode(jit, jit->codeUsed, MAX_REGION_CODE, false) != 0) count = 0;
+    }
+    if (count == 0) {
+        region->state = REGION_INTERPRET;
+        region->end = pc + 2;
+        markCovered(jit, pc, region->end);
+        return;
+    }
+    region->state = REGION_COMPILED;
+    region->codeOffset = (uint32_t)jit->codeUsed;
+    region->end = emitter.end;
+    jit->codeUsed += (emitter.size + 15) & ~(size_t)15;
+    jit->stats.compiled++;
+    markCovered(jit, pc, emitter.end);
+}
+
+// Compare the state a native run can touch against the interpreter's
+static bool sameState(const struct Chip8 *a, const struct Chip8 *b) {
+    return a->opcode == b->opcode && a->I == b->I && a->pc == b->pc && a->sp == b->sp && a->carry == b->carry &&
+           a->delay_timer == b->delay_timer && a->sound_timer == b->sound_timer &&
+           memcmp(a->V, b->V, sizeof(a->V)) == 0 && memcmp(a->stack, b->stack, sizeof(a->stack)) == 0 &&
+           memcmp(a->memory, b->memory, sizeof(a->memory)) == 0;
+}
+
+// Run one native region and, in lockstep mode, the same number of instructions on an interpreter copy
+static int runRegion(struct Jit *jit, struct Chip8 *chip8, const struct JitRegion *region, int budget) {
+    const RegionFn fn = (RegionFn)(void *)(jit->code + region->codeOffset);
+    const uint16_t pc = chip8->pc;
+    int executed;
+
+    if (!jit->lockstep) return budget - fn(chip8, budget);
+
+    memcpy(jit->shadow, chip8, sizeof(struct Chip8));
+    jit->shadow->blockCache = NULL;
+    jit->shadow->jit = NULL;
+    executed = budget - fn(chip8, budget);
+    executeCyclesSwitch(jit->shadow, executed);
+    jit->stats.lockstepChecks++;
+    if (!sameState(chip8, jit->shadow)) {
+        jit->stats.lockstepMismatches++;
+        printf("JIT mismatch: region 0x%03X ran %d instructions, pc 0x%03X (interpreter 0x%03X), I 0x%03X (interpreter 0x%03X)\n",
+               pc, executed, chip8->pc, jit->shadow->pc, chip8->I, jit->shadow->I);
+        // Carry on from the interpreter's state
+        jit->shadow->blockCache = chip8->blockCache;
+        jit->shadow->jit = chip8->jit;
+        memcpy(chip8, jit->shadow, sizeof(struct Chip8));
+    }
+    return executed;
+}
+
+// Attach a JIT to an instance. Returns -1 if executable memory is not available, the interpreter is used then
+int enableJit(struct Chip8 *chip8) {
+    if (chip8->jit) return 0;
+
+    struct Jit *jit = calloc(1, sizeof(struct Jit));
+    if (!jit) {
+        printf("Memory could not be allocated.\n");
+        return -1;
+    }
+    void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        printf("JIT code buffer could not be mapped.\n");
+        free(jit);
+        return -1;
+    }
+    // Hardened runtimes refuse executable anonymous memory, find out now rather than on the first compile
+    if (mprotect(code, JIT_CODE_SIZE, PROT_READ | PROT_EXEC) != 0) {
+        printf("JIT code buffer could not be made executable.\n");
+        munmap(code, JIT_CODE_SIZE);
+        free(jit);
+        return -1;
+    }
+    jit->code = code;
+    chip8->jit = jit;
+    return 0;
+}
+
+void disableJit(struct Chip8 *chip8) {
+    struct Jit *jit = chip8->jit;
+    if (!jit) return;
+    munmap(jit->code, JIT_CODE_SIZE);
+    free(jit->shadow);
+    free(jit);
+    chip8->jit = NULL;
+}
+
+// Compare every native region against the interpreter, slow but catches any translation bug
+int setJitLockstep(struct Chip8 *chip8, bool enabled) {
+    struct Jit *jit = chip8->jit;
+    if (!jit) return -1;
+    if (enabled && !jit->shadow) {
+        jit->shadow = calloc(1, sizeof(struct Chip8));
+        if (!jit->shadow) {
+            printf("Memory could not be allocated.\n");
+            return -1;
+        }
+    }
+    jit->lockstep = enabled;
+    return 0;
+}
+
+// Drop every region and reuse the whole code buffer
+void flushJit(struct Jit *jit) {
+    memset(jit->regions, 0, sizeof(jit->regions));
+    memset(jit->covered, 0, sizeof(jit->covered));
+    jit->codeUsed = 0;
+    jit->stats.flushes++;
+}
+
+// Drop every region that overlaps [address, address + length), wrapping at 4K. Regions are at most
+// JIT_MAX_REGION_OPS instructions long, so only starts that close before the write can reach it
+void invalidateJit(struct Jit *jit, uint16_t address, int length) {
+    bool hit = false;
+    for (int i = 0; i < length; ++i) {
+        const int a = (address + i) & 0xFFF;
+        if (jit->covered[a >> 6] & (1ULL << (a & 63))) {
+            hit = true;
+            break;
+        }
+    }
+    if (!hit) return;
+
+    for (int i = 0; i < length; ++i) {
+        const int written = (address + i) & 0xFFF;
+        for (int back = 0; back < JIT_MAX_REGION_OPS * 2; ++back) {
+            const int start = written - back;
+            if (start < 0) break;
+            struct JitRegion *region = &jit->regions[start];
+            if (region->state != REGION_EMPTY && region->end > written) {
+                region->state = REGION_EMPTY;
+                region->heat = 0;
+                jit->stats.invalidations++;
+            }
+        }
+    }
+}
+
+// Run up to count instructions, native where a region is compiled and interpreted otherwise.
+// Stops early on FX0A or 00FD like executeCycles
+uint64_t executeJit(struct Chip8 *chip8, int count) {
+    struct Jit *jit = chip8->jit;
+    uint64_t executed = 0;
+
+    while ((int)executed < count && chip8->speed > 0 && chip8->running) {
+        const uint16_t pc = chip8->pc;
+        struct JitRegion *region = pc <= MEMORY_SIZE - 2 ? &jit->regions[pc] : NULL;
+
+        if (region && region->state != REGION_EMPTY && region->modeKey != modeKey(chip8)) {
+            region->state = REGION_EMPTY;
+        }
+        if (region && region->state == REGION_EMPTY && ++region->heat >= JIT_HOT_THRESHOLD) {
+            compileAt(jit, chip8, pc);
+            region = &jit->regions[pc];
+        }
+        if (region && region->state == REGION_COMPILED) {
+            const int ran = runRegion(jit, chip8, region, count - (int)executed);
+            jit->stats.nativeInstructions += ran;
+            executed += ran;
+        } else {
+            emulateCycle(chip8);
+            jit->stats.interpretedInstructions++;
+            ++executed;
+        }
+    }
+    return executed;
+}
+
+#else
+
+// No native backend on this host, the JIT API stays available and runs the interpreter
+
+int enableJit(struct Chip8 *chip8) {
+    (void)chip8;
+    printf("JIT not supported on this platform.\n");
+    return -1;
+}
+
+void disableJit(struct Chip8 *chip8) {
+    (void)chip8;
+}
+
+int setJitLockstep(struct Chip8 *chip8, bool enabled) {
+    (void)chip8;
+    (void)enabled;
+    return -1;
+}
+
+void flushJit(struct Jit *jit) {
+    (void)jit;
+}
+
+void invalidateJit(struct Jit *jit, uint16_t address, int length) {
+    (void)jit;
+    (void)address;
+    (void)length;
+}
+
+uint64_t executeJit(struct Chip8 *chip8, int count) {
+    return executeCycles(chip8, count);
+}
+
+#endif
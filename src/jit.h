@@ -0,0 +1,61 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "core.h"
+
+// Native code generation needs x86-64 and a way to map executable memory
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define CHIP8_HAVE_JIT 1
+#endif
+
+#define JIT_MAX_REGION_OPS 64
+#define JIT_HOT_THRESHOLD 2 // Entries into a pc before it gets compiled
+#define JIT_CODE_SIZE (4 * 1024 * 1024)
+
+enum JitRegionState {
+    REGION_EMPTY, // Never seen or invalidated
+    REGION_COMPILED, // Native code at codeOffset
+    REGION_INTERPRET // First instruction has no native form, always goes to emulateCycle
+};
+
+// Native code for the run of instructions starting at one pc
+struct JitRegion {
+    uint32_t codeOffset;
+    uint16_t end; // First byte past the region
+    uint16_t heat;
+    uint8_t state; // enum JitRegionState
+    uint8_t modeKey; // compatMode/highRes the code was specialised for
+};
+
+struct JitStats {
+    uint64_t compiled; // Regions compiled
+    uint64_t nativeInstructions; // Instructions executed as native code
+    uint64_t interpretedInstructions; // Instructions that fell back to emulateCycle
+    uint64_t invalidations; // Regions dropped because memory under them was written
+    uint64_t flushes; // Whole-cache flushes (reset, ROM load, code buffer full)
+    uint64_t lockstepChecks; // Native runs compared against the interpreter
+    uint64_t lockstepMismatches; // Native runs that did not match the interpreter
+};
+
+struct Jit {
+    uint8_t *code; // Buffer shared by all regions, read/execute except while a region is written
+    size_t codeUsed;
+    struct JitRegion regions[MEMORY_SIZE]; // Indexed by start address
+    uint64_t covered[MEMORY_SIZE / 64]; // Bytes that lie inside at least one compiled region
+    bool lockstep; // Run every native region against the interpreter as well
+    struct Chip8 *shadow; // Interpreter copy used by the lockstep mode
+    struct JitStats stats;
+};
+
+// Function prototypes
+int enableJit(struct Chip8 *chip8);
+void disableJit(struct Chip8 *chip8);
+int setJitLockstep(struct Chip8 *chip8, bool enabled);
+void flushJit(struct Jit *jit);
+void invalidateJit(struct Jit *jit, uint16_t address, int length);
+uint64_t executeJit(struct Chip8 *chip8, int count);
+
+#endif // JIT_H
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "movie.h"
+
+_Static_assert(sizeof(struct MovieEvent) == 8, "MovieEvent must stay 8 bytes");
+
+// Call after initChip8, seedRandom, setInstructionsPerFrame and loadRom, before the first frame
+void startMovie(struct Movie *movie, const struct Chip8 *chip8, uint32_t hashInterval) {
+    memset(movie, 0, sizeof(*movie));
+    movie->seed = chip8->randomState;
+    movie->instructionsPerFrame = (uint32_t)chip8->IPC;
+    movie->hashInterval = hashInterval > 0 ? hashInterval : 1;
+    movie->startDigest = stateDigest(chip8);
+}
+
+// Append the frame runFrame just finished. Returns -1 if the movie could not grow
+int recordFrame(struct Movie *movie, const struct Chip8 *chip8) {
+    if (movie->frameCount == movie->capacity) {
+        const int capacity = movie->capacity ? movie->capacity * 2 : 3600;
+        uint16_t *keys = realloc(movie->keys, capacity * sizeof(uint16_t));
+        if (keys) movie->keys = keys;
+        uint64_t *hashes = realloc(movie->hashes, (capacity / movie->hashInterval + 1) * sizeof(uint64_t));
+        if (hashes) movie->hashes = hashes;
+        if (!keys || !hashes) {
+            printf("Memory could not be allocated.\n");
+            return -1;
+        }
+        movie->capacity = capacity;
+    }
+    // Key events the frame applied partway through
+    if (movie->eventCount + chip8->appliedEventCount > movie->eventCapacity) {
+        const int capacity = movie->eventCapacity ? movie->eventCapacity * 2 : 1024;
+        struct MovieEvent *events = realloc(movie->events, capacity * sizeof(struct MovieEvent));
+        if (!events) {
+            printf("Memory could not be allocated.\n");
+            return -1;
+        }
+        movie->events = events;
+        movie->eventCapacity = capacity;
+    }
+    for (int i = 0; i < chip8->appliedEventCount; ++i) {
+        movie->events[movie->eventCount].frame = (uint32_t)movie->frameCount;
+        movie->events[movie->eventCount++].event = chip8->inputEvents[i];
+    }
+    movie->keys[movie->frameCount++] = chip8->KC;
+    if (movie->frameCount % movie->hashInterval == 0) {
+        movie->hashes[movie->frameCount / movie->hashInterval - 1] = framebufferHash(chip8);
+    }
+    return 0;
+}
+
+void freeMovie(struct Movie *movie) {
+    free(movie->keys);
+    free(movie->hashes);
+    free(movie->events);
+    memset(movie, 0, sizeof(*movie));
+}
+
+int writeMovie(const struct Movie *movie, const char *path) {
+    struct MovieFileHeader header;
+    const size_t hashCount = movie->frameCount / movie->hashInterval;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MOVIE_MAGIC, 4);
+    header.version = MOVIE_VERSION;
+    header.byteOrder = MOVIE_BYTE_ORDER;
+    header.seed = movie->seed;
+    header.instructionsPerFrame = movie->instructionsPerFrame;
+    header.frameCount = (uint32_t)movie->frameCount;
+    header.hashInterval = movie->hashInterval;
+    header.startDigest = movie->startDigest;
+
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        printf("File could not be opened: %s\n", path);
+        return -1;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (ok && movie->frameCount > 0) ok = fwrite(movie->keys, sizeof(uint16_t), movie->frameCount, file) == (size_t)movie->frameCount;
+    if (ok && hashCount > 0) ok = fwrite(movie->hashes, sizeof(uint64_t), hashCount, file) == hashCount;
+    const uint32_t eventCount = (uint32_t)movie->eventCount;
+    if (ok) ok = fwrite(&eventCount, sizeof(eventCount), 1, file) == 1;
+    if (ok && eventCount > 0) ok = fwrite(movie->events, sizeof(struct MovieEvent), eventCount, file) == eventCount;
+    if (fclose(file) != 0 || !ok) {
+        printf("Writing error.\n");
+        return -1;
+    }
+    return 0;
+}
+
+int readMovie(struct Movie *movie, const char *path) {
+    struct MovieFileHeader header;
+
+    memset(movie, 0, sizeof(*movie));
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        printf("File could not be opened: %s\n", path);
+        return -1;
+    }
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, MOVIE_MAGIC, 4) != 0) {
+        printf("Not a movie file.\n");
+        fclose(file);
+        return -1;
+    }
+    if (header.byteOrder != MOVIE_BYTE_ORDER || header.version < 1 || header.version > MOVIE_VERSION || header.hashInterval == 0 ||
+        header.frameCount > INT32_MAX) {
+        printf("Movie version %d is not supported.\n", header.version);
+        fclose(file);
+        return -1;
+    }
+
+    const size_t hashCount = header.frameCount / header.hashInterval;
+    movie->seed = header.seed;
+    movie->instructionsPerFrame = header.instructionsPerFrame;
+    movie->hashInterval = header.hashInterval;
+    movie->startDigest = header.startDigest;
+    movie->frameCount = movie->capacity = (int)header.frameCount;
+    movie->keys = malloc(header.frameCount * sizeof(uint16_t) + 1);
+    movie->hashes = malloc(hashCount * sizeof(uint64_t) + 1);
+    if (!movie->keys || !movie->hashes) {
+        printf("Memory could not be allocated.\n");
+        fclose(file);
+        freeMovie(movie);
+        return -1;
+    }
+    if (fread(movie->keys, sizeof(uint16_t), header.frameCount, file) != header.frameCount ||
+        fread(movie->hashes, sizeof(uint64_t), hashCount, file) != hashCount) {
+        printf("Movie is truncated.\n");
+        fclose(file);
+        freeMovie(movie);
+        return -1;
+    }
+    uint32_t eventCount = 0;
+    if (header.version >= 2) {
+        if (fread(&eventCount, sizeof(eventCount), 1, file) != 1 || eventCount > INT32_MAX ||
+            !(movie->events = malloc(eventCount * sizeof(struct MovieEvent) + 1)) ||
+            fread(movie->events, sizeof(struct MovieEvent), eventCount, file) != eventCount) {
+            printf("Movie is truncated.\n");
+            fclose(file);
+            freeMovie(movie);
+            return -1;
+        }
+    }
+    movie->eventCount = movie->eventCapacity = (int)eventCount;
+    fclose(file);
+    return 0;
+}
+
+// Replay a movie on a machine that has just been initialized and had the same ROM loaded. Frames run back
+// to back with no pacing. Stops at the first framebuffer hash that differs. Returns 0 when everything matched
+int replayMovie(struct Chip8 *chip8, const struct Movie *movie, struct ReplayResult *result) {
+    memset(result, 0, sizeof(*result));
+    result->firstMismatch = -1;
+
+    seedRandom(chip8, movie->seed);
+    setInstructionsPerFrame(chip8, (int)movie->instructionsPerFrame);
+    if (stateDigest(chip8) != movie->startDigest) {
+        printf("Movie was recorded with a different ROM.\n");
+        return -1;
+    }
+
+    int event = 0;
+    for (int frame = 0; frame < movie->frameCount && chip8->running; ++frame) {
+        // KC is latched from key[] at the end of the frame, the same point the recording read it. Instructions only
+        // see KC, so the events inside the frame are replayed at their offsets
+        const uint16_t keys = movie->keys[frame];
+        for (int key = 0; key < 16; ++key) {
+            chip8->key[key] = (keys >> key) & 1;
+        }
+        for (; event < movie->eventCount && movie->events[event].frame == (uint32_t)frame; ++event) {
+            const struct InputEvent *input = &movie->events[event].event;
+            queueKeyEvent(chip8, input->key, input->pressed, input->offset);
+        }
+        result->instructions += runFrame(chip8);
+        result->frames = frame + 1;
+
+        if (result->frames % movie->hashInterval == 0) {
+            result->hashesChecked++;
+            if (framebufferHash(chip8) != movie->hashes[result->frames / movie->hashInterval - 1]) {
+                result->firstMismatch = frame;
+                return -1;
+            }
+        }
+    }
+    return result->frames == movie->frameCount ? 0 : -1;
+}
@@ -0,0 +1,64 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "core.h"
+
+#define MOVIE_MAGIC "C8MV"
+#define MOVIE_VERSION 2 // Version 1 movies have no event section and still replay
+#define MOVIE_BYTE_ORDER 0x0102
+#define MOVIE_HASH_INTERVAL 1 // Frames between framebuffer hashes when recording
+
+// A key event applied partway through a recorded frame
+struct MovieEvent {
+    uint32_t frame;
+    struct InputEvent event;
+};
+
+// Input movie: the KC key mask of every frame from power-on, the key events applied inside frames, plus
+// framebuffer hashes to check a replay against. The machine's seed and speed are part of the movie, so a replay
+// needs nothing but the ROM
+struct Movie {
+    uint32_t seed; // randomState when recording started
+    uint32_t instructionsPerFrame;
+    uint32_t hashInterval;
+    uint64_t startDigest; // stateDigest after the ROM was loaded, catches a replay against the wrong ROM
+    int frameCount;
+    int capacity;
+    uint16_t *keys; // KC after each frame
+    uint64_t *hashes; // framebufferHash after every hashInterval-th frame
+    int eventCount;
+    int eventCapacity;
+    struct MovieEvent *events; // In frame order
+};
+
+// Movie file: this header, then frameCount key masks, then frameCount / hashInterval hashes. From version 2 a
+// uint32_t event count and the events follow
+struct MovieFileHeader {
+    char magic[4]; // MOVIE_MAGIC
+    uint16_t version;
+    uint16_t byteOrder; // MOVIE_BYTE_ORDER
+    uint32_t seed;
+    uint32_t instructionsPerFrame;
+    uint32_t frameCount;
+    uint32_t hashInterval;
+    uint64_t startDigest;
+};
+
+struct ReplayResult {
+    int frames; // Frames replayed
+    uint64_t instructions;
+    int hashesChecked;
+    int firstMismatch; // Frame whose hash differed, -1 if every hash matched
+};
+
+// Function prototypes
+void startMovie(struct Movie *movie, const struct Chip8 *chip8, uint32_t hashInterval);
+int recordFrame(struct Movie *movie, const struct Chip8 *chip8);
+void freeMovie(struct Movie *movie);
+int writeMovie(const struct Movie *movie, const char *path);
+int readMovie(struct Movie *movie, const char *path);
+int replayMovie(struct Chip8 *chip8, const struct Movie *movie, struct ReplayResult *result);
+
+#endif // MOVIE_H
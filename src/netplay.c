@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "netplay.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#define CHIP8_HAVE_NETPLAY 1
+_Static_assert(sizeof(struct sockaddr_in) <= sizeof(((struct Netplay *)0)->peerAddress), "peerAddress is too small");
+#endif
+
+#define SLOT(frame) ((frame) & (NETPLAY_WINDOW - 1))
+
+// Packet layout, every field big-endian:
+//   0  magic[4]     NETPLAY_MAGIC
+//   4  session      hash of the starting state
+//   8  start        frame of the first input
+//   12 ack          the sender has every input of ours before this frame
+//   16 frame        the sender's next frame
+//   20 digestFrame  frame + 1 of digest, 0 when there is none yet
+//   24 digest       state after a confirmed frame
+//   32 advantage    int8, how far the sender is ahead of what it has heard from us
+//   33 player
+//   34 count        inputs that follow, uint16 each
+
+uint16_t netplayKeyMask(int player) {
+    return player ? NETPLAY_RIGHT_KEYS : NETPLAY_LEFT_KEYS;
+}
+
+static void put16(uint8_t *data, uint16_t value) {
+    data[0] = value >> 8;
+    data[1] = value & 0xFF;
+}
+
+static void put32(uint8_t *data, uint32_t value) {
+    put16(data, value >> 16);
+    put16(data + 2, value & 0xFFFF);
+}
+
+static void put64(uint8_t *data, uint64_t value) {
+    put32(data, value >> 32);
+    put32(data + 4, value & 0xFFFFFFFF);
+}
+
+static uint16_t get16(const uint8_t *data) {
+    return (uint16_t)(data[0] << 8 | data[1]);
+}
+
+static uint32_t get32(const uint8_t *data) {
+    return (uint32_t)get16(data) << 16 | get16(data + 2);
+}
+
+static uint64_t get64(const uint8_t *data) {
+    return (uint64_t)get32(data) << 32 | get32(data + 4);
+}
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift32, only decides which packets the injected loss and jitter hit
+static uint32_t netRandom(struct Netplay *netplay) {
+    uint32_t x = netplay->randomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    netplay->randomState = x;
+    return x;
+}
+
+// Run one frame with the local input and the remote input, known or predicted, then snapshot the state after it
+static void runNetplayFrame(struct Netplay *netplay, struct Chip8 *chip8, uint32_t frame) {
+    const uint16_t remote = frame < netplay->confirmedFrame ? netplay->remoteInputs[SLOT(frame)] : netplay->lastRemote;
+    const uint16_t keys = netplay->localInputs[SLOT(frame)] | remote;
+
+    for (int key = 0; key < 16; ++key) {
+        chip8->key[key] = (keys >> key) & 1;
+    }
+    netplay->usedRemote[SLOT(frame)] = remote;
+    runFrame(chip8);
+    saveState(chip8, &netplay->snapshots[SLOT(frame + 1)]);
+}
+
+#ifdef CHIP8_HAVE_NETPLAY
+static void sendPacket(struct Netplay *netplay, const uint8_t *data, int size) {
+    sendto(netplay->socket, data, (size_t)size, 0, (const struct sockaddr *)netplay->peerAddress,
+           sizeof(struct sockaddr_in));
+}
+
+// Send the packets whose injected delay has passed
+static void flushDelayed(struct Netplay *netplay, double now) {
+    for (int i = 0; i < NETPLAY_DELAY_SLOTS; ++i) {
+        struct NetplayDelayed *delayed = &netplay->delayed[i];
+        if (delayed->size && delayed->sendAt <= now) {
+            sendPacket(netplay, delayed->data, delayed->size);
+            delayed->size = 0;
+        }
+    }
+}
+
+// Send a packet through the injected network conditions
+static void queuePacket(struct Netplay *netplay, const uint8_t *data, int size, double now) {
+    const struct NetplayConditions *conditions = &netplay->conditions;
+
+    ++netplay->stats.packetsSent;
+    if (conditions->lossPercent > 0 && (int)(netRandom(netplay) % 100) < conditions->lossPercent) {
+        ++netplay->stats.packetsDropped;
+        return;
+    }
+    if (conditions->latencyMs <= 0 && conditions->jitterMs <= 0) {
+        sendPacket(netplay, data, size);
+        return;
+    }
+    int delayMs = conditions->latencyMs > 0 ? conditions->latencyMs : 0;
+    if (conditions->jitterMs > 0) delayMs += (int)(netRandom(netplay) % (uint32_t)(conditions->jitterMs + 1));
+    for (int i = 0; i < NETPLAY_DELAY_SLOTS; ++i) {
+        struct NetplayDelayed *delayed = &netplay->delayed[i];
+        if (delayed->size == 0) {
+            delayed->sendAt = now + delayMs / 1000.0;
+            delayed->size = size;
+            memcpy(delayed->data, data, (size_t)size);
+            return;
+        }
+    }
+    ++netplay->stats.packetsDropped;
+}
+
+// Send every local input the peer has not acknowledged, with our frame and latest confirmed digest
+static void sendInputs(struct Netplay *netplay, double now) {
+    uint8_t packet[NETPLAY_PACKET_MAX];
+    uint32_t count = netplay->frame - netplay->peerAck;
+    int advantage = netplay->stats.packetsReceived ? (int)(netplay->frame - netplay->peerFrame) : 0;
+
+    if (count > NETPLAY_WINDOW) count = NETPLAY_WINDOW;
+    if (advantage > 127) advantage = 127;
+    if (advantage < -127) advantage = -127;
+    memcpy(packet, NETPLAY_MAGIC, 4);
+    put32(packet + 4, netplay->session);
+    put32(packet + 8, netplay->frame - count);
+    put32(packet + 12, netplay->confirmedFrame);
+    put32(packet + 16, netplay->frame);
+    put32(packet + 20, netplay->digestedFrame);
+    put64(packet + 24, netplay->digestedFrame ? netplay->digests[SLOT(netplay->digestedFrame - 1)] : 0);
+    packet[32] = (uint8_t)(int8_t)advantage;
+    packet[33] = (uint8_t)netplay->player;
+    put16(packet + 34, (uint16_t)count);
+    for (uint32_t i = 0; i < count; ++i) {
+        put16(packet + NETPLAY_HEADER_SIZE + i * 2, netplay->localInputs[SLOT(netplay->frame - count + i)]);
+    }
+    queuePacket(netplay, packet, NETPLAY_HEADER_SIZE + (int)count * 2, now);
+}
+
+// Take in every packet waiting on the socket. Returns the earliest frame that ran with a mispredicted remote input,
+// or the current frame when every prediction held
+static uint32_t receivePackets(struct Netplay *netplay) {
+    const uint16_t remoteMask = netplayKeyMask(!netplay->player);
+    uint32_t rollback = netplay->frame;
+    uint8_t packet[NETPLAY_PACKET_MAX];
+    ssize_t size;
+
+    while ((size = recv(netplay->socket, packet, sizeof(packet), 0)) >= 0) {
+        if (size < NETPLAY_HEADER_SIZE || memcmp(packet, NETPLAY_MAGIC, 4) != 0) continue;
+        if (get32(packet + 4) != netplay->session || packet[33] == netplay->player) continue;
+        const uint32_t start = get32(packet + 8);
+        const uint32_t count = get16(packet + 34);
+        if (count > NETPLAY_WINDOW || size < NETPLAY_HEADER_SIZE + (ssize_t)count * 2) continue;
+        ++netplay->stats.packetsReceived;
+
+        // Packets can arrive late or out of order, only ever move forward
+        const uint32_t ack = get32(packet + 12);
+        const uint32_t peerFrame = get32(packet + 16);
+        if (ack > netplay->peerAck && ack <= netplay->frame) netplay->peerAck = ack;
+        if (peerFrame >= netplay->peerFrame) {
+            netplay->peerFrame = peerFrame;
+            netplay->peerAdvantage = (int8_t)packet[32];
+        }
+        const uint32_t digestFrame = get32(packet + 20);
+        if (digestFrame > netplay->peerDigestFrame) {
+            netplay->peerDigestFrame = digestFrame;
+            netplay->peerDigest = get64(packet + 24);
+        }
+
+        // Inputs are contiguous from the first one we lack, never more than the window ahead of us
+        for (uint32_t i = 0; i < count; ++i) {
+            const uint32_t frame = start + i;
+            if (frame < netplay->confirmedFrame) continue;
+            if (frame > netplay->confirmedFrame || frame >= netplay->frame + NETPLAY_WINDOW / 2) break;
+            const uint16_t input = get16(packet + NETPLAY_HEADER_SIZE + i * 2) & remoteMask;
+            netplay->remoteInputs[SLOT(frame)] = input;
+            if (frame < netplay->frame && netplay->usedRemote[SLOT(frame)] != input && frame < rollback) {
+                rollback = frame;
+            }
+            netplay->lastRemote = input;
+            ++netplay->confirmedFrame;
+        }
+    }
+    return rollback;
+}
+#endif
+
+// Digest the frames that are now confirmed and simulated, and check the peer's digest once ours is there
+static void updateDigests(struct Netplay *netplay) {
+    const uint32_t until = netplay->confirmedFrame < netplay->frame ? netplay->confirmedFrame : netplay->frame;
+
+    for (; netplay->digestedFrame < until; ++netplay->digestedFrame) {
+        const struct Chip8State *after = &netplay->snapshots[SLOT(netplay->digestedFrame + 1)];
+        netplay->digests[SLOT(netplay->digestedFrame)] = hashBytes(HASH_SEED, after, sizeof(*after));
+    }
+    uint64_t digest;
+    if (netplay->peerDigestFrame > netplay->checkedDigestFrame &&
+        netplayConfirmedDigest(netplay, netplay->peerDigestFrame - 1, &digest)) {
+        if (digest != netplay->peerDigest) {
+            if (netplay->stats.desyncs == 0) printf("Netplay desync at frame %u.\n", netplay->peerDigestFrame - 1);
+            ++netplay->stats.desyncs;
+        }
+        netplay->checkedDigestFrame = netplay->peerDigestFrame;
+    }
+}
+
+// Open a session as player 0 or 1. Both sides have to start from the same state: same ROM, seed and speed
+int openNetplay(struct Netplay *netplay, const struct Chip8 *chip8, int player, int localPort, const char *peerHost,
+                int peerPort) {
+    memset(netplay, 0, sizeof(*netplay));
+    netplay->socket = -1;
+#ifdef CHIP8_HAVE_NETPLAY
+    struct addrinfo hints = { 0 };
+    struct addrinfo *found;
+    char port[16];
+
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    snprintf(port, sizeof(port), "%d", peerPort);
+    if (getaddrinfo(peerHost, port, &hints, &found) != 0) {
+        printf("Netplay peer could not be found: %s\n", peerHost);
+        return -1;
+    }
+    memcpy(netplay->peerAddress, found->ai_addr, sizeof(struct sockaddr_in));
+    freeaddrinfo(found);
+
+    struct sockaddr_in local = { 0 };
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons((uint16_t)localPort);
+    netplay->socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (netplay->socket < 0 || bind(netplay->socket, (struct sockaddr *)&local, sizeof(local)) != 0 ||
+        fcntl(netplay->socket, F_SETFL, fcntl(netplay->socket, F_GETFL) | O_NONBLOCK) != 0) {
+        printf("Netplay socket could not be opened on port %d.\n", localPort);
+        closeNetplay(netplay);
+        return -1;
+    }
+
+    netplay->snapshots = malloc(NETPLAY_WINDOW * sizeof(struct Chip8State));
+    netplay->delayed = calloc(NETPLAY_DELAY_SLOTS, sizeof(struct NetplayDelayed));
+    if (!netplay->snapshots || !netplay->delayed) {
+        printf("Memory could not be allocated.\n");
+        closeNetplay(netplay);
+        return -1;
+    }
+    netplay->player = player & 1;
+    netplay->randomState = 0x9E3779B9u ^ (uint32_t)localPort;
+    saveState(chip8, &netplay->snapshots[0]);
+    netplay->session = (uint32_t)hashBytes(HASH_SEED, &netplay->snapshots[0], sizeof(struct Chip8State));
+    return 0;
+#else
+    (void)chip8;
+    (void)player;
+    (void)localPort;
+    (void)peerHost;
+    (void)peerPort;
+    printf("Netplay is not available on this platform.\n");
+    return -1;
+#endif
+}
+
+void setNetplayConditions(struct Netplay *netplay, const struct NetplayConditions *conditions) {
+    netplay->conditions = *conditions;
+}
+
+// One 60 Hz tick: take in remote input, roll back and re-simulate if a prediction was wrong, then run the next frame
+// with the local keys unless the remote side is too far behind. Returns 1 when a frame was run, 0 when the tick was
+// spent waiting. A tick that rolled back marks every row changed, since frames already shown were replaced
+int netplayAdvance(struct Netplay *netplay, struct Chip8 *chip8, uint16_t keys, double now) {
+#ifdef CHIP8_HAVE_NETPLAY
+    flushDelayed(netplay, now);
+    const uint32_t rollback = receivePackets(netplay);
+    const bool rolledBack = rollback < netplay->frame;
+    int ran = 0;
+
+    if (rolledBack) {
+        const double start = nowSeconds();
+        const int depth = (int)(netplay->frame - rollback);
+        loadState(chip8, &netplay->snapshots[SLOT(rollback)]);
+        for (uint32_t frame = rollback; frame < netplay->frame; ++frame) runNetplayFrame(netplay, chip8, frame);
+        ++netplay->stats.rollbacks;
+        netplay->stats.resimulatedFrames += (uint64_t)depth;
+        if (depth > netplay->stats.maxRollback) netplay->stats.maxRollback = depth;
+        netplay->stats.resimulateSeconds += nowSeconds() - start;
+    }
+
+    // Frame advantage from both sides' point of view, the side ahead gives up a tick now and then. The remote side
+    // can be ahead of us, so confirmedFrame may be past frame
+    const int advantage = netplay->stats.packetsReceived ? (int)(netplay->frame - netplay->peerFrame) : 0;
+    if ((int32_t)(netplay->frame - netplay->confirmedFrame) >= NETPLAY_MAX_ROLLBACK ||
+        netplay->frame - netplay->peerAck >= NETPLAY_WINDOW - 1) {
+        ++netplay->stats.stalls;
+    } else if (advantage - netplay->peerAdvantage >= 2 && netplay->frame - netplay->lastSync >= NETPLAY_SYNC_INTERVAL) {
+        netplay->lastSync = netplay->frame;
+        ++netplay->stats.syncWaits;
+    } else {
+        netplay->localInputs[SLOT(netplay->frame)] = keys & netplayKeyMask(netplay->player);
+        runNetplayFrame(netplay, chip8, netplay->frame);
+        ++netplay->frame;
+        ++netplay->stats.frames;
+        ran = 1;
+    }
+
+    if (rolledBack) {
+        const int height = chip8->highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
+        chip8->changedRows = height == 64 ? ~0ULL : (1ULL << height) - 1;
+        chip8->drawFlag = true;
+    } else if (!ran) {
+        chip8->changedRows = 0;
+        chip8->drawFlag = false;
+    }
+    updateDigests(netplay);
+    sendInputs(netplay, now);
+    flushDelayed(netplay, now);
+    return ran;
+#else
+    (void)netplay;
+    (void)chip8;
+    (void)keys;
+    (void)now;
+    return 0;
+#endif
+}
+
+// Digest of the state after a confirmed frame, false when the frame is not confirmed or has left the window
+bool netplayConfirmedDigest(const struct Netplay *netplay, uint32_t frame, uint64_t *digest) {
+    if (frame >= netplay->digestedFrame || netplay->digestedFrame - frame > NETPLAY_WINDOW) return false;
+    *digest = netplay->digests[SLOT(frame)];
+    return true;
+}
+
+void printNetplayStats(const struct Netplay *netplay) {
+    const struct NetplayStats *stats = &netplay->stats;
+    printf("Netplay: %llu frames, %llu rollbacks (%llu frames re-simulated, deepest %d, %.3f ms each), "
+           "%llu stalls, %llu sync waits\n",
+           (unsigned long long)stats->frames, (unsigned long long)stats->rollbacks,
+           (unsigned long long)stats->resimulatedFrames, stats->maxRollback,
+           stats->rollbacks ? stats->resimulateSeconds * 1e3 / stats->rollbacks : 0.0,
+           (unsigned long long)stats->stalls, (unsigned long long)stats->syncWaits);
+    printf("Netplay packets: %llu sent, %llu received, %llu dropped, %llu desyncs\n",
+           (unsigned long long)stats->packetsSent, (unsigned long long)stats->packetsReceived,
+           (unsigned long long)stats->packetsDropped, (unsigned long long)stats->desyncs);
+}
+
+void closeNetplay(struct Netplay *netplay) {
+#ifdef CHIP8_HAVE_NETPLAY
+    if (netplay->socket >= 0) close(netplay->socket);
+#endif
+    netplay->socket = -1;
+    free(netplay->snapshots);
+    free(netplay->delayed);
+    netplay->snapshots = NULL;
+    netplay->delayed = NULL;
+}
@@ -0,0 +1,93 @@
+#ifndef NETPLAY_H
+#define NETPLAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "core.h"
+#include "savestate.h"
+
+#define NETPLAY_MAGIC "C8NP"
+#define NETPLAY_WINDOW 32 // Frames of inputs and snapshots kept, a power of two
+#define NETPLAY_MAX_ROLLBACK 8 // Frames the local side may run past the last confirmed remote input
+#define NETPLAY_SYNC_INTERVAL 16 // Fewest frames between two waits to let a lagging peer catch up
+#define NETPLAY_DELAY_SLOTS 128 // Outgoing packets held back by the injected latency
+#define NETPLAY_HEADER_SIZE 36
+#define NETPLAY_PACKET_MAX (NETPLAY_HEADER_SIZE + NETPLAY_WINDOW * 2)
+
+// Each player owns one half of the keypad, split down the middle of the 4x4 layout:
+//   1 2 | 3 C
+//   4 5 | 6 D
+//   7 8 | 9 E
+//   A 0 | B F
+#define NETPLAY_LEFT_KEYS 0x05B7 // 0, 1, 2, 4, 5, 7, 8, A
+#define NETPLAY_RIGHT_KEYS 0xFA48 // 3, 6, 9, B, C, D, E, F
+
+// Injected network conditions, applied to every packet this side sends
+struct NetplayConditions {
+    int latencyMs; // Added one-way delay
+    int jitterMs; // Extra random delay up to this much, packets can arrive out of order
+    int lossPercent; // Packets dropped before they are sent
+};
+
+struct NetplayStats {
+    uint64_t frames; // Frames advanced, not counting re-simulation
+    uint64_t rollbacks; // Mispredicted remote inputs that forced a restore
+    uint64_t resimulatedFrames;
+    int maxRollback; // Deepest rollback in frames
+    double resimulateSeconds; // Time spent restoring and re-simulating
+    uint64_t stalls; // Ticks spent waiting because the remote side fell NETPLAY_MAX_ROLLBACK frames behind
+    uint64_t syncWaits; // Ticks given up so a lagging peer could catch up
+    uint64_t packetsSent;
+    uint64_t packetsReceived;
+    uint64_t packetsDropped; // By the injected loss, or a full delay queue
+    uint64_t desyncs; // Confirmed frames whose state differed from the peer's
+};
+
+struct NetplayDelayed {
+    double sendAt;
+    int size;
+    uint8_t data[NETPLAY_PACKET_MAX];
+};
+
+// GGPO-style rollback session between two machines running the same ROM. Local input is applied at once and the
+// remote input is predicted by repeating the last one received. When the real input arrives and differs, the machine
+// goes back to the snapshot taken before that frame and re-simulates up to the present within the same tick.
+// Every packet carries all local inputs the peer has not acknowledged, so a lost packet costs nothing but time
+struct Netplay {
+    int socket;
+    uint8_t peerAddress[16]; // struct sockaddr_in
+    int player; // 0 plays the left half of the keypad, 1 the right
+    uint32_t session; // Hash of the starting state, packets from a machine in another state are ignored
+    uint32_t frame; // Next frame to run
+    uint32_t confirmedFrame; // Every remote input before this frame is known
+    uint32_t peerAck; // The peer knows every local input before this frame
+    uint32_t peerFrame; // Latest frame the peer reported reaching
+    int peerAdvantage; // How far the peer says it is ahead of us
+    uint32_t lastSync; // Frame of the last time sync wait
+    uint16_t lastRemote; // Latest confirmed remote input, the prediction
+    uint16_t localInputs[NETPLAY_WINDOW];
+    uint16_t remoteInputs[NETPLAY_WINDOW]; // Valid for frames before confirmedFrame
+    uint16_t usedRemote[NETPLAY_WINDOW]; // Remote input each simulated frame ran with
+    uint64_t digests[NETPLAY_WINDOW]; // State after each confirmed frame
+    uint32_t digestedFrame; // digests holds every frame before this one still in the window
+    uint32_t peerDigestFrame; // Frame + 1 of the peer's latest digest, 0 when there is none yet
+    uint32_t checkedDigestFrame; // Frame + 1 of the last digest compared with the peer's
+    uint64_t peerDigest;
+    struct Chip8State *snapshots; // NETPLAY_WINDOW states, the state before each frame in the window
+    struct NetplayConditions conditions;
+    struct NetplayDelayed *delayed; // NETPLAY_DELAY_SLOTS packets, size 0 when free
+    uint32_t randomState; // Loss and jitter
+    struct NetplayStats stats;
+};
+
+// Function prototypes
+uint16_t netplayKeyMask(int player);
+int openNetplay(struct Netplay *netplay, const struct Chip8 *chip8, int player, int localPort, const char *peerHost,
+                int peerPort);
+void setNetplayConditions(struct Netplay *netplay, const struct NetplayConditions *conditions);
+int netplayAdvance(struct Netplay *netplay, struct Chip8 *chip8, uint16_t keys, double now);
+bool netplayConfirmedDigest(const struct Netplay *netplay, uint32_t frame, uint64_t *digest);
+void printNetplayStats(const struct Netplay *netplay);
+void closeNetplay(struct Netplay *netplay);
+
+#endif // NETPLAY_H
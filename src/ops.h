@@ -0,0 +1,677 @@
+#ifndef OPS_H
+#define OPS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blockcache.h"
+#include "core.h"
+#include "dispatch.h"
+#include "jit.h"
+
+// Opcode handlers shared by every dispatch mode. Each handler gets the fetched opcode
+// (pc already points past it) and decodes its own operands once.
+
+// Quirk-sensitive helpers take the quirk bits as a parameter. QUIRKS_DYNAMIC reads each flag from the machine
+// where it is needed, a constant set of QUIRK_* bits lets the compiler drop the checks for a specialised interpreter
+#define QUIRKS_DYNAMIC (-1)
+
+static inline bool hasQuirk(const struct Chip8 *chip8, const int quirks, const int quirk) {
+    if (quirks == QUIRKS_DYNAMIC) {
+        switch (quirk) {
+            case QUIRK_COMPAT: return chip8->compatMode;
+            case QUIRK_HIGH_RES: return chip8->highRes;
+            default: return chip8->legacyMode;
+        }
+    }
+    return quirks & quirk;
+}
+
+// Opcode classes, one per handler
+enum OpClass {
+    OP_CLS,         // 00E0
+    OP_RET,         // 00EE
+    OP_SCROLL_DOWN, // 00CN
+    OP_SCROLL_UP,   // 00DN
+    OP_SCROLL_RIGHT,// 00FB
+    OP_SCROLL_LEFT, // 00FC
+    OP_SCROLL_DOWN_6,  // 00C6
+    OP_SCROLL_DOWN_12, // 00CC, 00DC
+    OP_COMPAT,      // 00FA
+    OP_LOW_RES,     // 00FE
+    OP_HIGH_RES,    // 00FF
+    OP_EXIT,        // 00FD
+    OP_JP,          // 1NNN
+    OP_CALL,        // 2NNN
+    OP_SE_IMM,      // 3XNN
+    OP_SNE_IMM,     // 4XNN
+    OP_SE_REG,      // 5XY0
+    OP_LD_IMM,      // 6XNN
+    OP_ADD_IMM,     // 7XNN
+    OP_LD_REG,      // 8XY0
+    OP_OR,          // 8XY1
+    OP_AND,         // 8XY2
+    OP_XOR,         // 8XY3
+    OP_ADD_REG,     // 8XY4
+    OP_SUB,         // 8XY5
+    OP_SHR,         // 8XY6
+    OP_SUBN,        // 8XY7
+    OP_SHL,         // 8XYE
+    OP_SNE_REG,     // 9XY0
+    OP_LD_I,        // ANNN
+    OP_JP_V0,       // BNNN
+    OP_RND,         // CXNN
+    OP_DRW,         // DXYN
+    OP_SKP,         // EX9E
+    OP_SKNP,        // EXA1
+    OP_LD_VX_DT,    // FX07
+    OP_LD_KEY,      // FX0A
+    OP_LD_DT,       // FX15
+    OP_LD_ST,       // FX18
+    OP_ADD_I,       // FX1E
+    OP_LD_F,        // FX29
+    OP_BCD,         // FX33
+    OP_STORE,       // FX55
+    OP_LOAD,        // FX65
+    OP_AUDIO,       // F002, XO-CHIP
+    OP_PITCH,       // FX3A, XO-CHIP
+    OP_UNKNOWN,
+    OP_COUNT
+};
+
+// Opcode pattern of each class, for reports
+static inline const char *opClassName(enum OpClass cls) {
+    static const char *const names[OP_COUNT] = {
+        [OP_CLS] = "00E0", [OP_RET] = "00EE", [OP_SCROLL_DOWN] = "00CN", [OP_SCROLL_UP] = "00DN",
+        [OP_SCROLL_RIGHT] = "00FB", [OP_SCROLL_LEFT] = "00FC", [OP_SCROLL_DOWN_6] = "00C6",
+        [OP_SCROLL_DOWN_12] = "00CC", [OP_COMPAT] = "00FA", [OP_LOW_RES] = "00FE", [OP_HIGH_RES] = "00FF",
+        [OP_EXIT] = "00FD", [OP_JP] = "1NNN", [OP_CALL] = "2NNN", [OP_SE_IMM] = "3XNN", [OP_SNE_IMM] = "4XNN",
+        [OP_SE_REG] = "5XY0", [OP_LD_IMM] = "6XNN", [OP_ADD_IMM] = "7XNN", [OP_LD_REG] = "8XY0", [OP_OR] = "8XY1",
+        [OP_AND] = "8XY2", [OP_XOR] = "8XY3", [OP_ADD_REG] = "8XY4", [OP_SUB] = "8XY5", [OP_SHR] = "8XY6",
+        [OP_SUBN] = "8XY7", [OP_SHL] = "8XYE", [OP_SNE_REG] = "9XY0", [OP_LD_I] = "ANNN", [OP_JP_V0] = "BNNN",
+        [OP_RND] = "CXNN", [OP_DRW] = "DXYN", [OP_SKP] = "EX9E", [OP_SKNP] = "EXA1", [OP_LD_VX_DT] = "FX07",
+        [OP_LD_KEY] = "FX0A", [OP_LD_DT] = "FX15", [OP_LD_ST] = "FX18", [OP_ADD_I] = "FX1E", [OP_LD_F] = "FX29",
+        [OP_BCD] = "FX33", [OP_STORE] = "FX55", [OP_LOAD] = "FX65", [OP_AUDIO] = "F002", [OP_PITCH] = "FX3A",
+        [OP_UNKNOWN] = "unknown",
+    };
+    return cls < OP_COUNT ? names[cls] : "unknown";
+}
+
+// Fetch the opcode at pc and step past it. Addresses wrap at 4K so a core can never read outside its own memory
+static inline uint16_t fetchOpcode(struct Chip8 *chip8) {
+    chip8->opcode = chip8->memory[chip8->pc & 0xFFF] << 8 | chip8->memory[(chip8->pc + 1) & 0xFFF];
+    chip8->pc += 2;
+    return chip8->opcode;
+}
+
+// Map an opcode to its class, following the same decode rules as emulateCycleSwitch
+static inline enum OpClass classifyOpcode(uint16_t opcode) {
+    switch (opcode & 0xF000) {
+        case 0x0000:
+            switch (opcode & 0x00FF) {
+                case 0x00E0: return OP_CLS;
+                case 0x00EE: return OP_RET;
+                case 0x00C0: return OP_SCROLL_DOWN;
+                case 0x00D0: return OP_SCROLL_UP;
+                case 0x00FB: return OP_SCROLL_RIGHT;
+                case 0x00FC: return OP_SCROLL_LEFT;
+                case 0x00C6: return OP_SCROLL_DOWN_6;
+                case 0x00DC: return OP_SCROLL_DOWN_12;
+                case 0x00CC: return OP_SCROLL_DOWN_12;
+                case 0x00FA: return OP_COMPAT;
+                case 0x00FE: return OP_LOW_RES;
+                case 0x00FF: return OP_HIGH_RES;
+                case 0x00FD: return OP_EXIT;
+                default: return OP_UNKNOWN;
+            }
+        case 0x1000: return OP_JP;
+        case 0x2000: return OP_CALL;
+        case 0x3000: return OP_SE_IMM;
+        case 0x4000: return OP_SNE_IMM;
+        case 0x5000: return OP_SE_REG;
+        case 0x6000: return OP_LD_IMM;
+        case 0x7000: return OP_ADD_IMM;
+        case 0x8000:
+            switch (opcode & 0x000F) {
+                case 0x0000: return OP_LD_REG;
+                case 0x0001: return OP_OR;
+                case 0x0002: return OP_AND;
+                case 0x0003: return OP_XOR;
+                case 0x0004: return OP_ADD_REG;
+                case 0x0005: return OP_SUB;
+                case 0x0006: return OP_SHR;
+                case 0x0007: return OP_SUBN;
+                case 0x000E: return OP_SHL;
+                default: return OP_UNKNOWN;
+            }
+        case 0x9000: return OP_SNE_REG;
+        case 0xA000: return OP_LD_I;
+        case 0xB000: return OP_JP_V0;
+        case 0xC000: return OP_RND;
+        case 0xD000: return OP_DRW;
+        case 0xE000:
+            switch (opcode & 0x00FF) {
+                case 0x009E: return OP_SKP;
+                case 0x00A1: return OP_SKNP;
+                default: return OP_UNKNOWN;
+            }
+        case 0xF000:
+            switch (opcode & 0x00FF) {
+                case 0x0002: return OP_AUDIO;
+                case 0x0007: return OP_LD_VX_DT;
+                case 0x000A: return OP_LD_KEY;
+                case 0x0015: return OP_LD_DT;
+                case 0x0018: return OP_LD_ST;
+                case 0x001E: return OP_ADD_I;
+                case 0x0029: return OP_LD_F;
+                case 0x0033: return OP_BCD;
+                case 0x0055: return OP_STORE;
+                case 0x0065: return OP_LOAD;
+                case 0x003A: return OP_PITCH;
+                default: return OP_UNKNOWN;
+            }
+        default: return OP_UNKNOWN;
+    }
+}
+
+// Display rows are packed, see struct Chip8. Low res only uses the first word of each row.
+// Anything that writes plane 0 marks the rows in dirtyRows so the frame can be diffed cheaply
+
+// Scroll the selected planes N lines down
+static inline void scrollDownQuirks(struct Chip8 *chip8, int n, const int quirks) {
+    const int height = hasQuirk(chip8, quirks, QUIRK_HIGH_RES) ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
+
+    if (n > 0) {
+        for (int plane = 0; plane < 2; ++plane) {
+            if (chip8->plane & (1 << plane)) {
+                memmove(chip8->gfx[plane][n], chip8->gfx[plane][0], (height - n) * sizeof(chip8->gfx[plane][0]));
+                memset(chip8->gfx[plane][0], 0, n * sizeof(chip8->gfx[plane][0]));
+            }
+        }
+        chip8->dirtyRows = ~0ULL;
+        chip8->drawFlag = true;
+    }
+}
+
+// Scroll the selected planes N lines up
+static inline void scrollUpQuirks(struct Chip8 *chip8, int n, const int quirks) {
+    const int height = hasQuirk(chip8, quirks, QUIRK_HIGH_RES) ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
+
+    if (n > 0) {
+        for (int plane = 0; plane < 2; ++plane) {
+            if (chip8->plane & (1 << plane)) {
+                memmove(chip8->gfx[plane][0], chip8->gfx[plane][n], (height - n) * sizeof(chip8->gfx[plane][0]));
+                memset(chip8->gfx[plane][height - n], 0, n * sizeof(chip8->gfx[plane][0]));
+            }
+        }
+        chip8->dirtyRows = ~0ULL;
+        chip8->drawFlag = true;
+    }
+}
+
+// Scroll the selected planes 4 pixels (2 in legacy low res) right or left
+static inline void scrollHorizontalQuirks(struct Chip8 *chip8, int right, const int quirks) {
+    const bool highRes = hasQuirk(chip8, quirks, QUIRK_HIGH_RES);
+    const int height = highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
+    const int scrollAmount = hasQuirk(chip8, quirks, QUIRK_LEGACY) && !highRes ? 2 : 4;
+
+    for (int plane = 0; plane < 2; ++plane) {
+        if (chip8->plane & (1 << plane)) {
+            for (int y = 0; y < height; ++y) {
+                uint64_t *row = chip8->gfx[plane][y];
+                if (!highRes) {
+                    row[0] = right ? row[0] >> scrollAmount : row[0] << scrollAmount;
+                } else if (right) {
+                    row[1] = row[1] >> scrollAmount | row[0] << (64 - scrollAmount);
+                    row[0] >>= scrollAmount;
+                } else {
+                    row[0] = row[0] << scrollAmount | row[1] >> (64 - scrollAmount);
+                    row[1] <<= scrollAmount;
+                }
+            }
+        }
+    }
+    chip8->dirtyRows = ~0ULL;
+    chip8->drawFlag = true;
+}
+
+static inline void scrollDown(struct Chip8 *chip8, int n) {
+    scrollDownQuirks(chip8, n, QUIRKS_DYNAMIC);
+}
+
+static inline void scrollUp(struct Chip8 *chip8, int n) {
+    scrollUpQuirks(chip8, n, QUIRKS_DYNAMIC);
+}
+
+static inline void scrollHorizontal(struct Chip8 *chip8, int right) {
+    scrollHorizontalQuirks(chip8, right, QUIRKS_DYNAMIC);
+}
+
+static inline void opClearScreen(struct Chip8 *chip8, uint16_t opcode) {
+    (void)opcode;
+    memset(chip8->gfx[0], 0, sizeof(chip8->gfx[0]));
+    chip8->dirtyRows = ~0ULL;
+    chip8->drawFlag = true;
+}
+
+static inline void opReturn(struct Chip8 *chip8, uint16_t opcode) {
+    (void)opcode;
+    chip8->sp = (chip8->sp - 1) & 0xF;
+    chip8->pc = chip8->stack[chip8->sp];
+}
+
+static inline void opScrollDown(struct Chip8 *chip8, uint16_t opcode) {
+    scrollDown(chip8, opcode & 0x000F);
+}
+
+static inline void opScrollUp(struct Chip8 *chip8, uint16_t opcode) {
+    scrollUp(chip8, opcode & 0x000F);
+}
+
+static inline void opScrollRight(struct Chip8 *chip8, uint16_t opcode) {
+    (void)opcode;
+    scrollHorizontal(chip8, 1);
+}
+
+static inline void opScrollLeft(struct Chip8 *chip8, uint16_t opcode) {
+    (void)opcode;
+    scrollHorizontal(chip8, 0);
+}
+
+static inline void opScrollDown6(struct Chip8 *chip8, uint16_t opcode) {
+    (void)opcode;
+    scrollDown(chip8, 6);
+}
+
+static inline void opScrollDown12(struct Chip8 *chip8, uint16_t opcode) {
+    (void)opcode;
+    scrollDown(chip8, 12);
+}
+
+static inline void opCompat(struct Chip8 *chip8, uint16_t opcode) {
+    (void)opcode;
+    chip8->compatMode = !chip8->compatMode;
+}
+
+static inline void opLowRes(struct Chip8 *chip8, uint16_t opcode) {
+    (void)opcode;
+    chip8->highRes = false;
+    memset(chip8->gfx, 0, sizeof(chip8->gfx));
+    chip8->dirtyRows = ~0ULL;
+    chip8->drawFlag = true;
+}
+
+static inline void opHighRes(struct Chip8 *chip8, uint16_t opcode) {
+    (void)opcode;
+    chip8->highRes = true;
+    memset(chip8->gfx, 0, sizeof(chip8->gfx));
+    chip8->dirtyRows = ~0ULL;
+    chip8->drawFlag = true;
+}
+
+static inline void opExit(struct Chip8 *chip8, uint16_t opcode) {
+    (void)opcode;
+    chip8->running = false;
+}
+
+static inline void opJump(struct Chip8 *chip8, uint16_t opcode) {
+    chip8->pc = opcode & 0x0FFF;
+}
+
+static inline void opCall(struct Chip8 *chip8, uint16_t opcode) {
+    chip8->stack[chip8->sp] = chip8->pc;
+    chip8->sp = (chip8->sp + 1) & 0xF;
+    chip8->pc = opcode & 0x0FFF;
+}
+
+// Operand-level helpers, shared by the opcode handlers and the block cache's pre-decoded micro-ops
+static inline void skipEqualImm(struct Chip8 *chip8, uint8_t x, uint8_t nn) {
+    if (chip8->V[x] == nn) {
+        chip8->pc += 2;
+    }
+}
+
+static inline void skipNotEqualImm(struct Chip8 *chip8, uint8_t x, uint8_t nn) {
+    if (chip8->V[x] != nn) {
+        chip8->pc += 2;
+    }
+}
+
+static inline void skipEqualReg(struct Chip8 *chip8, uint8_t x, uint8_t y) {
+    if (chip8->V[x] == chip8->V[y]) {
+        chip8->pc += 2;
+    }
+}
+
+static inline void skipNotEqualReg(struct Chip8 *chip8, uint8_t x, uint8_t y) {
+    if (chip8->V[x] != chip8->V[y]) {
+        chip8->pc += 2;
+    }
+}
+
+static inline void loadImm(struct Chip8 *chip8, uint8_t x, uint8_t nn) {
+    chip8->V[x] = nn;
+}
+
+static inline void addImm(struct Chip8 *chip8, uint8_t x, uint8_t nn) {
+    chip8->V[x] += nn;
+}
+
+static inline void loadReg(struct Chip8 *chip8, uint8_t x, uint8_t y) {
+    chip8->V[x] = chip8->V[y];
+}
+
+static inline void orRegQuirks(struct Chip8 *chip8, uint8_t x, uint8_t y, const int quirks) {
+    chip8->V[x] |= chip8->V[y];
+    if (!hasQuirk(chip8, quirks, QUIRK_HIGH_RES)) chip8->V[0xF] = 0;
+}
+
+static inline void orReg(struct Chip8 *chip8, uint8_t x, uint8_t y) {
+    orRegQuirks(chip8, x, y, QUIRKS_DYNAMIC);
+}
+
+static inline void andRegQuirks(struct Chip8 *chip8, uint8_t x, uint8_t y, const int quirks) {
+    chip8->V[x] &= chip8->V[y];
+    if (!hasQuirk(chip8, quirks, QUIRK_HIGH_RES)) chip8->V[0xF] = 0;
+}
+
+static inline void andReg(struct Chip8 *chip8, uint8_t x, uint8_t y) {
+    andRegQuirks(chip8, x, y, QUIRKS_DYNAMIC);
+}
+
+static inline void xorRegQuirks(struct Chip8 *chip8, uint8_t x, uint8_t y, const int quirks) {
+    chip8->V[x] ^= chip8->V[y];
+    if (!hasQuirk(chip8, quirks, QUIRK_HIGH_RES)) chip8->V[0xF] = 0;
+}
+
+static inline void xorReg(struct Chip8 *chip8, uint8_t x, uint8_t y) {
+    xorRegQuirks(chip8, x, y, QUIRKS_DYNAMIC);
+}
+
+// VF is set to 1 on overflow
+static inline void addReg(struct Chip8 *chip8, uint8_t x, uint8_t y) {
+    uint16_t sum = chip8->V[x] + chip8->V[y];
+    chip8->V[x] = sum & 0xFF;
+    chip8->V[0xF] = sum > 0xFF;
+}
+
+// VF is set to 0 when there's a borrow, and 1 when there isn't
+static inline void subReg(struct Chip8 *chip8, uint8_t x, uint8_t y) {
+    uint8_t vx = chip8->V[x];
+    uint8_t vy = chip8->V[y];
+    chip8->V[x] = vx - vy;
+    chip8->V[0xF] = (vx >= vy) ? 0x01 : 0x00;
+}
+
+// VF is set to the least significant bit before the shift. Compat mode shifts VX in place, otherwise VY is shifted into VX
+static inline void shiftRightQuirks(struct Chip8 *chip8, uint8_t x, uint8_t y, const int quirks) {
+    const uint8_t src = hasQuirk(chip8, quirks, QUIRK_COMPAT) ? chip8->V[x] : chip8->V[y];
+    chip8->carry = src & 0x1;
+    chip8->V[x] = src >> 1;
+    chip8->V[0xF] = chip8->carry;
+}
+
+static inline void shiftRight(struct Chip8 *chip8, uint8_t x, uint8_t y) {
+    shiftRightQuirks(chip8, x, y, QUIRKS_DYNAMIC);
+}
+
+// VF is set to 1 if VY >= VX, otherwise 0
+static inline void subNReg(struct Chip8 *chip8, uint8_t x, uint8_t y) {
+    uint8_t vx = chip8->V[x];
+    uint8_t vy = chip8->V[y];
+    chip8->V[x] = vy - vx;
+    chip8->V[0xF] = (vy >= vx) ? 0x01 : 0x00;
+}
+
+// VF is set to the most significant bit before the shift
+static inline void shiftLeftQuirks(struct Chip8 *chip8, uint8_t x, uint8_t y, const int quirks) {
+    const uint8_t src = hasQuirk(chip8, quirks, QUIRK_COMPAT) ? chip8->V[x] : chip8->V[y];
+    chip8->carry = (src & 0x80) >> 7;
+    chip8->V[x] = src << 1;
+    chip8->V[0xF] = chip8->carry;
+}
+
+static inline void shiftLeft(struct Chip8 *chip8, uint8_t x, uint8_t y) {
+    shiftLeftQuirks(chip8, x, y, QUIRKS_DYNAMIC);
+}
+
+static inline void loadDelay(struct Chip8 *chip8, uint8_t x) {
+    chip8->V[x] = chip8->delay_timer;
+}
+
+static inline void setDelay(struct Chip8 *chip8, uint8_t x) {
+    chip8->delay_timer = chip8->V[x];
+}
+
+static inline void setSound(struct Chip8 *chip8, uint8_t x) {
+    chip8->sound_timer = chip8->V[x];
+}
+
+static inline void addI(struct Chip8 *chip8, uint8_t x) {
+    chip8->I += chip8->V[x];
+}
+
+static inline void loadFont(struct Chip8 *chip8, uint8_t x) {
+    chip8->I = chip8->V[x] * 0x5;
+}
+
+static inline void opSkipEqualImm(struct Chip8 *chip8, uint16_t opcode) {
+    skipEqualImm(chip8, (opcode & 0x0F00) >> 8, opcode & 0x00FF);
+}
+
+static inline void opSkipNotEqualImm(struct Chip8 *chip8, uint16_t opcode) {
+    skipNotEqualImm(chip8, (opcode & 0x0F00) >> 8, opcode & 0x00FF);
+}
+
+static inline void opSkipEqualReg(struct Chip8 *chip8, uint16_t opcode) {
+    skipEqualReg(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
+}
+
+static inline void opLoadImm(struct Chip8 *chip8, uint16_t opcode) {
+    loadImm(chip8, (opcode & 0x0F00) >> 8, opcode & 0x00FF);
+}
+
+static inline void opAddImm(struct Chip8 *chip8, uint16_t opcode) {
+    addImm(chip8, (opcode & 0x0F00) >> 8, opcode & 0x00FF);
+}
+
+static inline void opLoadReg(struct Chip8 *chip8, uint16_t opcode) {
+    loadReg(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
+}
+
+static inline void opOr(struct Chip8 *chip8, uint16_t opcode) {
+    orReg(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
+}
+
+static inline void opAnd(struct Chip8 *chip8, uint16_t opcode) {
+    andReg(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
+}
+
+static inline void opXor(struct Chip8 *chip8, uint16_t opcode) {
+    xorReg(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
+}
+
+static inline void opAddReg(struct Chip8 *chip8, uint16_t opcode) {
+    addReg(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
+}
+
+static inline void opSub(struct Chip8 *chip8, uint16_t opcode) {
+    subReg(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
+}
+
+static inline void opShiftRight(struct Chip8 *chip8, uint16_t opcode) {
+    shiftRight(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
+}
+
+static inline void opSubN(struct Chip8 *chip8, uint16_t opcode) {
+    subNReg(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
+}
+
+static inline void opShiftLeft(struct Chip8 *chip8, uint16_t opcode) {
+    shiftLeft(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
+}
+
+static inline void opSkipNotEqualReg(struct Chip8 *chip8, uint16_t opcode) {
+    skipNotEqualReg(chip8, (opcode & 0x0F00) >> 8, (opcode & 0x00F0) >> 4);
+}
+
+static inline void opLoadI(struct Chip8 *chip8, uint16_t opcode) {
+    chip8->I = opcode & 0x0FFF;
+}
+
+static inline void opJumpV0(struct Chip8 *chip8, uint16_t opcode) {
+    chip8->pc = (opcode & 0x0FFF) + chip8->V[0];
+}
+
+static inline void opRandom(struct Chip8 *chip8, uint16_t opcode) {
+    chip8->V[(opcode & 0x0F00) >> 8] = (nextRandom(chip8) % 0xFF) & (opcode & 0x00FF);
+}
+
+// Draw a sprite at VX, VY with N bytes of sprite data starting at I. VF is set on collision.
+// Each sprite line is XORed into its row a word at a time, wrapping around the right edge
+static inline void opDrawQuirks(struct Chip8 *chip8, uint16_t opcode, const int quirks) {
+    const bool highRes = hasQuirk(chip8, quirks, QUIRK_HIGH_RES);
+    const int width = highRes ? HIGH_RES_WIDTH : LOW_RES_WIDTH;
+    const int displayHeight = highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
+    const int x = chip8->V[(opcode & 0x0F00) >> 8] % width;
+    const uint8_t y = chip8->V[(opcode & 0x00F0) >> 4];
+    const uint8_t height = opcode & 0x000F;
+    const int word = x >> 6;
+    const int shift = x & 63;
+    uint64_t collision = 0;
+
+    for (int yline = 0; yline < height; yline++) {
+        const int rowIndex = (y + yline) % displayHeight;
+        const uint64_t pixels = (uint64_t)chip8->memory[(chip8->I + yline) & 0xFFF] << 56;
+        uint64_t *row = chip8->gfx[0][rowIndex];
+        chip8->dirtyRows |= 1ULL << rowIndex;
+
+        if (!highRes) {
+            // 64 pixel rows, the part past the right edge rotates back to the left
+            const uint64_t line = shift ? pixels >> shift | pixels << (64 - shift) : pixels;
+            collision |= row[0] & line;
+            row[0] ^= line;
+        } else {
+            const uint64_t line = pixels >> shift;
+            collision |= row[word] & line;
+            row[word] ^= line;
+            if (shift > 56) {
+                const uint64_t spill = pixels << (64 - shift);
+                collision |= row[word ^ 1] & spill;
+                row[word ^ 1] ^= spill;
+            }
+        }
+    }
+
+    chip8->V[0xF] = collision != 0;
+    chip8->drawFlag = true; // Set flag to update the screen
+}
+
+static inline void opDraw(struct Chip8 *chip8, uint16_t opcode) {
+    opDrawQuirks(chip8, opcode, QUIRKS_DYNAMIC);
+}
+
+static inline void opSkipKey(struct Chip8 *chip8, uint16_t opcode) {
+    if (chip8->KC & ~(chip8->IK) & (1 << chip8->V[(opcode & 0x0F00) >> 8])) {
+        chip8->pc += 2;
+    }
+}
+
+static inline void opSkipNotKey(struct Chip8 *chip8, uint16_t opcode) {
+    if (!(chip8->KC & ~(chip8->IK) & (1 << chip8->V[(opcode & 0x0F00) >> 8]))) {
+        chip8->pc += 2;
+    }
+}
+
+static inline void opLoadDelay(struct Chip8 *chip8, uint16_t opcode) {
+    loadDelay(chip8, (opcode & 0x0F00) >> 8);
+}
+
+// Raise the key interrupt, the frame stops early until handleInterrupts sees a key press
+static inline void opWaitKey(struct Chip8 *chip8, uint16_t opcode) {
+    chip8->waitingForKey = true;
+    chip8->keyReg = (opcode & 0x0F00) >> 8;
+    chip8->interruptType = INTERRUPT_KEY; // Set interrupt type for FX0A
+    chip8->speed = -chip8->speed; // Invert speed to quit early
+}
+
+static inline void opSetDelay(struct Chip8 *chip8, uint16_t opcode) {
+    setDelay(chip8, (opcode & 0x0F00) >> 8);
+}
+
+static inline void opSetSound(struct Chip8 *chip8, uint16_t opcode) {
+    setSound(chip8, (opcode & 0x0F00) >> 8);
+}
+
+static inline void opAddI(struct Chip8 *chip8, uint16_t opcode) {
+    addI(chip8, (opcode & 0x0F00) >> 8);
+}
+
+static inline void opLoadFont(struct Chip8 *chip8, uint16_t opcode) {
+    loadFont(chip8, (opcode & 0x0F00) >> 8);
+}
+
+// Every guest write to memory goes through here so cached code over those bytes gets dropped
+static inline void memoryWritten(struct Chip8 *chip8, uint16_t address, int length) {
+    if (chip8->blockCache) invalidateBlocks(chip8->blockCache, address & 0xFFF, length);
+    if (chip8->jit) invalidateJit(chip8->jit, address & 0xFFF, length);
+}
+
+static inline void opBcd(struct Chip8 *chip8, uint16_t opcode) {
+    const uint8_t vx = chip8->V[(opcode & 0x0F00) >> 8];
+    chip8->memory[chip8->I & 0xFFF] = vx / 100;
+    chip8->memory[(chip8->I + 1) & 0xFFF] = (vx / 10) % 10;
+    chip8->memory[(chip8->I + 2) & 0xFFF] = vx % 10;
+    memoryWritten(chip8, chip8->I, 3);
+}
+
+static inline void opStoreQuirks(struct Chip8 *chip8, uint16_t opcode, const int quirks) {
+    const uint8_t x = (opcode & 0x0F00) >> 8;
+    for (int i = 0; i <= x; ++i) {
+        chip8->memory[(chip8->I + i) & 0xFFF] = chip8->V[i];
+    }
+    memoryWritten(chip8, chip8->I, x + 1);
+    if (!hasQuirk(chip8, quirks, QUIRK_COMPAT)) {
+        chip8->I += x + 1;
+    }
+}
+
+static inline void opStore(struct Chip8 *chip8, uint16_t opcode) {
+    opStoreQuirks(chip8, opcode, QUIRKS_DYNAMIC);
+}
+
+static inline void opLoadQuirks(struct Chip8 *chip8, uint16_t opcode, const int quirks) {
+    const uint8_t x = (opcode & 0x0F00) >> 8;
+    for (int i = 0; i <= x; ++i) {
+        chip8->V[i] = chip8->memory[(chip8->I + i) & 0xFFF];
+    }
+    // If not in compat mode, increase I
+    if (!hasQuirk(chip8, quirks, QUIRK_COMPAT)) {
+        chip8->I += x + 1;
+    }
+}
+
+static inline void opLoad(struct Chip8 *chip8, uint16_t opcode) {
+    opLoadQuirks(chip8, opcode, QUIRKS_DYNAMIC);
+}
+
+// XO-CHIP: load the 16 byte (128 sample) audio pattern from I
+static inline void opAudio(struct Chip8 *chip8, uint16_t opcode) {
+    (void)opcode;
+    for (int i = 0; i < AUDIO_PATTERN_SIZE; ++i) {
+        chip8->audioPattern[i] = chip8->memory[(chip8->I + i) & 0xFFF];
+    }
+    chip8->audioPatternLoaded = true;
+}
+
+// XO-CHIP: set the pattern playback pitch from VX
+static inline void opPitch(struct Chip8 *chip8, uint16_t opcode) {
+    chip8->pitch = chip8->V[(opcode & 0x0F00) >> 8];
+}
+
+static inline void opUnknown(struct Chip8 *chip8, uint16_t opcode) {
+    (void)chip8;
+    printf("Unknown opcode: 0x%X\n", opcode);
+}
+
+#endif // OPS_H
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profiler.h"
+
+int enableProfiler(struct Chip8 *chip8) {
+    if (chip8->profiler) return 0;
+    chip8->profiler = malloc(sizeof(struct Profiler));
+    if (!chip8->profiler) {
+        printf("Memory could not be allocated.\n");
+        return -1;
+    }
+    resetProfiler(chip8->profiler);
+    return 0;
+}
+
+void disableProfiler(struct Chip8 *chip8) {
+    free(chip8->profiler);
+    chip8->profiler = NULL;
+}
+
+void resetProfiler(struct Profiler *profiler) {
+    memset(profiler, 0, sizeof(*profiler));
+    profiler->nodeCount = 1; // Top level
+}
+
+// Node for address called from parent, created on first use. A full table charges the call to its parent
+static int findNode(struct Profiler *profiler, int parent, uint16_t address) {
+    unsigned int slot = ((unsigned int)parent * 4099u + address) & (PROFILER_HASH_SIZE - 1);
+
+    while (profiler->lookup[slot]) {
+        const int node = profiler->lookup[slot] - 1;
+        if (profiler->nodes[node].parent == parent && profiler->nodes[node].address == address) return node;
+        slot = (slot + 1) & (PROFILER_HASH_SIZE - 1);
+    }
+    if (profiler->nodeCount == PROFILER_MAX_NODES) {
+        profiler->overflows++;
+        return parent;
+    }
+    const int node = profiler->nodeCount++;
+    profiler->nodes[node].address = address;
+    profiler->nodes[node].parent = parent;
+    profiler->nodes[node].instructions = 0;
+    profiler->lookup[slot] = node + 1;
+    return node;
+}
+
+// Same loop as executeCycles, with the counting done around each emulateCycle
+uint64_t executeProfiled(struct Chip8 *chip8, int count) {
+    struct Profiler *profiler = chip8->profiler;
+    uint64_t executed = 0;
+
+    while ((int)executed < count && chip8->speed > 0 && chip8->running) {
+        const uint16_t pc = chip8->pc & 0xFFF;
+        const uint16_t opcode = chip8->memory[pc] << 8 | chip8->memory[(pc + 1) & 0xFFF];
+        const enum OpClass cls = classifyOpcode(opcode);
+
+        profiler->instructions++;
+        profiler->classCounts[cls]++;
+        profiler->pcCounts[pc]++;
+        profiler->nodes[profiler->stack[profiler->depth]].instructions++;
+        emulateCycle(chip8);
+        ++executed;
+
+        // Follow the guest's calls on a shadow stack. Returns with nothing to return from (a ROM that
+        // resets sp itself) are ignored, and calls past the stack depth are charged to their caller until they return
+        if (cls == OP_CALL) {
+            const uint16_t target = opcode & 0x0FFF;
+            profiler->calls[target]++;
+            if (profiler->depth < PROFILER_MAX_DEPTH) {
+                const int node = findNode(profiler, profiler->stack[profiler->depth], target);
+                profiler->stack[++profiler->depth] = node;
+            } else {
+                profiler->overflows++;
+                profiler->overflowDepth++;
+            }
+        } else if (cls == OP_RET && profiler->overflowDepth > 0) {
+            profiler->overflowDepth--;
+        } else if (cls == OP_RET && profiler->depth > 0) {
+            profiler->depth--;
+        }
+    }
+    return executed;
+}
+
+// Sort helpers, indexes ordered by a count array, highest first
+static const uint64_t *sortCounts;
+static int compareCounts(const void *a, const void *b) {
+    const uint64_t left = sortCounts[*(const int *)a], right = sortCounts[*(const int *)b];
+    if (left != right) return left < right ? 1 : -1;
+    return *(const int *)a - *(const int *)b;
+}
+
+static int sortedIndexes(const uint64_t *counts, int size, int *order) {
+    int used = 0;
+    for (int i = 0; i < size; ++i) {
+        if (counts[i]) order[used++] = i;
+    }
+    sortCounts = counts;
+    qsort(order, used, sizeof(int), compareCounts);
+    return used;
+}
+
+// Hot spot report: instructions per opcode class, per address, and per subroutine (self and inclusive)
+int writeProfileJson(const struct Profiler *profiler, const char *path) {
+    uint64_t *self = calloc(MEMORY_SIZE, sizeof(uint64_t));
+    uint64_t *inclusive = calloc(MEMORY_SIZE, sizeof(uint64_t));
+    int *seen = calloc(MEMORY_SIZE, sizeof(int));
+    int *order = malloc(MEMORY_SIZE * sizeof(int));
+    int status = 0;
+
+    if (!self || !inclusive || !seen || !order) {
+        printf("Memory could not be allocated.\n");
+        status = -1;
+        goto done;
+    }
+
+    // A subroutine's inclusive count is every instruction run while it was anywhere on the stack,
+    // counted once per stack even when it recursed
+    for (int node = 1; node < profiler->nodeCount; ++node) {
+        const uint64_t count = profiler->nodes[node].instructions;
+        self[profiler->nodes[node].address] += count;
+        for (int up = node; up > 0; up = profiler->nodes[up].parent) {
+            const uint16_t address = profiler->nodes[up].address;
+            if (seen[address] == node) continue;
+            seen[address] = node;
+            inclusive[address] += count;
+        }
+    }
+
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        printf("File could not be opened: %s\n", path);
+        status = -1;
+        goto done;
+    }
+    fprintf(file, "{\n  \"instructions\": %llu,\n  \"topLevel\": %llu,\n  \"overflows\": %llu,\n",
+            (unsigned long long)profiler->instructions, (unsigned long long)profiler->nodes[0].instructions,
+            (unsigned long long)profiler->overflows);
+
+    int used = sortedIndexes(profiler->classCounts, OP_COUNT, order);
+    fprintf(file, "  \"opcodeClasses\": [\n");
+    for (int i = 0; i < used; ++i) {
+        fprintf(file, "    { \"class\": \"%s\", \"count\": %llu }%s\n", opClassName((enum OpClass)order[i]),
+                (unsigned long long)profiler->classCounts[order[i]], i + 1 < used ? "," : "");
+    }
+
+    used = sortedIndexes(profiler->pcCounts, MEMORY_SIZE, order);
+    fprintf(file, "  ],\n  \"addresses\": [\n");
+    for (int i = 0; i < used; ++i) {
+        fprintf(file, "    { \"pc\": \"0x%03X\", \"count\": %llu }%s\n", order[i],
+                (unsigned long long)profiler->pcCounts[order[i]], i + 1 < used ? "," : "");
+    }
+
+    used = sortedIndexes(inclusive, MEMORY_SIZE, order);
+    fprintf(file, "  ],\n  \"subroutines\": [\n");
+    for (int i = 0; i < used; ++i) {
+        fprintf(file, "    { \"address\": \"0x%03X\", \"calls\": %llu, \"self\": %llu, \"inclusive\": %llu }%s\n",
+                order[i], (unsigned long long)profiler->calls[order[i]], (unsigned long long)self[order[i]],
+                (unsigned long long)inclusive[order[i]], i + 1 < used ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    if (fclose(file) != 0) {
+        printf("Writing error.\n");
+        status = -1;
+    }
+
+done:
+    free(self);
+    free(inclusive);
+    free(seen);
+    free(order);
+    return status;
+}
+
+// One line per distinct call stack, "main;sub_2A0;sub_31C count", the input format of flamegraph.pl
+int writeProfileFolded(const struct Profiler *profiler, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        printf("File could not be opened: %s\n", path);
+        return -1;
+    }
+    for (int node = 0; node < profiler->nodeCount; ++node) {
+        int chain[PROFILER_MAX_DEPTH + 1];
+        int depth = 0;
+
+        if (profiler->nodes[node].instructions == 0) continue;
+        for (int up = node; up > 0 && depth <= PROFILER_MAX_DEPTH; up = profiler->nodes[up].parent) {
+            chain[depth++] = up;
+        }
+        fprintf(file, "main");
+        while (depth > 0) {
+            fprintf(file, ";sub_%03X", profiler->nodes[chain[--depth]].address);
+        }
+        fprintf(file, " %llu\n", (unsigned long long)profiler->nodes[node].instructions);
+    }
+    if (fclose(file) != 0) {
+        printf("Writing error.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Write both reports, <prefix>.json and <prefix>.folded
+int writeProfile(const struct Profiler *profiler, const char *prefix) {
+    char path[1024];
+    int status = 0;
+
+    snprintf(path, sizeof(path), "%s.json", prefix);
+    if (writeProfileJson(profiler, path) != 0) status = -1;
+    snprintf(path, sizeof(path), "%s.folded", prefix);
+    if (writeProfileFolded(profiler, path) != 0) status = -1;
+    if (status == 0) printf("Profile of %llu instructions written to %s.json and %s.folded\n",
+                            (unsigned long long)profiler->instructions, prefix, prefix);
+    return status;
+}
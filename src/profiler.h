@@ -0,0 +1,47 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "core.h"
+#include "ops.h"
+
+#define PROFILER_MAX_NODES 4096 // Distinct call stacks tracked, deeper or newer ones are charged to their caller
+#define PROFILER_HASH_SIZE 8192 // Power of two, at least twice PROFILER_MAX_NODES
+#define PROFILER_MAX_DEPTH 16 // Same as the guest stack
+
+// One distinct call stack: the subroutine at its top and the stack it was called from. Node 0 is the ROM's
+// top level, outside every subroutine
+struct ProfileNode {
+    uint16_t address; // Subroutine entry point
+    int parent;
+    uint64_t instructions; // Executed with exactly this stack
+};
+
+// Attached with enableProfiler. While attached, runFrame runs every instruction through emulateCycle and
+// counts it here. Without a profiler the dispatch loops are untouched, so it costs nothing when off
+struct Profiler {
+    uint64_t instructions;
+    uint64_t classCounts[OP_COUNT];
+    uint64_t pcCounts[MEMORY_SIZE]; // Executions per instruction address
+    uint64_t calls[MEMORY_SIZE]; // 2NNN executions per target
+
+    struct ProfileNode nodes[PROFILER_MAX_NODES];
+    int nodeCount;
+    int lookup[PROFILER_HASH_SIZE]; // (parent, address) -> node + 1, 0 for an empty slot
+    int stack[PROFILER_MAX_DEPTH + 1]; // Shadow call stack of nodes, stack[0] is the top level
+    int depth;
+    int overflowDepth; // Calls past PROFILER_MAX_DEPTH not returned from yet, their returns leave the stack alone
+    uint64_t overflows; // Calls that found the node table or shadow stack full
+};
+
+// Function prototypes
+int enableProfiler(struct Chip8 *chip8);
+void disableProfiler(struct Chip8 *chip8);
+void resetProfiler(struct Profiler *profiler);
+uint64_t executeProfiled(struct Chip8 *chip8, int count);
+int writeProfileJson(const struct Profiler *profiler, const char *path);
+int writeProfileFolded(const struct Profiler *profiler, const char *path);
+int writeProfile(const struct Profiler *profiler, const char *prefix);
+
+#endif // PROFILER_H
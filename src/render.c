@@ -0,0 +1,23 @@
+#include "render.h"
+
+// Expand plane 0 into displayWidth x displayHeight ARGB pixels. pitch is in bytes, palette[0] is the background
+// and palette[1] the foreground
+void renderFrame(const struct Display *display, uint32_t *pixels, int pitch, const uint32_t palette[2]) {
+    renderRows(display, pixels, pitch, palette, 0, displayHeight(display));
+}
+
+// Expand rowCount rows starting at firstRow. pixels points at the output for firstRow
+void renderRows(const struct Display *display, uint32_t *pixels, int pitch, const uint32_t palette[2], int firstRow, int rowCount) {
+    const int width = displayWidth(display);
+
+    for (int y = firstRow; y < firstRow + rowCount; ++y) {
+        uint32_t *line = (uint32_t *)((uint8_t *)pixels + (size_t)(y - firstRow) * pitch);
+        for (int word = 0; word < width / 64; ++word) {
+            const uint64_t bits = display->gfx[y][word];
+            uint32_t *out = line + word * 64;
+            for (int bit = 0; bit < 64; ++bit) {
+                out[bit] = palette[(bits >> (63 - bit)) & 1];
+            }
+        }
+    }
+}
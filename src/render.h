@@ -0,0 +1,39 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "core.h"
+
+// The part of a machine the renderers read, small enough to hand between threads once per frame
+struct Display {
+    bool highRes;
+    uint64_t gfx[HIGH_RES_HEIGHT][HIGH_RES_WIDTH / 64]; // Plane 0, packed like struct Chip8
+};
+
+// Size of the display at the current resolution
+static inline int displayWidth(const struct Display *display) {
+    return display->highRes ? HIGH_RES_WIDTH : LOW_RES_WIDTH;
+}
+
+static inline int displayHeight(const struct Display *display) {
+    return display->highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
+}
+
+// Take the machine's display, only the rows visible at its resolution are copied
+static inline void copyDisplay(struct Display *display, const struct Chip8 *chip8) {
+    display->highRes = chip8->highRes;
+    memcpy(display->gfx, chip8->gfx[0], (size_t)displayHeight(display) * sizeof(display->gfx[0]));
+}
+
+// Pack an RGBA colour into the 0xAARRGGBB layout renderFrame writes
+static inline uint32_t packArgb(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    return (uint32_t)a << 24 | (uint32_t)r << 16 | (uint32_t)g << 8 | b;
+}
+
+// Function prototypes
+void renderFrame(const struct Display *display, uint32_t *pixels, int pitch, const uint32_t palette[2]);
+void renderRows(const struct Display *display, uint32_t *pixels, int pitch, const uint32_t palette[2], int firstRow, int rowCount);
+
+#endif // RENDER_H
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "analysis.h"
+#include "rompack.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CHIP8_HAVE_MMAP 1
+#endif
+
+_Static_assert(sizeof(struct PackHeader) == 24, "PackHeader must stay 24 bytes");
+_Static_assert(sizeof(struct PackEntry) == 32, "PackEntry must stay 32 bytes");
+
+// Check the header, index and name table, and that every image lies inside the file
+static int checkRomPack(struct RomPack *pack) {
+    const struct PackHeader *header = (const struct PackHeader *)pack->data;
+
+    if (pack->size < sizeof(*header) || memcmp(header->magic, PACK_MAGIC, 4) != 0) {
+        printf("Not a ROM pack.\n");
+        return -1;
+    }
+    if (header->byteOrder != PACK_BYTE_ORDER || header->version != PACK_VERSION) {
+        printf("ROM pack version %d is not supported.\n", header->version);
+        return -1;
+    }
+    const size_t indexSize = (size_t)header->romCount * sizeof(struct PackEntry) + header->namesSize;
+    if (indexSize > pack->size - sizeof(*header) ||
+        hashBytes(HASH_SEED, header + 1, indexSize) != header->checksum) {
+        printf("ROM pack is corrupt.\n");
+        return -1;
+    }
+    pack->header = header;
+    pack->entries = (const struct PackEntry *)(header + 1);
+    pack->names = (const char *)(pack->entries + header->romCount);
+    for (uint32_t i = 0; i < header->romCount; ++i) {
+        const struct PackEntry *entry = &pack->entries[i];
+        if (entry->offset > pack->size || entry->size > pack->size - entry->offset ||
+            entry->nameOffset >= header->namesSize || entry->quirks >= PROFILE_COUNT) {
+            printf("ROM pack is corrupt.\n");
+            return -1;
+        }
+    }
+    if (header->namesSize > 0 && pack->names[header->namesSize - 1] != '\0') {
+        printf("ROM pack is corrupt.\n");
+        return -1;
+    }
+    return 0;
+}
+
+// Open a pack. It is mapped once, ROMs are then loaded straight out of the mapping
+int openRomPack(struct RomPack *pack, const char *path) {
+    memset(pack, 0, sizeof(*pack));
+#ifdef CHIP8_HAVE_MMAP
+    struct stat info;
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size <= 0) {
+        printf("File could not be opened: %s\n", path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("File could not be mapped: %s\n", path);
+        return -1;
+    }
+    pack->data = data;
+    pack->size = (size_t)info.st_size;
+    pack->mapped = true;
+#else
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        printf("File could not be opened: %s\n", path);
+        return -1;
+    }
+    fseek(in, 0, SEEK_END);
+    const long size = ftell(in);
+    rewind(in);
+    uint8_t *data = size > 0 ? malloc((size_t)size) : NULL;
+    if (!data) {
+        printf("Memory could not be allocated.\n");
+        fclose(in);
+        return -1;
+    }
+    const size_t result = fread(data, 1, (size_t)size, in);
+    fclose(in);
+    if (result != (size_t)size) {
+        printf("Reading error.\n");
+        free(data);
+        return -1;
+    }
+    pack->data = data;
+    pack->size = (size_t)size;
+#endif
+    if (checkRomPack(pack) != 0) {
+        closeRomPack(pack);
+        return -1;
+    }
+    return 0;
+}
+
+void closeRomPack(struct RomPack *pack) {
+#ifdef CHIP8_HAVE_MMAP
+    if (pack->mapped) munmap((void *)pack->data, pack->size);
+#endif
+    if (!pack->mapped) free((void *)pack->data);
+    memset(pack, 0, sizeof(*pack));
+}
+
+const char *packRomName(const struct RomPack *pack, uint32_t index) {
+    return index < pack->header->romCount ? pack->names + pack->entries[index].nameOffset : NULL;
+}
+
+// Index of the ROM with this hash, or -1. Entries are sorted by hash
+int findPackRom(const struct RomPack *pack, uint64_t hash) {
+    int low = 0, high = (int)pack->header->romCount - 1;
+    while (low <= high) {
+        const int middle = low + (high - low) / 2;
+        const uint64_t found = pack->entries[middle].hash;
+        if (found == hash) return middle;
+        if (found < hash) low = middle + 1;
+        else high = middle - 1;
+    }
+    return -1;
+}
+
+// Index of the ROM with this name, or -1
+int findPackRomName(const struct RomPack *pack, const char *name) {
+    for (uint32_t i = 0; i < pack->header->romCount; ++i) {
+        if (strcmp(pack->names + pack->entries[i].nameOffset, name) == 0) return (int)i;
+    }
+    return -1;
+}
+
+// Load ROM number index into a machine straight from the pack, with the quirks recorded for it
+int loadPackRom(struct Chip8 *chip8, const struct RomPack *pack, uint32_t index) {
+    if (index >= pack->header->romCount) {
+        printf("ROM %u is not in the pack.\n", index);
+        return -1;
+    }
+    const struct PackEntry *entry = &pack->entries[index];
+    if (loadRomData(chip8, pack->data + entry->offset, entry->size) != 0) return -1;
+    applyQuirkProfile(chip8, (enum QuirkProfile)entry->quirks);
+    return 0;
+}
+
+// Hash every image against its entry. Loading skips this, so a pack can be checked once after copying.
+// Returns the number of bad entries
+int verifyRomPack(const struct RomPack *pack) {
+    int bad = 0;
+    for (uint32_t i = 0; i < pack->header->romCount; ++i) {
+        const struct PackEntry *entry = &pack->entries[i];
+        if (romHash(pack->data + entry->offset, entry->size) != entry->hash) {
+            printf("ROM %u (%s) does not match its hash.\n", i, packRomName(pack, i));
+            ++bad;
+        }
+    }
+    return bad;
+}
+
+static const struct PackEntry *sortEntries;
+static int compareEntries(const void *a, const void *b) {
+    const struct PackEntry *left = &sortEntries[*(const int *)a], *right = &sortEntries[*(const int *)b];
+    if (left->hash != right->hash) return left->hash < right->hash ? -1 : 1;
+    return *(const int *)a - *(const int *)b;
+}
+
+// Build a pack from ROM images. Every ROM is analysed for its quirk profile on the way in.
+// Written to a temporary file and renamed into place
+int writeRomPack(const char *path, const struct PackSource *sources, int count) {
+    struct PackHeader header;
+    struct PackEntry *entries = calloc(count > 0 ? count : 1, sizeof(struct PackEntry));
+    struct PackEntry *sorted = calloc(count > 0 ? count : 1, sizeof(struct PackEntry));
+    int *order = calloc(count > 0 ? count : 1, sizeof(int));
+    struct RomAnalysis *analysis = malloc(sizeof(struct RomAnalysis));
+    FILE *out = NULL;
+    char tempPath[1024];
+    int status = -1;
+
+    if (!entries || !sorted || !order || !analysis) {
+        printf("Memory could not be allocated.\n");
+        goto done;
+    }
+
+    // Index first: names go into the table in source order, images are laid out after it in hash order
+    uint32_t namesSize = 0;
+    for (int i = 0; i < count; ++i) {
+        if (analyzeRom(sources[i].data, sources[i].size, analysis) != 0) {
+            printf("ROM %s can not be packed.\n", sources[i].name);
+            goto done;
+        }
+        entries[i].hash = analysis->romHash;
+        entries[i].size = (uint32_t)sources[i].size;
+        entries[i].nameOffset = namesSize;
+        entries[i].features = analysis->features;
+        const enum QuirkProfile profile = analysisProfile(analysis);
+        const bool legacy = sources[i].legacy && (analysis->features & ROM_SCHIP) && profile != PROFILE_XO_CHIP;
+        entries[i].quirks = legacy ? PROFILE_SCHIP_LEGACY : profile;
+        namesSize += (uint32_t)strlen(sources[i].name) + 1;
+        order[i] = i;
+    }
+    sortEntries = entries;
+    qsort(order, count, sizeof(int), compareEntries);
+    const size_t indexEnd = sizeof(header) + (size_t)count * sizeof(struct PackEntry) + namesSize;
+    size_t offset = (indexEnd + PACK_ALIGNMENT - 1) & ~(size_t)(PACK_ALIGNMENT - 1);
+    for (int i = 0; i < count; ++i) {
+        sorted[i] = entries[order[i]];
+        sorted[i].offset = (uint32_t)offset;
+        offset = (offset + sorted[i].size + PACK_ALIGNMENT - 1) & ~(size_t)(PACK_ALIGNMENT - 1);
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACK_MAGIC, 4);
+    header.version = PACK_VERSION;
+    header.byteOrder = PACK_BYTE_ORDER;
+    header.romCount = (uint32_t)count;
+    header.namesSize = namesSize;
+    uint64_t checksum = hashBytes(HASH_SEED, sorted, (size_t)count * sizeof(struct PackEntry));
+    for (int i = 0; i < count; ++i) {
+        checksum = hashBytes(checksum, sources[i].name, strlen(sources[i].name) + 1);
+    }
+    header.checksum = checksum;
+
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    out = fopen(tempPath, "wb");
+    if (!out) {
+        printf("File could not be opened: %s\n", tempPath);
+        goto done;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, out) == 1 &&
+                   (count == 0 || fwrite(sorted, sizeof(struct PackEntry), count, out) == (size_t)count);
+    for (int i = 0; written && i < count; ++i) {
+        written = fwrite(sources[i].name, strlen(sources[i].name) + 1, 1, out) == 1;
+    }
+    size_t position = indexEnd;
+    for (int i = 0; written && i < count; ++i) {
+        static const uint8_t padding[PACK_ALIGNMENT];
+        const struct PackSource *source = &sources[order[i]];
+        written = fwrite(padding, 1, sorted[i].offset - position, out) == sorted[i].offset - position &&
+                  fwrite(source->data, 1, source->size, out) == source->size;
+        position = sorted[i].offset + source->size;
+    }
+    if (fclose(out) != 0 || !written) {
+        printf("Writing error.\n");
+        remove(tempPath);
+        goto done;
+    }
+    if (rename(tempPath, path) != 0) {
+        printf("File could not be replaced: %s\n", path);
+        remove(tempPath);
+        goto done;
+    }
+    status = 0;
+
+done:
+    free(entries);
+    free(sorted);
+    free(order);
+    free(analysis);
+    return status;
+}
@@ -0,0 +1,62 @@
+#ifndef ROMPACK_H
+#define ROMPACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "core.h"
+
+#define PACK_MAGIC "C8PK"
+#define PACK_VERSION 2 // Bump whenever the header or struct PackEntry changes
+#define PACK_BYTE_ORDER 0x0102
+#define PACK_ALIGNMENT 16 // ROM images start on this boundary in the file
+
+// File layout: header, romCount entries sorted by hash, the name table, then the ROM images
+struct PackHeader {
+    char magic[4]; // PACK_MAGIC
+    uint16_t version;
+    uint16_t byteOrder; // PACK_BYTE_ORDER
+    uint32_t romCount;
+    uint32_t namesSize; // Bytes of NUL-terminated names after the entries
+    uint64_t checksum; // hashBytes over the entries and the name table
+};
+
+struct PackEntry {
+    uint64_t hash; // romHash of the image, also the sort key
+    uint32_t offset; // Image position from the start of the file
+    uint32_t size;
+    uint32_t nameOffset; // Into the name table
+    uint32_t features; // ROM_* bits from analyzeRom
+    uint32_t quirks; // enum QuirkProfile the ROM starts in, see analysisProfile and PackSource.legacy
+    uint32_t reserved;
+};
+
+// An open pack. The whole file is mapped read-only where possible and read into memory otherwise
+struct RomPack {
+    const uint8_t *data;
+    size_t size;
+    bool mapped;
+    const struct PackHeader *header;
+    const struct PackEntry *entries;
+    const char *names;
+};
+
+// A ROM to go into a new pack
+struct PackSource {
+    const char *name;
+    const uint8_t *data;
+    size_t size;
+    bool legacy; // Record a SCHIP ROM as schip-legacy instead of what its analysis suggests
+};
+
+// Function prototypes
+int openRomPack(struct RomPack *pack, const char *path);
+void closeRomPack(struct RomPack *pack);
+const char *packRomName(const struct RomPack *pack, uint32_t index);
+int findPackRom(const struct RomPack *pack, uint64_t hash);
+int findPackRomName(const struct RomPack *pack, const char *name);
+int loadPackRom(struct Chip8 *chip8, const struct RomPack *pack, uint32_t index);
+int verifyRomPack(const struct RomPack *pack);
+int writeRomPack(const char *path, const struct PackSource *sources, int count);
+
+#endif // ROMPACK_H
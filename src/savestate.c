@@ -0,0 +1,206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blockcache.h"
+#include "jit.h"
+#include "savestate.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CHIP8_HAVE_MMAP 1
+#endif
+
+// Granularity memory is compared at on restore, so attached caches only drop code that really changed
+#define STATE_MEMORY_CHUNK 64
+
+_Static_assert(sizeof(struct Chip8State) % 8 == 0, "Chip8State must not end in padding");
+_Static_assert(sizeof(struct StateFileHeader) == 24, "StateFileHeader must stay 24 bytes");
+
+// Snapshot the machine. Roughly 6 KB of copies, dominated by memory and the display
+void saveState(const struct Chip8 *chip8, struct Chip8State *state) {
+    memcpy(state->gfx, chip8->gfx, sizeof(state->gfx));
+    memcpy(state->memory, chip8->memory, sizeof(state->memory));
+    state->randomState = chip8->randomState;
+    state->speed = chip8->speed;
+    state->interruptType = chip8->interruptType;
+    state->instructionsPerFrame = (uint32_t)chip8->IPC;
+    memcpy(state->stack, chip8->stack, sizeof(state->stack));
+    state->opcode = chip8->opcode;
+    state->I = chip8->I;
+    state->pc = chip8->pc;
+    state->sp = chip8->sp;
+    state->KP = chip8->KP;
+    state->KC = chip8->KC;
+    state->IK = chip8->IK;
+    state->flags = (chip8->compatMode ? STATE_COMPAT_MODE : 0) | (chip8->highRes ? STATE_HIGH_RES : 0) |
+                   (chip8->legacyMode ? STATE_LEGACY_MODE : 0) | (chip8->xoChipMode ? STATE_XO_CHIP_MODE : 0) |
+                   (chip8->waitingForKey ? STATE_WAITING_FOR_KEY : 0) | (chip8->keyReleased ? STATE_KEY_RELEASED : 0) |
+                   (chip8->running ? STATE_RUNNING : 0) | (chip8->audioPatternLoaded ? STATE_AUDIO_PATTERN_LOADED : 0);
+    memcpy(state->V, chip8->V, sizeof(state->V));
+    memcpy(state->key, chip8->key, sizeof(state->key));
+    memcpy(state->audioPattern, chip8->audioPattern, sizeof(state->audioPattern));
+    state->delayTimer = chip8->delay_timer;
+    state->soundTimer = chip8->sound_timer;
+    state->keyReg = chip8->keyReg;
+    state->carry = chip8->carry;
+    state->plane = chip8->plane;
+    state->pitch = chip8->pitch;
+    state->reserved[0] = 0;
+    state->reserved[1] = 0;
+}
+
+// Restore memory. Without caches it is one copy, with caches only changed chunks are copied and invalidated
+static void restoreMemory(struct Chip8 *chip8, const uint8_t *memory) {
+    if (!chip8->blockCache && !chip8->jit) {
+        memcpy(chip8->memory, memory, MEMORY_SIZE);
+        return;
+    }
+    for (int address = 0; address < MEMORY_SIZE; address += STATE_MEMORY_CHUNK) {
+        if (memcmp(chip8->memory + address, memory + address, STATE_MEMORY_CHUNK) == 0) continue;
+        memcpy(chip8->memory + address, memory + address, STATE_MEMORY_CHUNK);
+        if (chip8->blockCache) invalidateBlocks(chip8->blockCache, (uint16_t)address, STATE_MEMORY_CHUNK);
+        if (chip8->jit) invalidateJit(chip8->jit, (uint16_t)address, STATE_MEMORY_CHUNK);
+    }
+}
+
+// Put a snapshot back. Attached caches stay valid for unchanged code, and the whole display is marked
+// dirty so the next frame reports every row that differs from what the frontend last showed
+void loadState(struct Chip8 *chip8, const struct Chip8State *state) {
+    memcpy(chip8->gfx, state->gfx, sizeof(chip8->gfx));
+    restoreMemory(chip8, state->memory);
+    chip8->randomState = state->randomState;
+    chip8->speed = state->speed;
+    chip8->interruptType = state->interruptType;
+    chip8->IPC = state->instructionsPerFrame;
+    memcpy(chip8->stack, state->stack, sizeof(chip8->stack));
+    chip8->opcode = state->opcode;
+    chip8->I = state->I;
+    chip8->pc = state->pc;
+    chip8->sp = state->sp;
+    chip8->KP = state->KP;
+    chip8->KC = state->KC;
+    chip8->IK = state->IK;
+    chip8->compatMode = state->flags & STATE_COMPAT_MODE;
+    chip8->highRes = state->flags & STATE_HIGH_RES;
+    chip8->legacyMode = state->flags & STATE_LEGACY_MODE;
+    chip8->xoChipMode = state->flags & STATE_XO_CHIP_MODE;
+    chip8->waitingForKey = state->flags & STATE_WAITING_FOR_KEY;
+    chip8->keyReleased = state->flags & STATE_KEY_RELEASED;
+    chip8->running = state->flags & STATE_RUNNING;
+    chip8->audioPatternLoaded = state->flags & STATE_AUDIO_PATTERN_LOADED;
+    memcpy(chip8->V, state->V, sizeof(chip8->V));
+    memcpy(chip8->key, state->key, sizeof(chip8->key));
+    memcpy(chip8->audioPattern, state->audioPattern, sizeof(chip8->audioPattern));
+    chip8->delay_timer = state->delayTimer;
+    chip8->sound_timer = state->soundTimer;
+    chip8->keyReg = state->keyReg;
+    chip8->carry = state->carry;
+    chip8->plane = state->plane;
+    chip8->pitch = state->pitch;
+    chip8->dirtyRows = ~0ULL;
+}
+
+// Validate a save state file image (read or mapped) and return the state inside it, or NULL
+const struct Chip8State *checkStateFile(const void *data, size_t size) {
+    const struct StateFileHeader *header = data;
+
+    if (size < sizeof(*header) + sizeof(struct Chip8State) || memcmp(header->magic, STATE_MAGIC, 4) != 0) {
+        printf("Not a save state file.\n");
+        return NULL;
+    }
+    if (header->byteOrder != STATE_BYTE_ORDER || header->version != STATE_VERSION ||
+        header->stateSize != sizeof(struct Chip8State)) {
+        printf("Save state version %d is not supported.\n", header->version);
+        return NULL;
+    }
+    const struct Chip8State *state = (const struct Chip8State *)(header + 1);
+    if (hashBytes(HASH_SEED, state, sizeof(*state)) != header->checksum) {
+        printf("Save state is corrupt.\n");
+        return NULL;
+    }
+    return state;
+}
+
+// Write the state to path. It goes to a temporary file first and is renamed over the old one,
+// so a crash while saving never leaves a half written state behind
+int writeStateFile(const struct Chip8 *chip8, const char *path) {
+    struct {
+        struct StateFileHeader header;
+        struct Chip8State state;
+    } file;
+    char tempPath[1024];
+
+    memset(&file.header, 0, sizeof(file.header));
+    memcpy(file.header.magic, STATE_MAGIC, 4);
+    file.header.version = STATE_VERSION;
+    file.header.byteOrder = STATE_BYTE_ORDER;
+    file.header.stateSize = sizeof(file.state);
+    saveState(chip8, &file.state);
+    file.header.checksum = hashBytes(HASH_SEED, &file.state, sizeof(file.state));
+
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    FILE *out = fopen(tempPath, "wb");
+    if (!out) {
+        printf("File could not be opened: %s\n", tempPath);
+        return -1;
+    }
+    const size_t written = fwrite(&file, sizeof(file), 1, out);
+    if (fclose(out) != 0 || written != 1) {
+        printf("Writing error.\n");
+        remove(tempPath);
+        return -1;
+    }
+    if (rename(tempPath, path) != 0) {
+        printf("File could not be replaced: %s\n", path);
+        remove(tempPath);
+        return -1;
+    }
+    return 0;
+}
+
+// Load a state file into a machine. The file is mapped where possible and read otherwise
+int readStateFile(struct Chip8 *chip8, const char *path) {
+    int status = -1;
+#ifdef CHIP8_HAVE_MMAP
+    struct stat info;
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size <= 0) {
+        printf("File could not be opened: %s\n", path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("File could not be mapped: %s\n", path);
+        return -1;
+    }
+    const struct Chip8State *state = checkStateFile(data, (size_t)info.st_size);
+    if (state) {
+        loadState(chip8, state);
+        status = 0;
+    }
+    munmap(data, (size_t)info.st_size);
+#else
+    struct {
+        struct StateFileHeader header;
+        struct Chip8State state;
+    } file;
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        printf("File could not be opened: %s\n", path);
+        return -1;
+    }
+    const size_t size = fread(&file, 1, sizeof(file), in);
+    fclose(in);
+    const struct Chip8State *state = checkStateFile(&file, size);
+    if (state) {
+        loadState(chip8, state);
+        status = 0;
+    }
+#endif
+    return status;
+}
@@ -0,0 +1,71 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "core.h"
+
+#define STATE_MAGIC "C8SS"
+#define STATE_VERSION 1 // Bump whenever struct Chip8State changes
+#define STATE_BYTE_ORDER 0x0102 // Written natively, reads back as 0x0201 on a host of the other byte order
+
+// Bits of Chip8State.flags
+#define STATE_COMPAT_MODE (1 << 0)
+#define STATE_HIGH_RES (1 << 1)
+#define STATE_LEGACY_MODE (1 << 2)
+#define STATE_XO_CHIP_MODE (1 << 3)
+#define STATE_WAITING_FOR_KEY (1 << 4)
+#define STATE_KEY_RELEASED (1 << 5)
+#define STATE_RUNNING (1 << 6)
+#define STATE_AUDIO_PATTERN_LOADED (1 << 7)
+
+// Everything a running machine needs to continue, in a fixed layout with no pointers. Taking or restoring
+// a snapshot is a few straight copies. Caches, frame tracking and stats are not part of the state
+struct Chip8State {
+    uint64_t gfx[2][HIGH_RES_HEIGHT][HIGH_RES_WIDTH / 64];
+    uint8_t memory[MEMORY_SIZE];
+    uint32_t randomState;
+    int32_t speed; // Negative while FX0A waits
+    int32_t interruptType;
+    uint32_t instructionsPerFrame;
+    uint16_t stack[16];
+    uint16_t opcode;
+    uint16_t I;
+    uint16_t pc;
+    uint16_t sp;
+    uint16_t KP;
+    uint16_t KC;
+    uint16_t IK;
+    uint16_t flags; // STATE_* bits
+    uint8_t V[16];
+    uint8_t key[16];
+    uint8_t audioPattern[AUDIO_PATTERN_SIZE];
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+    uint8_t keyReg;
+    uint8_t carry;
+    uint8_t plane;
+    uint8_t pitch;
+    uint8_t reserved[2];
+};
+
+// Save state file: this header followed by a struct Chip8State. Both are 8-byte aligned with no padding,
+// so a mapped file can be read in place
+struct StateFileHeader {
+    char magic[4]; // STATE_MAGIC
+    uint16_t version;
+    uint16_t byteOrder; // STATE_BYTE_ORDER
+    uint32_t stateSize; // sizeof(struct Chip8State)
+    uint32_t reserved;
+    uint64_t checksum; // hashBytes over the state
+};
+
+// Function prototypes
+void saveState(const struct Chip8 *chip8, struct Chip8State *state);
+void loadState(struct Chip8 *chip8, const struct Chip8State *state);
+const struct Chip8State *checkStateFile(const void *data, size_t size);
+int writeStateFile(const struct Chip8 *chip8, const char *path);
+int readStateFile(struct Chip8 *chip8, const char *path);
+
+#endif // SAVESTATE_H
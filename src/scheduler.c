@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include "scheduler.h"
+
+// Accumulator gained per counter tick, one frame costs frequency
+static uint64_t frameScale(const struct Scheduler *scheduler) {
+    return (uint64_t)SCHEDULER_FRAME_RATE * scheduler->multiplier;
+}
+
+static void advanceClock(struct Scheduler *scheduler) {
+    const uint64_t now = SDL_GetPerformanceCounter();
+    scheduler->accumulator += (now - scheduler->last) * frameScale(scheduler);
+    scheduler->last = now;
+}
+
+void initScheduler(struct Scheduler *scheduler, int multiplier, bool uncapped) {
+    memset(scheduler, 0, sizeof(*scheduler));
+    scheduler->frequency = SDL_GetPerformanceFrequency();
+    scheduler->multiplier = multiplier < 1 ? 1 : multiplier;
+    scheduler->uncapped = uncapped;
+    scheduler->last = scheduler->startTime = SDL_GetPerformanceCounter();
+    scheduler->accumulator = scheduler->frequency * scheduler->multiplier; // First batch is due right away
+}
+
+// Returns true while another frame should run before the caller presents. A batch is one 60 Hz display
+// frame's worth of emulation: 1 frame at 1x, N at Nx, more after a stall, and as many as fit in 1/60 s uncapped
+bool schedulerFrameDue(struct Scheduler *scheduler) {
+    if (scheduler->uncapped) {
+        const uint64_t now = SDL_GetPerformanceCounter();
+        if (!scheduler->inBatch) {
+            scheduler->inBatch = true;
+            scheduler->batchStart = now;
+        } else if ((now - scheduler->batchStart) * SCHEDULER_FRAME_RATE >= scheduler->frequency) {
+            scheduler->inBatch = false;
+            return false;
+        }
+        scheduler->frames++;
+        return true;
+    }
+
+    advanceClock(scheduler);
+    if (!scheduler->inBatch) {
+        const uint64_t batch = scheduler->frequency * scheduler->multiplier;
+        const uint64_t limit = batch * SCHEDULER_MAX_CATCHUP;
+        if (scheduler->accumulator < batch) return false;
+
+        // How long after its due time this batch started
+        const double late = (double)(scheduler->accumulator - batch) / frameScale(scheduler) / scheduler->frequency;
+        scheduler->errorSum += late;
+        if (late > scheduler->errorMax) scheduler->errorMax = late;
+        scheduler->wakeups++;
+
+        // Too far behind to catch up, drop the backlog so the emulator doesn't spiral
+        if (scheduler->accumulator > limit) {
+            scheduler->droppedFrames += (scheduler->accumulator - limit) / scheduler->frequency;
+            scheduler->accumulator = limit;
+        }
+        scheduler->inBatch = true;
+        scheduler->batchFrames = 0;
+    }
+    // Slower than real time: end the batch anyway so the frontend still presents and polls events
+    if (scheduler->accumulator < scheduler->frequency ||
+        scheduler->batchFrames >= SCHEDULER_MAX_CATCHUP * scheduler->multiplier) {
+        scheduler->inBatch = false;
+        return false;
+    }
+    scheduler->accumulator -= scheduler->frequency;
+    scheduler->batchFrames++;
+    scheduler->frames++;
+    return true;
+}
+
+// Sleep until the next batch is due. SDL_Delay covers most of the wait and the rest is spun on the counter
+void schedulerWait(struct Scheduler *scheduler) {
+    if (scheduler->uncapped) return;
+
+    advanceClock(scheduler);
+    const uint64_t batch = scheduler->frequency * scheduler->multiplier;
+    if (scheduler->accumulator >= batch) return;
+
+    const uint64_t remaining = (batch - scheduler->accumulator + frameScale(scheduler) - 1) / frameScale(scheduler);
+    const uint64_t due = scheduler->last + remaining;
+    const uint64_t spin = scheduler->frequency * SCHEDULER_SPIN_MS / 1000;
+    if (remaining > spin) SDL_Delay((Uint32)((remaining - spin) * 1000 / scheduler->frequency));
+    while (SDL_GetPerformanceCounter() < due) {
+    }
+}
+
+// Milliseconds until the next batch is due, rounded up, 0 when it already is. For waiting in SDL_WaitEventTimeout
+uint32_t schedulerMsUntilDue(struct Scheduler *scheduler) {
+    if (scheduler->uncapped) return 0;
+
+    advanceClock(scheduler);
+    const uint64_t batch = scheduler->frequency * scheduler->multiplier;
+    if (scheduler->accumulator >= batch) return 0;
+    const uint64_t remaining = (batch - scheduler->accumulator + frameScale(scheduler) - 1) / frameScale(scheduler);
+    return (uint32_t)((remaining * 1000 + scheduler->frequency - 1) / scheduler->frequency);
+}
+
+// Forget the time spent blocked while the guest was quiescent. The frames it would have run change nothing,
+// so they are neither caught up nor counted as dropped, and the next batch is due right away. Returns how many
+// frames the wait stood in for beyond that batch, so frame counters that follow real time can skip ahead
+uint64_t schedulerResync(struct Scheduler *scheduler) {
+    const uint64_t batch = scheduler->frequency * scheduler->multiplier;
+    uint64_t skipped = 0;
+
+    scheduler->inBatch = false;
+    if (scheduler->uncapped) {
+        scheduler->last = SDL_GetPerformanceCounter();
+        scheduler->accumulator = batch;
+        return 0;
+    }
+    // The part of a frame already waited for carries over, so repeated waits don't lose time
+    advanceClock(scheduler);
+    if (scheduler->accumulator > batch) skipped = (scheduler->accumulator - batch) / scheduler->frequency;
+    scheduler->accumulator = batch + scheduler->accumulator % scheduler->frequency;
+    return skipped;
+}
+
+void printSchedulerStats(const struct Scheduler *scheduler) {
+    const double seconds = (double)(SDL_GetPerformanceCounter() - scheduler->startTime) / scheduler->frequency;
+
+    printf("Emulated %llu frames in %.2f s (%.1f per second)", (unsigned long long)scheduler->frames, seconds,
+           seconds > 0 ? scheduler->frames / seconds : 0.0);
+    if (scheduler->wakeups > 0) {
+        printf(", pacing error mean %.3f ms, max %.3f ms, %llu frames dropped",
+               scheduler->errorSum / scheduler->wakeups * 1000.0, scheduler->errorMax * 1000.0,
+               (unsigned long long)scheduler->droppedFrames);
+    }
+    printf("\n");
+}
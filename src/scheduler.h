@@ -0,0 +1,40 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SCHEDULER_FRAME_RATE 60 // Emulated frames (timer ticks) per second at 1x
+#define SCHEDULER_MAX_CATCHUP 4 // Frames per 1x of speed run back to back after a stall, the rest are dropped
+#define SCHEDULER_SPIN_MS 2 // Busy-wait the last stretch of a wait, SDL_Delay overshoots by up to a millisecond
+
+// Paces emulated frames against the high resolution counter. Elapsed time is accumulated in counter ticks
+// scaled by frame rate and multiplier, so the long run frame rate is exact and never drifts
+struct Scheduler {
+    uint64_t frequency; // Counter ticks per second, one frame costs this much accumulator
+    uint64_t last; // Counter value the accumulator was last updated at
+    uint64_t accumulator;
+    int multiplier; // Speed, N times the 60 Hz frame rate
+    bool uncapped; // Run frames as fast as the host allows, presenting at 60 Hz
+    bool inBatch; // Frames are being handed out, cleared once the caller should present
+    int batchFrames; // Frames handed out in the current batch
+    uint64_t batchStart; // Uncapped mode: counter value the current batch started at
+
+    // Pacing stats
+    uint64_t frames;
+    uint64_t droppedFrames; // Frames skipped after a stall instead of being caught up
+    uint64_t wakeups; // Batches measured for pacing error
+    double errorSum; // Seconds between when a batch was due and when it started
+    double errorMax;
+    uint64_t startTime;
+};
+
+// Function prototypes
+void initScheduler(struct Scheduler *scheduler, int multiplier, bool uncapped);
+bool schedulerFrameDue(struct Scheduler *scheduler);
+void schedulerWait(struct Scheduler *scheduler);
+uint32_t schedulerMsUntilDue(struct Scheduler *scheduler);
+uint64_t schedulerResync(struct Scheduler *scheduler);
+void printSchedulerStats(const struct Scheduler *scheduler);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,74 @@
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+// Lock-free single-producer/single-consumer ring of fixed-size items. One thread pushes and one other thread pops,
+// neither ever blocks. capacity must be a power of two; the storage is owned by the caller.
+struct SpscQueue {
+    unsigned char *items;
+    size_t itemSize;
+    size_t mask; // capacity - 1
+    _Atomic size_t head; // Next slot to pop, written by the consumer
+    _Atomic size_t tail; // Next slot to push, written by the producer
+};
+
+static inline void spscInit(struct SpscQueue *queue, void *storage, size_t itemSize, size_t capacity) {
+    queue->items = storage;
+    queue->itemSize = itemSize;
+    queue->mask = capacity - 1;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+}
+
+// Producer side. Returns false when the queue is full
+static inline bool spscPush(struct SpscQueue *queue, const void *item) {
+    const size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (tail - head > queue->mask) return false;
+    memcpy(queue->items + (tail & queue->mask) * queue->itemSize, item, queue->itemSize);
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+// Producer side. The slot the next item goes in, to be filled in place and published with spscCommit. Returns NULL
+// when the queue is full
+static inline void *spscReserve(struct SpscQueue *queue) {
+    const size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+    if (tail - head > queue->mask) return NULL;
+    return queue->items + (tail & queue->mask) * queue->itemSize;
+}
+
+// Producer side. Publishes the slot from spscReserve
+static inline void spscCommit(struct SpscQueue *queue) {
+    const size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+}
+
+// Consumer side. Copies the oldest item without removing it, returns false when the queue is empty
+static inline bool spscPeek(struct SpscQueue *queue, void *item) {
+    const size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    const size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if (head == tail) return false;
+    memcpy(item, queue->items + (head & queue->mask) * queue->itemSize, queue->itemSize);
+    return true;
+}
+
+// Consumer side. Drops the oldest item, only valid after a successful spscPeek
+static inline void spscDrop(struct SpscQueue *queue) {
+    const size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+}
+
+// Consumer side. Returns false when the queue is empty
+static inline bool spscPop(struct SpscQueue *queue, void *item) {
+    if (!spscPeek(queue, item)) return false;
+    spscDrop(queue);
+    return true;
+}
+
+#endif // SPSC_H
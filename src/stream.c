@@ -0,0 +1,484 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stream.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define CHIP8_HAVE_STREAM 1
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0 // SIGPIPE is ignored instead, see openStreamServer
+#endif
+#endif
+
+_Static_assert(HIGH_RES_HEIGHT <= 64, "The changed row mask is one uint64_t");
+
+static void put16(uint8_t *data, uint16_t value) {
+    data[0] = value >> 8;
+    data[1] = value & 0xFF;
+}
+
+static void put32(uint8_t *data, uint32_t value) {
+    put16(data, value >> 16);
+    put16(data + 2, value & 0xFFFF);
+}
+
+static void put64(uint8_t *data, uint64_t value) {
+    put32(data, value >> 32);
+    put32(data + 4, value & 0xFFFFFFFF);
+}
+
+static uint16_t get16(const uint8_t *data) {
+    return (uint16_t)(data[0] << 8 | data[1]);
+}
+
+static uint32_t get32(const uint8_t *data) {
+    return (uint32_t)get16(data) << 16 | get16(data + 2);
+}
+
+static uint64_t get64(const uint8_t *data) {
+    return (uint64_t)get32(data) << 32 | get32(data + 4);
+}
+
+static inline int leadingZeros(uint64_t value) {
+#if defined(__GNUC__)
+    return value ? __builtin_clzll(value) : 64;
+#else
+    int count = 0;
+    while (count < 64 && !(value >> (63 - count) & 1)) ++count;
+    return count;
+#endif
+}
+
+// Pixels from pos on that are all set (bit 1) or all clear (bit 0), up to the end of the row
+static int runLength(const uint64_t *row, int words, int pos, int bit) {
+    int length = 0;
+
+    while (pos < words * 64) {
+        const int available = 64 - (pos & 63);
+        uint64_t word = row[pos >> 6] << (pos & 63);
+        if (bit) word = ~word;
+        const int run = leadingZeros(word) < available ? leadingZeros(word) : available;
+        length += run;
+        pos += run;
+        if (run < available) break;
+    }
+    return length;
+}
+
+// Encode one row's XOR delta as runs, or raw when the runs would not be shorter. Returns the bytes written
+static int encodeRow(const uint64_t *delta, int words, uint8_t *out) {
+    const int rawSize = 1 + words * 8;
+    int size = 0;
+
+    for (int pos = 0, bit = 0; pos < words * 64; bit ^= 1) {
+        if (size + 1 >= rawSize) {
+            out[0] = STREAM_RAW_ROW;
+            for (int word = 0; word < words; ++word) put64(out + 1 + word * 8, delta[word]);
+            return rawSize;
+        }
+        const int run = runLength(delta, words, pos, bit);
+        out[size++] = (uint8_t)run;
+        pos += run;
+    }
+    return size;
+}
+
+// Flip the pixels [pos, pos + length) of a packed row
+static void flipRun(uint64_t *row, int pos, int length) {
+    while (length > 0) {
+        const int offset = pos & 63;
+        const int take = length < 64 - offset ? length : 64 - offset;
+        const uint64_t bits = take == 64 ? ~0ULL : ((1ULL << take) - 1) << (64 - offset - take);
+        row[pos >> 6] ^= bits;
+        pos += take;
+        length -= take;
+    }
+}
+
+// Apply one row's delta. Returns the bytes read, or -1 if the delta is malformed or runs past size
+static int decodeRow(uint64_t *row, int words, const uint8_t *data, size_t size) {
+    if (size < 1) return -1;
+    if (data[0] == STREAM_RAW_ROW) {
+        if (size < 1 + (size_t)words * 8) return -1;
+        for (int word = 0; word < words; ++word) row[word] ^= get64(data + 1 + word * 8);
+        return 1 + words * 8;
+    }
+    size_t used = 0;
+    int pos = 0;
+    for (int bit = 0; pos < words * 64; bit ^= 1) {
+        if (used == size) return -1;
+        const int run = data[used++];
+        if (pos + run > words * 64) return -1;
+        if (bit) flipRun(row, pos, run);
+        pos += run;
+    }
+    return (int)used;
+}
+
+void initStreamEncoder(struct StreamEncoder *encoder) {
+    memset(encoder, 0, sizeof(*encoder));
+}
+
+// Flags, mode and palette at the start of a message. Returns where the body starts
+static uint8_t *writeHeader(uint8_t *out, int flags, bool highRes, const uint32_t palette[2]) {
+    uint8_t *p = out + 2;
+
+    *p++ = (uint8_t)flags;
+    if (flags & STREAM_MODE) *p++ = highRes;
+    if (flags & STREAM_PALETTE) {
+        put32(p, palette[0]);
+        put32(p + 4, palette[1]);
+        p += 8;
+    }
+    return p;
+}
+
+// Write the rows of rows that differ from base, with the header, into out. Falls back to the raw display when the
+// deltas would not be smaller. Returns the message size
+static int writeMessage(uint8_t *out, int flags, bool highRes, const uint32_t palette[2], const uint64_t rows[][2],
+                        const uint64_t base[][2]) {
+    const int height = highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
+    const int words = highRes ? 2 : 1;
+    uint8_t *p = writeHeader(out, flags, highRes, palette);
+    uint64_t changed = 0;
+
+    for (int y = 0; y < height; ++y) {
+        if (rows[y][0] != base[y][0] || (words == 2 && rows[y][1] != base[y][1])) changed |= 1ULL << y;
+    }
+    put64(p, changed);
+    p += 8;
+    for (uint64_t pending = changed; pending; pending &= pending - 1) {
+        const int y = 63 - leadingZeros(pending & -pending);
+        const uint64_t delta[2] = { rows[y][0] ^ base[y][0], words == 2 ? rows[y][1] ^ base[y][1] : 0 };
+        p += encodeRow(delta, words, p);
+    }
+    if (p - out >= streamRawSize(flags, highRes)) {
+        p = writeHeader(out, flags | STREAM_RAW, highRes, palette);
+        for (int y = 0; y < height; ++y) {
+            for (int word = 0; word < words; ++word, p += 8) put64(p, rows[y][word]);
+        }
+    }
+    put16(out, (uint16_t)(p - out - 2));
+    return (int)(p - out);
+}
+
+// Encode the display against the last encoded frame into out (STREAM_MAX_MESSAGE bytes). Returns the message size,
+// or 0 when nothing changed and no message is needed
+int encodeFrame(struct StreamEncoder *encoder, const struct Chip8 *chip8, const uint32_t palette[2], uint8_t *out) {
+    static const uint64_t blank[HIGH_RES_HEIGHT][2];
+    int flags = 0;
+
+    if (!encoder->started || chip8->highRes != encoder->highRes) flags |= STREAM_MODE | STREAM_KEYFRAME;
+    if (!encoder->started || palette[0] != encoder->palette[0] || palette[1] != encoder->palette[1]) {
+        flags |= STREAM_PALETTE;
+    }
+    // A resolution switch clears the display, so the new one is sent against a blank one
+    if (flags & STREAM_KEYFRAME) memset(encoder->rows, 0, sizeof(encoder->rows));
+    const int size = writeMessage(out, flags, chip8->highRes, palette, chip8->gfx[0],
+                                  flags & STREAM_KEYFRAME ? blank : (const uint64_t (*)[2])encoder->rows);
+    if (!flags && !(out[2] & STREAM_RAW) && get64(out + 3) == 0) return 0;
+
+    memcpy(encoder->rows, chip8->gfx[0], sizeof(encoder->rows));
+    encoder->highRes = chip8->highRes;
+    encoder->palette[0] = palette[0];
+    encoder->palette[1] = palette[1];
+    encoder->started = true;
+    ++encoder->frames;
+    encoder->bytes += (uint64_t)size;
+    return size;
+}
+
+// The whole display as last encoded, for a subscriber joining or resyncing
+int encodeKeyframe(const struct StreamEncoder *encoder, uint8_t *out) {
+    static const uint64_t blank[HIGH_RES_HEIGHT][2];
+    return writeMessage(out, STREAM_KEYFRAME | STREAM_MODE | STREAM_PALETTE, encoder->highRes, encoder->palette,
+                        (const uint64_t (*)[2])encoder->rows, blank);
+}
+
+void writeStreamHello(uint8_t *out) {
+    memcpy(out, STREAM_MAGIC, 4);
+    put16(out + 4, STREAM_VERSION);
+    put16(out + 6, 0);
+}
+
+void initStreamDecoder(struct StreamDecoder *decoder) {
+    memset(decoder, 0, sizeof(*decoder));
+}
+
+int checkStreamHello(const uint8_t *data, size_t size) {
+    if (size < STREAM_HELLO_SIZE || memcmp(data, STREAM_MAGIC, 4) != 0) {
+        printf("Not a CHIP-8 frame stream.\n");
+        return -1;
+    }
+    if (get16(data + 4) != STREAM_VERSION) {
+        printf("Stream version %d is not supported.\n", get16(data + 4));
+        return -1;
+    }
+    return 0;
+}
+
+// Apply one frame message from the start of data. Returns the bytes it took, 0 when data does not hold a whole
+// message yet, or -1 when the message is malformed
+int decodeMessage(struct StreamDecoder *decoder, const uint8_t *data, size_t size) {
+    if (size < 2 || size < 2 + (size_t)get16(data)) return 0;
+    const size_t length = 2 + (size_t)get16(data);
+    struct Display *display = &decoder->display;
+    size_t used = 2;
+
+    if (length < used + 9) return -1;
+    const int flags = data[used++];
+    decoder->modeChanged = false;
+    decoder->paletteChanged = false;
+    if (flags & STREAM_MODE) {
+        const bool highRes = data[used++] != 0;
+        decoder->modeChanged = highRes != display->highRes;
+        display->highRes = highRes;
+    }
+    if (flags & STREAM_PALETTE) {
+        if (length < used + 8 + 8) return -1;
+        decoder->palette[0] = get32(data + used);
+        decoder->palette[1] = get32(data + used + 4);
+        decoder->paletteChanged = true;
+        used += 8;
+    }
+    const int height = display->highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
+    const int words = display->highRes ? 2 : 1;
+    const uint64_t allRows = height == 64 ? ~0ULL : (1ULL << height) - 1;
+    if (flags & STREAM_RAW) {
+        if (length != used + (size_t)(height * words * 8)) return -1;
+        memset(display->gfx, 0, sizeof(display->gfx));
+        for (int y = 0; y < height; ++y) {
+            for (int word = 0; word < words; ++word, used += 8) display->gfx[y][word] = get64(data + used);
+        }
+        decoder->changedRows = allRows;
+        return (int)length;
+    }
+    if (length < used + 8) return -1;
+    const uint64_t changed = get64(data + used);
+    used += 8;
+
+    if (height < 64 && changed >> height) return -1;
+    if (flags & STREAM_KEYFRAME) memset(display->gfx, 0, sizeof(display->gfx));
+    for (uint64_t pending = changed; pending; pending &= pending - 1) {
+        const int y = 63 - leadingZeros(pending & -pending);
+        const int read = decodeRow(display->gfx[y], words, data + used, length - used);
+        if (read < 0) return -1;
+        used += (size_t)read;
+    }
+    if (used != length) return -1;
+    decoder->changedRows = flags & (STREAM_KEYFRAME | STREAM_MODE) ? allRows : changed;
+    return (int)length;
+}
+
+#ifdef CHIP8_HAVE_STREAM
+// Open a socket for unix:PATH or tcp:[HOST:]PORT, listening or connected. Returns the socket or -1
+static int openAddress(const char *address, bool listening, char *unixPath, size_t unixPathSize) {
+    int fd = -1;
+
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un local = { 0 };
+        local.sun_family = AF_UNIX;
+        if (strlen(address + 5) >= sizeof(local.sun_path)) {
+            printf("Invalid stream address: %s\n", address);
+            return -1;
+        }
+        strcpy(local.sun_path, address + 5);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (listening) {
+            unlink(local.sun_path); // A socket file left by a previous run
+            if (bind(fd, (struct sockaddr *)&local, sizeof(local)) != 0 || listen(fd, 8) != 0) {
+                close(fd);
+                return -1;
+            }
+            if (unixPath) snprintf(unixPath, unixPathSize, "%s", local.sun_path);
+        } else if (connect(fd, (struct sockaddr *)&local, sizeof(local)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    if (strncmp(address, "tcp:", 4) != 0) {
+        printf("Invalid stream address: %s\n", address);
+        return -1;
+    }
+
+    char host[256] = "";
+    const char *port = address + 4;
+    const char *colon = strrchr(port, ':');
+    if (colon) {
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - port), port);
+        port = colon + 1;
+    }
+    struct addrinfo hints = { 0 };
+    struct addrinfo *found;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    if (getaddrinfo(host[0] ? host : NULL, port, &hints, &found) != 0) {
+        printf("Invalid stream address: %s\n", address);
+        return -1;
+    }
+    fd = socket(found->ai_family, found->ai_socktype, found->ai_protocol);
+    if (fd >= 0) {
+        const int reuse = 1;
+        int status;
+        if (listening) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            status = bind(fd, found->ai_addr, found->ai_addrlen) == 0 && listen(fd, 8) == 0 ? 0 : -1;
+        } else {
+            status = connect(fd, found->ai_addr, found->ai_addrlen);
+        }
+        if (status != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(found);
+    return fd;
+}
+
+static void setNonBlocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Send as much of a subscriber's queue as the socket takes. Returns -1 when the subscriber is gone
+static int flushClient(struct StreamServer *server, struct StreamClient *client) {
+    while (client->pendingSize > 0) {
+        const ssize_t sent = send(client->socket, client->pending, (size_t)client->pendingSize, MSG_NOSIGNAL);
+        if (sent < 0) return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        memmove(client->pending, client->pending + sent, (size_t)(client->pendingSize - sent));
+        client->pendingSize -= (int)sent;
+        server->stats.bytesSent += (uint64_t)sent;
+    }
+    return 0;
+}
+
+static void queueBytes(struct StreamClient *client, const uint8_t *data, int size) {
+    memcpy(client->pending + client->pendingSize, data, (size_t)size);
+    client->pendingSize += size;
+}
+
+static void removeClient(struct StreamServer *server, int index) {
+    close(server->clients[index].socket);
+    free(server->clients[index].pending);
+    server->clients[index] = server->clients[--server->clientCount];
+}
+
+// Take every waiting connection. A new subscriber gets the hello and a keyframe of the current display
+static void acceptClients(struct StreamServer *server, const struct StreamEncoder *encoder) {
+    int fd;
+
+    while ((fd = accept(server->listener, NULL, NULL)) >= 0) {
+        struct StreamClient *client = &server->clients[server->clientCount];
+        if (server->clientCount == STREAM_MAX_CLIENTS || !(client->pending = malloc(STREAM_CLIENT_BUFFER))) {
+            close(fd);
+            continue;
+        }
+        setNonBlocking(fd);
+        client->socket = fd;
+        client->pendingSize = 0;
+        client->resync = !encoder->started;
+        writeStreamHello(client->pending);
+        client->pendingSize = STREAM_HELLO_SIZE;
+        if (encoder->started) client->pendingSize += encodeKeyframe(encoder, client->pending + client->pendingSize);
+        ++server->clientCount;
+        ++server->stats.subscribers;
+        if (flushClient(server, client) != 0) removeClient(server, server->clientCount - 1);
+    }
+}
+#endif
+
+// Listen on unix:PATH or tcp:[HOST:]PORT for subscribers
+int openStreamServer(struct StreamServer *server, const char *address) {
+    memset(server, 0, sizeof(*server));
+    server->listener = -1;
+#ifdef CHIP8_HAVE_STREAM
+    signal(SIGPIPE, SIG_IGN); // A subscriber hanging up must not end the emulator
+    server->listener = openAddress(address, true, server->path, sizeof(server->path));
+    if (server->listener < 0) {
+        printf("Stream could not be opened: %s\n", address);
+        return -1;
+    }
+    setNonBlocking(server->listener);
+    return 0;
+#else
+    (void)address;
+    printf("Streaming is not available on this platform.\n");
+    return -1;
+#endif
+}
+
+// Send a message from encodeFrame to every subscriber, or with size 0 only take in new ones. Call it after
+// encodeFrame, new subscribers get a keyframe of the encoder's display and then every message after it
+void publishStream(struct StreamServer *server, struct StreamEncoder *encoder, const uint8_t *message, int size) {
+#ifdef CHIP8_HAVE_STREAM
+    uint8_t keyframe[STREAM_MAX_MESSAGE];
+
+    if (size > 0) ++server->stats.messages;
+    for (int i = 0; i < server->clientCount; ++i) {
+        struct StreamClient *client = &server->clients[i];
+        if (flushClient(server, client) != 0) {
+            removeClient(server, i--);
+            continue;
+        }
+        if (client->resync) {
+            // The keyframe already holds this frame, so it replaces the message
+            if (client->pendingSize == 0 && encoder->started) {
+                queueBytes(client, keyframe, encodeKeyframe(encoder, keyframe));
+                client->resync = false;
+            }
+        } else if (size > 0 && client->pendingSize + size <= STREAM_CLIENT_BUFFER) {
+            queueBytes(client, message, size);
+        } else if (size > 0) {
+            client->resync = true;
+            ++server->stats.resyncs;
+        }
+        if (flushClient(server, client) != 0) removeClient(server, i--);
+    }
+    acceptClients(server, encoder);
+#else
+    (void)server;
+    (void)encoder;
+    (void)message;
+    (void)size;
+#endif
+}
+
+void printStreamStats(const struct StreamServer *server, const struct StreamEncoder *encoder) {
+    printf("Stream: %llu messages, %llu bytes encoded (%.1f bytes per message), %llu bytes sent to %llu subscribers, "
+           "%llu resyncs\n",
+           (unsigned long long)encoder->frames, (unsigned long long)encoder->bytes,
+           encoder->frames ? (double)encoder->bytes / encoder->frames : 0.0, (unsigned long long)server->stats.bytesSent,
+           (unsigned long long)server->stats.subscribers, (unsigned long long)server->stats.resyncs);
+}
+
+void closeStreamServer(struct StreamServer *server) {
+#ifdef CHIP8_HAVE_STREAM
+    while (server->clientCount > 0) removeClient(server, server->clientCount - 1);
+    if (server->listener >= 0) close(server->listener);
+    if (server->path[0]) unlink(server->path);
+#endif
+    server->listener = -1;
+}
+
+// Connect to a stream server as a subscriber. Returns the socket, or -1
+int connectStream(const char *address) {
+#ifdef CHIP8_HAVE_STREAM
+    const int fd = openAddress(address, false, NULL, 0);
+    if (fd < 0) printf("Stream could not be opened: %s\n", address);
+    return fd;
+#else
+    printf("Streaming is not available on this platform.\n");
+    (void)address;
+    return -1;
+#endif
+}
@@ -0,0 +1,94 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "core.h"
+#include "render.h"
+
+#define STREAM_MAGIC "C8FS"
+#define STREAM_VERSION 2
+#define STREAM_HELLO_SIZE 8 // STREAM_MAGIC, uint16 version, uint16 reserved, sent once per connection
+#define STREAM_MAX_MESSAGE 2048 // Largest frame message: a keyframe of 64 raw high res rows plus the headers
+#define STREAM_MAX_CLIENTS 32
+#define STREAM_CLIENT_BUFFER 65536 // Bytes queued per subscriber before it is resynced with a keyframe
+#define STREAM_RAW_ROW 0xFF // Row marker: the row's delta follows as raw bytes instead of runs
+
+// Bits of the flags byte at the start of each frame message
+#define STREAM_KEYFRAME (1 << 0) // Deltas are against a blank display
+#define STREAM_MODE (1 << 1) // A resolution byte follows, 1 for high res
+#define STREAM_PALETTE (1 << 2) // Background and foreground ARGB follow
+#define STREAM_RAW (1 << 3) // The whole display follows as raw rows instead of the row mask and deltas
+
+// Frame message, big-endian: uint16 length of the rest, flags, [mode], [palette], uint64 changed row mask, then one
+// delta per changed row. A delta is the XOR of the row against the previous frame, either as alternating runs of
+// unchanged and changed pixels (one byte each, starting with unchanged, until the row width is covered) or as
+// STREAM_RAW_ROW and the XOR bytes when that is shorter. When the deltas of a frame add up to no less than the display
+// itself, as on a full redraw, the frame goes out with STREAM_RAW instead: every row's bytes in place of the mask and
+// deltas, so no message is ever larger than sending the raw display
+
+// Size of a message with these flags carrying the whole display raw, the most any frame message takes
+static inline int streamRawSize(int flags, bool highRes) {
+    return 3 + (flags & STREAM_MODE ? 1 : 0) + (flags & STREAM_PALETTE ? 8 : 0) +
+           (highRes ? HIGH_RES_HEIGHT * HIGH_RES_WIDTH : LOW_RES_HEIGHT * LOW_RES_WIDTH) / 8;
+}
+
+// Encoder side. Holds the display as last encoded, one encoder feeds every subscriber
+struct StreamEncoder {
+    uint64_t rows[HIGH_RES_HEIGHT][HIGH_RES_WIDTH / 64];
+    bool highRes;
+    uint32_t palette[2];
+    bool started; // A frame has been encoded, the first one goes out with mode and palette
+    uint64_t frames; // Messages from encodeFrame, keyframes for subscribers are not counted
+    uint64_t bytes;
+};
+
+// Decoder side: the display rebuilt from the stream, ready for renderRows
+struct StreamDecoder {
+    struct Display display;
+    uint32_t palette[2];
+    uint64_t changedRows; // Rows the last decoded message changed, all of them after a mode change or keyframe
+    bool modeChanged; // The last message switched resolution
+    bool paletteChanged;
+};
+
+struct StreamClient {
+    int socket;
+    bool resync; // Its queue overflowed, the next message it gets is a keyframe
+    int pendingSize;
+    uint8_t *pending; // STREAM_CLIENT_BUFFER bytes not sent yet
+};
+
+struct StreamStats {
+    uint64_t subscribers; // Accepted over the lifetime of the server
+    uint64_t messages; // Frame messages published
+    uint64_t bytesSent;
+    uint64_t resyncs; // Times a slow subscriber's queue overflowed
+};
+
+// Fans one encoded stream out to up to STREAM_MAX_CLIENTS subscribers over a Unix or TCP socket. Nothing blocks:
+// a subscriber that cannot keep up has its frames dropped and gets a keyframe once its queue drains
+struct StreamServer {
+    int listener;
+    struct StreamClient clients[STREAM_MAX_CLIENTS];
+    int clientCount;
+    char path[108]; // Unix socket to remove on close, empty for TCP
+    struct StreamStats stats;
+};
+
+// Function prototypes
+void initStreamEncoder(struct StreamEncoder *encoder);
+int encodeFrame(struct StreamEncoder *encoder, const struct Chip8 *chip8, const uint32_t palette[2], uint8_t *out);
+int encodeKeyframe(const struct StreamEncoder *encoder, uint8_t *out);
+void writeStreamHello(uint8_t *out);
+void initStreamDecoder(struct StreamDecoder *decoder);
+int checkStreamHello(const uint8_t *data, size_t size);
+int decodeMessage(struct StreamDecoder *decoder, const uint8_t *data, size_t size);
+int openStreamServer(struct StreamServer *server, const char *address);
+void publishStream(struct StreamServer *server, struct StreamEncoder *encoder, const uint8_t *message, int size);
+void printStreamStats(const struct StreamServer *server, const struct StreamEncoder *encoder);
+void closeStreamServer(struct StreamServer *server);
+int connectStream(const char *address);
+
+#endif // STREAM_H
@@ -0,0 +1,59 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define TRIPLE_FRESH 4u // Set in middle while it holds a frame the reader has not taken yet
+
+// Lock-free triple buffer between one writer thread and one reader thread. The writer always has a slot of its own
+// to fill and the reader always has the latest complete one, so neither ever waits on the other. A frame published
+// before the reader took the previous one replaces it, and is counted as dropped. The slots are owned by the caller.
+struct TripleBuffer {
+    void *slots[3];
+    _Atomic unsigned middle; // Slot handed between the sides, with TRIPLE_FRESH
+    unsigned back; // Slot the writer fills, writer side only
+    unsigned front; // Slot the reader holds, reader side only
+    _Atomic uint64_t published; // Frames published by the writer
+    _Atomic uint64_t dropped; // Frames replaced before the reader took them
+};
+
+static inline void tripleInit(struct TripleBuffer *buffer, void *first, void *second, void *third) {
+    buffer->slots[0] = first;
+    buffer->slots[1] = second;
+    buffer->slots[2] = third;
+    buffer->back = 0;
+    atomic_init(&buffer->middle, 1);
+    buffer->front = 2;
+    atomic_init(&buffer->published, 0);
+    atomic_init(&buffer->dropped, 0);
+}
+
+// Writer side. The slot to fill for the next frame
+static inline void *tripleWriteSlot(struct TripleBuffer *buffer) {
+    return buffer->slots[buffer->back];
+}
+
+// Writer side. Hand the filled slot to the reader and take the middle one back to fill next
+static inline void triplePublish(struct TripleBuffer *buffer) {
+    const unsigned previous = atomic_exchange_explicit(&buffer->middle, buffer->back | TRIPLE_FRESH, memory_order_acq_rel);
+    buffer->back = previous & 3;
+    if (previous & TRIPLE_FRESH) atomic_fetch_add_explicit(&buffer->dropped, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&buffer->published, 1, memory_order_relaxed);
+}
+
+// Reader side. Take the latest published frame if there is a new one, returns false when there is not
+static inline bool tripleAcquire(struct TripleBuffer *buffer) {
+    if (!(atomic_load_explicit(&buffer->middle, memory_order_relaxed) & TRIPLE_FRESH)) return false;
+    const unsigned previous = atomic_exchange_explicit(&buffer->middle, buffer->front, memory_order_acq_rel);
+    buffer->front = previous & 3;
+    return true;
+}
+
+// Reader side. The frame taken by the last successful tripleAcquire
+static inline const void *tripleReadSlot(const struct TripleBuffer *buffer) {
+    return buffer->slots[buffer->front];
+}
+
+#endif // TRIPLEBUFFER_H
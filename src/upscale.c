@@ -0,0 +1,331 @@
+#include <string.h>
+#include "render.h"
+#include "upscale.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define CHIP8_HAVE_X86_SIMD 1
+#endif
+
+// Filters work a row at a time on plane 0 as packed bits, so the edge rules of Scale2x/Scale3x are
+// plain 64-bit logic over whole rows. Only the last step, bits to ARGB, touches every output pixel,
+// and that step is the SIMD kernel.
+#define ROW_WORDS (HIGH_RES_WIDTH / 64)
+#define CRT_SCANLINE 128 // Brightness of the last row of each cell, out of 256
+#define CRT_MASK 180 // Brightness of the two channels an aperture column does not favour, out of 256
+
+// Expand width bits (MSB first) into pixels: bg for 0, fg for 1
+typedef void (*ExpandFn)(uint32_t *out, const uint8_t *bits, int width, uint32_t bg, uint32_t fg);
+// Same with per-column colours
+typedef void (*BlendFn)(uint32_t *out, const uint8_t *bits, int width, const uint32_t *bg, const uint32_t *fg);
+
+static void expandScalar(uint32_t *out, const uint8_t *bits, int width, uint32_t bg, uint32_t fg) {
+    for (int x = 0; x < width; ++x) {
+        out[x] = (bits[x >> 3] >> (7 - (x & 7))) & 1 ? fg : bg;
+    }
+}
+
+static void blendScalar(uint32_t *out, const uint8_t *bits, int width, const uint32_t *bg, const uint32_t *fg) {
+    for (int x = 0; x < width; ++x) {
+        out[x] = (bits[x >> 3] >> (7 - (x & 7))) & 1 ? fg[x] : bg[x];
+    }
+}
+
+#ifdef CHIP8_HAVE_X86_SIMD
+// Each byte of bits becomes 8 pixels: broadcast it, test one bit per lane and select between the colours
+__attribute__((target("sse2")))
+static void expandSse2(uint32_t *out, const uint8_t *bits, int width, uint32_t bg, uint32_t fg) {
+    const __m128i background = _mm_set1_epi32((int)bg);
+    const __m128i difference = _mm_set1_epi32((int)(bg ^ fg));
+    const __m128i high = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+    const __m128i low = _mm_set_epi32(0x01, 0x02, 0x04, 0x08);
+
+    for (int i = 0; i < width / 8; ++i) {
+        const __m128i byte = _mm_set1_epi32(bits[i]);
+        const __m128i first = _mm_cmpeq_epi32(_mm_and_si128(byte, high), high);
+        const __m128i second = _mm_cmpeq_epi32(_mm_and_si128(byte, low), low);
+        _mm_storeu_si128((__m128i *)(out + 8 * i), _mm_xor_si128(background, _mm_and_si128(first, difference)));
+        _mm_storeu_si128((__m128i *)(out + 8 * i + 4), _mm_xor_si128(background, _mm_and_si128(second, difference)));
+    }
+}
+
+__attribute__((target("sse2")))
+static void blendSse2(uint32_t *out, const uint8_t *bits, int width, const uint32_t *bg, const uint32_t *fg) {
+    const __m128i high = _mm_set_epi32(0x10, 0x20, 0x40, 0x80);
+    const __m128i low = _mm_set_epi32(0x01, 0x02, 0x04, 0x08);
+
+    for (int i = 0; i < width / 8; ++i) {
+        const __m128i byte = _mm_set1_epi32(bits[i]);
+        const __m128i masks[2] = { _mm_cmpeq_epi32(_mm_and_si128(byte, high), high),
+                                   _mm_cmpeq_epi32(_mm_and_si128(byte, low), low) };
+        for (int half = 0; half < 2; ++half) {
+            const int x = 8 * i + 4 * half;
+            const __m128i background = _mm_loadu_si128((const __m128i *)(bg + x));
+            const __m128i foreground = _mm_loadu_si128((const __m128i *)(fg + x));
+            const __m128i pixels = _mm_xor_si128(background, _mm_and_si128(masks[half], _mm_xor_si128(background, foreground)));
+            _mm_storeu_si128((__m128i *)(out + x), pixels);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void expandAvx2(uint32_t *out, const uint8_t *bits, int width, uint32_t bg, uint32_t fg) {
+    const __m256i background = _mm256_set1_epi32((int)bg);
+    const __m256i difference = _mm256_set1_epi32((int)(bg ^ fg));
+    const __m256i select = _mm256_set_epi32(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80);
+
+    for (int i = 0; i < width / 8; ++i) {
+        const __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits[i]), select), select);
+        _mm256_storeu_si256((__m256i *)(out + 8 * i), _mm256_xor_si256(background, _mm256_and_si256(mask, difference)));
+    }
+}
+
+__attribute__((target("avx2")))
+static void blendAvx2(uint32_t *out, const uint8_t *bits, int width, const uint32_t *bg, const uint32_t *fg) {
+    const __m256i select = _mm256_set_epi32(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80);
+
+    for (int i = 0; i < width / 8; ++i) {
+        const __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(bits[i]), select), select);
+        const __m256i background = _mm256_loadu_si256((const __m256i *)(bg + 8 * i));
+        const __m256i foreground = _mm256_loadu_si256((const __m256i *)(fg + 8 * i));
+        const __m256i pixels = _mm256_xor_si256(background, _mm256_and_si256(mask, _mm256_xor_si256(background, foreground)));
+        _mm256_storeu_si256((__m256i *)(out + 8 * i), pixels);
+    }
+}
+#endif
+
+static const struct {
+    const char *name;
+    ExpandFn expand;
+    BlendFn blend;
+} kernels[KERNEL_COUNT] = {
+    [KERNEL_SCALAR] = { "scalar", expandScalar, blendScalar },
+#ifdef CHIP8_HAVE_X86_SIMD
+    [KERNEL_SSE2] = { "sse2", expandSse2, blendSse2 },
+    [KERNEL_AVX2] = { "avx2", expandAvx2, blendAvx2 },
+#else
+    [KERNEL_SSE2] = { "sse2", NULL, NULL },
+    [KERNEL_AVX2] = { "avx2", NULL, NULL },
+#endif
+};
+
+static int activeKernel = -1; // Picked on first use
+
+const char *upscaleKernelName(enum UpscaleKernel kernel) {
+    return kernel < KERNEL_COUNT ? kernels[kernel].name : "unknown";
+}
+
+bool upscaleKernelSupported(enum UpscaleKernel kernel) {
+    if (kernel >= KERNEL_COUNT || !kernels[kernel].expand) return false;
+#ifdef CHIP8_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (kernel == KERNEL_SSE2) return __builtin_cpu_supports("sse2");
+    if (kernel == KERNEL_AVX2) return __builtin_cpu_supports("avx2");
+#endif
+    return true;
+}
+
+// The widest kernel the CPU runs, unless setUpscaleKernel picked one
+enum UpscaleKernel upscaleKernel(void) {
+    if (activeKernel < 0) {
+        activeKernel = KERNEL_SCALAR;
+        for (int kernel = KERNEL_COUNT - 1; kernel > KERNEL_SCALAR; --kernel) {
+            if (upscaleKernelSupported((enum UpscaleKernel)kernel)) {
+                activeKernel = kernel;
+                break;
+            }
+        }
+    }
+    return (enum UpscaleKernel)activeKernel;
+}
+
+int setUpscaleKernel(enum UpscaleKernel kernel) {
+    if (!upscaleKernelSupported(kernel)) return -1;
+    activeKernel = kernel;
+    return 0;
+}
+
+const char *filterName(enum ScaleFilter filter) {
+    static const char *const names[FILTER_COUNT] = {
+        [FILTER_NONE] = "none", [FILTER_SCALE2X] = "scale2x", [FILTER_SCALE3X] = "scale3x", [FILTER_CRT] = "crt",
+    };
+    return filter < FILTER_COUNT ? names[filter] : "unknown";
+}
+
+// Filter by name, or -1
+int parseFilter(const char *name) {
+    for (int filter = 0; filter < FILTER_COUNT; ++filter) {
+        if (strcmp(name, filterName((enum ScaleFilter)filter)) == 0) return filter;
+    }
+    return -1;
+}
+
+// Output pixels per display pixel, in each direction
+int filterScale(enum ScaleFilter filter) {
+    switch (filter) {
+        case FILTER_SCALE2X: return 2;
+        case FILTER_SCALE3X: return 3;
+        case FILTER_CRT: return CRT_SCALE;
+        default: return 1;
+    }
+}
+
+void initUpscaler(struct Upscaler *upscaler, enum ScaleFilter filter) {
+    upscaler->filter = filter;
+    upscaler->crtWidth = 0;
+    upscaleKernel();
+}
+
+// Row y of plane 0, with rows past the edges repeating the edge row
+static void loadRow(const struct Display *display, int y, int height, uint64_t row[ROW_WORDS]) {
+    y = y < 0 ? 0 : y >= height ? height - 1 : y;
+    memcpy(row, display->gfx[y], sizeof(uint64_t) * ROW_WORDS);
+}
+
+// Each pixel's left neighbour, the leftmost pixel repeats itself
+static void leftNeighbours(const uint64_t *row, int words, uint64_t *out) {
+    for (int i = 0; i < words; ++i) {
+        out[i] = row[i] >> 1 | (i > 0 ? row[i - 1] << 63 : row[0] & 1ULL << 63);
+    }
+}
+
+// Each pixel's right neighbour, the rightmost pixel repeats itself
+static void rightNeighbours(const uint64_t *row, int words, uint64_t *out) {
+    for (int i = 0; i < words; ++i) {
+        out[i] = row[i] << 1 | (i + 1 < words ? row[i + 1] >> 63 : row[words - 1] & 1);
+    }
+}
+
+// Pick a where mask is set and b elsewhere
+static inline uint64_t choose(uint64_t mask, uint64_t a, uint64_t b) {
+    return (mask & a) | (~mask & b);
+}
+
+// Spread the 8 bits of value so each one is followed by scale - 1 zero bits
+static inline uint32_t spreadByte(uint32_t value, int scale) {
+    uint32_t out = 0;
+    for (int bit = 0; bit < 8; ++bit) {
+        out |= (value >> bit & 1) << (bit * scale);
+    }
+    return out;
+}
+
+// Interleave scale lanes of width bits into one output row of width * scale bits, lane k giving the k-th
+// pixel of each group. Output bytes are MSB first like the display
+static void interleaveLanes(uint64_t (*lanes)[ROW_WORDS], int scale, int width, uint8_t *out) {
+    for (int byte = 0; byte < width / 8; ++byte) {
+        const int shift = 56 - 8 * (byte & 7);
+        uint32_t group = 0;
+        for (int lane = 0; lane < scale; ++lane) {
+            group |= spreadByte((uint32_t)(lanes[lane][byte >> 3] >> shift) & 0xFF, scale) << (scale - 1 - lane);
+        }
+        for (int i = 0; i < scale; ++i) {
+            out[byte * scale + i] = (uint8_t)(group >> (8 * (scale - 1 - i)));
+        }
+    }
+}
+
+static inline uint32_t dimColour(uint32_t colour, int red, int green, int blue) {
+    return (colour & 0xFF000000) | (((colour >> 16 & 0xFF) * red >> 8) << 16) |
+           (((colour >> 8 & 0xFF) * green >> 8) << 8) | ((colour & 0xFF) * blue >> 8);
+}
+
+// Per-column colours of the CRT filter: an R, G, B aperture mask across, darker scanline rows
+static void buildCrtLines(struct Upscaler *upscaler, const uint32_t palette[2], int width) {
+    for (int scanline = 0; scanline < 2; ++scanline) {
+        const int level = scanline ? CRT_SCANLINE : 256;
+        const int dim = level * CRT_MASK >> 8;
+        for (int x = 0; x < width; ++x) {
+            const int column = x % 3;
+            for (int colour = 0; colour < 2; ++colour) {
+                upscaler->crtLines[scanline][colour][x] = dimColour(palette[colour], column == 0 ? level : dim,
+                                                                    column == 1 ? level : dim, column == 2 ? level : dim);
+            }
+        }
+    }
+    upscaler->palette[0] = palette[0];
+    upscaler->palette[1] = palette[1];
+    upscaler->crtWidth = width;
+}
+
+// Filter rowCount display rows starting at firstRow into pixels, which points at the output of firstRow.
+// Each display row becomes filterScale() output rows of displayWidth() * filterScale() pixels
+void upscaleRows(struct Upscaler *upscaler, const struct Display *display, uint32_t *pixels, int pitch,
+                 const uint32_t palette[2], int firstRow, int rowCount) {
+    const int scale = filterScale(upscaler->filter);
+    const int width = displayWidth(display), height = displayHeight(display), words = width / 64;
+    const int outWidth = width * scale;
+    const ExpandFn expand = kernels[upscaleKernel()].expand;
+    const BlendFn blend = kernels[upscaleKernel()].blend;
+    uint8_t bits[UPSCALE_MAX_WIDTH / 8];
+
+    if (upscaler->filter == FILTER_NONE) {
+        renderRows(display, pixels, pitch, palette, firstRow, rowCount);
+        return;
+    }
+    if (upscaler->filter == FILTER_CRT && (upscaler->crtWidth != outWidth || upscaler->palette[0] != palette[0] ||
+                                           upscaler->palette[1] != palette[1])) {
+        buildCrtLines(upscaler, palette, outWidth);
+    }
+
+    for (int y = firstRow; y < firstRow + rowCount; ++y) {
+        // Neighbourhood of every pixel in the row: up, down, left, right and for Scale3x the corners
+        uint64_t up[ROW_WORDS], centre[ROW_WORDS], down[ROW_WORDS], left[ROW_WORDS], right[ROW_WORDS];
+        uint64_t lanes[UPSCALE_MAX_SCALE][UPSCALE_MAX_SCALE][ROW_WORDS]; // [output row][lane][word]
+        loadRow(display, y - 1, height, up);
+        loadRow(display, y, height, centre);
+        loadRow(display, y + 1, height, down);
+        leftNeighbours(centre, words, left);
+        rightNeighbours(centre, words, right);
+
+        if (upscaler->filter == FILTER_SCALE2X) {
+            // EPX with A above, B right, C left, D below
+            for (int i = 0; i < words; ++i) {
+                const uint64_t a = up[i], b = right[i], c = left[i], d = down[i], p = centre[i];
+                lanes[0][0][i] = choose(~(c ^ a) & (c ^ d) & (a ^ b), a, p);
+                lanes[0][1][i] = choose(~(a ^ b) & (a ^ c) & (b ^ d), b, p);
+                lanes[1][0][i] = choose(~(d ^ c) & (d ^ b) & (c ^ a), c, p);
+                lanes[1][1][i] = choose(~(b ^ d) & (b ^ a) & (d ^ c), d, p);
+            }
+        } else if (upscaler->filter == FILTER_SCALE3X) {
+            // AdvMAME3x on the 3x3 block A B C / D E F / G H I
+            uint64_t upLeft[ROW_WORDS], upRight[ROW_WORDS], downLeft[ROW_WORDS], downRight[ROW_WORDS];
+            leftNeighbours(up, words, upLeft);
+            rightNeighbours(up, words, upRight);
+            leftNeighbours(down, words, downLeft);
+            rightNeighbours(down, words, downRight);
+            for (int i = 0; i < words; ++i) {
+                const uint64_t a = upLeft[i], b = up[i], c = upRight[i], d = left[i], e = centre[i], f = right[i];
+                const uint64_t g = downLeft[i], h = down[i], k = downRight[i];
+                const uint64_t db = ~(d ^ b) & (b ^ f) & (d ^ h);
+                const uint64_t bf = ~(b ^ f) & (b ^ d) & (f ^ h);
+                const uint64_t dh = ~(d ^ h) & (d ^ b) & (h ^ f);
+                const uint64_t hf = ~(h ^ f) & (d ^ h) & (b ^ f);
+                lanes[0][0][i] = choose(db, d, e);
+                lanes[0][1][i] = choose((db & (e ^ c)) | (bf & (e ^ a)), b, e);
+                lanes[0][2][i] = choose(bf, f, e);
+                lanes[1][0][i] = choose((db & (e ^ g)) | (dh & (e ^ a)), d, e);
+                lanes[1][1][i] = e;
+                lanes[1][2][i] = choose((bf & (e ^ k)) | (hf & (e ^ c)), f, e);
+                lanes[2][0][i] = choose(dh, d, e);
+                lanes[2][1][i] = choose((dh & (e ^ k)) | (hf & (e ^ g)), h, e);
+                lanes[2][2][i] = choose(hf, f, e);
+            }
+        } else {
+            // CRT is nearest neighbour, every lane is the row itself and the look comes from the per-column colours
+            for (int lane = 0; lane < scale; ++lane) memcpy(lanes[0][lane], centre, sizeof(centre));
+            interleaveLanes(lanes[0], scale, width, bits);
+        }
+
+        for (int sub = 0; sub < scale; ++sub) {
+            uint32_t *line = (uint32_t *)((uint8_t *)pixels + ((size_t)(y - firstRow) * scale + sub) * pitch);
+            if (upscaler->filter == FILTER_CRT) {
+                const int scanline = sub == scale - 1;
+                blend(line, bits, outWidth, upscaler->crtLines[scanline][0], upscaler->crtLines[scanline][1]);
+            } else {
+                interleaveLanes(lanes[sub], scale, width, bits);
+                expand(line, bits, outWidth, palette[0], palette[1]);
+            }
+        }
+    }
+}
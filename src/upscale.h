@@ -0,0 +1,49 @@
+#ifndef UPSCALE_H
+#define UPSCALE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "core.h"
+#include "render.h"
+
+#define CRT_SCALE 4 // Output pixels per display pixel for FILTER_CRT
+#define UPSCALE_MAX_SCALE CRT_SCALE
+#define UPSCALE_MAX_WIDTH (HIGH_RES_WIDTH * UPSCALE_MAX_SCALE)
+
+enum ScaleFilter {
+    FILTER_NONE, // One texel per pixel, the renderer stretches it
+    FILTER_SCALE2X, // EPX/Scale2x edge smoothing
+    FILTER_SCALE3X, // AdvMAME3x/Scale3x edge smoothing
+    FILTER_CRT, // Nearest neighbour with dark scanlines and an RGB aperture mask
+    FILTER_COUNT
+};
+
+// Pixel expansion kernels, picked once by CPU features and overridable for benchmarks
+enum UpscaleKernel {
+    KERNEL_SCALAR,
+    KERNEL_SSE2,
+    KERNEL_AVX2,
+    KERNEL_COUNT
+};
+
+// Per-output filter state. The CRT filter caches its per-column colours for the current palette here
+struct Upscaler {
+    enum ScaleFilter filter;
+    uint32_t palette[2]; // Palette the CRT lines were built for
+    int crtWidth; // Output width the CRT lines were built for, 0 when they need rebuilding
+    uint32_t crtLines[2][2][UPSCALE_MAX_WIDTH]; // [scanline][background, foreground][x]
+};
+
+// Function prototypes
+const char *filterName(enum ScaleFilter filter);
+int parseFilter(const char *name);
+int filterScale(enum ScaleFilter filter);
+const char *upscaleKernelName(enum UpscaleKernel kernel);
+bool upscaleKernelSupported(enum UpscaleKernel kernel);
+enum UpscaleKernel upscaleKernel(void);
+int setUpscaleKernel(enum UpscaleKernel kernel);
+void initUpscaler(struct Upscaler *upscaler, enum ScaleFilter filter);
+void upscaleRows(struct Upscaler *upscaler, const struct Display *display, uint32_t *pixels, int pitch,
+                 const uint32_t palette[2], int firstRow, int rowCount);
+
+#endif // UPSCALE_H
@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <string.h>
+#include "video.h"
+
+#define GIF_MIN_CODE_SIZE 2 // Smallest the format allows, two colours would need only one bit
+#define GIF_CLEAR_CODE (1 << GIF_MIN_CODE_SIZE)
+#define GIF_END_CODE (GIF_CLEAR_CODE + 1)
+#define Y4M_PLANES_SIZE (VIDEO_WIDTH * VIDEO_HEIGHT * 3 / 2) // Y at full size, U and V at half size both ways
+
+// Codes packed LSB first into the 255-byte sub-blocks GIF image data is split into
+struct GifBits {
+    FILE *file;
+    uint8_t block[255];
+    int blockSize;
+    uint32_t bits;
+    int bitCount;
+};
+
+static void putCode(struct GifBits *out, int code, int size) {
+    out->bits |= (uint32_t)code << out->bitCount;
+    out->bitCount += size;
+    while (out->bitCount >= 8) {
+        out->block[out->blockSize++] = out->bits & 0xFF;
+        out->bits >>= 8;
+        out->bitCount -= 8;
+        if (out->blockSize == 255) {
+            fputc(255, out->file);
+            fwrite(out->block, 1, 255, out->file);
+            out->blockSize = 0;
+        }
+    }
+}
+
+static void flushBits(struct GifBits *out) {
+    if (out->bitCount > 0) putCode(out, 0, 8 - out->bitCount);
+    if (out->blockSize > 0) {
+        fputc(out->blockSize, out->file);
+        fwrite(out->block, 1, (size_t)out->blockSize, out->file);
+    }
+    fputc(0, out->file);
+}
+
+static void put16le(FILE *file, int value) {
+    fputc(value & 0xFF, file);
+    fputc(value >> 8 & 0xFF, file);
+}
+
+static void putPalette(FILE *file, const uint32_t palette[2]) {
+    for (int i = 0; i < 2; ++i) {
+        fputc(palette[i] >> 16 & 0xFF, file);
+        fputc(palette[i] >> 8 & 0xFF, file);
+        fputc(palette[i] & 0xFF, file);
+    }
+}
+
+static inline int framePixel(const struct VideoFrame *frame, int x, int y) {
+    return (int)(frame->gfx[y][x >> 6] >> (63 - (x & 63)) & 1);
+}
+
+// Presentation time of a frame number in centiseconds, the unit of GIF delays
+static uint64_t centiseconds(uint64_t number) {
+    return (number * 100 + VIDEO_FRAME_RATE / 2) / VIDEO_FRAME_RATE;
+}
+
+// LZW-compress output rows [top, top + rows) of a frame. With two colours each dictionary entry has two children,
+// so the dictionary is a plain table instead of a hash
+static void writeGifPixels(struct VideoWriter *writer, const struct VideoFrame *frame, int top, int rows) {
+    const int pixelSize = frame->highRes ? VIDEO_SCALE : VIDEO_SCALE * 2;
+    struct GifBits out = { writer->file, { 0 }, 0, 0, 0 };
+    int size = GIF_MIN_CODE_SIZE + 1;
+    int last = GIF_END_CODE;
+    int prefix = -1;
+    uint8_t line[VIDEO_WIDTH]; // The output row being compressed, rebuilt once per display row
+
+    fputc(GIF_MIN_CODE_SIZE, writer->file);
+    memset(writer->children, 0, sizeof(writer->children));
+    putCode(&out, GIF_CLEAR_CODE, size);
+    for (int row = top; row < top + rows; ++row) {
+        if (row == top || row % pixelSize == 0) {
+            for (int x = 0; x < VIDEO_WIDTH; x += pixelSize) {
+                memset(line + x, framePixel(frame, x / pixelSize, row / pixelSize), (size_t)pixelSize);
+            }
+        }
+        for (int x = 0; x < VIDEO_WIDTH; ++x) {
+            const int pixel = line[x];
+            if (prefix < 0) {
+                prefix = pixel;
+                continue;
+            }
+            if (writer->children[prefix][pixel]) {
+                prefix = writer->children[prefix][pixel];
+                continue;
+            }
+            putCode(&out, prefix, size);
+            writer->children[prefix][pixel] = (uint16_t)++last;
+            if (last >= 1 << size) ++size;
+            if (last == VIDEO_LZW_CODES - 1) {
+                putCode(&out, GIF_CLEAR_CODE, size);
+                memset(writer->children, 0, sizeof(writer->children));
+                size = GIF_MIN_CODE_SIZE + 1;
+                last = GIF_END_CODE;
+            }
+            prefix = pixel;
+        }
+    }
+    putCode(&out, prefix, size);
+    putCode(&out, GIF_END_CODE, size);
+    flushBits(&out);
+}
+
+// Write a frame as one GIF image shown for delay centiseconds. Only the band of rows that differ from the canvas is
+// stored, the rest of the canvas stays as it was
+static void writeGifImage(struct VideoWriter *writer, const struct VideoFrame *frame, uint64_t delay) {
+    FILE *file = writer->file;
+    const int height = frame->highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
+    const int pixelSize = frame->highRes ? VIDEO_SCALE : VIDEO_SCALE * 2;
+    int first = 0, last = height - 1;
+
+    if (!writer->hasShown) {
+        // The first frame's palette becomes the global one, the animation loops forever
+        fwrite("GIF89a", 1, 6, file);
+        put16le(file, VIDEO_WIDTH);
+        put16le(file, VIDEO_HEIGHT);
+        fputc(0x80, file); // Global colour table of 2 entries
+        fputc(0, file);
+        fputc(0, file);
+        putPalette(file, frame->palette);
+        fwrite("\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 1, 19, file);
+        memcpy(writer->globalPalette, frame->palette, sizeof(writer->globalPalette));
+    } else if (frame->highRes == writer->shown.highRes && frame->palette[0] == writer->shown.palette[0] &&
+               frame->palette[1] == writer->shown.palette[1]) {
+        const size_t rowSize = sizeof(frame->gfx[0]);
+        while (first < last && memcmp(frame->gfx[first], writer->shown.gfx[first], rowSize) == 0) ++first;
+        while (last > first && memcmp(frame->gfx[last], writer->shown.gfx[last], rowSize) == 0) --last;
+    }
+
+    // Graphic control extension: keep the canvas under the image, then wait
+    fwrite("\x21\xF9\x04\x04", 1, 4, file);
+    put16le(file, delay > 0xFFFF ? 0xFFFF : (int)delay);
+    fputc(0, file);
+    fputc(0, file);
+
+    const bool localPalette = memcmp(frame->palette, writer->globalPalette, sizeof(writer->globalPalette)) != 0;
+    fputc(0x2C, file);
+    put16le(file, 0);
+    put16le(file, first * pixelSize);
+    put16le(file, VIDEO_WIDTH);
+    put16le(file, (last - first + 1) * pixelSize);
+    fputc(localPalette ? 0x80 : 0, file);
+    if (localPalette) putPalette(file, frame->palette);
+    writeGifPixels(writer, frame, first * pixelSize, (last - first + 1) * pixelSize);
+
+    writer->shown = *frame;
+    writer->hasShown = true;
+    ++writer->framesWritten;
+}
+
+// BT.601 limited range, what ffmpeg assumes for Y4M
+static void toYuv(uint32_t argb, uint8_t yuv[3]) {
+    const int r = argb >> 16 & 0xFF, g = argb >> 8 & 0xFF, b = argb & 0xFF;
+    yuv[0] = (uint8_t)(16 + ((66 * r + 129 * g + 25 * b + 128) >> 8));
+    yuv[1] = (uint8_t)(128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8));
+    yuv[2] = (uint8_t)(128 + ((112 * r - 94 * g - 18 * b + 128) >> 8));
+}
+
+// Fill the Y, U and V planes from a frame. Pixels are at least 4 output pixels wide, so 4:2:0 loses nothing
+static void buildPlanes(uint8_t *planes, const struct VideoFrame *frame) {
+    const int width = frame->highRes ? HIGH_RES_WIDTH : LOW_RES_WIDTH;
+    const int height = frame->highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT;
+    const int pixelSize = frame->highRes ? VIDEO_SCALE : VIDEO_SCALE * 2;
+    uint8_t colours[2][3];
+    uint8_t *u = planes + VIDEO_WIDTH * VIDEO_HEIGHT;
+    uint8_t *v = u + VIDEO_WIDTH * VIDEO_HEIGHT / 4;
+
+    toYuv(frame->palette[0], colours[0]);
+    toYuv(frame->palette[1], colours[1]);
+    for (int y = 0; y < height; ++y) {
+        uint8_t *luma = planes + (size_t)y * pixelSize * VIDEO_WIDTH;
+        uint8_t *cb = u + (size_t)y * pixelSize / 2 * (VIDEO_WIDTH / 2);
+        uint8_t *cr = v + (size_t)y * pixelSize / 2 * (VIDEO_WIDTH / 2);
+        for (int x = 0; x < width; ++x) {
+            const uint8_t *colour = colours[framePixel(frame, x, y)];
+            memset(luma + x * pixelSize, colour[0], (size_t)pixelSize);
+            memset(cb + x * pixelSize / 2, colour[1], (size_t)pixelSize / 2);
+            memset(cr + x * pixelSize / 2, colour[2], (size_t)pixelSize / 2);
+        }
+        for (int row = 1; row < pixelSize; ++row) memcpy(luma + row * VIDEO_WIDTH, luma, VIDEO_WIDTH);
+        for (int row = 1; row < pixelSize / 2; ++row) {
+            memcpy(cb + row * (VIDEO_WIDTH / 2), cb, VIDEO_WIDTH / 2);
+            memcpy(cr + row * (VIDEO_WIDTH / 2), cr, VIDEO_WIDTH / 2);
+        }
+    }
+}
+
+// Write the pending frame for count emulated frames
+static void writeY4mFrames(struct VideoWriter *writer, uint64_t count) {
+    if (!writer->planesValid) {
+        buildPlanes(writer->planes, &writer->pending);
+        writer->planesValid = true;
+    }
+    for (uint64_t i = 0; i < count; ++i) {
+        fwrite("FRAME\n", 1, 6, writer->file);
+        fwrite(writer->planes, 1, Y4M_PLANES_SIZE, writer->file);
+    }
+    writer->framesWritten += count;
+}
+
+// Format from the file extension, -1 if it is neither .gif nor .y4m
+int parseVideoFormat(const char *path) {
+    const char *extension = strrchr(path, '.');
+
+    if (extension && strcmp(extension, ".gif") == 0) return VIDEO_GIF;
+    if (extension && strcmp(extension, ".y4m") == 0) return VIDEO_Y4M;
+    return -1;
+}
+
+int openVideo(struct VideoWriter *writer, const char *path, enum VideoFormat format) {
+    memset(writer, 0, sizeof(*writer));
+    writer->format = format;
+    if (format == VIDEO_Y4M) {
+        writer->planes = malloc(Y4M_PLANES_SIZE);
+        if (!writer->planes) {
+            printf("Memory could not be allocated.\n");
+            return -1;
+        }
+    }
+    writer->file = fopen(path, "wb");
+    if (!writer->file) {
+        printf("File could not be opened: %s\n", path);
+        free(writer->planes);
+        writer->planes = NULL;
+        return -1;
+    }
+    if (format == VIDEO_Y4M) {
+        fprintf(writer->file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", VIDEO_WIDTH, VIDEO_HEIGHT, VIDEO_FRAME_RATE);
+    }
+    return 0;
+}
+
+// Queue a frame, writing the previous one now that its duration is known. GIF frames shorter than
+// VIDEO_MIN_DELAY are replaced by the next one instead, Y4M repeats a frame for every emulated frame it stays up
+int writeVideoFrame(struct VideoWriter *writer, const struct VideoFrame *frame) {
+    if (writer->hasPending) {
+        const uint64_t start = writer->pending.number;
+        if (writer->format == VIDEO_GIF) {
+            const uint64_t delay = centiseconds(frame->number) - centiseconds(start);
+            if (delay < VIDEO_MIN_DELAY) {
+                writer->pending = *frame;
+                writer->pending.number = start;
+                return 0;
+            }
+            writeGifImage(writer, &writer->pending, delay);
+        } else {
+            writeY4mFrames(writer, frame->number > start ? frame->number - start : 1);
+        }
+    }
+    writer->pending = *frame;
+    writer->hasPending = true;
+    writer->planesValid = false;
+    return ferror(writer->file) ? -1 : 0;
+}
+
+// Write the last frame, shown until endFrame, and finish the file
+int closeVideo(struct VideoWriter *writer, uint64_t endFrame) {
+    int status = 0;
+
+    if (!writer->file) return -1;
+    if (writer->hasPending) {
+        const uint64_t start = writer->pending.number;
+        if (writer->format == VIDEO_GIF) {
+            const uint64_t delay = centiseconds(endFrame > start ? endFrame : start + 1) - centiseconds(start);
+            writeGifImage(writer, &writer->pending, delay < VIDEO_MIN_DELAY ? VIDEO_MIN_DELAY : delay);
+        } else {
+            writeY4mFrames(writer, endFrame > start ? endFrame - start : 1);
+        }
+    }
+    if (writer->format == VIDEO_GIF && writer->hasShown) fputc(0x3B, writer->file);
+    if (ferror(writer->file) || fclose(writer->file) != 0) {
+        printf("Writing error.\n");
+        status = -1;
+    }
+    writer->file = NULL;
+    free(writer->planes);
+    writer->planes = NULL;
+    return status;
+}
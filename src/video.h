@@ -0,0 +1,54 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "core.h"
+
+#define VIDEO_SCALE 4 // Output pixels per high res pixel, low res pixels are twice that
+#define VIDEO_WIDTH (HIGH_RES_WIDTH * VIDEO_SCALE)
+#define VIDEO_HEIGHT (HIGH_RES_HEIGHT * VIDEO_SCALE)
+#define VIDEO_FRAME_RATE 60 // Emulated frames per second, the clock frame numbers count in
+#define VIDEO_MIN_DELAY 2 // Shortest GIF frame in centiseconds, viewers slow anything shorter down to 10
+#define VIDEO_LZW_CODES 4096
+
+enum VideoFormat {
+    VIDEO_GIF, // Animated GIF in the frame's palette, only the rows that changed are stored
+    VIDEO_Y4M, // Raw YUV 4:2:0 at 60 fps for ffmpeg, every emulated frame is written
+};
+
+// The display after one emulated frame. It stays on screen until the next captured frame
+struct VideoFrame {
+    uint64_t number; // Emulated frames before this one, 0 for the first
+    uint32_t palette[2]; // Background and foreground, 0xAARRGGBB
+    bool highRes;
+    uint64_t gfx[HIGH_RES_HEIGHT][HIGH_RES_WIDTH / 64]; // Plane 0 of the machine
+};
+
+// Writes captured frames to a file. A frame is written once the next one arrives, when its duration is known
+struct VideoWriter {
+    FILE *file;
+    enum VideoFormat format;
+    struct VideoFrame pending; // Newest frame, not written yet
+    bool hasPending;
+    uint64_t framesWritten; // Output frames: GIF images, or Y4M frames including repeats
+
+    // GIF: the canvas as written so far, new images cover only the rows that differ from it
+    struct VideoFrame shown;
+    bool hasShown;
+    uint32_t globalPalette[2];
+    uint16_t children[VIDEO_LZW_CODES][2]; // LZW dictionary: code of the string extended by pixel 0 or 1, 0 if none
+
+    // Y4M: the planes of the pending frame, written again for every emulated frame it stays on screen
+    uint8_t *planes;
+    bool planesValid;
+};
+
+// Function prototypes
+int parseVideoFormat(const char *path);
+int openVideo(struct VideoWriter *writer, const char *path, enum VideoFormat format);
+int writeVideoFrame(struct VideoWriter *writer, const struct VideoFrame *frame);
+int closeVideo(struct VideoWriter *writer, uint64_t endFrame);
+
+#endif // VIDEO_H
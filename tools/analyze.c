@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "analysis.h"
+
+#define TIMING_RUNS 200
+
+static const char *const exitNames[] = {
+    [BLOCK_FALLTHROUGH] = "fall-through", [BLOCK_JUMP] = "jump", [BLOCK_CALL] = "call",
+    [BLOCK_RETURN] = "return", [BLOCK_SKIP] = "skip", [BLOCK_INDIRECT] = "indirect jump",
+    [BLOCK_HALT] = "exit", [BLOCK_END_OF_MEMORY] = "end of memory",
+};
+
+static const struct {
+    uint32_t bit;
+    const char *name;
+} featureNames[] = {
+    { ROM_HIGH_RES, "high-res (00FE/00FF)" }, { ROM_SCROLL, "scrolling" }, { ROM_LARGE_SPRITES, "16x16 sprites" },
+    { ROM_EXIT, "exit (00FD)" }, { ROM_SETS_COMPAT, "sets compat mode (00FA)" },
+    { ROM_SHIFTS, "shifts (8XY6/8XYE)" }, { ROM_LOAD_STORE, "register load/store (FX55/FX65)" },
+    { ROM_INDIRECT_JUMP, "indirect jumps (BNNN)" }, { ROM_SELF_MODIFYING, "self-modifying" },
+    { ROM_XO_CHIP, "XO-CHIP audio" }, { ROM_UNKNOWN_OPCODES, "unknown opcodes" },
+};
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Read a whole ROM file. Returns the size or -1
+static long readRomFile(const char *path, uint8_t *buffer, size_t capacity) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        printf("File could not be opened: %s\n", path);
+        return -1;
+    }
+    const size_t size = fread(buffer, 1, capacity, file);
+    const bool tooBig = fgetc(file) != EOF;
+    fclose(file);
+    if (tooBig) {
+        printf("ROM too big for memory.\n");
+        return -1;
+    }
+    return (long)size;
+}
+
+static void printSummary(const struct RomAnalysis *analysis) {
+    printf("rom hash %016llx, %u bytes\n", (unsigned long long)analysis->romHash, analysis->romSize);
+    printf("%u reachable instructions in %u blocks\n", analysis->instructionCount, analysis->blockCount);
+    printf("indirect jumps %u, writes over code %u, writes with unknown I %u\n", analysis->indirectJumps,
+           analysis->codeWrites, analysis->unknownWrites);
+    printf("uses:");
+    for (size_t i = 0; i < sizeof(featureNames) / sizeof(featureNames[0]); ++i) {
+        if (analysis->features & featureNames[i].bit) printf(" [%s]", featureNames[i].name);
+    }
+    printf("%s\n", analysis->features ? "" : " plain CHIP-8");
+    printf("compat mode %s\n", analysis->suggestedCompatMode ? "on (SCHIP quirks, ROM never sets 00FA)" : "off");
+    printf("profile %s\n", quirkProfileName(analysisProfile(analysis)));
+}
+
+// Listing of the ROM: reachable instructions with their labels, everything else as data
+static void printListing(const uint8_t *rom, const struct RomAnalysis *analysis) {
+    const uint8_t *flags = analysis->addressFlags;
+    const int end = ROM_START + (int)analysis->romSize;
+
+    for (int address = ROM_START; address < end; ) {
+        if (flags[address] & ADDR_INSTRUCTION && address + 1 < end) {
+            const uint16_t opcode = rom[address - ROM_START] << 8 | rom[address + 1 - ROM_START];
+            char text[32];
+            disassembleOpcode(opcode, text, sizeof(text));
+            if (flags[address] & ADDR_CALL_TARGET) printf("\nsub_%03X:\n", address);
+            else if (flags[address] & (ADDR_JUMP_TARGET | ADDR_LEADER)) printf("L%03X:\n", address);
+            if (flags[address] & ADDR_SELF_MODIFIED) printf("    %03X  %04X  %-18s; overwritten at run time\n", address, opcode, text);
+            else printf("    %03X  %04X  %s\n", address, opcode, text);
+            address += 2;
+        } else {
+            const uint8_t byte = rom[address - ROM_START];
+            if (flags[address] & ADDR_WRITTEN) printf("    %03X  %02X    DB 0x%02X           ; written\n", address, byte, byte);
+            else printf("    %03X  %02X    DB 0x%02X\n", address, byte, byte);
+            ++address;
+        }
+    }
+}
+
+static void printBlocks(const struct RomAnalysis *analysis) {
+    for (uint32_t i = 0; i < analysis->blockCount; ++i) {
+        const struct BasicBlock *block = &analysis->blocks[i];
+        printf("block %03X-%03X %-14s", block->start, block->end, exitNames[block->exit]);
+        for (int s = 0; s < block->successorCount; ++s) printf(" -> %03X", block->successors[s]);
+        printf("\n");
+    }
+}
+
+// Control flow graph in Graphviz dot format
+static int writeDot(const char *path, const struct RomAnalysis *analysis) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        printf("File could not be opened: %s\n", path);
+        return -1;
+    }
+    fprintf(out, "digraph cfg {\n    node [shape=box, fontname=monospace];\n");
+    for (uint32_t i = 0; i < analysis->blockCount; ++i) {
+        const struct BasicBlock *block = &analysis->blocks[i];
+        fprintf(out, "    b%03X [label=\"%03X-%03X\\n%s\"];\n", block->start, block->start, block->end,
+                exitNames[block->exit]);
+        for (int s = 0; s < block->successorCount; ++s) {
+            fprintf(out, "    b%03X -> b%03X;\n", block->start, block->successors[s]);
+        }
+    }
+    fprintf(out, "}\n");
+    if (fclose(out) != 0) {
+        printf("Writing error.\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *cacheDir = ANALYSIS_CACHE_DIR, *dotPath = NULL, *romPath = NULL;
+    bool listing = false, blocks = false;
+    static uint8_t rom[MEMORY_SIZE];
+    static struct RomAnalysis analysis, timed;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            cacheDir = argv[++i];
+        } else if (strcmp(argv[i], "--no-cache") == 0) {
+            cacheDir = NULL;
+        } else if (strcmp(argv[i], "--disasm") == 0) {
+            listing = true;
+        } else if (strcmp(argv[i], "--blocks") == 0) {
+            blocks = true;
+        } else if (strcmp(argv[i], "--dot") == 0 && i + 1 < argc) {
+            dotPath = argv[++i];
+        } else if (argv[i][0] != '-' && !romPath) {
+            romPath = argv[i];
+        } else {
+            romPath = NULL;
+            break;
+        }
+    }
+    if (!romPath) {
+        printf("Usage: %s [--cache dir | --no-cache] [--disasm] [--blocks] [--dot file] <ROM>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const long size = readRomFile(romPath, rom, MEMORY_SIZE - ROM_START);
+    if (size < 0) return EXIT_FAILURE;
+
+    const int source = loadAnalysis(cacheDir, rom, (size_t)size, &analysis);
+    if (source < 0) return EXIT_FAILURE;
+    printSummary(&analysis);
+    if (blocks) printBlocks(&analysis);
+    if (listing) printListing(rom, &analysis);
+    if (dotPath && writeDot(dotPath, &analysis) != 0) return EXIT_FAILURE;
+
+    // What a cache hit saves at ROM load: a fresh analysis against reading the cache entry back
+    double start = nowSeconds();
+    for (int i = 0; i < TIMING_RUNS; ++i) analyzeRom(rom, (size_t)size, &timed);
+    const double analyzeSeconds = (nowSeconds() - start) / TIMING_RUNS;
+    printf("analysis %s, fresh analysis %.1f us", source == 1 ? "from cache" : "fresh", analyzeSeconds * 1e6);
+    if (cacheDir && readCachedAnalysis(cacheDir, rom, (size_t)size, &timed) == 0) {
+        start = nowSeconds();
+        for (int i = 0; i < TIMING_RUNS; ++i) readCachedAnalysis(cacheDir, rom, (size_t)size, &timed);
+        printf(", cached load %.1f us", (nowSeconds() - start) / TIMING_RUNS * 1e6);
+    }
+    printf("\n");
+    return EXIT_SUCCESS;
+}
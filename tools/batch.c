@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "core.h"
+#include "rompack.h"
+#include "workpool.h"
+
+#define MAX_LINE 4096
+
+// One line of the manifest: <ROM> <frames> [input script]
+struct Job {
+    char *rom;
+    int packIndex; // ROM number in the batch pack, -1 when rom is a file
+    char *input; // NULL when no keys are pressed
+    int frames;
+    int line; // Manifest line, for error messages
+
+    // Filled in by the worker
+    int status;
+    int framesRun;
+    uint64_t instructions;
+    uint64_t digest;
+};
+
+struct Batch {
+    struct Job *jobs;
+    int jobCount;
+    const char *outDir; // Per-frame hashes go to <outDir>/job<N>.hashes when set
+    const struct RomPack *pack; // Set with -p, manifest ROMs written @N or @name come from it
+};
+
+// Key change in an input script: from frame on, the keys in mask are held
+struct KeyEvent {
+    int frame;
+    uint16_t mask;
+};
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *copyString(const char *text) {
+    char *copy = malloc(strlen(text) + 1);
+    if (copy) strcpy(copy, text);
+    return copy;
+}
+
+// Input scripts are lines of "<frame> <hex key mask>", '#' starts a comment. Returns the number of events or -1
+static int readInputScript(const char *path, struct KeyEvent **events) {
+    FILE *file = fopen(path, "r");
+    char line[MAX_LINE];
+    int count = 0, capacity = 0;
+
+    *events = NULL;
+    if (!file) {
+        printf("File could not be opened: %s\n", path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        int frame;
+        unsigned int mask;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        if (sscanf(line, "%d %x", &frame, &mask) != 2) continue;
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            struct KeyEvent *grown = realloc(*events, capacity * sizeof(struct KeyEvent));
+            if (!grown) {
+                printf("Memory could not be allocated.\n");
+                free(*events);
+                *events = NULL;
+                count = -1;
+                break;
+            }
+            *events = grown;
+        }
+        (*events)[count].frame = frame;
+        (*events)[count].mask = (uint16_t)mask;
+        ++count;
+    }
+    fclose(file);
+    return count;
+}
+
+// Worker entry point: run one job start to finish on its own machine
+static void runJob(void *context, int index, int worker) {
+    struct Batch *batch = context;
+    struct Job *job = &batch->jobs[index];
+    struct KeyEvent *events = NULL;
+    int eventCount = 0, nextEvent = 0;
+    FILE *out = NULL;
+    (void)worker;
+
+    job->status = -1;
+    struct Chip8 *chip8 = calloc(1, sizeof(struct Chip8));
+    if (!chip8) {
+        printf("Memory could not be allocated.\n");
+        return;
+    }
+    initChip8(chip8);
+    const int loaded = job->packIndex >= 0 ? loadPackRom(chip8, batch->pack, (uint32_t)job->packIndex)
+                                           : loadRom(chip8, job->rom);
+    if (loaded != 0 || (job->input && (eventCount = readInputScript(job->input, &events)) < 0)) {
+        printf("Job %d (manifest line %d) failed to load.\n", index, job->line);
+        free(chip8);
+        return;
+    }
+    if (batch->outDir) {
+        char path[MAX_LINE];
+        snprintf(path, sizeof(path), "%s/job%d.hashes", batch->outDir, index);
+        out = fopen(path, "w");
+        // The hashes are the job's output, without them the job has failed
+        if (!out) {
+            printf("File could not be opened: %s\n", path);
+            printf("Job %d (manifest line %d) failed, its hashes cannot be written.\n", index, job->line);
+            free(events);
+            free(chip8);
+            return;
+        }
+    }
+
+    for (int frame = 0; frame < job->frames && chip8->running; ++frame) {
+        while (nextEvent < eventCount && events[nextEvent].frame <= frame) {
+            for (int key = 0; key < 16; ++key) {
+                chip8->key[key] = (events[nextEvent].mask >> key) & 1;
+            }
+            ++nextEvent;
+        }
+        job->instructions += runFrame(chip8);
+        job->framesRun = frame + 1;
+        if (out) fprintf(out, "%016llx\n", (unsigned long long)framebufferHash(chip8));
+    }
+    job->digest = stateDigest(chip8);
+    job->status = 0;
+    if (out) {
+        fprintf(out, "digest %016llx\n", (unsigned long long)job->digest);
+        if (ferror(out) | fclose(out)) {
+            printf("Writing error.\n");
+            printf("Job %d (manifest line %d) failed, its hashes were not written.\n", index, job->line);
+            job->status = -1;
+        }
+    }
+    free(events);
+    free(chip8);
+}
+
+// Manifest lines are "<ROM> <frames> [input script]", blank lines and lines starting with '#' are skipped
+static int readManifest(const char *path, struct Batch *batch) {
+    FILE *file = fopen(path, "r");
+    char line[MAX_LINE];
+    int capacity = 0, lineNumber = 0;
+
+    if (!file) {
+        printf("File could not be opened: %s\n", path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        char rom[MAX_LINE], input[MAX_LINE];
+        int frames;
+        ++lineNumber;
+        if (line[0] == '#') continue;
+        const int fields = sscanf(line, "%s %d %s", rom, &frames, input);
+        if (fields <= 0) continue;
+        if (fields < 2 || frames <= 0) {
+            printf("Manifest line %d: expected <ROM> <frames> [input script]\n", lineNumber);
+            fclose(file);
+            return -1;
+        }
+        if (batch->jobCount == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            struct Job *grown = realloc(batch->jobs, capacity * sizeof(struct Job));
+            if (!grown) {
+                printf("Memory could not be allocated.\n");
+                fclose(file);
+                return -1;
+            }
+            batch->jobs = grown;
+        }
+        struct Job *job = &batch->jobs[batch->jobCount++];
+        memset(job, 0, sizeof(*job));
+        job->rom = copyString(rom);
+        job->packIndex = -1;
+        if (rom[0] == '@') {
+            char *end;
+            const long index = strtol(rom + 1, &end, 0);
+            job->packIndex = !batch->pack ? -1 : *end == '\0' ? (int)index : findPackRomName(batch->pack, rom + 1);
+            if (job->packIndex < 0 || (batch->pack && job->packIndex >= (int)batch->pack->header->romCount)) {
+                printf("Manifest line %d: %s is not in the pack\n", lineNumber, rom);
+                fclose(file);
+                return -1;
+            }
+        }
+        job->input = fields == 3 ? copyString(input) : NULL;
+        job->frames = frames;
+        job->line = lineNumber;
+    }
+    fclose(file);
+    return 0;
+}
+
+// Without a manifest, every ROM of the pack is one job of the same length
+static int packJobs(const struct RomPack *pack, int frames, struct Batch *batch) {
+    batch->jobCount = (int)pack->header->romCount;
+    batch->jobs = calloc(batch->jobCount > 0 ? batch->jobCount : 1, sizeof(struct Job));
+    if (!batch->jobs) {
+        printf("Memory could not be allocated.\n");
+        return -1;
+    }
+    for (int i = 0; i < batch->jobCount; ++i) {
+        batch->jobs[i].rom = copyString(packRomName(pack, (uint32_t)i));
+        batch->jobs[i].packIndex = i;
+        batch->jobs[i].frames = frames;
+    }
+    return 0;
+}
+
+// Longest jobs first, so the last jobs to finish are short ones
+static const struct Job *sortJobs;
+static int compareJobs(const void *a, const void *b) {
+    const int left = *(const int *)a, right = *(const int *)b;
+    if (sortJobs[left].frames != sortJobs[right].frames) return sortJobs[right].frames - sortJobs[left].frames;
+    return left - right;
+}
+
+int main(int argc, char *argv[]) {
+    struct Batch batch = { NULL, 0, NULL, NULL };
+    struct RomPack pack;
+    int workers = defaultWorkerCount();
+    int packFrames = 600;
+    const char *manifest = NULL, *packPath = NULL;
+    uint64_t instructions = 0;
+    int failed = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            batch.outDir = argv[++i];
+        } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            packPath = argv[++i];
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            packFrames = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && !manifest) {
+            manifest = argv[i];
+        } else {
+            manifest = packPath = NULL;
+            break;
+        }
+    }
+    if ((!manifest && !packPath) || packFrames <= 0) {
+        printf("Usage: %s [-j threads] [-o output dir] [-p pack [-f frames]] <manifest>\n", argv[0]);
+        printf("Manifest lines: <ROM> <frames> [input script], input script lines: <frame> <hex key mask>\n");
+        printf("With -p, ROMs written @N or @name come from the pack, and without a manifest every ROM in it runs\n");
+        return EXIT_FAILURE;
+    }
+    if (workers <= 0) workers = 1;
+    if (packPath) {
+        if (openRomPack(&pack, packPath) != 0) return EXIT_FAILURE;
+        batch.pack = &pack;
+    }
+    if (manifest ? readManifest(manifest, &batch) != 0 : packJobs(&pack, packFrames, &batch) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (batch.jobCount == 0) {
+        printf("No jobs in %s\n", manifest ? manifest : packPath);
+        return EXIT_FAILURE;
+    }
+
+    int *order = malloc(batch.jobCount * sizeof(int));
+    if (!order) {
+        printf("Memory could not be allocated.\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < batch.jobCount; ++i) order[i] = i;
+    sortJobs = batch.jobs;
+    qsort(order, batch.jobCount, sizeof(int), compareJobs);
+
+    initDispatch();
+    const double start = nowSeconds();
+    if (runWorkPool(batch.jobCount, order, workers, runJob, &batch) != 0) return EXIT_FAILURE;
+    const double seconds = nowSeconds() - start;
+
+    for (int i = 0; i < batch.jobCount; ++i) {
+        const struct Job *job = &batch.jobs[i];
+        if (job->status != 0) {
+            printf("job %d %s failed\n", i, job->rom);
+            ++failed;
+            continue;
+        }
+        printf("job %d %s frames=%d instructions=%llu digest=%016llx\n", i, job->rom, job->framesRun,
+               (unsigned long long)job->instructions, (unsigned long long)job->digest);
+        instructions += job->instructions;
+    }
+    printf("%d jobs (%d failed) on %d threads: %llu instructions in %.3f s, %.0f instructions/s\n", batch.jobCount,
+           failed, workers < batch.jobCount ? workers : batch.jobCount, (unsigned long long)instructions, seconds,
+           seconds > 0 ? instructions / seconds : 0.0);
+
+    for (int i = 0; i < batch.jobCount; ++i) {
+        free(batch.jobs[i].rom);
+        free(batch.jobs[i].input);
+    }
+    free(batch.jobs);
+    free(order);
+    if (batch.pack) closeRomPack(&pack);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
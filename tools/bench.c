@@ -0,0 +1,664 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "blockcache.h"
+#include "core.h"
+#include "dispatch.h"
+#include "jit.h"
+#include "render.h"
+#include "savestate.h"
+#include "stream.h"
+#include "upscale.h"
+
+// Instructions per frame while benchmarking, high enough that dispatch dominates the frame overhead
+#define BENCH_SPEED 10000
+#define BENCH_UNROLL 48 // Copies of a microbenchmark body per loop
+#define BENCH_MACRO_FRAMES_PER_FRAME 50 // Macro runs play this many times the frame count at the ROM's own speed
+#define BENCH_MAX_RESULTS 256
+#define BENCH_STREAM_SPEED 100 // Instructions per frame for generated ROMs in stream runs, a busy game rather than a storm
+
+typedef uint64_t (*ExecuteFn)(struct Chip8 *chip8, int count);
+
+struct DispatchMode {
+    const char *name;
+    ExecuteFn execute;
+    int (*attach)(struct Chip8 *chip8); // Attaches the cache the mode runs from, if any
+};
+
+#ifdef CHIP8_DEBUGGER
+// The interpreter the debugger runs while breakpoints are set, with none of them hit: the cost of the bitmap test
+static uint64_t executeCyclesNoBreak(struct Chip8 *chip8, int count) {
+    static const uint64_t breakpoints[MEMORY_SIZE / 64];
+    return executeCyclesBreak(chip8, count, breakpoints);
+}
+#endif
+
+static const struct DispatchMode dispatchModes[] = {
+    { "switch", executeCyclesSwitch, NULL },
+    { "quirks", executeCyclesQuirks, NULL },
+#ifdef CHIP8_DEBUGGER
+    { "break", executeCyclesNoBreak, NULL },
+#endif
+    { "table", executeCyclesTable, NULL },
+#ifdef CHIP8_HAVE_COMPUTED_GOTO
+    { "goto", executeCyclesGoto, NULL },
+#endif
+    { "blocks", executeBlocks, enableBlockCache },
+#ifdef CHIP8_HAVE_JIT
+    { "jit", executeJit, enableJit },
+#endif
+};
+
+static bool lockstep; // Check every JIT region against the interpreter
+
+// One benchmark run, kept for the machine-readable report
+struct BenchResult {
+    const char *suite; // "micro", "profile", "macro", "upscale" or "stream"
+    char name[128];
+    const char *opcodes; // Opcode classes the run is made of
+    const char *mode; // Dispatch mode, or the pixel kernel for upscale runs
+    uint64_t instructions;
+    uint64_t frames;
+    double seconds;
+};
+
+static struct BenchResult results[BENCH_MAX_RESULTS];
+static int resultCount;
+static double snapshotTime, restoreTime, cachedRestoreTime; // Seconds per call
+
+// Stream sizes of one run, the encode and decode times go to results
+struct StreamResult {
+    char name[128];
+    uint64_t frames;
+    uint64_t messages;
+    uint64_t bytes; // Frame messages as sent
+    uint64_t rawBytes; // The whole display raw in every frame message, what a plain framebuffer stream would send
+};
+
+static struct StreamResult streamResults[BENCH_MAX_RESULTS];
+static int streamResultCount;
+
+// Microbenchmark ROMs are generated: a short setup, then the body repeated BENCH_UNROLL times and a jump back,
+// so almost every instruction executed is one of the opcodes being measured
+struct RomBuilder {
+    uint8_t data[MEMORY_SIZE - ROM_START];
+    size_t size;
+};
+
+static uint16_t romAddress(const struct RomBuilder *rom) {
+    return (uint16_t)(ROM_START + rom->size);
+}
+
+static void emit(struct RomBuilder *rom, uint16_t opcode) {
+    rom->data[rom->size++] = opcode >> 8;
+    rom->data[rom->size++] = opcode & 0xFF;
+}
+
+static void emitLoop(struct RomBuilder *rom, const uint16_t *body, int count) {
+    const uint16_t start = romAddress(rom);
+    for (int i = 0; i < BENCH_UNROLL; ++i) {
+        for (int j = 0; j < count; ++j) emit(rom, body[j]);
+    }
+    emit(rom, 0x1000 | start);
+}
+
+// 8XYN arithmetic and logic over eight registers
+static void buildAlu(struct RomBuilder *rom) {
+    static const uint16_t body[] = { 0x8014, 0x8125, 0x8231, 0x8342, 0x8453, 0x8506, 0x8617, 0x870E, 0x8120 };
+    for (int v = 0; v < 8; ++v) emit(rom, 0x6000 | v << 8 | (v * 37 + 1));
+    emitLoop(rom, body, (int)(sizeof(body) / sizeof(body[0])));
+}
+
+// Low res DXYN storm: four font sprites per pass, moving every pass
+static void buildDrawLowRes(struct RomBuilder *rom) {
+    static const uint16_t body[] = { 0xD015, 0xD125, 0xD235, 0xD345, 0x7009, 0x7105 };
+    emit(rom, 0xA000);
+    for (int v = 0; v < 4; ++v) emit(rom, 0x6000 | v << 8 | (v * 13));
+    emitLoop(rom, body, (int)(sizeof(body) / sizeof(body[0])));
+}
+
+// High res DXYN storm with 16x16 sprites (N = 0) mixed in
+static void buildDrawHighRes(struct RomBuilder *rom) {
+    static const uint16_t body[] = { 0xD010, 0xD125, 0xD230, 0xD345, 0x7009, 0x7105 };
+    emit(rom, 0x00FF);
+    emit(rom, 0xA000);
+    for (int v = 0; v < 4; ++v) emit(rom, 0x6000 | v << 8 | (v * 29));
+    emitLoop(rom, body, (int)(sizeof(body) / sizeof(body[0])));
+}
+
+// High res scrolls in every direction, with a sprite drawn each pass so there is something to move
+static void buildScroll(struct RomBuilder *rom) {
+    static const uint16_t body[] = { 0x00C6, 0x00FB, 0x00CC, 0x00FC, 0xD010 };
+    emit(rom, 0x00FF);
+    emit(rom, 0xA000);
+    emitLoop(rom, body, (int)(sizeof(body) / sizeof(body[0])));
+}
+
+// FX55/FX65 block moves. 00FA keeps I in place, so the loop never walks into its own code
+static void buildBlockMove(struct RomBuilder *rom) {
+    static const uint16_t body[] = { 0xFF55, 0xFF65, 0xF755, 0xF765 };
+    emit(rom, 0x00FA);
+    emit(rom, 0xAE00);
+    for (int v = 0; v < 16; ++v) emit(rom, 0x6000 | v << 8 | v);
+    emitLoop(rom, body, (int)(sizeof(body) / sizeof(body[0])));
+}
+
+// 2NNN/00EE chains 15 calls deep, the deepest the 16 entry stack allows with the caller's own call
+static void buildCallChain(struct RomBuilder *rom) {
+    const int depth = 15;
+    emit(rom, 0x1000 | (ROM_START + 2 + depth * 4));
+    for (int i = 0; i < depth; ++i) {
+        const uint16_t next = (uint16_t)(romAddress(rom) + 4);
+        emit(rom, i + 1 < depth ? 0x2000 | next : 0x00EE);
+        emit(rom, 0x00EE);
+    }
+    const uint16_t body[] = { 0x2000 | (ROM_START + 2) };
+    emitLoop(rom, body, 1);
+}
+
+// Every quirk-sensitive opcode at once, run under each quirk profile. I is reset each pass since FX55/FX65 move it
+// outside compat mode
+static void buildQuirks(struct RomBuilder *rom, const uint16_t *prologue, int prologueCount) {
+    static const uint16_t body[] = { 0xAE00, 0x8016, 0x812E, 0x8231, 0x8342, 0x8453, 0xF355, 0xF365, 0x8014 };
+    for (int i = 0; i < prologueCount; ++i) emit(rom, prologue[i]);
+    for (int v = 0; v < 8; ++v) emit(rom, 0x6000 | v << 8 | (v * 53 + 7));
+    emitLoop(rom, body, (int)(sizeof(body) / sizeof(body[0])));
+}
+
+// Each quirk profile as a ROM would be started in it, applied after loading like a pack entry or --legacy does.
+// The SCHIP profiles switch to high res like SCHIP games do
+struct ProfileBench {
+    enum QuirkProfile profile;
+    uint16_t prologue[2];
+    int prologueCount;
+};
+
+static const struct ProfileBench profileBenches[] = {
+    { PROFILE_CHIP8, { 0 }, 0 },
+    { PROFILE_SCHIP_LEGACY, { 0x00FF }, 1 },
+    { PROFILE_SCHIP_MODERN, { 0x00FF }, 1 },
+    { PROFILE_XO_CHIP, { 0 }, 0 },
+};
+
+static const struct ProfileBench *benchProfile; // Profile the runs of benchDispatch start in, if any
+
+struct MicroBench {
+    const char *name;
+    const char *opcodes;
+    void (*build)(struct RomBuilder *rom);
+};
+
+static const struct MicroBench microBenches[] = {
+    { "alu", "8XYN", buildAlu },
+    { "draw-lowres", "DXYN", buildDrawLowRes },
+    { "draw-highres", "DXYN", buildDrawHighRes },
+    { "scroll", "00CN/00FB/00FC", buildScroll },
+    { "block-move", "FX55/FX65", buildBlockMove },
+    { "call-chain", "2NNN/00EE", buildCallChain },
+};
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Read a whole ROM file into a malloc'd buffer
+static uint8_t *readFile(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        printf("File could not be opened: %s\n", path);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    rewind(file);
+    uint8_t *data = malloc(length > 0 ? length : 1);
+    if (data && fread(data, 1, length, file) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *size = data ? (size_t)length : 0;
+    return data;
+}
+
+// Run frames with the given dispatch mode, same frame structure as runFrame
+static double runDispatch(struct Chip8 *chip8, const struct DispatchMode *mode, const uint8_t *rom, size_t size, int frames, uint64_t *executed) {
+    initChip8(chip8);
+    if (mode->attach && mode->attach(chip8) == -1) return -1;
+    if (chip8->jit && lockstep) setJitLockstep(chip8, true);
+    loadRomData(chip8, rom, size);
+    setInstructionsPerFrame(chip8, BENCH_SPEED);
+    if (benchProfile) applyQuirkProfile(chip8, benchProfile->profile);
+
+    *executed = 0;
+    double start = nowSeconds();
+    for (int frame = 0; frame < frames && chip8->running; ++frame) {
+        updateTimers(chip8);
+        *executed += mode->execute(chip8, chip8->speed);
+        updateInput(chip8);
+        handleInterrupts(chip8);
+    }
+    return nowSeconds() - start;
+}
+
+static void addResult(const char *suite, const char *name, const char *opcodes, const char *mode, uint64_t instructions,
+                      uint64_t frames, double seconds) {
+    if (resultCount == BENCH_MAX_RESULTS) return;
+    struct BenchResult *result = &results[resultCount++];
+    result->suite = suite;
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    result->opcodes = opcodes;
+    result->mode = mode;
+    result->instructions = instructions;
+    result->frames = frames;
+    result->seconds = seconds;
+}
+
+// Compare each dispatch mode against the switch on one ROM, checking they all end in the same state
+static int benchDispatch(const char *suite, const char *name, const char *opcodes, const uint8_t *rom, size_t size,
+                         int frames) {
+    const int modeCount = (int)(sizeof(dispatchModes) / sizeof(dispatchModes[0]));
+    struct Chip8 *reference = calloc(1, sizeof(struct Chip8));
+    struct Chip8 *chip8 = calloc(1, sizeof(struct Chip8));
+    double baseline = 0;
+    int status = 0;
+
+    printf("%s [%s] (%d frames at %d instructions/frame)\n", name, opcodes, frames, BENCH_SPEED);
+    for (int i = 0; i < modeCount; ++i) {
+        uint64_t executed;
+        struct Chip8 *target = i == 0 ? reference : chip8;
+        double seconds = runDispatch(target, &dispatchModes[i], rom, size, frames, &executed);
+        if (seconds < 0) {
+            status = 1;
+            continue;
+        }
+        double ips = executed / seconds;
+        if (i == 0) baseline = ips;
+
+        addResult(suite, name, opcodes, dispatchModes[i].name, executed, (uint64_t)frames, seconds);
+
+        printf("  %-8s %12.0f instructions/s %8.2f ns/instruction  %6.2fx", dispatchModes[i].name, ips,
+               executed ? seconds * 1e9 / executed : 0.0, ips / baseline);
+        if (target->blockCache) {
+            printf("  (hit rate %.2f%%, %llu invalidations)", blockCacheHitRate(target->blockCache) * 100,
+                   (unsigned long long)target->blockCache->stats.invalidations);
+            disableBlockCache(target);
+        }
+        if (target->jit) {
+            const struct JitStats *stats = &target->jit->stats;
+            printf("  (%.2f%% native, %llu regions, %llu invalidations",
+                   executed ? stats->nativeInstructions * 100.0 / executed : 0.0, (unsigned long long)stats->compiled,
+                   (unsigned long long)stats->invalidations);
+            if (target->jit->lockstep) printf(", %llu lockstep mismatches", (unsigned long long)stats->lockstepMismatches);
+            printf(")");
+            if (stats->lockstepMismatches) status = 1;
+            disableJit(target);
+        }
+        printf("\n");
+        if (i > 0 && (memcmp(target->V, reference->V, sizeof(target->V)) != 0 || target->pc != reference->pc ||
+                      target->I != reference->I || memcmp(target->memory, reference->memory, MEMORY_SIZE) != 0 ||
+                      memcmp(target->gfx, reference->gfx, sizeof(target->gfx)) != 0)) {
+            printf("  %s diverged from switch dispatch\n", dispatchModes[i].name);
+            status = 1;
+        }
+    }
+    free(reference);
+    free(chip8);
+    return status;
+}
+
+// Time snapshot and restore on a machine in the middle of a sprite storm, and check the round trip
+static int benchSaveState(const struct RomBuilder *rom) {
+    const int rounds = 100000;
+    struct Chip8 *chip8 = calloc(1, sizeof(struct Chip8));
+    struct Chip8State *state = malloc(sizeof(struct Chip8State));
+    int status = 0;
+
+    initChip8(chip8);
+    loadRomData(chip8, rom->data, rom->size);
+    runFrames(chip8, 100);
+    const uint64_t digest = stateDigest(chip8);
+
+    double start = nowSeconds();
+    for (int i = 0; i < rounds; ++i) saveState(chip8, state);
+    const double saveTime = (nowSeconds() - start) / rounds;
+    start = nowSeconds();
+    for (int i = 0; i < rounds; ++i) loadState(chip8, state);
+    const double loadTime = (nowSeconds() - start) / rounds;
+
+    // With a cache attached restore compares memory first, so unchanged code stays compiled
+    enableJit(chip8);
+    start = nowSeconds();
+    for (int i = 0; i < rounds; ++i) loadState(chip8, state);
+    const double cachedLoadTime = (nowSeconds() - start) / rounds;
+    disableJit(chip8);
+    snapshotTime = saveTime;
+    restoreTime = loadTime;
+    cachedRestoreTime = cachedLoadTime;
+
+    printf("save state (%d bytes)\n  snapshot %8.1f ns  restore %8.1f ns  restore with cache %8.1f ns\n",
+           (int)sizeof(struct Chip8State), saveTime * 1e9, loadTime * 1e9, cachedLoadTime * 1e9);
+    runFrames(chip8, 10);
+    loadState(chip8, state);
+    if (stateDigest(chip8) != digest) {
+        printf("  restored state differs from the snapshot\n");
+        status = 1;
+    }
+    free(state);
+    free(chip8);
+    return status;
+}
+
+// Filter whole frames of a sprite storm at each resolution with every kernel the CPU runs, the work drawGfx does
+// on a frame that changes every row. Every kernel has to produce the scalar kernel's pixels
+static int benchUpscale(int frames) {
+    const enum UpscaleKernel defaultKernel = upscaleKernel();
+    const int pitch = UPSCALE_MAX_WIDTH * (int)sizeof(uint32_t);
+    const size_t bufferSize = (size_t)HIGH_RES_HEIGHT * UPSCALE_MAX_SCALE * pitch;
+    const uint32_t palette[2] = { packArgb(0x10, 0x20, 0x30, 0xFF), packArgb(0xE0, 0xD0, 0xA0, 0xFF) };
+    struct Chip8 *chip8 = calloc(1, sizeof(struct Chip8));
+    struct Upscaler *upscaler = malloc(sizeof(struct Upscaler));
+    uint32_t *pixels = malloc(bufferSize);
+    uint32_t *reference = malloc(bufferSize);
+    struct Display display;
+    int status = 0;
+
+    if (!chip8 || !upscaler || !pixels || !reference) {
+        printf("Memory could not be allocated.\n");
+        free(chip8);
+        free(upscaler);
+        free(pixels);
+        free(reference);
+        return 1;
+    }
+    printf("upscale (%d frames, default kernel %s)\n", frames, upscaleKernelName(defaultKernel));
+    for (int res = 0; res < 2; ++res) {
+        struct RomBuilder rom = { { 0 }, 0 };
+        if (res) buildDrawHighRes(&rom);
+        else buildDrawLowRes(&rom);
+        initChip8(chip8);
+        loadRomData(chip8, rom.data, rom.size);
+        runFrames(chip8, 100);
+        copyDisplay(&display, chip8);
+        const int width = displayWidth(&display), height = displayHeight(&display);
+
+        for (int filter = 0; filter < FILTER_COUNT; ++filter) {
+            const int scale = filterScale((enum ScaleFilter)filter);
+            char name[64];
+            snprintf(name, sizeof(name), "%s %dx%d", filterName((enum ScaleFilter)filter), width * scale, height * scale);
+            for (int kernel = 0; kernel < KERNEL_COUNT; ++kernel) {
+                if (setUpscaleKernel((enum UpscaleKernel)kernel) != 0) continue;
+                uint32_t *target = kernel == KERNEL_SCALAR ? reference : pixels;
+                initUpscaler(upscaler, (enum ScaleFilter)filter);
+                memset(target, 0, bufferSize);
+                const double start = nowSeconds();
+                for (int i = 0; i < frames; ++i) upscaleRows(upscaler, &display, target, pitch, palette, 0, height);
+                const double seconds = nowSeconds() - start;
+                addResult("upscale", name, "render", upscaleKernelName((enum UpscaleKernel)kernel), 0, (uint64_t)frames,
+                          seconds);
+                printf("  %-16s %-8s %8.4f ms/frame %10.0f frames/s\n", name, upscaleKernelName((enum UpscaleKernel)kernel),
+                       seconds * 1e3 / frames, seconds > 0 ? frames / seconds : 0.0);
+                if (kernel != KERNEL_SCALAR && memcmp(pixels, reference, bufferSize) != 0) {
+                    printf("  %s differs from the scalar kernel\n", upscaleKernelName((enum UpscaleKernel)kernel));
+                    status = 1;
+                }
+            }
+        }
+    }
+    setUpscaleKernel(defaultKernel);
+    free(chip8);
+    free(upscaler);
+    free(pixels);
+    free(reference);
+    return status;
+}
+
+// Encode every frame of a run for streaming and decode it again, the work --stream adds to the emulation thread
+// and chip8_viewer does per frame. The decoded display has to match the machine's after every frame
+static int benchStream(const char *name, const uint8_t *rom, size_t size, int speed, int frames) {
+    const uint32_t palette[2] = { packArgb(0x10, 0x20, 0x30, 0xFF), packArgb(0xE0, 0xD0, 0xA0, 0xFF) };
+    struct Chip8 *chip8 = calloc(1, sizeof(struct Chip8));
+    struct StreamEncoder *encoder = malloc(sizeof(struct StreamEncoder));
+    struct StreamDecoder *decoder = malloc(sizeof(struct StreamDecoder));
+    static uint8_t message[STREAM_MAX_MESSAGE];
+    double encodeSeconds = 0, decodeSeconds = 0;
+    int status = 0;
+
+    if (!chip8 || !encoder || !decoder || streamResultCount == BENCH_MAX_RESULTS) {
+        if (streamResultCount < BENCH_MAX_RESULTS) printf("Memory could not be allocated.\n");
+        free(chip8);
+        free(encoder);
+        free(decoder);
+        return 1;
+    }
+    struct StreamResult *result = &streamResults[streamResultCount++];
+    memset(result, 0, sizeof(*result));
+    snprintf(result->name, sizeof(result->name), "%s", name);
+    initChip8(chip8);
+    loadRomData(chip8, rom, size);
+    if (speed) setInstructionsPerFrame(chip8, speed);
+    initStreamEncoder(encoder);
+    initStreamDecoder(decoder);
+
+    for (int frame = 0; frame < frames && chip8->running; ++frame) {
+        runFrame(chip8);
+        const double start = nowSeconds();
+        const int messageSize = encodeFrame(encoder, chip8, palette, message);
+        const double encoded = nowSeconds();
+        if (messageSize > 0 && decodeMessage(decoder, message, (size_t)messageSize) != messageSize) status = 1;
+        decodeSeconds += nowSeconds() - encoded;
+        encodeSeconds += encoded - start;
+
+        ++result->frames;
+        result->rawBytes += (uint64_t)streamRawSize(messageSize > 0 ? message[2] : 0, chip8->highRes);
+        if (messageSize > 0) {
+            ++result->messages;
+            result->bytes += (uint64_t)messageSize;
+            if (messageSize > streamRawSize(message[2], chip8->highRes)) status = 1;
+        }
+        if (decoder->display.highRes != chip8->highRes ||
+            memcmp(decoder->display.gfx, chip8->gfx[0], sizeof(chip8->gfx[0])) != 0) {
+            status = 1;
+        }
+    }
+    addResult("stream", name, "display", "encode", 0, result->frames, encodeSeconds);
+    addResult("stream", name, "display", "decode", 0, result->frames, decodeSeconds);
+
+    const double frameCount = result->frames ? (double)result->frames : 1.0;
+    printf("  %-20s %8.1f bytes/frame (raw %6.1f, %5.1f%%) %6.1f%% frames changed %8.1f ns encode %8.1f ns decode\n",
+           name, result->bytes / frameCount, result->rawBytes / frameCount,
+           result->rawBytes ? result->bytes * 100.0 / result->rawBytes : 0.0, result->messages * 100.0 / frameCount,
+           encodeSeconds * 1e9 / frameCount, decodeSeconds * 1e9 / frameCount);
+    if (status) printf("  %s: a message is larger than the raw display, or the decoded display differs\n", name);
+    free(chip8);
+    free(encoder);
+    free(decoder);
+    return status;
+}
+
+// The worst cases for deltas: the whole display inverted every frame, checkerboards and noise at both resolutions.
+// No message may be larger than the raw display, and every one has to decode to the machine's display
+static int checkStreamFullRedraw(void) {
+    const uint32_t palette[2] = { packArgb(0, 0, 0, 0xFF), packArgb(0xFF, 0xFF, 0xFF, 0xFF) };
+    struct Chip8 *chip8 = calloc(1, sizeof(struct Chip8));
+    struct StreamEncoder *encoder = malloc(sizeof(struct StreamEncoder));
+    struct StreamDecoder *decoder = malloc(sizeof(struct StreamDecoder));
+    static uint8_t message[STREAM_MAX_MESSAGE];
+    int status = 0, largest[2] = { 0, 0 };
+
+    if (!chip8 || !encoder || !decoder) {
+        printf("Memory could not be allocated.\n");
+        free(chip8);
+        free(encoder);
+        free(decoder);
+        return 1;
+    }
+    initChip8(chip8);
+    initStreamEncoder(encoder);
+    initStreamDecoder(decoder);
+    for (int frame = 0; frame < 64; ++frame) {
+        chip8->highRes = frame >= 32;
+        memset(chip8->gfx, 0, sizeof(chip8->gfx));
+        for (int y = 0; y < (chip8->highRes ? HIGH_RES_HEIGHT : LOW_RES_HEIGHT); ++y) {
+            for (int word = 0; word < (chip8->highRes ? 2 : 1); ++word) {
+                const uint64_t checker = y & 1 ? 0x5555555555555555ULL : 0xAAAAAAAAAAAAAAAAULL;
+                chip8->gfx[0][y][word] = frame & 2 ? nextRandom(chip8) * 0x9E3779B97F4A7C15ULL : checker;
+                if (frame & 1) chip8->gfx[0][y][word] = ~chip8->gfx[0][y][word];
+            }
+        }
+        const int size = encodeFrame(encoder, chip8, palette, message);
+        if (!(message[2] & (STREAM_MODE | STREAM_PALETTE)) && size > largest[chip8->highRes]) largest[chip8->highRes] = size;
+        if (size > streamRawSize(message[2], chip8->highRes) || decodeMessage(decoder, message, (size_t)size) != size ||
+            memcmp(decoder->display.gfx, chip8->gfx[0], (size_t)displayHeight(&decoder->display) * sizeof(chip8->gfx[0][0])) != 0) {
+            status = 1;
+        }
+    }
+    printf("  full redraws: largest message after the first %d bytes low res (raw %d), %d bytes high res (raw %d)%s\n",
+           largest[0], streamRawSize(0, false), largest[1], streamRawSize(0, true), status ? ", FAILED" : "");
+    free(chip8);
+    free(encoder);
+    free(decoder);
+    return status;
+}
+
+// Play a ROM the way the frontend does, whole frames at the default speed, to get frames per second
+static void benchMacro(const char *name, const uint8_t *rom, size_t size, int frames) {
+    struct Chip8 *chip8 = calloc(1, sizeof(struct Chip8));
+
+    initChip8(chip8);
+    loadRomData(chip8, rom, size);
+    const double start = nowSeconds();
+    const uint64_t executed = runFrames(chip8, frames);
+    const double seconds = nowSeconds() - start;
+    const uint64_t played = chip8->frameStats.frames;
+    addResult("macro", name, "mixed", "frames", executed, played, seconds);
+
+    printf("  %-8s %12.0f frames/s %12.0f instructions/s (%llu frames at %d instructions/frame)\n", "frames",
+           seconds > 0 ? played / seconds : 0.0, seconds > 0 ? executed / seconds : 0.0, (unsigned long long)played,
+           (int)chip8->IPC);
+    free(chip8);
+}
+
+// Write every result as JSON so runs can be compared over time
+static int writeJson(const char *path, int frames) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        printf("File could not be opened: %s\n", path);
+        return -1;
+    }
+    fprintf(file, "{\n  \"timestamp\": %lld,\n  \"frames\": %d,\n  \"instructionsPerFrame\": %d,\n",
+            (long long)time(NULL), frames, BENCH_SPEED);
+    fprintf(file, "  \"saveState\": { \"bytes\": %d, \"snapshotNs\": %.1f, \"restoreNs\": %.1f, \"cachedRestoreNs\": %.1f },\n",
+            (int)sizeof(struct Chip8State), snapshotTime * 1e9, restoreTime * 1e9, cachedRestoreTime * 1e9);
+    fprintf(file, "  \"results\": [\n");
+    for (int i = 0; i < resultCount; ++i) {
+        const struct BenchResult *result = &results[i];
+        const double seconds = result->seconds > 0 ? result->seconds : 1e-9;
+        fprintf(file, "    { \"suite\": \"%s\", \"name\": \"", result->suite);
+        for (const char *c = result->name; *c; ++c) {
+            if (*c == '"' || *c == '\\') fputc('\\', file);
+            fputc(*c, file);
+        }
+        fprintf(file, "\", \"opcodes\": \"%s\", \"mode\": \"%s\", \"instructions\": %llu, \"frames\": %llu, "
+                      "\"seconds\": %.6f, \"instructionsPerSecond\": %.0f, \"framesPerSecond\": %.1f, "
+                      "\"nsPerInstruction\": %.3f, \"msPerFrame\": %.4f }%s\n",
+                result->opcodes, result->mode, (unsigned long long)result->instructions,
+                (unsigned long long)result->frames, result->seconds, result->instructions / seconds,
+                result->frames / seconds, result->instructions ? result->seconds * 1e9 / result->instructions : 0.0,
+                result->frames ? result->seconds * 1e3 / result->frames : 0.0, i + 1 < resultCount ? "," : "");
+    }
+    fprintf(file, "  ],\n  \"stream\": [\n");
+    for (int i = 0; i < streamResultCount; ++i) {
+        const struct StreamResult *result = &streamResults[i];
+        const double frameCount = result->frames ? (double)result->frames : 1.0;
+        fprintf(file, "    { \"name\": \"");
+        for (const char *c = result->name; *c; ++c) {
+            if (*c == '"' || *c == '\\') fputc('\\', file);
+            fputc(*c, file);
+        }
+        fprintf(file, "\", \"frames\": %llu, \"messages\": %llu, \"bytesPerFrame\": %.2f, \"rawBytesPerFrame\": %.2f }%s\n",
+                (unsigned long long)result->frames, (unsigned long long)result->messages, result->bytes / frameCount,
+                result->rawBytes / frameCount, i + 1 < streamResultCount ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    if (fclose(file) != 0) {
+        printf("Writing error.\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const int microCount = (int)(sizeof(microBenches) / sizeof(microBenches[0]));
+    const char *jsonPath = NULL;
+    struct RomBuilder sprites;
+    int frames = 2000;
+    int status = 0;
+    int arg = 1;
+
+    if (argc >= 2 && strcmp(argv[1], "-h") == 0) {
+        printf("Usage: %s [--lockstep] [--json FILE] [frames] [ROM...]\n", argv[0]);
+        return EXIT_SUCCESS;
+    }
+    for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+        if (strcmp(argv[arg], "--lockstep") == 0) {
+            lockstep = true;
+        } else if (strcmp(argv[arg], "--json") == 0 && arg + 1 < argc) {
+            jsonPath = argv[++arg];
+        } else {
+            printf("Unknown option: %s\n", argv[arg]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (arg < argc) frames = atoi(argv[arg++]);
+    if (frames <= 0) frames = 2000;
+
+    // Microbenchmarks, one opcode family each
+    for (int i = 0; i < microCount; ++i) {
+        struct RomBuilder rom = { { 0 }, 0 };
+        microBenches[i].build(&rom);
+        status |= benchDispatch("micro", microBenches[i].name, microBenches[i].opcodes, rom.data, rom.size, frames);
+    }
+    // The same quirk-heavy loop under each quirk profile
+    for (int i = 0; i < (int)(sizeof(profileBenches) / sizeof(profileBenches[0])); ++i) {
+        struct RomBuilder rom = { { 0 }, 0 };
+        char name[64];
+        buildQuirks(&rom, profileBenches[i].prologue, profileBenches[i].prologueCount);
+        snprintf(name, sizeof(name), "quirks-%s", quirkProfileName(profileBenches[i].profile));
+        benchProfile = &profileBenches[i];
+        status |= benchDispatch("profile", name, "8XY1/8XY6/8XYE/FX55/FX65", rom.data, rom.size, frames);
+    }
+    benchProfile = NULL;
+    memset(&sprites, 0, sizeof(sprites));
+    buildDrawHighRes(&sprites);
+    status |= benchSaveState(&sprites);
+    status |= benchUpscale(frames);
+
+    // Stream deltas of the sprite storms at a game's pace, the macro ROMs follow at their own speed
+    printf("stream (%d frames, %d instructions/frame for generated ROMs)\n", frames, BENCH_STREAM_SPEED);
+    for (int i = 0; i < 2; ++i) {
+        static const char *const names[] = { "draw-lowres", "draw-highres" };
+        static void (*const builders[])(struct RomBuilder *rom) = { buildDrawLowRes, buildDrawHighRes };
+        struct RomBuilder rom = { { 0 }, 0 };
+        builders[i](&rom);
+        status |= benchStream(names[i], rom.data, rom.size, BENCH_STREAM_SPEED, frames);
+    }
+    status |= checkStreamFullRedraw();
+
+    // Macro runs over real ROMs: every dispatch mode flat out, then whole frames at the ROM's own speed
+    for (int i = arg; i < argc; ++i) {
+        size_t size;
+        uint8_t *rom = readFile(argv[i], &size);
+        if (!rom) return EXIT_FAILURE;
+        status |= benchDispatch("macro", argv[i], "mixed", rom, size, frames);
+        benchMacro(argv[i], rom, size, frames * BENCH_MACRO_FRAMES_PER_FRAME);
+        status |= benchStream(argv[i], rom, size, 0, frames);
+        free(rom);
+    }
+
+    if (jsonPath && writeJson(jsonPath, frames) != 0) status = 1;
+    return status ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "core.h"
+#include "netplay.h"
+#include "savestate.h"
+
+#define HARNESS_FRAMES 3600 // One minute of play
+#define HARNESS_PORT 7800 // Player 0 listens here, player 1 on the next port
+#define HARNESS_TICK (1.0 / 60.0)
+#define HARNESS_HOLD 12 // Frames each scripted input is held
+
+// Scripted input for one player: a random set of their keys, changing every HARNESS_HOLD frames. A pure function
+// of the frame so both peers and the reference agree on it
+static uint16_t scriptedKeys(int player, uint32_t frame) {
+    uint32_t x = ((frame + (uint32_t)player * 5) / HARNESS_HOLD + 1) * 0x9E3779B9u ^ (uint32_t)(player + 1) * 0x85EBCA6Bu;
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+
+    const uint16_t mask = netplayKeyMask(player);
+    uint16_t keys = 0;
+    for (int key = 0; key < 16; ++key) {
+        if ((mask >> key & 1) && (x >> key) % 5 == 0) keys |= (uint16_t)(1 << key);
+    }
+    return keys;
+}
+
+// Load the same ROM into a fresh machine, the starting state both peers and the reference share
+static struct Chip8 *newMachine(const char *rom) {
+    struct Chip8 *chip8 = calloc(1, sizeof(struct Chip8));
+    if (!chip8) {
+        printf("Memory could not be allocated.\n");
+        return NULL;
+    }
+    initChip8(chip8);
+    if (loadRom(chip8, rom) != 0) {
+        free(chip8);
+        return NULL;
+    }
+    return chip8;
+}
+
+// Two netplay peers in one process over loopback, with injected latency, jitter and loss. Each tick is 1/60 s of
+// simulated time, so the run goes as fast as the machines do. Every frame either peer confirms is checked against
+// a reference machine fed both players' inputs directly
+int main(int argc, char *argv[]) {
+    struct NetplayConditions conditions = { 0, 0, 0 };
+    const char *rom = NULL;
+    int frames = HARNESS_FRAMES;
+    int port = HARNESS_PORT;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+            conditions.latencyMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--jitter") == 0 && i + 1 < argc) {
+            conditions.jitterMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--loss") == 0 && i + 1 < argc) {
+            conditions.lossPercent = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (!rom) {
+            rom = argv[i];
+        }
+    }
+    if (!rom || frames <= 0) {
+        printf("Usage: %s [--latency ms] [--jitter ms] [--loss percent] [--frames N] [--port N] <ROM>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // Reference run: the digest after every frame with both players' input known
+    uint64_t *expected = malloc((size_t)frames * sizeof(uint64_t));
+    struct Chip8State *state = malloc(sizeof(struct Chip8State));
+    struct Chip8 *reference = newMachine(rom);
+    if (!expected || !state || !reference) {
+        if (!expected || !state) printf("Memory could not be allocated.\n");
+        return EXIT_FAILURE;
+    }
+    for (int frame = 0; frame < frames; ++frame) {
+        const uint16_t keys = scriptedKeys(0, (uint32_t)frame) | scriptedKeys(1, (uint32_t)frame);
+        for (int key = 0; key < 16; ++key) reference->key[key] = (keys >> key) & 1;
+        runFrame(reference);
+        saveState(reference, state);
+        expected[frame] = hashBytes(HASH_SEED, state, sizeof(*state));
+    }
+
+    struct Chip8 *machines[2] = { newMachine(rom), newMachine(rom) };
+    static struct Netplay peers[2];
+    if (!machines[0] || !machines[1]) return EXIT_FAILURE;
+    for (int player = 0; player < 2; ++player) {
+        if (openNetplay(&peers[player], machines[player], player, port + player, "127.0.0.1", port + !player) != 0) {
+            return EXIT_FAILURE;
+        }
+        setNetplayConditions(&peers[player], &conditions);
+    }
+
+    // Both peers tick at 60 Hz of simulated time until both have run every frame and confirmed it
+    uint32_t checked[2] = { 0, 0 };
+    int mismatches = 0;
+    int ticks = 0;
+    const int maxTicks = frames * 4 + 600;
+    for (; ticks < maxTicks && (checked[0] < (uint32_t)frames || checked[1] < (uint32_t)frames); ++ticks) {
+        const double now = ticks * HARNESS_TICK;
+        for (int player = 0; player < 2; ++player) {
+            struct Netplay *netplay = &peers[player];
+            // Past the end the peers keep ticking on empty input so the last frames get confirmed
+            const uint16_t keys = netplay->frame < (uint32_t)frames ? scriptedKeys(player, netplay->frame) : 0;
+            netplayAdvance(netplay, machines[player], keys, now);
+
+            uint64_t digest;
+            while (checked[player] < (uint32_t)frames && netplayConfirmedDigest(netplay, checked[player], &digest)) {
+                if (digest != expected[checked[player]]) {
+                    if (mismatches == 0) printf("Player %d diverged from the reference at frame %u\n", player, checked[player]);
+                    ++mismatches;
+                }
+                ++checked[player];
+            }
+        }
+    }
+
+    printf("%d frames, latency %d ms, jitter %d ms, loss %d%%: %d ticks (%.2f ticks per frame)\n", frames,
+           conditions.latencyMs, conditions.jitterMs, conditions.lossPercent, ticks, (double)ticks / frames);
+    for (int player = 0; player < 2; ++player) {
+        const struct NetplayStats *stats = &peers[player].stats;
+        printf("Player %d: %u frames checked, %.1f rollbacks per 100 frames, %.2f us per re-simulated frame\n", player,
+               checked[player], stats->frames ? stats->rollbacks * 100.0 / stats->frames : 0.0,
+               stats->resimulatedFrames ? stats->resimulateSeconds * 1e6 / stats->resimulatedFrames : 0.0);
+        printNetplayStats(&peers[player]);
+    }
+
+    const bool complete = checked[0] == (uint32_t)frames && checked[1] == (uint32_t)frames;
+    const bool desynced = peers[0].stats.desyncs || peers[1].stats.desyncs;
+    if (!complete) printf("Not every frame was confirmed.\n");
+    if (complete && !mismatches && !desynced) printf("Both players match the reference on every frame\n");
+    for (int player = 0; player < 2; ++player) {
+        closeNetplay(&peers[player]);
+        free(machines[player]);
+    }
+    free(reference);
+    free(state);
+    free(expected);
+    return complete && !mismatches && !desynced ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,254 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "analysis.h"
+#include "rompack.h"
+
+#define MAX_PATH 4096
+
+// A ROM file found on disk: where it is and the name it gets in the pack
+struct RomFile {
+    char *path;
+    char *name;
+    uint8_t *data;
+    size_t size;
+    uint64_t hash;
+};
+
+struct RomList {
+    struct RomFile *files;
+    int count;
+    int capacity;
+};
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *copyString(const char *text) {
+    char *copy = malloc(strlen(text) + 1);
+    if (copy) strcpy(copy, text);
+    return copy;
+}
+
+static bool isRomFile(const char *name) {
+    static const char *const extensions[] = { ".ch8", ".c8", ".sc8", ".xo8" };
+    const char *dot = strrchr(name, '.');
+    if (!dot) return false;
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); ++i) {
+        if (strcasecmp(dot, extensions[i]) == 0) return true;
+    }
+    return false;
+}
+
+static int addRomFile(struct RomList *list, const char *path, const char *name) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        struct RomFile *grown = realloc(list->files, list->capacity * sizeof(struct RomFile));
+        if (!grown) {
+            printf("Memory could not be allocated.\n");
+            return -1;
+        }
+        list->files = grown;
+    }
+    struct RomFile *file = &list->files[list->count];
+    memset(file, 0, sizeof(*file));
+    file->path = copyString(path);
+    file->name = copyString(name);
+    if (!file->path || !file->name) {
+        printf("Memory could not be allocated.\n");
+        free(file->path);
+        free(file->name);
+        return -1;
+    }
+    ++list->count;
+    return 0;
+}
+
+// Collect ROM files under a directory. Names in the pack are paths relative to the directory given. Paths too long
+// for MAX_PATH are reported and skipped, never cut short
+static int scanDirectory(struct RomList *list, const char *root, const char *relative) {
+    char path[MAX_PATH];
+    if (snprintf(path, sizeof(path), "%s%s%s", root, *relative ? "/" : "", relative) >= (int)sizeof(path)) {
+        printf("Path is too long: %s/%s\n", root, relative);
+        return *relative ? 0 : -1; // A subdirectory is skipped, the directory given fails the pack
+    }
+    DIR *dir = opendir(path);
+    if (!dir) {
+        printf("Directory could not be opened: %s\n", path);
+        return -1;
+    }
+    int status = 0;
+    struct dirent *entry;
+    while (status == 0 && (entry = readdir(dir))) {
+        char child[MAX_PATH], childPath[MAX_PATH];
+        struct stat info;
+        if (entry->d_name[0] == '.') continue;
+        if (snprintf(child, sizeof(child), "%s%s%s", relative, *relative ? "/" : "", entry->d_name) >= (int)sizeof(child) ||
+            snprintf(childPath, sizeof(childPath), "%s/%s", root, child) >= (int)sizeof(childPath)) {
+            printf("Path is too long: %s/%s%s%s\n", root, relative, *relative ? "/" : "", entry->d_name);
+            continue;
+        }
+        if (stat(childPath, &info) != 0) continue;
+        if (S_ISDIR(info.st_mode)) status = scanDirectory(list, root, child);
+        else if (S_ISREG(info.st_mode) && isRomFile(entry->d_name)) status = addRomFile(list, childPath, child);
+    }
+    closedir(dir);
+    return status;
+}
+
+static int compareFiles(const void *a, const void *b) {
+    return strcmp(((const struct RomFile *)a)->name, ((const struct RomFile *)b)->name);
+}
+
+static int readWholeFile(struct RomFile *file) {
+    FILE *in = fopen(file->path, "rb");
+    if (!in) {
+        printf("File could not be opened: %s\n", file->path);
+        return -1;
+    }
+    file->data = malloc(MEMORY_SIZE);
+    if (!file->data) {
+        printf("Memory could not be allocated.\n");
+        fclose(in);
+        return -1;
+    }
+    file->size = fread(file->data, 1, MEMORY_SIZE, in);
+    fclose(in);
+    file->hash = romHash(file->data, file->size);
+    return 0;
+}
+
+static void listPack(const struct RomPack *pack) {
+    for (uint32_t i = 0; i < pack->header->romCount; ++i) {
+        const struct PackEntry *entry = &pack->entries[i];
+        printf("%5u  %016llx  %5u bytes  features %04x  %-12s  %s\n", i, (unsigned long long)entry->hash, entry->size,
+               entry->features, quirkProfileName((enum QuirkProfile)entry->quirks), packRomName(pack, i));
+    }
+}
+
+// Load every ROM into one machine, once from the loose files and once from the pack
+static void compareLoadTimes(const struct RomList *list, const char *packPath) {
+    static struct Chip8 chip8;
+    struct RomPack pack;
+
+    initChip8(&chip8);
+    double start = nowSeconds();
+    for (int i = 0; i < list->count; ++i) loadRom(&chip8, list->files[i].path);
+    const double fileSeconds = nowSeconds() - start;
+
+    start = nowSeconds();
+    if (openRomPack(&pack, packPath) != 0) return;
+    const uint32_t packed = pack.header->romCount;
+    for (uint32_t i = 0; i < packed; ++i) loadPackRom(&chip8, &pack, i);
+    closeRomPack(&pack);
+    const double packSeconds = nowSeconds() - start;
+
+    printf("load from files %.1f us/ROM (%d ROMs), from the pack %.1f us/ROM (%u ROMs, open included)\n",
+           fileSeconds / list->count * 1e6, list->count, packed ? packSeconds / packed * 1e6 : 0.0, packed);
+}
+
+int main(int argc, char *argv[]) {
+    struct RomList list = { NULL, 0, 0 };
+    const char *output = NULL, *listPath = NULL;
+    bool verify = false, legacy = false, usage = argc < 2;
+    int status = EXIT_SUCCESS;
+
+    for (int i = 1; i < argc && !usage; ++i) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "--list") == 0 && i + 1 < argc) {
+            listPath = argv[++i];
+        } else if (strcmp(argv[i], "--verify") == 0 && i + 1 < argc) {
+            listPath = argv[++i];
+            verify = true;
+        } else if (strcmp(argv[i], "--legacy") == 0) {
+            legacy = true;
+        } else if (argv[i][0] == '-') {
+            usage = true;
+        } else {
+            struct stat info;
+            if (stat(argv[i], &info) != 0) {
+                printf("File could not be opened: %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            const char *base = strrchr(argv[i], '/');
+            if (S_ISDIR(info.st_mode) ? scanDirectory(&list, argv[i], "") != 0
+                                      : addRomFile(&list, argv[i], base ? base + 1 : argv[i]) != 0) {
+                return EXIT_FAILURE;
+            }
+        }
+    }
+    if (usage || (!listPath && (!output || list.count == 0))) {
+        printf("Usage: %s [--legacy] -o <pack> <ROM or directory>...\n", argv[0]);
+        printf("       %s --list <pack> | --verify <pack>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (listPath) {
+        struct RomPack pack;
+        if (openRomPack(&pack, listPath) != 0) return EXIT_FAILURE;
+        if (verify) {
+            const int bad = verifyRomPack(&pack);
+            printf("%u ROMs, %d bad\n", pack.header->romCount, bad);
+            if (bad) status = EXIT_FAILURE;
+        } else {
+            listPack(&pack);
+        }
+        closeRomPack(&pack);
+        return status;
+    }
+
+    qsort(list.files, list.count, sizeof(struct RomFile), compareFiles);
+    struct PackSource *sources = calloc(list.count, sizeof(struct PackSource));
+    if (!sources) {
+        printf("Memory could not be allocated.\n");
+        return EXIT_FAILURE;
+    }
+    int packed = 0;
+    for (int i = 0; i < list.count; ++i) {
+        if (readWholeFile(&list.files[i]) != 0) {
+            status = EXIT_FAILURE;
+            break;
+        }
+        if (list.files[i].size >= MEMORY_SIZE - ROM_START) {
+            printf("Skipping %s, too big for memory.\n", list.files[i].name);
+            continue;
+        }
+        // Identical images are stored once, under the first name
+        bool duplicate = false;
+        for (int j = 0; j < i && !duplicate; ++j) {
+            duplicate = list.files[j].hash == list.files[i].hash && list.files[j].size == list.files[i].size &&
+                        memcmp(list.files[j].data, list.files[i].data, list.files[i].size) == 0;
+        }
+        if (duplicate) {
+            printf("Skipping %s, same image as an earlier ROM.\n", list.files[i].name);
+            continue;
+        }
+        sources[packed].name = list.files[i].name;
+        sources[packed].data = list.files[i].data;
+        sources[packed].size = list.files[i].size;
+        sources[packed].legacy = legacy;
+        ++packed;
+    }
+    if (status == EXIT_SUCCESS && writeRomPack(output, sources, packed) != 0) status = EXIT_FAILURE;
+    if (status == EXIT_SUCCESS) {
+        printf("Packed %d ROMs into %s\n", packed, output);
+        compareLoadTimes(&list, output);
+    }
+
+    for (int i = 0; i < list.count; ++i) {
+        free(list.files[i].path);
+        free(list.files[i].name);
+        free(list.files[i].data);
+    }
+    free(list.files);
+    free(sources);
+    return status;
+}
@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "blockcache.h"
+#include "core.h"
+#include "jit.h"
+#include "movie.h"
+#include "profiler.h"
+
+static double nowSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Replay a recorded movie headless at full speed and check the framebuffer hashes, for regression jobs
+int main(int argc, char *argv[]) {
+    const char *rom = NULL;
+    const char *moviePath = NULL;
+    const char *profilePath = NULL;
+    bool jit = false;
+    bool blocks = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--jit") == 0) {
+            jit = true;
+        } else if (strcmp(argv[i], "--blocks") == 0) {
+            blocks = true;
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profilePath = argv[++i];
+        } else if (!rom) {
+            rom = argv[i];
+        } else if (!moviePath) {
+            moviePath = argv[i];
+        }
+    }
+    if (!rom || !moviePath) {
+        printf("Usage: %s [--jit | --blocks] [--profile prefix] <ROM> <movie>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct Movie movie;
+    struct ReplayResult result;
+    struct Chip8 *chip8 = calloc(1, sizeof(struct Chip8));
+    if (!chip8) {
+        printf("Memory could not be allocated.\n");
+        return EXIT_FAILURE;
+    }
+    if (readMovie(&movie, moviePath) != 0) return EXIT_FAILURE;
+    initChip8(chip8);
+    if (jit && enableJit(chip8) != 0) printf("JIT not available, using the interpreter.\n");
+    if (blocks) enableBlockCache(chip8);
+    if (profilePath && enableProfiler(chip8) != 0) return EXIT_FAILURE;
+    if (loadRom(chip8, rom) != 0) return EXIT_FAILURE;
+
+    const double start = nowSeconds();
+    const int status = replayMovie(chip8, &movie, &result);
+    const double seconds = nowSeconds() - start;
+
+    printf("%d/%d frames, %llu instructions in %.3f s (%.0f frames/s, %.0f instructions/s), %d hashes checked\n",
+           result.frames, movie.frameCount, (unsigned long long)result.instructions, seconds,
+           seconds > 0 ? result.frames / seconds : 0.0, seconds > 0 ? result.instructions / seconds : 0.0,
+           result.hashesChecked);
+    if (result.firstMismatch >= 0) {
+        printf("Framebuffer differs from the recording at frame %d\n", result.firstMismatch);
+    } else if (status == 0) {
+        printf("Replay matches the recording, final digest %016llx\n", (unsigned long long)stateDigest(chip8));
+    }
+
+    if (chip8->profiler) {
+        writeProfile(chip8->profiler, profilePath);
+        disableProfiler(chip8);
+    }
+    if (chip8->jit) disableJit(chip8);
+    if (chip8->blockCache) disableBlockCache(chip8);
+    freeMovie(&movie);
+    free(chip8);
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
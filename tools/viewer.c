@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL.h>
+#include <poll.h>
+#include <unistd.h>
+#include "render.h"
+#include "stream.h"
+
+#define VIEWER_BUFFER (STREAM_MAX_MESSAGE * 8) // Received bytes not decoded yet
+#define VIEWER_WAIT_MS 16 // Longest wait on the socket before SDL events are handled again
+
+// Read from the stream into buffer. Returns the bytes read, 0 if none were waiting, or -1 when the stream ended
+static int receive(int fd, uint8_t *buffer, size_t space) {
+    struct pollfd ready = { .fd = fd, .events = POLLIN };
+    if (poll(&ready, 1, VIEWER_WAIT_MS) <= 0) return 0;
+    const ssize_t got = read(fd, buffer, space);
+    return got > 0 ? (int)got : -1;
+}
+
+// Subscribe to an emulator started with --stream and show its display. Everything drawn comes from the stream,
+// mode and palette included
+int main(int argc, char *argv[]) {
+    int width = 640, height = 320;
+
+    if (argc < 2) {
+        printf("Usage: %s <unix:PATH | tcp:HOST:PORT> [WIDTHxHEIGHT]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc >= 3 && (sscanf(argv[2], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)) {
+        printf("Invalid window size. Using 640x320.\n");
+        width = 640;
+        height = 320;
+    }
+
+    const int fd = connectStream(argv[1]);
+    if (fd < 0) return EXIT_FAILURE;
+    static uint8_t buffer[VIEWER_BUFFER];
+    size_t used = 0;
+    while (used < STREAM_HELLO_SIZE) {
+        const int got = receive(fd, buffer + used, STREAM_HELLO_SIZE - used);
+        if (got < 0) {
+            printf("Stream ended.\n");
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        used += (size_t)got;
+    }
+    if (checkStreamHello(buffer, used) != 0) {
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    used = 0;
+
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+        printf("SDL could not be initialized. %s\n", SDL_GetError());
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    SDL_Window *window = SDL_CreateWindow("CHIP-8 Viewer", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width,
+                                          height, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
+    SDL_Renderer *renderer = window ? SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED) : NULL;
+    // Sized for high res, low res frames use its top left corner
+    SDL_Texture *screen = renderer ? SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                                       HIGH_RES_WIDTH, HIGH_RES_HEIGHT) : NULL;
+    if (!screen) {
+        printf("Window could not be created. %s\n", SDL_GetError());
+        SDL_Quit();
+        close(fd);
+        return EXIT_FAILURE;
+    }
+
+    static struct StreamDecoder decoder;
+    initStreamDecoder(&decoder);
+    bool running = true, redraw = false, started = false;
+    uint64_t messages = 0;
+    while (running) {
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) running = false;
+            if (event.type == SDL_WINDOWEVENT) redraw = true;
+        }
+
+        const int got = receive(fd, buffer + used, sizeof(buffer) - used);
+        if (got < 0) {
+            printf("Stream ended.\n");
+            break;
+        }
+        used += (size_t)got;
+
+        // Apply every whole message and note the rows they changed
+        uint64_t changedRows = 0;
+        size_t offset = 0;
+        int taken;
+        while ((taken = decodeMessage(&decoder, buffer + offset, used - offset)) > 0) {
+            offset += (size_t)taken;
+            changedRows = decoder.modeChanged || decoder.paletteChanged ? ~0ULL : changedRows | decoder.changedRows;
+            started = true;
+            ++messages;
+        }
+        if (taken < 0) {
+            printf("Malformed stream.\n");
+            break;
+        }
+        memmove(buffer, buffer + offset, used - offset);
+        used -= offset;
+
+        // Locked pixels are write only, so every row of the locked band is drawn again, not just the changed ones
+        if (changedRows) {
+            const int height = displayHeight(&decoder.display);
+            int first = 0, last = height - 1;
+            while (first < last && !(changedRows >> first & 1)) ++first;
+            while (last > first && !(changedRows >> last & 1)) --last;
+            const SDL_Rect band = { 0, first, displayWidth(&decoder.display), last - first + 1 };
+            void *pixels;
+            int pitch;
+            if (SDL_LockTexture(screen, &band, &pixels, &pitch) == 0) {
+                renderRows(&decoder.display, pixels, pitch, decoder.palette, first, band.h);
+                SDL_UnlockTexture(screen);
+            }
+            redraw = true;
+        }
+        if (redraw && started) {
+            const SDL_Rect source = { 0, 0, displayWidth(&decoder.display), displayHeight(&decoder.display) };
+            SDL_RenderClear(renderer);
+            SDL_RenderCopy(renderer, screen, &source, NULL);
+            SDL_RenderPresent(renderer);
+            redraw = false;
+        }
+    }
+
+    printf("Messages received: %llu\n", (unsigned long long)messages);
+    SDL_DestroyTexture(screen);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    close(fd);
+    return EXIT_SUCCESS;
+}
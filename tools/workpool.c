@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "workpool.h"
+
+struct WorkerArgs {
+    struct WorkPool *pool;
+    int index;
+};
+
+int defaultWorkerCount(void) {
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+// Take a job from the back of our own queue
+static int popJob(struct WorkQueue *queue) {
+    int job = -1;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail > queue->head) job = queue->jobs[--queue->tail];
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+// Take a job from the front of someone else's queue
+static int stealJob(struct WorkQueue *queue) {
+    int job = -1;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail > queue->head) job = queue->jobs[queue->head++];
+    pthread_mutex_unlock(&queue->lock);
+    return job;
+}
+
+static void *workerMain(void *arg) {
+    const struct WorkerArgs *args = arg;
+    struct WorkPool *pool = args->pool;
+
+    for (;;) {
+        int job = popJob(&pool->queues[args->index]);
+
+        // Out of local work, try every other queue once starting with our neighbour
+        for (int i = 1; job < 0 && i < pool->workerCount; ++i) {
+            job = stealJob(&pool->queues[(args->index + i) % pool->workerCount]);
+        }
+        // The job list is fixed up front, so once every queue is empty there is nothing left to wait for
+        if (job < 0) break;
+        pool->run(pool->context, job, args->index);
+    }
+    return NULL;
+}
+
+// Run jobCount jobs on workerCount threads and wait for all of them. Jobs are dealt round-robin in the given
+// order (NULL for 0..jobCount-1), so each worker starts on the first jobs of the list. Returns -1 on failure
+int runWorkPool(int jobCount, const int *order, int workerCount, WorkFn run, void *context) {
+    struct WorkPool pool = { workerCount, NULL, run, context };
+    struct WorkerArgs *args = NULL;
+    pthread_t *threads = NULL;
+    int started = 0;
+    int status = 0;
+
+    if (workerCount > jobCount) pool.workerCount = workerCount = jobCount > 0 ? jobCount : 1;
+    pool.queues = calloc(workerCount, sizeof(struct WorkQueue));
+    args = calloc(workerCount, sizeof(struct WorkerArgs));
+    threads = calloc(workerCount, sizeof(pthread_t));
+    if (!pool.queues || !args || !threads) {
+        printf("Memory could not be allocated.\n");
+        status = -1;
+        goto done;
+    }
+
+    for (int i = 0; i < workerCount; ++i) {
+        pthread_mutex_init(&pool.queues[i].lock, NULL);
+    }
+    for (int i = 0; i < workerCount; ++i) {
+        pool.queues[i].jobs = malloc(sizeof(int) * (jobCount / workerCount + 1));
+        if (!pool.queues[i].jobs) {
+            printf("Memory could not be allocated.\n");
+            status = -1;
+            goto done;
+        }
+    }
+    // The owner pops from the back, so fill each queue back to front to keep the list order
+    for (int i = jobCount - 1; i >= 0; --i) {
+        struct WorkQueue *queue = &pool.queues[i % workerCount];
+        queue->jobs[queue->tail++] = order ? order[i] : i;
+    }
+    for (int i = 0; i < workerCount; ++i) {
+        args[i].pool = &pool;
+        args[i].index = i;
+        if (pthread_create(&threads[i], NULL, workerMain, &args[i]) != 0) {
+            printf("Worker thread could not be created.\n");
+            status = -1;
+            break;
+        }
+        ++started;
+    }
+    // Workers that did start will still drain every queue
+    for (int i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    if (started == 0) status = -1;
+
+done:
+    if (pool.queues) {
+        for (int i = 0; i < workerCount; ++i) {
+            free(pool.queues[i].jobs);
+            pthread_mutex_destroy(&pool.queues[i].lock);
+        }
+    }
+    free(pool.queues);
+    free(args);
+    free(threads);
+    return status;
+}
@@ -0,0 +1,27 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <pthread.h>
+
+typedef void (*WorkFn)(void *context, int job, int worker);
+
+// One deque per worker. The owner takes jobs from the back, idle workers steal from the front
+struct WorkQueue {
+    pthread_mutex_t lock;
+    int *jobs;
+    int head;
+    int tail;
+};
+
+struct WorkPool {
+    int workerCount;
+    struct WorkQueue *queues;
+    WorkFn run;
+    void *context;
+};
+
+// Function prototypes
+int defaultWorkerCount(void);
+int runWorkPool(int jobCount, const int *order, int workerCount, WorkFn run, void *context);
+
+#endif // WORKPOOL_H